@@ -0,0 +1,150 @@
+#ifndef BATCHCODEC_HPP
+#define BATCHCODEC_HPP
+
+#include <cstdint>
+#include <bit>
+
+#include "netCommon.hpp"
+#include "vec.hpp"
+#include "timestamps.hpp"
+#include "packets/playerPosition.hpp"
+#include "packets/starPiece.hpp"
+
+// Decodes and encodes many packets of one type at once, between their wire
+// bytes and one array per field. The big endian words of four (SSSE3) or
+// eight (AVX2) packets are byte swapped and transposed together; the scalar
+// path does the same one word at a time and is bit for bit what
+// netReadFromBuffer/netWriteToBuffer do.
+
+namespace Packets {
+
+enum class BatchIsa : uint8_t {
+    SCALAR,
+    SSSE3,
+    AVX2
+};
+
+// The best one the CPU supports, detected on the first call
+BatchIsa detectBatchIsa();
+const char* batchIsaName(BatchIsa isa);
+
+namespace implementation {
+
+    // Word columns of one packet type, in the order the words are on the wire
+    template<uint32_t NUM_COLUMNS>
+    class ColumnBatch {
+    protected:
+        uint32_t capacity;
+        uint32_t size;
+        ConnectionId *playerIds;
+        // NUM_COLUMNS arrays of `capacity` words
+        uint32_t *columns;
+
+        inline ColumnBatch(uint32_t _capacity) : capacity(_capacity), size(0) {
+            playerIds = new ConnectionId[capacity];
+            columns = new uint32_t[NUM_COLUMNS * capacity];
+        }
+        inline ~ColumnBatch() {
+            delete[] playerIds;
+            delete[] columns;
+        }
+
+        inline uint32_t word(uint32_t column, uint32_t i) const {return columns[column * capacity + i];}
+        inline float wordFloat(uint32_t column, uint32_t i) const {
+            return std::bit_cast<float>(word(column, i));
+        }
+        inline Vec wordVec(uint32_t column, uint32_t i) const {
+            return {wordFloat(column, i), wordFloat(column + 1, i), wordFloat(column + 2, i)};
+        }
+        inline void setWord(uint32_t column, uint32_t i, uint32_t value) {columns[column * capacity + i] = value;}
+        inline void setVec(uint32_t column, uint32_t i, const Vec &v) {
+            setWord(column, i, std::bit_cast<uint32_t>(v.x));
+            setWord(column + 1, i, std::bit_cast<uint32_t>(v.y));
+            setWord(column + 2, i, std::bit_cast<uint32_t>(v.z));
+        }
+
+    public:
+        ColumnBatch(const ColumnBatch &) = delete;
+        ColumnBatch& operator=(const ColumnBatch &) = delete;
+
+        inline uint32_t getSize() const {return size;}
+        inline uint32_t getCapacity() const {return capacity;}
+        inline void clear() {size = 0;}
+        // Makes room for entries set one by one
+        inline void resize(uint32_t _size) {size = _size <= capacity ? _size : capacity;}
+
+        inline ConnectionId playerId(uint32_t i) const {return playerIds[i];}
+        inline const ConnectionId* getPlayerIds() const {return playerIds;}
+        inline ServerTimestamp timestamp(uint32_t i) const {
+            return {std::bit_cast<int32_t>(word(0, i))};
+        }
+        inline uint32_t* column(uint32_t c) {return columns + c * capacity;}
+        inline const uint32_t* column(uint32_t c) const {return columns + c * capacity;}
+    };
+
+}
+
+class PlayerPositionBatch : public implementation::ColumnBatch<13> {
+    uint8_t *stateFlags;
+public:
+    enum Column : uint32_t {
+        TIMESTAMP,
+        POSITION,
+        VELOCITY = POSITION + 3,
+        DIRECTION = VELOCITY + 3,
+        CURRENT_ANIMATION = DIRECTION + 3,
+        DEFAULT_ANIMATION,
+        ANIMATION_SPEED,
+        NUM_COLUMNS
+    };
+
+    PlayerPositionBatch(uint32_t capacity);
+    ~PlayerPositionBatch();
+
+    inline uint8_t getStateFlags(uint32_t i) const {return stateFlags[i];}
+    inline Vec position(uint32_t i) const {return wordVec(POSITION, i);}
+    inline Vec velocity(uint32_t i) const {return wordVec(VELOCITY, i);}
+    inline Vec direction(uint32_t i) const {return wordVec(DIRECTION, i);}
+    inline int32_t currentAnimation(uint32_t i) const {
+        return std::bit_cast<int32_t>(word(CURRENT_ANIMATION, i));
+    }
+    inline int32_t defaultAnimation(uint32_t i) const {
+        return std::bit_cast<int32_t>(word(DEFAULT_ANIMATION, i));
+    }
+    inline float animationSpeed(uint32_t i) const {return wordFloat(ANIMATION_SPEED, i);}
+
+    void get(uint32_t i, PlayerPosition *out) const;
+    void set(uint32_t i, const PlayerPosition &in);
+
+    // Replaces the contents with `count` packets of PlayerPositionView::SIZE
+    // bytes each. Returns how many fit.
+    uint32_t decode(const uint8_t *const *packets, uint32_t count, BatchIsa isa = detectBatchIsa());
+    // Writes every entry to out[i], PlayerPositionView::SIZE bytes each
+    void encode(uint8_t *const *out, BatchIsa isa = detectBatchIsa()) const;
+};
+
+class StarPieceBatch : public implementation::ColumnBatch<7> {
+public:
+    enum Column : uint32_t {
+        TIMESTAMP,
+        INIT_LINE_START,
+        INIT_LINE_END = INIT_LINE_START + 3,
+        NUM_COLUMNS = INIT_LINE_END + 3
+    };
+
+    inline StarPieceBatch(uint32_t capacity) : ColumnBatch(capacity) {}
+
+    inline Vec initLineStart(uint32_t i) const {return wordVec(INIT_LINE_START, i);}
+    inline Vec initLineEnd(uint32_t i) const {return wordVec(INIT_LINE_END, i);}
+
+    void get(uint32_t i, StarPiece *out) const;
+    void set(uint32_t i, const StarPiece &in);
+
+    // Same as PlayerPositionBatch, with StarPieceView::SIZE bytes each
+    uint32_t decode(const uint8_t *const *packets, uint32_t count, BatchIsa isa = detectBatchIsa());
+    void encode(uint8_t *const *out, BatchIsa isa = detectBatchIsa()) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "netCommon.hpp"
+
+extern "C" {
+#include <netinet/ip.h>
+}
+
+// Binary log of received datagrams, for replaying real traffic offline.
+//
+// A capture is a FileHeader followed by records, each a Record, the datagram
+// and padding up to RECORD_ALIGNMENT. A record with a zero stamp ends the
+// log early, which is where a server that didn't exit cleanly left off.
+namespace Capture {
+
+constexpr char MAGIC[8] = {'S', 'M', 'G', 'C', 'A', 'P', 'T', 0};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t RECORD_ALIGNMENT = 8;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+};
+
+struct Record {
+    // steady_clock nanoseconds when the server got the datagram
+    uint64_t stampNs;
+    // Network byte order, like in sockaddr_in
+    uint32_t addr;
+    uint16_t port;
+    // Connection the server gave the sender, NO_CONNECTION if it got none
+    uint16_t senderId;
+    // Bytes of the datagram, tag included
+    uint32_t size;
+    uint32_t reserved;
+};
+
+constexpr uint32_t recordSize(uint32_t datagramSize) {
+    return alignUp(static_cast<uint32_t>(sizeof(Record)) + datagramSize, RECORD_ALIGNMENT);
+}
+inline const uint8_t* datagramOf(const Record *r) {
+    return reinterpret_cast<const uint8_t *>(r + 1);
+}
+
+// Appends records to a file through a shared mapping, so recording is a
+// memcpy and the kernel writes the pages back on its own. The file grows
+// by doubling; the mapping only moves then.
+class Writer {
+    int fd;
+    uint8_t *map;
+    size_t mapLen;
+    size_t used;
+    uint64_t records;
+    uint64_t dropped;
+
+    bool grow(size_t needed);
+
+public:
+    // Bytes the file starts out with
+    static constexpr size_t INITIAL_SIZE = 64 << 20;
+
+    inline Writer() : fd(-1), map(nullptr), mapLen(0), used(0), records(0), dropped(0) {}
+    // Closes the capture
+    ~Writer();
+
+    Writer(const Writer &) = delete;
+    Writer& operator=(const Writer &) = delete;
+
+    // Creates (or replaces) the capture at `path`
+    NetReturn open(const char *path);
+    // Cuts the file down to the records written and unmaps it
+    void close();
+
+    // Records one datagram. Returns false, and counts it as dropped, if the
+    // file couldn't grow.
+    bool append(uint64_t stampNs, const sockaddr_in &addr, uint16_t senderId,
+        const void *datagram, uint32_t size);
+
+    inline bool isOpen() const {return map != nullptr;}
+    inline uint64_t getRecords() const {return records;}
+    inline uint64_t getDropped() const {return dropped;}
+};
+
+// Walks the records of a capture, mapped read-only
+class Reader {
+    int fd;
+    const uint8_t *map;
+    size_t len;
+    size_t position;
+
+public:
+    inline Reader() : fd(-1), map(nullptr), len(0), position(0) {}
+    ~Reader();
+
+    Reader(const Reader &) = delete;
+    Reader& operator=(const Reader &) = delete;
+
+    // Fails with INVALID_DATA if `path` isn't a capture we understand
+    NetReturn open(const char *path);
+
+    // The next record, or null at the end of the capture
+    const Record* next();
+    // Starts over at the first record
+    void rewind();
+};
+
+}
+
+#endif
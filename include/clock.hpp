@@ -0,0 +1,95 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <cstdint>
+#include <ctime>
+
+#include "timestamps.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CLOCK_X86
+#include <x86intrin.h>
+#endif
+
+// The server clock: milliseconds since startup, which is what ServerTimestamp
+// counts in, and CLOCK_MONOTONIC nanoseconds, which the timers count in, read
+// from one of three sources
+namespace Clock {
+
+enum class Source : uint8_t {
+    // CLOCK_MONOTONIC, through the vDSO
+    PRECISE,
+    // CLOCK_MONOTONIC_COARSE: the time of the last kernel tick, a few
+    // milliseconds behind at worst
+    COARSE,
+    // The invariant TSC, scaled to CLOCK_MONOTONIC nanoseconds at startup
+    TSC
+};
+
+namespace implementation {
+
+    extern Source source;
+    // CLOCK_MONOTONIC nanoseconds at TSC tscBase, and nanoseconds per TSC
+    // tick as a 32.32 fixed point number
+    extern uint64_t tscBase;
+    extern uint64_t tscBaseNs;
+    extern uint64_t tscMultiplier;
+    // nowNs at init
+    extern uint64_t startNs;
+
+    inline uint64_t readNs(clockid_t id) {
+        timespec ts;
+        clock_gettime(id, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+}
+
+// Makes `source` the one nowNs and nowMs read, and the current time the zero
+// of nowMs. TSC falls back to PRECISE without an invariant TSC. Returns the
+// source in use. Call it before any other thread reads the clock.
+Source init(Source source);
+
+inline Source getSource() {return implementation::source;}
+const char* sourceName(Source source);
+
+inline uint64_t preciseNs() {return implementation::readNs(CLOCK_MONOTONIC);}
+inline uint64_t coarseNs() {return implementation::readNs(CLOCK_MONOTONIC_COARSE);}
+// CLOCK_REALTIME, which kernel receive timestamps are in
+inline uint64_t realtimeNs() {return implementation::readNs(CLOCK_REALTIME);}
+// Only meaningful once init calibrated the TSC
+inline uint64_t tscNs() {
+#ifdef CLOCK_X86
+    using namespace implementation;
+    const uint64_t ticks = __rdtsc() - tscBase;
+    return tscBaseNs + static_cast<uint64_t>((static_cast<unsigned __int128>(ticks) * tscMultiplier) >> 32);
+#else
+    return preciseNs();
+#endif
+}
+
+// CLOCK_MONOTONIC nanoseconds, read from the source picked with init
+inline uint64_t nowNs() {
+    switch(implementation::source) {
+        case Source::COARSE: return coarseNs();
+        case Source::TSC: return tscNs();
+        case Source::PRECISE: break;
+    }
+    return preciseNs();
+}
+
+// Milliseconds since init at nowNs `ns`. Wraps after 49 days, like
+// everything counting in them does.
+inline uint32_t toMs(uint64_t ns) {
+    return static_cast<uint32_t>((ns - implementation::startNs) / 1000000);
+}
+
+inline uint32_t nowMs() {return toMs(nowNs());}
+
+inline ServerTimestamp toServerTimestamp(uint32_t ms) {
+    return {static_cast<int32_t>(ms)};
+}
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include "netCommon.hpp"
+
+namespace Event {
+
+enum Source : uint32_t {
+    SOCKET = 1 << 0,
+    CONTROL = 1 << 1,
+    TIMER = 1 << 2
+};
+
+// epoll reactor over the server socket, a control fd (stdin by default) and
+// a periodic timerfd. Sleeps until one of them is ready.
+class Loop {
+    int epollFd;
+    int timerFd;
+
+public:
+    inline Loop() : epollFd(-1), timerFd(-1) {}
+    ~Loop();
+
+    Loop(const Loop &) = delete;
+    Loop& operator=(const Loop &) = delete;
+
+    // Makes `socket` nonblocking and registers every source. A negative
+    // `controlFd` or a zero `tickMs` leaves that source out.
+    NetReturn init(int socket, int controlFd, uint32_t tickMs);
+
+    // Blocks until at least one source is ready and stores the ready
+    // sources as a mask of `Source` in `ready`
+    NetReturn wait(uint32_t *ready);
+
+    // Returns the number of ticks that elapsed since the last call
+    uint64_t consumeTicks();
+};
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include "netCommon.hpp"
+#include "packets.hpp"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+
+namespace Metrics {
+
+// Every value has a single writer. They are relaxed atomics only so that a
+// snapshot can be taken from another thread; adding to one is still a plain
+// load and store.
+typedef std::atomic<uint64_t> Value;
+
+inline void add(Value &value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+inline uint64_t get(const Value &value) {
+    return value.load(std::memory_order_relaxed);
+}
+
+inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Log-linear histogram: every power of two is split into SUB_BUCKETS equal
+// buckets, so a value is off by at most 25% of itself. Recording is a few
+// shifts and an add.
+class Histogram {
+public:
+    static constexpr uint32_t SUB_BITS = 2;
+    static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr uint32_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+private:
+    Value buckets[BUCKETS];
+    Value count;
+    Value sum;
+    Value max;
+
+public:
+    inline Histogram() : buckets{}, count(0), sum(0), max(0) {}
+
+    Histogram(const Histogram &) = delete;
+    Histogram& operator=(const Histogram &) = delete;
+
+    static inline constexpr uint32_t bucketOf(uint64_t value) {
+        if(value < SUB_BUCKETS) return static_cast<uint32_t>(value);
+        const uint32_t msb = std::bit_width(value) - 1;
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS
+            + static_cast<uint32_t>((value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+    // Smallest value that lands in `bucket`
+    static inline constexpr uint64_t lowerBound(uint32_t bucket) {
+        if(bucket < SUB_BUCKETS) return bucket;
+        const uint32_t msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        return static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << (msb - SUB_BITS);
+    }
+
+    // Records `value` `n` times
+    inline void record(uint64_t value, uint64_t n = 1) {
+        add(buckets[bucketOf(value)], n);
+        add(count, n);
+        add(sum, value * n);
+        if(value > get(max)) max.store(value, std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding quantile `q` (0 to 1)
+    uint64_t percentile(double q) const;
+
+    inline uint64_t getCount() const {return get(count);}
+    inline uint64_t getSum() const {return get(sum);}
+    inline uint64_t getMax() const {return get(max);}
+    inline uint64_t getBucket(uint32_t bucket) const {return get(buckets[bucket]);}
+};
+
+// Everything a room counts about its traffic. Usually only the room's own
+// thread records. In pipeline mode the send thread records what is sent,
+// and nothing else.
+class Recorder {
+public:
+    struct Counter {
+        Value packets;
+        Value bytes;
+    };
+
+    // The last entry counts tags we don't know
+    static constexpr uint32_t NUM_TAGS = static_cast<uint32_t>(Packets::Tag::MAX_TAG) + 1;
+    static constexpr uint32_t NUM_ERRORS = NetReturn::SYSTEM_ERROR + 1;
+
+private:
+    Counter received[NUM_TAGS];
+    Counter sent[NUM_TAGS];
+    Value dropped[NUM_ERRORS];
+
+    size_t ringCapacity;
+    size_t ringUsed;
+    size_t ringPeak;
+
+    Value kernelDrops;
+
+    static inline uint32_t tagIndex(uint32_t tag) {
+        return tag < NUM_TAGS - 1 ? tag : NUM_TAGS - 1;
+    }
+
+public:
+    // Time from the kernel receiving a datagram until we read it, from a
+    // batch being read until it was processed, and from then until its
+    // packets were handed to sendmmsg. Nanoseconds, recorded once per
+    // packet. The first only counts datagrams the kernel stamped.
+    Histogram kernelToRead;
+    Histogram recvToProcess;
+    Histogram processToSend;
+    // Whole time a relayed packet spent in the server, from the kernel
+    // receiving it until it was handed to sendmmsg
+    Histogram kernelToSend;
+
+    inline Recorder() 
+        : received{}, sent{}, dropped{}, ringCapacity(0), ringUsed(0), ringPeak(0), kernelDrops(0) {}
+
+    Recorder(const Recorder &) = delete;
+    Recorder& operator=(const Recorder &) = delete;
+
+    // `bytes` includes the tag
+    inline void receive(uint32_t tag, uint32_t bytes) {
+        Counter &c = received[tagIndex(tag)];
+        add(c.packets, 1);
+        add(c.bytes, bytes);
+    }
+    // One packet sent as `datagrams` datagrams of `bytes` each
+    inline void send(uint32_t tag, uint32_t bytes, uint64_t datagrams) {
+        Counter &c = sent[tagIndex(tag)];
+        add(c.packets, datagrams);
+        add(c.bytes, bytes * datagrams);
+    }
+    // A packet that was thrown away, and why
+    inline void drop(NetReturn::ErrorCode reason) {
+        add(dropped[reason < NUM_ERRORS ? reason : NetReturn::INVALID_STATE], 1);
+    }
+
+    inline void setRingCapacity(size_t capacity) {ringCapacity = capacity;}
+    inline void ring(size_t used) {
+        ringUsed = used;
+        if(used > ringPeak) ringPeak = used;
+    }
+
+    // Datagrams the kernel dropped before we could read them, as it counts
+    // them: from when the socket was opened
+    inline void setKernelDrops(uint64_t drops) {kernelDrops.store(drops, std::memory_order_relaxed);}
+
+    inline const Counter& getReceived(uint32_t tag) const {return received[tagIndex(tag)];}
+    inline const Counter& getSent(uint32_t tag) const {return sent[tagIndex(tag)];}
+    inline uint64_t getDropped(NetReturn::ErrorCode reason) const {return get(dropped[reason]);}
+    inline uint64_t getKernelDrops() const {return get(kernelDrops);}
+
+    // Writes everything as one JSON object
+    void write(FILE *out, uint32_t room, uint64_t uptimeMs) const;
+};
+
+// Writes a snapshot to `path` through a temporary file and a rename, so
+// readers never see half of one. Returns false if it couldn't.
+bool exportSnapshot(const Recorder &recorder, const char *path, uint32_t room, uint64_t uptimeMs);
+
+}
+
+#endif
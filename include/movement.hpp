@@ -0,0 +1,109 @@
+#ifndef MOVEMENT_HPP
+#define MOVEMENT_HPP
+
+#include "netCommon.hpp"
+#include "vec.hpp"
+#include "timestamps.hpp"
+#include "batchCodec.hpp"
+
+// Sanity checks on the movement players report, so garbage and impossible
+// positions are dropped before anyone else is sent them.
+namespace Movement {
+
+enum Verdict : uint8_t {
+    ACCEPTED,
+    // A coordinate of the position, velocity or direction is NaN or infinite
+    NOT_FINITE,
+    // Moved farther than maxJump in one update
+    TELEPORT,
+    // Moved faster than maxSpeed since the previous update
+    TOO_FAST,
+    NUM_VERDICTS
+};
+
+struct Limits {
+    // World units per second, 0 = no limit
+    float maxSpeed;
+    // World units per update, however long ago the previous one was.
+    // 0 = no limit.
+    float maxJump;
+};
+
+// Compares every update of a player with the last one that was accepted.
+//
+// A player that really was moved far (a warp, a new galaxy) keeps moving
+// plausibly from where it landed. Once WARP_UPDATES rejected updates in a
+// row did, the last of them is accepted and becomes the reference, so the
+// player loses WARP_UPDATES - 1 updates instead of being stuck. Sending the
+// same far position twice gets nothing through.
+class Checker {
+    ConnectionId capacity;
+    Limits limits;
+
+    // Last accepted update of every player, indexed by id. known is -1 once
+    // there is one and 0 before, so it can be gathered as a mask.
+    float *lastX;
+    float *lastY;
+    float *lastZ;
+    int32_t *lastMs;
+    int32_t *known;
+
+    // Last rejected update of every player, and how many rejected updates
+    // in a row were plausible from the one before
+    float *pendingX;
+    float *pendingY;
+    float *pendingZ;
+    int32_t *pendingMs;
+    uint32_t *streak;
+
+    // Batch each player was last checked in, to catch players that are in
+    // a batch more than once
+    uint32_t *seenIn;
+    uint32_t batchNumber;
+
+    uint64_t verdicts[NUM_VERDICTS];
+
+    void remember(ConnectionId id, ServerTimestamp t, const Vec &position);
+    // Keeps the references up to date after `id` got verdict `v`, and
+    // returns the verdict that stands
+    Verdict settle(ConnectionId id, ServerTimestamp t, const Vec &position, Verdict v);
+
+public:
+    // Leeway for the speed limit, so that timestamps a few milliseconds off
+    // don't get anyone dropped
+    static constexpr int32_t GRACE_MS = 50;
+    // Rejected updates in a row, each plausible from the one before, that
+    // are taken as a warp
+    static constexpr uint32_t WARP_UPDATES = 4;
+
+    Checker(ConnectionId capacity, Limits limits);
+    ~Checker();
+
+    Checker(const Checker &) = delete;
+    Checker& operator=(const Checker &) = delete;
+
+    // Forgets the previous holder of `id`
+    inline void reset(ConnectionId id) {
+        if(id < capacity) {
+            known[id] = 0;
+            streak[id] = 0;
+        }
+    }
+
+    // Checks one update
+    Verdict check(ConnectionId id, ServerTimestamp t,
+        const Vec &position, const Vec &velocity, const Vec &direction);
+    // Checks every update of `batch`, eight at a time with AVX2 where the
+    // CPU has it. Writes a verdict per entry to `out` and returns how many
+    // were accepted. Same verdicts as calling check on each in order.
+    uint32_t check(const Packets::PlayerPositionBatch &batch, Verdict *out);
+
+    inline uint64_t getCount(Verdict v) const {return verdicts[v];}
+    inline const Limits& getLimits() const {return limits;}
+};
+
+const char* verdictName(Verdict v);
+
+}
+
+#endif
@@ -20,6 +20,21 @@ struct NetReturn {
     ErrorCode errorCode;
 };
 
+// Identifies a connection, and the player behind it
+typedef uint16_t ConnectionId;
+
+// Where an outgoing packet goes. A plain id sends to every active
+// connection except that one.
+namespace Destination {
+    constexpr uint32_t BROADCAST = 0xFFFFFFFF;
+    // Send only to the id in the low bits
+    constexpr uint32_t ONLY = 0x80000000;
+    // Send to every active connection whose group is in the low bits
+    constexpr uint32_t GROUP = 0x40000000;
+    // Send to the RecipientLists entry in the low bits
+    constexpr uint32_t LIST = 0x20000000;
+}
+
 template<typename T>
 inline constexpr T alignUp(T base, size_t alignment) {
     T tmp = base + alignment - 1;
@@ -1,6 +1,11 @@
 #ifndef PACKETFACTORY_HPP
 #define PACKETFACTORY_HPP
 
+#include <algorithm>
+#include <array>
+#include <new>
+#include <type_traits>
+
 #include "packets.hpp"
 #include "packets/connect.hpp"
 #include "packets/ack.hpp"
@@ -8,25 +13,87 @@
 #include "packets/playerPosition.hpp"
 #include "packets/timeSync.hpp"
 #include "packets/starPiece.hpp"
+#include "packets/worldSnapshot.hpp"
+#include "packets/compactSnapshot.hpp"
+#include "packets/reliable.hpp"
+#include "packets/keepalive.hpp"
 
 namespace Packets {
 
+namespace implementation {
+
+    // Storage for any one of `Ts` and the tag -> decoder table, generated from
+    // the list of packet types
+    template<typename... Ts>
+    struct PacketList {
+        static constexpr size_t SIZE = std::max({sizeof(Ts)...});
+        static constexpr size_t ALIGNMENT = std::max({alignof(Ts)...});
+        template<typename T>
+        static constexpr bool contains = (std::is_same_v<T, Ts> || ...);
+
+        typedef NetReturn (*Decoder)(void *storage, const void *buffer, uint32_t len);
+
+        template<typename T>
+        static NetReturn decode(void *storage, const void *buffer, uint32_t len) {
+            return T::netReadFromBuffer(new(storage) T, buffer, len);
+        }
+
+        // How many of `Ts` have `tag`, which has to be exactly one
+        static constexpr uint32_t count(Tag tag) {return ((Ts::tag == tag) + ...);}
+
+        static constexpr bool coversEveryTag() {
+            for(uint32_t t = 0; t < static_cast<uint32_t>(Tag::MAX_TAG); t++) {
+                if(count(static_cast<Tag>(t)) != 1) return false;
+            }
+            return true;
+        }
+
+        static constexpr std::array<Decoder, static_cast<uint32_t>(Tag::MAX_TAG)> decoders() {
+            std::array<Decoder, static_cast<uint32_t>(Tag::MAX_TAG)> table{};
+            ((table[static_cast<uint32_t>(Ts::tag)] = &decode<Ts>), ...);
+            return table;
+        }
+    };
+
+}
+
+// Every packet the factory can construct. A new packet type only has to be
+// added here.
+typedef implementation::PacketList<
+    Connect,
+    Ack,
+    ServerInitialResponse,
+    PlayerPosition,
+    TimeQuery,
+    TimeResponse,
+    StarPiece,
+    WorldSnapshot,
+    CompactSnapshot,
+    Reliable,
+    Keepalive
+> AllPackets;
+
+static_assert(AllPackets::coversEveryTag(), "every tag needs exactly one packet type");
+
 class PacketFactory {
-    bool isCandidateMode;
+    bool isCandidateMode = false;
 public:
 
     struct PacketUnion {
         Tag tag;
-        union {
-            Connect connect;
-            Ack ack;
-            ServerInitialResponse sip;
-            PlayerPosition playerPos;
-            TimeQuery timeQuery;
-            TimeResponse timeResponse;
-            StarPiece starPiece;
-        };
-        PacketUnion() {}
+        alignas(AllPackets::ALIGNMENT) unsigned char storage[AllPackets::SIZE];
+
+        // The packet constructPacket made, which has to be of type T
+        template<typename T>
+        inline T& as() {
+            static_assert(AllPackets::contains<T>);
+            return *std::launder(reinterpret_cast<T *>(storage));
+        }
+        template<typename T>
+        inline const T& as() const {
+            static_assert(AllPackets::contains<T>);
+            return *std::launder(reinterpret_cast<const T *>(storage));
+        }
     };
 
     NetReturn constructPacket(Tag tag, PacketUnion *pu, const void *buffer, uint32_t len) const;
@@ -9,7 +9,7 @@ namespace Packets {
 // Can never be less than 4
 constexpr size_t PACKET_ALIGNMENT = 8;
 // Must be power of 2
-constexpr uint32_t MAX_PACKET_SIZE = 1 << 7; 
+constexpr uint32_t MAX_PACKET_SIZE = 1 << 10; 
 
 enum class Tag : uint32_t {
     CONNECT = 0,
@@ -19,6 +19,10 @@ enum class Tag : uint32_t {
     TIME_QUERY,
     TIME_RESPONSE,
     STAR_PIECE,
+    WORLD_SNAPSHOT,
+    COMPACT_SNAPSHOT,
+    RELIABLE,
+    KEEPALIVE,
     MAX_TAG
 };
 
@@ -36,6 +40,7 @@ public:
     inline bool verify(const ReliablePacketCode &other) const {
         return other.seqNum == seqNum;
     }
+    inline uint32_t getSeqNum() const {return seqNum;}
     friend class implementation::ReliablePacket;
 };
 
@@ -7,10 +7,24 @@ namespace Packets {
 
 class _Ack {
 public:
+    enum Channel : uint8_t {
+        // seqNum is the tick of a snapshot. Bit i of ackBits acknowledges
+        // the datagram of it with chunk i.
+        SNAPSHOT = 0,
+        // seqNum is the newest sequence number of the reliable channel
+        // below which everything arrived. Bit i of ackBits acknowledges
+        // seqNum + 2 + i.
+        RELIABLE = 1
+    };
+
     uint32_t seqNum;
+    uint32_t ackBits;
+    Channel channel;
 
     inline _Ack() = default;
-    inline _Ack(uint32_t seqNum) : seqNum(seqNum) {}
+    inline _Ack(uint32_t seqNum) : seqNum(seqNum), ackBits(0), channel(SNAPSHOT) {}
+    inline _Ack(uint32_t seqNum, uint32_t ackBits, Channel channel) 
+        : seqNum(seqNum), ackBits(ackBits), channel(channel) {}
     uint32_t getSize() const;
     NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
     static NetReturn netReadFromBuffer(Packet<_Ack> *out, const void *buffer, uint32_t len);
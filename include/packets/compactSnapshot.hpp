@@ -0,0 +1,79 @@
+#ifndef PACKETS_COMPACTSNAPSHOT_HPP
+#define PACKETS_COMPACTSNAPSHOT_HPP
+
+#include "vec.hpp"
+#include "packets.hpp"
+#include "packets/playerPosition.hpp"
+
+namespace Packets {
+
+// PlayerPosition reduced to what goes on the wire in a CompactSnapshot.
+// Two states encode the same way exactly when they compare equal here.
+struct CompactPosition {
+    // Position is in 1/POSITION_SCALE units relative to the snapshot origin,
+    // and must fit in 24 bits
+    static constexpr float POSITION_SCALE = 8.0f;
+    static constexpr int32_t POSITION_LIMIT = (1 << 23) - 1;
+    static constexpr float VELOCITY_SCALE = 64.0f;
+    static constexpr float ANIMATION_SPEED_SCALE = 256.0f;
+
+    ConnectionId playerId;
+    uint8_t stateFlags;
+    int32_t timestamp;
+    int32_t position[3];
+    int16_t velocity[3];
+    // Octahedral encoding of the unit direction
+    int16_t direction[2];
+    int32_t currentAnimation;
+    int32_t defaultAnimation;
+    int16_t animationSpeed;
+
+    inline CompactPosition() = default;
+    CompactPosition(const PlayerPosition &pos, const Vec &origin);
+
+    // Whether `position` can be encoded against `origin` without clamping
+    static bool inRange(const Vec &position, const Vec &origin);
+};
+
+// WorldSnapshot with quantized entries. With a baseline, each entry only
+// carries the fields that changed since the snapshot of tick `baselineTick`,
+// which the recipients acknowledged with an Ack. A baselineTick of 0 means
+// every entry is complete. Ticks with more players than fit in one datagram
+// are sent in several, numbered by `chunk`.
+class _CompactSnapshot {
+public:
+    uint32_t tick;
+    uint32_t baselineTick;
+    Vec origin;
+    // Not owned; must outlive the call to netWriteToBuffer
+    const CompactPosition *players;
+    // Parallel to `players`. A null array, or a null entry, sends that
+    // state in full.
+    const CompactPosition *const *baseline;
+    uint16_t numPlayers;
+    uint8_t chunk;
+
+    // Most entries that are guaranteed to fit in a single datagram
+    static const uint16_t MAX_PLAYERS;
+
+    inline _CompactSnapshot()
+        : tick(0), baselineTick(0), players(nullptr), baseline(nullptr), numPlayers(0), chunk(0) {}
+    inline _CompactSnapshot(uint32_t tick, uint32_t baselineTick, const Vec &origin,
+        const CompactPosition *players, const CompactPosition *const *baseline, uint16_t numPlayers,
+        uint8_t chunk = 0)
+        : tick(tick), baselineTick(baselineTick), origin(origin), players(players),
+        baseline(baseline), numPlayers(numPlayers), chunk(chunk) {}
+
+    NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
+    static NetReturn netReadFromBuffer(Packet<_CompactSnapshot> *out, const void *buffer, uint32_t len);
+
+    uint32_t getSize() const;
+
+    static constexpr Tag tag = Tag::COMPACT_SNAPSHOT;
+};
+
+typedef Packet<_CompactSnapshot> CompactSnapshot;
+
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PACKETS_KEEPALIVE_HPP
+#define PACKETS_KEEPALIVE_HPP
+
+#include "packets.hpp"
+
+namespace Packets {
+
+// Sent by the server to connections it has not heard from in a while.
+// Clients answer with the same packet, which proves they are still there.
+class _Keepalive {
+public:
+    uint32_t timeMs;
+
+    inline _Keepalive() = default;
+    inline _Keepalive(uint32_t timeMs) : timeMs(timeMs) {}
+
+    uint32_t getSize() const;
+    NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
+    static NetReturn netReadFromBuffer(Packet<_Keepalive> *out, const void *buffer, uint32_t len);
+
+    static constexpr Tag tag = Tag::KEEPALIVE;
+};
+
+typedef Packet<_Keepalive> Keepalive;
+
+}
+
+#endif
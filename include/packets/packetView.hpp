@@ -0,0 +1,104 @@
+#ifndef PACKETS_PACKETVIEW_HPP
+#define PACKETS_PACKETVIEW_HPP
+
+#include <cstring>
+#include <bit>
+
+#include "vec.hpp"
+#include "timestamps.hpp"
+#include "packets.hpp"
+#include "packets/schema.hpp"
+#include "packets/playerPosition.hpp"
+#include "packets/starPiece.hpp"
+
+// Views read single fields of a received packet straight from its wire bytes,
+// for handlers that mostly relay the bytes as they are and would waste time
+// decoding every field. A view is valid as long as the bytes it was bound to.
+// The offsets are checked against the packet layouts in packets.cpp.
+
+namespace Packets {
+
+namespace implementation {
+
+    inline Vec loadVec(const uint8_t *data) {
+        return {
+            std::bit_cast<float>(loadBigEndian(data)),
+            std::bit_cast<float>(loadBigEndian(data + 4)),
+            std::bit_cast<float>(loadBigEndian(data + 8))
+        };
+    }
+
+}
+
+class PlayerPositionView {
+    const uint8_t *data;
+public:
+    static constexpr uint32_t SIZE = 56;
+    static constexpr uint32_t ID_HIGH_OFFSET = 2;
+    static constexpr uint32_t TIMESTAMP_OFFSET = 4;
+    static constexpr uint32_t POSITION_OFFSET = 8;
+    static constexpr uint32_t VELOCITY_OFFSET = 20;
+    static constexpr uint32_t DIRECTION_OFFSET = 32;
+    static constexpr uint32_t CURRENT_ANIMATION_OFFSET = 44;
+    static constexpr uint32_t DEFAULT_ANIMATION_OFFSET = 48;
+    static constexpr uint32_t ANIMATION_SPEED_OFFSET = 52;
+
+    // Accepts exactly what PlayerPosition::netReadFromBuffer accepts
+    static inline NetReturn bind(PlayerPositionView *out, const void *buffer, uint32_t len) {
+        if(len < SIZE) return {SIZE, NetReturn::NOT_ENOUGH_SPACE};
+        out->data = reinterpret_cast<const uint8_t *>(buffer);
+        return {SIZE, NetReturn::OK};
+    }
+
+    inline const uint8_t* getData() const {return data;}
+    inline ConnectionId playerId() const {return data[0] | data[ID_HIGH_OFFSET] << 8;}
+    inline uint8_t stateFlags() const {return data[1];}
+    inline ServerTimestamp timestamp() const {
+        return {std::bit_cast<int32_t>(implementation::loadBigEndian(data + TIMESTAMP_OFFSET))};
+    }
+    inline Vec position() const {return implementation::loadVec(data + POSITION_OFFSET);}
+    inline Vec velocity() const {return implementation::loadVec(data + VELOCITY_OFFSET);}
+    inline Vec direction() const {return implementation::loadVec(data + DIRECTION_OFFSET);}
+    inline int32_t currentAnimation() const {
+        return std::bit_cast<int32_t>(implementation::loadBigEndian(data + CURRENT_ANIMATION_OFFSET));
+    }
+    inline int32_t defaultAnimation() const {
+        return std::bit_cast<int32_t>(implementation::loadBigEndian(data + DEFAULT_ANIMATION_OFFSET));
+    }
+    inline float animationSpeed() const {
+        return std::bit_cast<float>(implementation::loadBigEndian(data + ANIMATION_SPEED_OFFSET));
+    }
+
+    // Every field, for when the whole packet is needed after all
+    void decode(PlayerPosition *out) const;
+};
+
+class StarPieceView {
+    const uint8_t *data;
+public:
+    static constexpr uint32_t SIZE = 32;
+    static constexpr uint32_t ID_HIGH_OFFSET = 1;
+    static constexpr uint32_t TIMESTAMP_OFFSET = 4;
+    static constexpr uint32_t INIT_LINE_START_OFFSET = 8;
+    static constexpr uint32_t INIT_LINE_END_OFFSET = 20;
+
+    // Accepts exactly what StarPiece::netReadFromBuffer accepts
+    static inline NetReturn bind(StarPieceView *out, const void *buffer, uint32_t len) {
+        if(len < SIZE) return {SIZE, NetReturn::NOT_ENOUGH_SPACE};
+        out->data = reinterpret_cast<const uint8_t *>(buffer);
+        return {SIZE, NetReturn::OK};
+    }
+
+    inline ConnectionId playerId() const {return data[0] | data[ID_HIGH_OFFSET] << 8;}
+    inline ServerTimestamp timestamp() const {
+        return {std::bit_cast<int32_t>(implementation::loadBigEndian(data + TIMESTAMP_OFFSET))};
+    }
+    inline Vec initLineStart() const {return implementation::loadVec(data + INIT_LINE_START_OFFSET);}
+    inline Vec initLineEnd() const {return implementation::loadVec(data + INIT_LINE_END_OFFSET);}
+
+    void decode(StarPiece *out) const;
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define PACKETS_PLAYERPOSITION_HPP
 
 #include "vec.hpp"
+#include "packets.hpp"
 
 #include "timestamps.hpp"
 
@@ -10,7 +11,7 @@ namespace Packets {
 
 class _PlayerPosition {
 public:
-    uint8_t playerId;
+    ConnectionId playerId;
 
     ServerTimestamp timestamp;
 
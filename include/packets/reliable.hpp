@@ -0,0 +1,44 @@
+#ifndef PACKETS_RELIABLE_HPP
+#define PACKETS_RELIABLE_HPP
+
+#include "packets.hpp"
+
+namespace Packets {
+
+// Wraps another packet so it is acknowledged and retransmitted until it is.
+// See Reliable::Channel.
+class _Reliable {
+public:
+    enum {
+        O_ORDERED = 1
+    }; // Flags
+
+    ReliablePacketCode check;
+    uint8_t flags;
+    Tag innerTag;
+    // Not owned. Points into the datagram for received packets.
+    const void *payload;
+    uint32_t payloadSize;
+
+    inline _Reliable() : flags(0), innerTag(Tag::MAX_TAG), payload(nullptr), payloadSize(0) {}
+    inline _Reliable(ReliablePacketCode check, uint8_t flags, Tag innerTag, 
+        const void *payload, uint32_t payloadSize)
+        : check(check), flags(flags), innerTag(innerTag), payload(payload), 
+        payloadSize(payloadSize) {}
+
+    // Size of everything before the payload
+    static const uint32_t HEADER_SIZE;
+
+    NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
+    static NetReturn netReadFromBuffer(Packet<_Reliable> *out, const void *buffer, uint32_t len);
+
+    uint32_t getSize() const;
+
+    static constexpr Tag tag = Tag::RELIABLE;
+};
+
+typedef Packet<_Reliable> Reliable;
+
+}
+
+#endif
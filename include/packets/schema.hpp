@@ -0,0 +1,247 @@
+#ifndef PACKETS_SCHEMA_HPP
+#define PACKETS_SCHEMA_HPP
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "vec.hpp"
+#include "packets.hpp"
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+// Wire layouts of fixed size packets, as a list of fields. Encoding, decoding
+// and the size all follow from the list at compile time, and every field is
+// at a constant offset, so a codec is one length check followed by straight
+// line loads and stores.
+//
+//     typedef Schema::Layout<
+//         Schema::Word<&_TimeQuery::timeMs>,
+//         Schema::Word<&_TimeQuery::check>
+//     > TimeQueryLayout;
+
+namespace Packets {
+
+namespace implementation {
+
+    inline uint32_t loadBigEndian(const uint8_t *data) {
+        uint32_t word;
+        memcpy(&word, data, sizeof word);
+        return ntohl(word);
+    }
+
+    inline void storeBigEndian(uint8_t *data, uint32_t value) {
+        value = htonl(value);
+        memcpy(data, &value, sizeof value);
+    }
+
+    template<auto M>
+    struct MemberOf;
+
+    template<typename C, typename T, T C::*M>
+    struct MemberOf<M> {
+        typedef C Class;
+        typedef T Type;
+    };
+
+}
+
+namespace Schema {
+
+// Any 4 byte member, big endian
+template<auto M>
+struct Word {
+    typedef typename implementation::MemberOf<M>::Type Type;
+    static_assert(sizeof(Type) == 4 && std::is_trivially_copyable_v<Type>);
+
+    static constexpr uint32_t SIZE = 4;
+    static constexpr auto MEMBER = M;
+
+    template<typename T>
+    static inline void write(const T &packet, uint8_t *dst) {
+        implementation::storeBigEndian(dst, std::bit_cast<uint32_t>(packet.*M));
+    }
+    template<typename T>
+    static inline bool read(T &packet, const uint8_t *src) {
+        packet.*M = std::bit_cast<Type>(implementation::loadBigEndian(src));
+        return true;
+    }
+};
+
+// Three big endian floats
+template<auto M>
+struct Vec3 {
+    static_assert(std::is_same_v<typename implementation::MemberOf<M>::Type, Vec>);
+
+    static constexpr uint32_t SIZE = 12;
+    static constexpr auto MEMBER = M;
+
+    template<typename T>
+    static inline void write(const T &packet, uint8_t *dst) {
+        const Vec &v = packet.*M;
+        implementation::storeBigEndian(dst, std::bit_cast<uint32_t>(v.x));
+        implementation::storeBigEndian(dst + 4, std::bit_cast<uint32_t>(v.y));
+        implementation::storeBigEndian(dst + 8, std::bit_cast<uint32_t>(v.z));
+    }
+    template<typename T>
+    static inline bool read(T &packet, const uint8_t *src) {
+        packet.*M = {
+            std::bit_cast<float>(implementation::loadBigEndian(src)),
+            std::bit_cast<float>(implementation::loadBigEndian(src + 4)),
+            std::bit_cast<float>(implementation::loadBigEndian(src + 8))
+        };
+        return true;
+    }
+};
+
+template<auto M>
+struct Byte {
+    static_assert(sizeof(typename implementation::MemberOf<M>::Type) == 1);
+
+    static constexpr uint32_t SIZE = 1;
+    static constexpr auto MEMBER = M;
+
+    template<typename T>
+    static inline void write(const T &packet, uint8_t *dst) {*dst = packet.*M;}
+    template<typename T>
+    static inline bool read(T &packet, const uint8_t *src) {
+        packet.*M = *src;
+        return true;
+    }
+};
+
+// The two bytes of a ConnectionId, which don't have to be next to each other.
+// IdLow has to come before IdHigh. IdHigh reads both, so the id is stored
+// once, with a single load when the bytes are next to each other.
+template<auto M>
+struct IdLow {
+    static constexpr uint32_t SIZE = 1;
+    static constexpr auto MEMBER = M;
+
+    template<typename T>
+    static inline void write(const T &packet, uint8_t *dst) {*dst = packet.*M & 0xFF;}
+    template<typename T>
+    static inline bool read(T &, const uint8_t *) {return true;}
+};
+
+template<auto M>
+struct IdHigh {
+    static constexpr uint32_t SIZE = 1;
+    static constexpr auto MEMBER = M;
+    // Layout passes the bytes of the IdLow of M along
+    static constexpr bool PAIRED = true;
+
+    template<typename T>
+    static inline void write(const T &packet, uint8_t *dst) {*dst = packet.*M >> 8;}
+    template<typename T>
+    static inline bool read(T &packet, const uint8_t *src, const uint8_t *low) {
+        packet.*M = *low | *src << 8;
+        return true;
+    }
+};
+
+// Written as zeroes and ignored when read
+template<uint32_t N>
+struct Padding {
+    static constexpr uint32_t SIZE = N;
+    static constexpr auto MEMBER = nullptr;
+
+    template<typename T>
+    static inline void write(const T &, uint8_t *dst) {memset(dst, 0, N);}
+    template<typename T>
+    static inline bool read(T &, const uint8_t *) {return true;}
+};
+
+// A constant that a packet is only valid with
+template<uint64_t V>
+struct Magic {
+    static constexpr uint32_t SIZE = 8;
+    static constexpr auto MEMBER = nullptr;
+
+    template<typename T>
+    static inline void write(const T &, uint8_t *dst) {
+        implementation::storeBigEndian(dst, V >> 32);
+        implementation::storeBigEndian(dst + 4, V & 0xFFFFFFFF);
+    }
+    template<typename T>
+    static inline bool read(T &, const uint8_t *src) {
+        return (static_cast<uint64_t>(implementation::loadBigEndian(src)) << 32
+            | implementation::loadBigEndian(src + 4)) == V;
+    }
+};
+
+template<typename... Fields>
+class Layout {
+    static constexpr std::array<uint32_t, sizeof...(Fields)> OFFSETS = [] {
+        std::array<uint32_t, sizeof...(Fields)> offsets{};
+        const uint32_t sizes[] = {Fields::SIZE...};
+        uint32_t offset = 0;
+        for(size_t i = 0; i < sizeof...(Fields); i++) {
+            offsets[i] = offset;
+            offset += sizes[i];
+        }
+        return offsets;
+    }();
+
+    template<auto A, auto B>
+    static constexpr bool sameMember() {
+        if constexpr(std::is_same_v<decltype(A), decltype(B)>) return A == B;
+        else return false;
+    }
+
+    template<typename T, size_t... I>
+    static inline void writeFields(const T &packet, uint8_t *dst, std::index_sequence<I...>) {
+        (Fields::write(packet, dst + OFFSETS[I]), ...);
+    }
+    template<typename Field, size_t I, typename T>
+    static inline bool readField(T &packet, const uint8_t *src) {
+        if constexpr(requires {Field::PAIRED;}) {
+            return Field::read(packet, src + OFFSETS[I], src + offsetOf<Field::MEMBER>());
+        }
+        else return Field::read(packet, src + OFFSETS[I]);
+    }
+    // Every field is read, valid or not, so there is nothing to branch on
+    template<typename T, size_t... I>
+    static inline bool readFields(T &packet, const uint8_t *src, std::index_sequence<I...>) {
+        return (readField<Fields, I>(packet, src) & ...);
+    }
+
+public:
+    static constexpr uint32_t SIZE = (Fields::SIZE + ...);
+
+    // Offset of the first field holding member `M`
+    template<auto M>
+    static constexpr uint32_t offsetOf() {
+        constexpr bool matches[] = {sameMember<Fields::MEMBER, M>()...};
+        for(size_t i = 0; i < sizeof...(Fields); i++) {
+            if(matches[i]) return OFFSETS[i];
+        }
+        return SIZE;
+    }
+
+    template<typename T>
+    static inline NetReturn encode(const T &packet, void *buffer, uint32_t len) {
+        if(len < SIZE) return {SIZE, NetReturn::NOT_ENOUGH_SPACE};
+        writeFields(packet, static_cast<uint8_t *>(buffer), std::index_sequence_for<Fields...>());
+        return {SIZE, NetReturn::OK};
+    }
+
+    template<typename T>
+    static inline NetReturn decode(T &packet, const void *buffer, uint32_t len) {
+        if(len < SIZE) return {SIZE, NetReturn::NOT_ENOUGH_SPACE};
+        if(!readFields(packet, static_cast<const uint8_t *>(buffer), std::index_sequence_for<Fields...>())) {
+            return {0, NetReturn::INVALID_DATA};
+        }
+        return {SIZE, NetReturn::OK};
+    }
+};
+
+}
+
+}
+
+#endif
@@ -9,11 +9,11 @@ class _ServerInitialResponse {
 public:
     uint32_t majorVersion;
     uint32_t minorVersion;
-    uint8_t playerId;
+    ConnectionId playerId;
 
     inline _ServerInitialResponse() {}
 
-    inline _ServerInitialResponse(uint32_t majorVersion, uint32_t minorVersion, uint8_t id) : 
+    inline _ServerInitialResponse(uint32_t majorVersion, uint32_t minorVersion, ConnectionId id) : 
         majorVersion(majorVersion), minorVersion(minorVersion), playerId(id) {}
 
     NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
@@ -9,7 +9,7 @@ namespace Packets {
 
 class _StarPiece {
 public:
-    uint8_t playerId;
+    ConnectionId playerId;
     ServerTimestamp timestamp;
     Vec initLineStart;
     Vec initLineEnd;
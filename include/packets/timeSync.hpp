@@ -22,6 +22,7 @@ public:
     uint32_t timeMs;
     ReliablePacketCode check;
 
+    inline _TimeResponse() = default;
     inline _TimeResponse(uint32_t timeMs, ReliablePacketCode check) : timeMs(timeMs), check(check) {}
 
     uint32_t getSize() const;
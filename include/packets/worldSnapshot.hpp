@@ -0,0 +1,37 @@
+#ifndef PACKETS_WORLDSNAPSHOT_HPP
+#define PACKETS_WORLDSNAPSHOT_HPP
+
+#include "packets.hpp"
+#include "packets/playerPosition.hpp"
+
+namespace Packets {
+
+// The latest state of a group of players, sent once per server tick
+// instead of relaying every PlayerPosition. Recipients skip their own entry.
+class _WorldSnapshot {
+public:
+    uint32_t tick;
+    // Not owned; must outlive the call to netWriteToBuffer
+    const PlayerPosition *players;
+    uint16_t numPlayers;
+
+    // Most entries that fit in a single datagram
+    static const uint16_t MAX_PLAYERS;
+
+    inline _WorldSnapshot() : tick(0), players(nullptr), numPlayers(0) {}
+    inline _WorldSnapshot(uint32_t tick, const PlayerPosition *players, uint16_t numPlayers)
+        : tick(tick), players(players), numPlayers(numPlayers) {}
+
+    NetReturn netWriteToBuffer(void *buffer, uint32_t len) const;
+    static NetReturn netReadFromBuffer(Packet<_WorldSnapshot> *out, const void *buffer, uint32_t len);
+
+    uint32_t getSize() const;
+
+    static constexpr Tag tag = Tag::WORLD_SNAPSHOT;
+};
+
+typedef Packet<_WorldSnapshot> WorldSnapshot;
+
+}
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "protocol.hpp"
+#include "transmission.hpp"
+
+#include <atomic>
+#include <thread>
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+}
+
+namespace Metrics {
+
+    class Recorder;
+
+}
+
+namespace Capture {
+
+    class Writer;
+
+}
+
+// Splits a room over three threads: one receives, one runs the game logic
+// and one sends. Received datagrams stay where the receive thread put them
+// until the send thread has relayed them, and packets the logic makes go to
+// the send thread through a ring of their own, so nothing is copied on the
+// way.
+namespace Pipeline {
+
+// Every entry starts at a multiple of this, so the threads never write to
+// the same cache line
+constexpr size_t ENTRY_ALIGNMENT = 64;
+
+// Control sequence at the start of every entry, much like in PacketHolder
+struct Entry {
+    enum Code : uint32_t {
+        PACKET,
+        SKIP,
+        // Rest of the ring is unused, the next entry is at the start
+        WRAP,
+        // Too short to hold a tag
+        INVALID,
+        // Connection changes for the send thread, in order with the packets
+        CONNECT,
+        DISCONNECT,
+        GROUP
+    };
+
+    Code code;
+    // Bytes of the packet after its tag, every byte of an INVALID one, or
+    // the group of GROUP
+    uint32_t size;
+    // Bytes from this entry to the next one
+    uint32_t next;
+    // Sender of a received packet, once the logic thread looked it up, and
+    // where it goes from there (see Destination). The connection of
+    // CONNECT, DISCONNECT and GROUP.
+    uint32_t destination;
+    // When the receive thread got it
+    uint64_t stampNs;
+    // When the kernel received it (see Transmission::Reader::ReadSlot), 0
+    // without a kernel timestamp
+    uint64_t arrivalNs;
+    sockaddr_in addr;
+};
+
+// The tag sits right in front of the packet, which is aligned like in PacketHolder
+constexpr uint32_t PACKET_OFFSET
+    = alignUp(sizeof(Entry) + sizeof(Packets::Tag), Packets::PACKET_ALIGNMENT);
+
+constexpr uint32_t entrySize(uint32_t packetSize) {
+    return alignUp(PACKET_OFFSET + packetSize, ENTRY_ALIGNMENT);
+}
+inline uint8_t* packetOf(Entry *e) {
+    return reinterpret_cast<uint8_t *>(e) + PACKET_OFFSET;
+}
+inline uint32_t tagOf(const Entry *e) {
+    return ntohl(*reinterpret_cast<const uint32_t *>
+        (reinterpret_cast<const uint8_t *>(e) + PACKET_OFFSET - sizeof(Packets::Tag)));
+}
+
+// Ring of entries handed down a chain of stages, each owned by one thread.
+// Stage 0 writes entries, every later stage sees them once the stage before
+// it published them, and space is reused once the last stage did. Each pair
+// of neighbouring stages is a single-producer, single-consumer queue.
+// Positions only grow; an entry never crosses the end of the ring.
+class Ring {
+public:
+    static constexpr uint32_t MAX_STAGES = 3;
+
+private:
+    struct alignas(ENTRY_ALIGNMENT) Cursor {
+        std::atomic<uint64_t> published;
+    };
+
+    uint8_t *buffer;
+    size_t len;
+    uint32_t numStages;
+    Cursor cursors[MAX_STAGES];
+
+    // Stage 0 only: where the next entry goes, and how far the last stage
+    // was when we last looked
+    alignas(ENTRY_ALIGNMENT) uint64_t writePosition;
+    uint64_t reclaimed;
+
+public:
+    Ring(size_t len, uint32_t numStages);
+    ~Ring();
+
+    Ring(const Ring &) = delete;
+    Ring& operator=(const Ring &) = delete;
+
+    // Stage 0. Room for an entry with a packet of `packetSize` bytes, or
+    // null if the later stages haven't freed enough yet. Its `next` is set.
+    Entry* reserve(uint32_t packetSize);
+    // Ends the entry returned by reserve. Later stages see it after publish.
+    inline void commit(const Entry *e) {writePosition += e->next;}
+    inline uint64_t tell() const {return writePosition;}
+    // Forgets every entry committed after `position`
+    inline void rewind(uint64_t position) {writePosition = position;}
+    inline void publish() {cursors[0].published.store(writePosition, std::memory_order_release);}
+    // Whether a packet of `packetSize` can ever fit
+    inline bool fits(uint32_t packetSize) const {return 2 * entrySize(packetSize) <= len;}
+
+    // How far `stage` got. Entries before it can be read by the next stage.
+    inline uint64_t published(uint32_t stage) const {
+        return cursors[stage].published.load(std::memory_order_acquire);
+    }
+    inline void publish(uint32_t stage, uint64_t position) {
+        cursors[stage].published.store(position, std::memory_order_release);
+    }
+
+    // The entry at `position`, which moves past the end of the ring if
+    // the entry there is WRAP
+    inline Entry* at(uint64_t &position) const {
+        auto *e = reinterpret_cast<Entry *>(buffer + position % len);
+        if(e->code == Entry::WRAP) {
+            position += e->next;
+            e = reinterpret_cast<Entry *>(buffer);
+        }
+        return e;
+    }
+
+    // Bytes between the last stage and stage 0
+    inline size_t getUsed() const {
+        return cursors[0].published.load(std::memory_order_relaxed)
+            - cursors[numStages - 1].published.load(std::memory_order_relaxed);
+    }
+    inline size_t getCapacity() const {return len;}
+};
+
+// The room's side of the pipeline, with the same interface as
+// Protocol::PacketHolder apart from readPackets. The receive thread fills
+// the inbound ring, the logic thread looks up senders and processes packets
+// in place, and the send thread relays whatever the logic left in it, along
+// with the packets the logic added to the outbound ring.
+class PacketPipe {
+public:
+    typedef Protocol::PacketHolder::LatestSlot LatestSlot;
+    typedef Protocol::PacketHolder::ReadBatchInfo ReadBatchInfo;
+
+private:
+    // Stages: receive, logic, send
+    Ring inbound;
+    // Stages: logic, send
+    Ring outbound;
+
+    int socket;
+    // Logic thread's connections, which senders are looked up in
+    Transmission::ConnectionHolder *holder;
+
+    // Readable when the receive thread published, when the logic thread
+    // published, and once we stop
+    int readyFd;
+    int sendFd;
+    int stopFd;
+    std::atomic<bool> stopping;
+    // Last drop count the kernel sent along with a datagram, from the
+    // receive thread
+    std::atomic<uint32_t> kernelDrops;
+
+    std::thread receiver;
+    std::thread sender;
+
+    Metrics::Recorder *metrics;
+    Capture::Writer *capture;
+
+    // Logic thread. Entries from processPosition up to batchEnd were taken
+    // by readPackets; readPosition is where the next batch starts.
+    uint64_t readPosition;
+    uint64_t processPosition;
+    uint64_t batchEnd;
+    uint64_t batchStamp;
+    bool unpublished;
+
+    LatestSlot *latest;
+    uint32_t numLatest;
+    // Bumped whenever the logic thread publishes
+    uint32_t sendEpoch;
+
+    // Send thread. It keeps a copy of the logic thread's connections, kept
+    // up to date by CONNECT, DISCONNECT and GROUP.
+    Transmission::Connection *mirrorConnections;
+    Transmission::ConnectionHolder mirror;
+    Transmission::Writer relayWriter;
+    // When the logic thread last published
+    std::atomic<uint64_t> publishedNs;
+
+    void receive();
+    void send();
+    uint32_t drainOutbound(uint64_t &position, uint64_t end);
+    uint32_t drainInbound(uint64_t &position, uint64_t end);
+
+    void signal(int fd);
+    void publish();
+    // Waits for the send thread if the outbound ring is full
+    Entry* reserveOutbound(uint32_t size);
+    void queueControl(Entry::Code code, ConnectionId id, uint32_t size, const sockaddr_in *addr);
+
+    inline Entry* current() const {
+        uint64_t position = processPosition;
+        return inbound.at(position);
+    }
+
+public:
+    // Both rings get `ringLen` bytes. `holder` is only used by the logic
+    // thread; the send thread mirrors it for up to `capacity` connections.
+    PacketPipe(int socket, size_t ringLen, Transmission::ConnectionHolder *holder, ConnectionId capacity);
+    ~PacketPipe();
+
+    PacketPipe(const PacketPipe &) = delete;
+    PacketPipe& operator=(const PacketPipe &) = delete;
+
+    // Starts the receive and send threads. setMetrics has to come first.
+    NetReturn start();
+    // Sends whatever is left and joins both threads
+    void stop();
+
+    // Readable whenever readPackets has something, for Event::Loop
+    inline int getReadyFd() const {return readyFd;}
+
+    // Takes up to `maxPackets` of the datagrams the receive thread has
+    // published and looks up their senders. Never blocks. Returns the
+    // number of packets accepted, like PacketHolder::readPackets.
+    NetReturn readPackets(uint32_t maxPackets, ReadBatchInfo *info = nullptr);
+    // When the receive thread got the first datagram of the last batch
+    inline uint64_t getBatchStamp() const {return batchStamp;}
+
+    bool nextPacket();
+
+    inline NetReturn getSenderId() const {
+        const Entry *e = current();
+        if(e->code == Entry::PACKET) return {e->destination, NetReturn::OK};
+        return {0, NetReturn::INVALID_DATA};
+    }
+    inline NetReturn peekPacket(Packets::Tag *tag, const uint8_t **payload, uint32_t *len) const {
+        Entry *e = current();
+        if(e->code != Entry::PACKET) return netHandleInvalidState();
+        *tag = static_cast<Packets::Tag>(tagOf(e));
+        *payload = packetOf(e);
+        *len = e->size;
+        return {0, NetReturn::OK};
+    }
+    inline void setDestination(uint32_t destination) {
+        Entry *e = current();
+        if(e->code == Entry::PACKET) e->destination = destination;
+    }
+    inline void setLatestSlots(LatestSlot *slots, uint32_t numSlots) {
+        latest = slots;
+        numLatest = numSlots;
+    }
+    // Only packets the send thread hasn't been given yet can be skipped
+    bool supersede(uint32_t key);
+    inline void dropPacket() {current()->code = Entry::SKIP;}
+    void finishProcessing();
+
+    template<typename T>
+    NetReturn addPacket(const Packets::Packet<T> &packet, uint32_t destination) {
+        uint32_t size = packet.getSize();
+        Entry *e = reserveOutbound(size);
+        if(e == nullptr) return {0, NetReturn::NOT_ENOUGH_SPACE};
+
+        e->code = Entry::PACKET;
+        e->size = size;
+        e->destination = destination;
+        auto *tag = reinterpret_cast<uint32_t *>(packetOf(e) - sizeof(Packets::Tag));
+        *tag = htonl(static_cast<uint32_t>(Packets::Packet<T>::tag));
+
+        NetReturn res = packet.netWriteToBuffer(packetOf(e), size);
+        if(res.errorCode == NetReturn::NOT_ENOUGH_SPACE) return netHandleInvalidState();
+        if(res.errorCode != NetReturn::OK) return res;
+
+        outbound.commit(e);
+        unpublished = true;
+        return res;
+    }
+    template<typename T>
+    NetReturn addPacket(const Packets::Packet<T> &packet) {
+        return addPacket(packet, Destination::BROADCAST);
+    }
+
+    // Hands every processed and added packet to the send thread, and sends
+    // what was queued on `writer` (reliable packets) right away
+    NetReturn sendPackets(Transmission::Writer &writer);
+
+    // Tell the send thread about changes to the logic thread's connections
+    inline void connect(ConnectionId id, const sockaddr_in *addr) {
+        queueControl(Entry::CONNECT, id, 0, addr);
+    }
+    inline void disconnect(ConnectionId id) {queueControl(Entry::DISCONNECT, id, 0, nullptr);}
+    inline void setGroup(ConnectionId id, uint16_t group) {
+        queueControl(Entry::GROUP, id, group, nullptr);
+    }
+
+    void setMetrics(Metrics::Recorder *recorder);
+    // Appends every datagram readPackets takes to `writer`, stamped with when
+    // the receive thread got it
+    inline void setCapture(Capture::Writer *writer) {capture = writer;}
+    // Bytes of the inbound ring in use
+    inline size_t getUsed() const {return inbound.getUsed();}
+};
+
+template<typename T>
+    requires requires (const T t, Packets::Tag tag, T::PacketUnion *pu,
+        const void *buffer, uint32_t len)
+    {
+        {t.constructPacket(tag, pu, buffer, len)} -> std::same_as<NetReturn>;
+    }
+class PacketProcessor : public PacketPipe {
+    T packetFactory;
+public:
+    PacketProcessor(int socket, size_t ringLen, Transmission::ConnectionHolder *holder,
+        ConnectionId capacity, T packetFactory)
+        : PacketPipe(socket, ringLen, holder, capacity), packetFactory(packetFactory) {}
+
+    NetReturn processPacket(T::PacketUnion *pu) {
+        Packets::Tag tag;
+        const uint8_t *payload;
+        uint32_t len;
+        NetReturn res = peekPacket(&tag, &payload, &len);
+        if(res.errorCode != NetReturn::OK) return res;
+        return packetFactory.constructPacket(tag, pu, payload, len);
+    }
+    inline T& getPacketFactory() {return packetFactory;}
+};
+
+}
+
+#endif
@@ -1,27 +1,140 @@
 #ifndef PLAYERS_HPP
 #define PLAYERS_HPP
 
+#include <cstdint>
+
+#include "netCommon.hpp"
 #include "vec.hpp"
+#include "timestamps.hpp"
 
 namespace Player {
 
-class Player {
-    bool active;
-    Vec position;
-    Vec velocity;
-    Vec direction;
+// The state of every player of a room, one array per field.
+//
+// Active players (those that sent an update since they connected) are kept
+// in the first getNumActive() slots, so passes over the world run over
+// contiguous arrays and never look at anyone else. Slots move when a player
+// is deactivated; ids don't.
+//
+// The bulk operations work on every active player at once, eight at a time
+// with AVX2 where the CPU has it.
+class Store {
+public:
+    static constexpr ConnectionId NONE = 0xFFFF;
+    // Floats per AVX2 register. Every column starts aligned to one.
+    static constexpr uint32_t LANES = 8;
+
+private:
+    ConnectionId capacity;
+    ConnectionId numActive;
+    // Floats between the starts of two columns
+    size_t stride;
+
+    // Slot of every id, NONE while it is inactive, and the id in every slot
+    ConnectionId *slots;
+    ConnectionId *ids;
+
+    // Columns indexed by slot, all in one allocation
+    float *columns;
+    float *position[3];
+    float *velocity[3];
+    float *direction[3];
+    int32_t *timestampMs;
+    int32_t *currentAnimation;
+    int32_t *defaultAnimation;
+    float *animationSpeed;
+    // Number of updates since the player became active
+    uint32_t *numUpdates;
+    uint8_t *stateFlags;
+
+    inline Vec vecAt(float *const *v, ConnectionId slot) const {
+        return {v[0][slot], v[1][slot], v[2][slot]};
+    }
+    inline void setVecAt(float **v, ConnectionId slot, const Vec &value) {
+        v[0][slot] = value.x;
+        v[1][slot] = value.y;
+        v[2][slot] = value.z;
+    }
+    // Makes `id` active if it isn't, and returns its slot
+    ConnectionId activate(ConnectionId id);
+
 public:
-    inline void updateInfo(const Vec *_position, const Vec *_velocity, const Vec *_direction) {
-        active = true;
-        if(_position) position = *_position;
-        if(_velocity) velocity = *_velocity;
-        if(_direction) direction = *_direction;
+    Store(ConnectionId capacity);
+    ~Store();
+
+    Store(const Store &) = delete;
+    Store& operator=(const Store &) = delete;
+
+    // Counts an update of `id` sent at `t`, making it active if it isn't
+    inline void update(ConnectionId id, ServerTimestamp t) {
+        const ConnectionId slot = activate(id);
+        numUpdates[slot]++;
+        timestampMs[slot] = t.t.timeMs;
+    }
+    // Setters for what update left out. They do nothing for inactive players.
+    inline void setPosition(ConnectionId id, const Vec &_position) {
+        if(isActive(id)) setVecAt(position, slots[id], _position);
+    }
+    inline void setMotion(ConnectionId id, const Vec &_position, const Vec &_velocity, const Vec &_direction) {
+        if(!isActive(id)) return;
+        const ConnectionId slot = slots[id];
+        setVecAt(position, slot, _position);
+        setVecAt(velocity, slot, _velocity);
+        setVecAt(direction, slot, _direction);
+    }
+    inline void setAnimation(ConnectionId id, ServerTimestamp t, uint8_t _stateFlags,
+        int32_t _currentAnimation, int32_t _defaultAnimation, float _animationSpeed)
+    {
+        if(!isActive(id)) return;
+        const ConnectionId slot = slots[id];
+        timestampMs[slot] = t.t.timeMs;
+        stateFlags[slot] = _stateFlags;
+        currentAnimation[slot] = _currentAnimation;
+        defaultAnimation[slot] = _defaultAnimation;
+        animationSpeed[slot] = _animationSpeed;
+    }
+    // Forgets `id`. The last active player takes over its slot.
+    void deactivate(ConnectionId id);
+
+    inline bool isActive(ConnectionId id) const {return id < capacity && slots[id] != NONE;}
+    // Whether `t` is older than the latest update, allowing for wraparound
+    inline bool isStale(ConnectionId id, ServerTimestamp t) const {
+        return isActive(id) && static_cast<int32_t>(static_cast<uint32_t>(t.t.timeMs)
+            - static_cast<uint32_t>(timestampMs[slots[id]])) < 0;
     }
-    inline Vec getPosition() const {return position;}
-    inline Vec getVelocity() const {return velocity;}
-    inline Vec getDirection() const {return direction;}
-    inline bool isActive() const {return active;}
-    inline void deactivate() {active = false;}
+
+    // Active players are in slots 0 to getNumActive() - 1
+    inline ConnectionId getNumActive() const {return numActive;}
+    inline ConnectionId getCapacity() const {return capacity;}
+    inline ConnectionId idAt(ConnectionId slot) const {return ids[slot];}
+    inline ConnectionId slotOf(ConnectionId id) const {return slots[id];}
+
+    // Getters by slot
+    inline Vec getPosition(ConnectionId slot) const {return vecAt(position, slot);}
+    inline Vec getVelocity(ConnectionId slot) const {return vecAt(velocity, slot);}
+    inline Vec getDirection(ConnectionId slot) const {return vecAt(direction, slot);}
+    inline ServerTimestamp getTimestamp(ConnectionId slot) const {return {timestampMs[slot]};}
+    inline int32_t getCurrentAnimation(ConnectionId slot) const {return currentAnimation[slot];}
+    inline int32_t getDefaultAnimation(ConnectionId slot) const {return defaultAnimation[slot];}
+    inline float getAnimationSpeed(ConnectionId slot) const {return animationSpeed[slot];}
+    inline uint8_t getStateFlags(ConnectionId slot) const {return stateFlags[slot];}
+    inline uint32_t getNumUpdates(ConnectionId slot) const {return numUpdates[slot];}
+
+    // Bulk operations over every active player. Arrays written by slot need
+    // room for getNumActive() floats.
+
+    // Squared distance of every player to `point`
+    void distancesSquared(const Vec &point, float *out) const;
+    // Writes up to `maxCount` players within `radius` of `point`, other than
+    // `except`, to `out`. Returns how many were written.
+    uint32_t within(const Vec &point, float radius, ConnectionId except,
+        ConnectionId *out, uint32_t maxCount) const;
+    // Same for the players inside the box from `min` to `max`
+    uint32_t inside(const Vec &min, const Vec &max, ConnectionId *out, uint32_t maxCount) const;
+    // The box around every player. False if nobody is active.
+    bool bounds(Vec *min, Vec *max) const;
+    // Where every player is `steps` times its velocity from now
+    void extrapolate(float steps, float *outX, float *outY, float *outZ) const;
 };
 
 }
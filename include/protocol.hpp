@@ -14,10 +14,34 @@ namespace Transmission {
 
 }
 
+namespace Metrics {
+
+    class Recorder;
+
+}
+
+namespace Capture {
+
+    class Writer;
+
+}
+
 namespace Protocol {
 
 constexpr uint32_t MAJOR = 0;
-constexpr uint32_t MINOR = 0;
+constexpr uint32_t MINOR = 5;
+
+// Clients that connect with at least this minor version receive
+// CompactSnapshot instead of WorldSnapshot
+constexpr uint32_t COMPACT_SNAPSHOT_MINOR = 1;
+// ... and get star pieces through Reliable::Channel
+constexpr uint32_t RELIABLE_MINOR = 2;
+// ... and are sent Keepalive probes when idle
+constexpr uint32_t KEEPALIVE_MINOR = 3;
+// ... and acknowledge each datagram of a snapshot, rather than its tick
+constexpr uint32_t SNAPSHOT_CHUNK_MINOR = 4;
+// ... and put the high byte of their id in what used to be padding
+constexpr uint32_t WIDE_ID_MINOR = 5;
 
 
 class PacketHolder {
@@ -39,6 +63,24 @@ class PacketHolder {
     // Next packet to be sent
     uint8_t *sendHead;
 
+public:
+    // Latest unsent packet of a key, for supersede
+    struct LatestSlot {
+        uint8_t *packet;
+        uint32_t sendEpoch;
+    };
+
+private:
+    LatestSlot *latest;
+    uint32_t numLatest;
+    // Bumped whenever packets are sent, which invalidates every LatestSlot
+    // recorded before
+    uint32_t sendEpoch;
+
+    // Counts what is read and sent, if set
+    Metrics::Recorder *metrics;
+    // Records every datagram read, if set
+    Capture::Writer *capture;
 
     void resizeRead();
     
@@ -50,7 +92,7 @@ class PacketHolder {
     void initCachedReadHead();
     uint8_t* makeValid(uint8_t*);
 
-    NetReturn rollbackSendHead(uint8_t *&packetBuffer, uint32_t packetSize, uint8_t destination);
+    NetReturn rollbackSendHead(uint8_t *&packetBuffer, uint32_t packetSize, uint32_t destination);
 protected:
 
     struct PacketConstructionArgs {
@@ -66,18 +108,19 @@ public:
     inline PacketHolder(void *_buffer, uint32_t bufferLen) 
         : buffer(reinterpret_cast<uint8_t *>(_buffer)), bufferLen(bufferLen), 
         readHead(buffer),  readEnd(buffer), processHead(buffer), 
-        processEnd(buffer), sendHead(buffer) 
+        processEnd(buffer), sendHead(buffer), latest(nullptr), numLatest(0), sendEpoch(1), 
+        metrics(nullptr), capture(nullptr)
     {
         initCachedReadHead();
     }
 
     template<typename T>
     NetReturn addPacket(const Packets::Packet<T> &packet) {
-        return addPacket(packet, 0xFF);
+        return addPacket(packet, Destination::BROADCAST);
     }
     // Does not hold a reference to `packet` once call completes 
     template<typename T>
-    NetReturn addPacket(const Packets::Packet<T> &packet, uint8_t destination) {
+    NetReturn addPacket(const Packets::Packet<T> &packet, uint32_t destination) {
         
         uint8_t *packetBuffer;
 
@@ -98,10 +141,61 @@ public:
     }
 
     NetReturn sendPacket(Transmission::Writer &write);
+    // Sends every processed packet at once through Writer::queue/flush.
+    // Returns the number of packets sent.
+    NetReturn sendPackets(Transmission::Writer &writer);
     
     NetReturn readPacket(Transmission::Reader &reader);
+
+    struct ReadBatchInfo {
+        uint32_t filtered;
+        uint32_t invalid;
+    };
+    // Reads up to `maxPackets` datagrams into consecutive slots with one call to
+    // Reader::readBatch. Datagrams that fail sender resolution or are too short
+    // are left in the ring as skipped slots and counted in `info`. Returns the
+    // number of packets accepted.
+    NetReturn readPackets(Transmission::Reader &reader, uint32_t maxPackets, 
+        ReadBatchInfo *info = nullptr);
+
+    // Moves past skipped slots to the next packet that has been read but not
+    // processed yet. Returns false once every read packet has been processed.
+    bool nextPacket();
  
     NetReturn getSenderId() const;   
+    // The tag and wire bytes of the packet being processed, for handlers that
+    // read it in place instead of decoding it (see Packets::PlayerPositionView)
+    inline NetReturn peekPacket(Packets::Tag *tag, const uint8_t **payload, uint32_t *len) const {
+        PacketConstructionArgs args;
+        NetReturn res = extractPacketInfo(args);
+        if(res.errorCode != NetReturn::OK) return res;
+        *tag = args.tag;
+        *payload = args.buffer;
+        *len = args.len;
+        return res;
+    }
+    // Where the packet being processed is sent to (see Destination). By
+    // default a received packet goes to everyone except its sender.
+    void setDestination(uint32_t destination);
+    // Gives supersede one slot per key. `slots` must be zero-initialized.
+    inline void setLatestSlots(LatestSlot *slots, uint32_t numSlots) {
+        latest = slots;
+        numLatest = numSlots;
+    }
+    // Counts every packet read (by tag, or by why it was dropped) and every
+    // datagram sent from now on
+    void setMetrics(Metrics::Recorder *recorder);
+    // Appends every datagram readPackets takes, accepted or not, to `writer`
+    inline void setCapture(Capture::Writer *writer) {capture = writer;}
+    // Bytes of the ring in use, from the oldest packet not yet sent to the
+    // read head
+    inline size_t getUsed() const {
+        return readHead >= readEnd ? readHead - readEnd : bufferLen - (readEnd - readHead);
+    }
+    // Skips the packet that last called supersede with `key`, if it has not
+    // been sent yet, and makes the packet being processed the latest of `key`.
+    // Returns whether a packet was skipped.
+    bool supersede(uint32_t key);
     void dropPacket();
     void finishProcessing();
 
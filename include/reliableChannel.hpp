@@ -0,0 +1,202 @@
+#ifndef RELIABLECHANNEL_HPP
+#define RELIABLECHANNEL_HPP
+
+#include "netCommon.hpp"
+#include "packets.hpp"
+#include "packets/reliable.hpp"
+#include "packets/ack.hpp"
+#include "protocol.hpp"
+#include "transmission.hpp"
+
+namespace Reliable {
+
+// Per connection reliable delivery over Packets::Reliable. Every packet gets
+// a sequence number and is kept in a fixed pool until the peer acknowledges
+// it (selectively, see Packets::Ack), and is retransmitted after an RTT based
+// timeout until then. Incoming packets are deduplicated, and ordered ones are
+// held back until every earlier sequence number arrived. A connection may
+// hold at most half of its share of the pool, so that the rest is left for
+// sending.
+class Channel {
+public:
+    // Sequence numbers that can be unacknowledged at once, per direction
+    static constexpr uint32_t WINDOW = 32;
+    // Largest datagram, tag included, the pool can hold
+    static constexpr uint32_t MAX_DATAGRAM_SIZE = 128;
+
+    static constexpr uint32_t INITIAL_RTO_MS = 200;
+    static constexpr uint32_t MIN_RTO_MS = 30;
+    static constexpr uint32_t MAX_RTO_MS = 2000;
+    // Transmissions of a packet before it is abandoned
+    static constexpr uint32_t MAX_TRANSMISSIONS = 10;
+
+    enum Delivery {
+        // Process the payload now
+        DELIVER,
+        // Arrived early and is kept until nextHeld returns it
+        HELD,
+        // Already seen, or out of space. Nothing to process.
+        IGNORE
+    };
+
+    struct Received {
+        Packets::Tag tag;
+        const void *payload;
+        uint32_t size;
+    };
+
+private:
+    struct Pending {
+        // 0 when unused
+        uint32_t seq;
+        uint32_t slot;
+        uint32_t size;
+        uint32_t sentAtMs;
+        uint32_t deadlineMs;
+        uint32_t transmissions;
+    };
+
+    struct Held {
+        // 0 when unused
+        uint32_t seq;
+        uint32_t slot;
+        uint32_t size;
+        Packets::Tag tag;
+    };
+
+    struct Endpoint {
+        bool supported;
+
+        uint32_t nextSeq;
+        uint32_t inFlight;
+        // Index into busy while inFlight > 0
+        uint32_t busyIndex;
+        uint32_t srttMs;
+        uint32_t rttvarMs;
+        uint32_t rtoMs;
+
+        // Next sequence number not received yet, and which of the WINDOW
+        // after it were
+        uint32_t recvNext;
+        uint32_t recvMask;
+        uint32_t numHeld;
+        bool ackPending;
+    };
+
+    ConnectionId capacity;
+    Endpoint *endpoints;
+    // WINDOW entries per connection, indexed by sequence number
+    Pending *pending;
+    Held *held;
+
+    uint8_t *slots;
+    uint32_t *freeSlots;
+    uint32_t numFree;
+    uint32_t numSlots;
+    // Slot of the packet nextHeld returned last, given back on its next call
+    static constexpr uint32_t NO_SLOT = 0xFFFFFFFF;
+    uint32_t lentSlot;
+    uint32_t maxHeld;
+
+    // Connections with packets in flight, which poll has to look at
+    ConnectionId *busy;
+    uint32_t numBusy;
+
+    // Connections owed an Ack
+    ConnectionId *ackQueue;
+    uint32_t numAcks;
+
+    inline uint8_t* slotData(uint32_t slot) {return slots + static_cast<size_t>(slot) * MAX_DATAGRAM_SIZE;}
+    void release(Pending &p);
+    void markBusy(ConnectionId id);
+    void markIdle(ConnectionId id);
+    void sample(Endpoint &e, uint32_t rttMs);
+    NetReturn commit(Transmission::Writer &writer, ConnectionId id, uint32_t slot,
+        uint32_t size, uint32_t nowMs);
+
+public:
+    Channel(ConnectionId capacity, uint32_t numSlots);
+    ~Channel();
+
+    Channel(const Channel &) = delete;
+    Channel& operator=(const Channel &) = delete;
+
+    // Forgets everything about the previous holder of `id`. Unsupported
+    // connections never get reliable packets.
+    void connect(ConnectionId id, bool supported);
+    inline bool isSupported(ConnectionId id) const {
+        return id < capacity ? endpoints[id].supported : false;
+    }
+
+    // Wraps `packet`, keeps it until acknowledged and queues it on `writer`.
+    // Returns NOT_ENOUGH_SPACE when the window or the pool is full.
+    template<typename T>
+    NetReturn send(Transmission::Writer &writer, ConnectionId id,
+        const Packets::Packet<T> &packet, bool ordered, uint32_t nowMs);
+
+    // Handles an Ack on the reliable channel
+    void acknowledge(ConnectionId id, uint32_t seqNum, uint32_t ackBits, uint32_t nowMs);
+
+    Delivery receive(ConnectionId id, const Packets::Reliable &packet);
+    // Returns held packets once everything before them arrived, in order.
+    // `out` stays valid until the next call to nextHeld, for any connection.
+    // Call it until it returns false, so the last slot goes back to the pool.
+    bool nextHeld(ConnectionId id, Received *out);
+
+    // Adds an Ack for every connection that sent reliable packets since
+    // the last call, on a Protocol::PacketHolder or a Pipeline::PacketPipe
+    template<typename P>
+    void queueAcks(P &pp);
+
+    // Retransmits everything whose timeout passed
+    void poll(Transmission::Writer &writer, uint32_t nowMs);
+};
+
+template<typename T>
+NetReturn Channel::send(Transmission::Writer &writer, ConnectionId id,
+    const Packets::Packet<T> &packet, bool ordered, uint32_t nowMs)
+{
+    if(id >= capacity || !endpoints[id].supported) return {0, NetReturn::INVALID_STATE};
+
+    Endpoint &e = endpoints[id];
+    const uint32_t headerSize = sizeof(Packets::Tag) + Packets::Reliable::HEADER_SIZE;
+    const uint32_t size = headerSize + packet.getSize();
+    if(size > MAX_DATAGRAM_SIZE) return {size, NetReturn::NOT_ENOUGH_SPACE};
+    if(pending[id * WINDOW + e.nextSeq % WINDOW].seq != 0 || numFree == 0) {
+        return {0, NetReturn::NOT_ENOUGH_SPACE};
+    }
+
+    uint32_t slot = freeSlots[--numFree];
+    uint8_t *data = slotData(slot);
+
+    NetReturn res = packet.netWriteToBuffer(data + headerSize, size - headerSize);
+    if(res.errorCode == NetReturn::OK) {
+        *reinterpret_cast<uint32_t *>(data) = htonl(static_cast<uint32_t>(Packets::Tag::RELIABLE));
+        res = Packets::Reliable(Packets::ReliablePacketCode(e.nextSeq), ordered ? Packets::Reliable::O_ORDERED : 0,
+            Packets::Packet<T>::tag, data + headerSize, size - headerSize)
+            .netWriteToBuffer(data + sizeof(Packets::Tag), size - sizeof(Packets::Tag));
+    }
+    if(res.errorCode != NetReturn::OK) {
+        freeSlots[numFree++] = slot;
+        return res;
+    }
+
+    return commit(writer, id, slot, size, nowMs);
+}
+
+template<typename P>
+void Channel::queueAcks(P &pp) {
+    for(uint32_t i = 0; i < numAcks; i++) {
+        ConnectionId id = ackQueue[i];
+        Endpoint &e = endpoints[id];
+        e.ackPending = false;
+
+        pp.addPacket(Packets::Ack(e.recvNext - 1, e.recvMask, Packets::Ack::RELIABLE),
+            Destination::ONLY | id);
+    }
+    numAcks = 0;
+}
+
+}
+
+#endif
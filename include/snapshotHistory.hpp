@@ -0,0 +1,98 @@
+#ifndef SNAPSHOTHISTORY_HPP
+#define SNAPSHOTHISTORY_HPP
+
+#include "netCommon.hpp"
+#include "vec.hpp"
+#include "packets/playerPosition.hpp"
+#include "packets/compactSnapshot.hpp"
+
+namespace Snapshot {
+
+// Quantized player states of the last DEPTH snapshots, along with the newest
+// snapshot each client acknowledged, so that CompactSnapshot can be sent as
+// a delta against it. A snapshot goes out in chunks of
+// CompactSnapshot::MAX_PLAYERS states, in the order they were recorded, and
+// only counts as acknowledged once every chunk of it is.
+class History {
+public:
+    static constexpr uint32_t DEPTH = 32;
+    // Snapshots sent in more chunks than acks have bits for are never
+    // acknowledged
+    static constexpr uint32_t MAX_CHUNKS = 32;
+
+    // Values for Connection::group. Compact clients are grouped by baseline
+    // so every group is sent the same datagrams.
+    static constexpr uint16_t LEGACY_GROUP = 0;
+    static constexpr uint16_t FULL_GROUP = 1;
+    static constexpr uint16_t MAX_GROUP = 2 + DEPTH;
+    static constexpr uint16_t baselineGroup(uint32_t tick) {return 2 + tick % DEPTH;}
+
+private:
+    struct Recipient {
+        bool compact;
+        // Whether acks say which chunks arrived. Otherwise they only vouch
+        // for snapshots sent in a single one.
+        bool chunked;
+        uint32_t ackedTick;
+        // Newest tick only some chunks of were acknowledged, and which
+        uint32_t partialTick;
+        uint32_t partialChunks;
+    };
+
+    ConnectionId capacity;
+
+    // DEPTH rows of `capacity` states, indexed by tick % DEPTH and player id,
+    // along with the tick each state was recorded at
+    Packets::CompactPosition *states;
+    uint32_t *stateTicks;
+    uint32_t rowTicks[DEPTH];
+    uint32_t rowChunks[DEPTH];
+
+    // States of the latest snapshot, in the order they were recorded
+    Packets::CompactPosition *current;
+    uint16_t numCurrent;
+    uint32_t currentTick;
+
+    Recipient *recipients;
+
+    // Returned by gatherBaseline
+    const Packets::CompactPosition **baseline;
+
+    Vec origin;
+    bool hasOrigin;
+    // Snapshots from before the origin last moved can't be baselines
+    uint32_t originTick;
+
+public:
+    History(ConnectionId capacity);
+    ~History();
+
+    History(const History &) = delete;
+    History& operator=(const History &) = delete;
+
+    // Forgets whatever the previous holder of `id` acknowledged
+    void connect(ConnectionId id, bool compact, bool chunked);
+    // Bit i of `chunks` acknowledges chunk i of `tick`
+    void acknowledge(ConnectionId id, uint32_t tick, uint32_t chunks);
+
+    // Quantizes the snapshot of `tick`. Moves the origin, and with it drops
+    // every baseline, if a player ended up out of range of the old one.
+    void record(uint32_t tick, const Packets::PlayerPosition *players, uint16_t numPlayers);
+
+    // The tick `id` should get deltas against, or 0 for a full snapshot
+    uint32_t baselineFor(ConnectionId id) const;
+    // The state of every current player at `baselineTick`, or null where that
+    // player was not part of it. Valid until the next call.
+    const Packets::CompactPosition *const *gatherBaseline(uint32_t baselineTick);
+
+    inline bool isCompact(ConnectionId id) const {
+        return id < capacity ? recipients[id].compact : false;
+    }
+    inline const Packets::CompactPosition* getCurrent() const {return current;}
+    inline uint16_t getNumCurrent() const {return numCurrent;}
+    inline const Vec& getOrigin() const {return origin;}
+};
+
+}
+
+#endif
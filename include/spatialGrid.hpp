@@ -0,0 +1,55 @@
+#ifndef SPATIALGRID_HPP
+#define SPATIALGRID_HPP
+
+#include "netCommon.hpp"
+#include "vec.hpp"
+
+namespace Spatial {
+
+// Uniform grid over player positions, so the players near someone can be
+// found without looking at everyone. Cells are hashed into a fixed table
+// and each cell keeps an intrusive list of the players inside it.
+class Grid {
+    struct Entry {
+        Vec position;
+        int32_t cell[3];
+        uint32_t bucket;
+        ConnectionId next;
+        ConnectionId prev;
+        bool present;
+    };
+
+    float cellSize;
+    float inverseCellSize;
+
+    ConnectionId capacity;
+    Entry *entries;
+
+    // First player of every cell that hashes to each bucket
+    ConnectionId *buckets;
+    uint32_t bucketMask;
+
+    void cellOf(const Vec &position, int32_t *cell) const;
+    uint32_t bucketOf(const int32_t *cell) const;
+    void unlink(ConnectionId id);
+
+public:
+    static constexpr ConnectionId NONE = 0xFFFF;
+
+    Grid(ConnectionId capacity, float cellSize);
+    ~Grid();
+
+    Grid(const Grid &) = delete;
+    Grid& operator=(const Grid &) = delete;
+
+    void update(ConnectionId id, const Vec &position);
+    void remove(ConnectionId id);
+
+    // Writes up to `maxCount` players within `radius` of `id`, other than
+    // `id` itself, to `out`. Returns how many were written.
+    uint32_t query(ConnectionId id, float radius, ConnectionId *out, uint32_t maxCount) const;
+};
+
+}
+
+#endif
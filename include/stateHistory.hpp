@@ -0,0 +1,69 @@
+#ifndef STATEHISTORY_HPP
+#define STATEHISTORY_HPP
+
+#include "netCommon.hpp"
+#include "vec.hpp"
+#include "timestamps.hpp"
+
+namespace Player {
+
+struct State {
+    Vec position;
+    Vec velocity;
+    Vec direction;
+};
+
+// The last DEPTH timestamped states of every player, so that checks can look
+// at where a player was at the time a packet was sent rather than where it
+// is now.
+//
+// Each player has a ring of DEPTH timestamps and a parallel ring of states.
+// A lookup searches the timestamps, which are a couple of cache lines, and
+// only touches the two states it interpolates between.
+class StateHistory {
+public:
+    static constexpr uint32_t DEPTH = 32;
+    static_assert((DEPTH & (DEPTH - 1)) == 0, "DEPTH has to be a power of two");
+
+private:
+    ConnectionId capacity;
+
+    // DEPTH entries per player, indexed by id * DEPTH + (entry % DEPTH)
+    int32_t *stampsMs;
+    State *states;
+    // Entries recorded per player since it was last cleared
+    uint32_t *numRecorded;
+
+    inline int32_t stampAt(size_t base, uint32_t entry) const {
+        return stampsMs[base + (entry & (DEPTH - 1))];
+    }
+
+public:
+    StateHistory(ConnectionId capacity);
+    ~StateHistory();
+
+    StateHistory(const StateHistory &) = delete;
+    StateHistory& operator=(const StateHistory &) = delete;
+
+    // Forgets the states of the previous holder of `id`
+    inline void clear(ConnectionId id) {
+        if(id < capacity) numRecorded[id] = 0;
+    }
+
+    // Adds the state of `id` at `t`. A state with the timestamp of the newest
+    // one replaces it, older ones are ignored.
+    void record(ConnectionId id, ServerTimestamp t,
+        const Vec &position, const Vec &velocity, const Vec &direction);
+
+    // The state of `id` at `t`, interpolated between the two recorded states
+    // around it. Before the oldest or after the newest state, that state is
+    // returned as it is. Returns false if nothing was recorded for `id`.
+    bool sample(ConnectionId id, ServerTimestamp t, State *out) const;
+
+    // Whether `t` lies between the oldest and the newest state of `id`
+    bool covers(ConnectionId id, ServerTimestamp t) const;
+};
+
+}
+
+#endif
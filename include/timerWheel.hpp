@@ -0,0 +1,74 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <cstdint>
+
+namespace Event {
+
+// Hierarchical timer wheel with one timer per id. Scheduling and cancelling
+// are O(1); timers further out than one revolution of the first level sit
+// in coarser levels and move down as their time approaches. Time is in
+// ticks of whatever length the owner chooses.
+class TimerWheel {
+public:
+    static constexpr uint32_t LEVELS = 4;
+    static constexpr uint32_t SLOT_BITS = 6;
+    static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+    // Timers further out than this are clamped
+    static constexpr uint64_t MAX_DELAY = (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+    struct Node {
+        uint64_t expires;
+        uint32_t next;
+        uint32_t prev;
+        // Index into heads, or NONE when not scheduled
+        uint32_t slot;
+    };
+
+    Node *nodes;
+    uint32_t capacity;
+    uint32_t heads[LEVELS * SLOTS];
+    uint64_t now;
+
+    void link(uint32_t id);
+    void unlink(uint32_t id);
+    void cascade(uint32_t level);
+    uint32_t popExpired();
+
+public:
+    TimerWheel(uint32_t capacity, uint64_t now);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel& operator=(const TimerWheel &) = delete;
+
+    // Replaces any timer `id` already had. Times in the past fire on the
+    // next tick.
+    void schedule(uint32_t id, uint64_t expires);
+    void cancel(uint32_t id);
+    inline bool isScheduled(uint32_t id) const {
+        return id < capacity && nodes[id].slot != NONE;
+    }
+    inline uint64_t getNow() const {return now;}
+
+    // Moves time forward to `target`, calling `onExpire(id)` for every timer
+    // that comes due, in order. `onExpire` may schedule timers again.
+    template<typename F>
+    void advance(uint64_t target, F onExpire) {
+        while(now < target) {
+            now++;
+            for(uint32_t level = 1; level < LEVELS; level++) {
+                if(now & ((1ull << (SLOT_BITS * level)) - 1)) break;
+                cascade(level);
+            }
+            for(uint32_t id = popExpired(); id != NONE; id = popExpired()) onExpire(id);
+        }
+    }
+};
+
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef TIMESTAMPS_HPP
 #define TIMESTAMPS_HPP
 
+#include <cstdint>
+#include <limits>
+
 struct Timestamp {
     int32_t timeMs;
 };
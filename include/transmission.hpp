@@ -3,8 +3,19 @@
 
 #include "netCommon.hpp"
 
+#include <ctime>
+
 extern "C" {
     #include <netinet/ip.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+}
+
+namespace Uring {
+
+    class Ring;
+    class BufferRing;
+
 }
 
 namespace Transmission {
@@ -13,88 +24,306 @@ struct Connection {
     bool isActive;
     bool isCandidate;
 
+    // Position in the holder's list of active connections
+    ConnectionId activeIndex;
+
+    // Selects the connection for Destination::GROUP. 0 once connected.
+    uint16_t group;
+
     sockaddr_in addr;
 };
 
 class ConnectionHolder {
     Connection *connections;
-    uint8_t len;
+    ConnectionId len;
+
+    // Ids of every active connection, in no particular order, so that
+    // broadcasts only touch connections that are in use
+    ConnectionId *activeIds;
+    ConnectionId numActive;
+
+    // Ids that are neither active nor candidates
+    ConnectionId *freeIds;
+    ConnectionId numFree;
+
+    // Linear probing table from address to id, covering both active
+    // connections and candidates. Never more than half full.
+    ConnectionId *addrIndex;
+    uint32_t indexMask;
+
+    uint32_t findIndex(const sockaddr_in *addr) const;
+    void eraseIndex(ConnectionId id);
+    void release(ConnectionId id);
+
 public:
-    ConnectionHolder(Connection *connections, uint8_t len);
+    static constexpr ConnectionId NO_CONNECTION = 0xFFFF;
+
+    ConnectionHolder(Connection *connections, ConnectionId capacity);
+    ~ConnectionHolder();
+
+    ConnectionHolder(const ConnectionHolder &) = delete;
+    ConnectionHolder& operator=(const ConnectionHolder &) = delete;
+
     // Either return the id of the corresponding address, or
     // create a connection candidate and return that id, along with
-    // error code NetReturn::CANDIDATE. Maybe in the future return
-    // FILTERED if necessary
-    NetReturn getId(sockaddr_in *addr);
+    // error code NetReturn::CANDIDATE. Returns FILTERED when every
+    // id is taken.
+    NetReturn getId(const sockaddr_in *addr);
     inline NetReturn getId(const Connection *c) const {
         ssize_t res = c - connections;
-        if(res < len && res > 0) return {static_cast<uint32_t>(res), NetReturn::OK};
+        if(res < len && res >= 0) return {static_cast<uint32_t>(res), NetReturn::OK};
         return {0, NetReturn::INVALID_DATA};
     }
 
-    inline bool isCandidate(uint8_t id) const {
+    inline bool isCandidate(ConnectionId id) const {
         return id < len ? connections[id].isCandidate : false;
     }
     
-    inline void purgeCandidate(uint8_t candidateId) {
-        if(candidateId < len) connections[candidateId].isCandidate = false;
-    }
-    inline void purgeConnection(uint8_t id) {
-        if(id < len) connections[id].isActive = false;
-    }
-    inline NetReturn addConnection(sockaddr_in *addr) {
+    void purgeCandidate(ConnectionId candidateId);
+    void purgeConnection(ConnectionId id);
+
+    inline NetReturn addConnection(const sockaddr_in *addr) {
         NetReturn res = getId(addr);
-        if(res.errorCode == NetReturn::OK) return res;
         if(res.errorCode == NetReturn::CANDIDATE) {
             addConnection(res.bytes);
             return {res.bytes, NetReturn::OK};
         }
+        return res;
     }
-    inline bool addConnection(uint8_t id) {
-        if(id < len && connections[id].isCandidate) {
-            connections[id].isCandidate = false;
-            connections[id].isActive = true;
-            return true;
-        }
-        return false;
+    bool addConnection(ConnectionId id);
+    // Makes `id` an active connection to `addr`, replacing whatever had
+    // either of them, so that the holder can follow another one that hands
+    // out the ids. Slower than addConnection.
+    bool mirrorConnection(ConnectionId id, const sockaddr_in *addr);
+
+    inline void setGroup(ConnectionId id, uint16_t group) {
+        if(id < len) connections[id].group = group;
     }
 
-    inline const Connection* getConnection(uint8_t id) const {
+    inline const Connection* getConnection(ConnectionId id) const {
         if(id < len) return connections + id;
         else return nullptr;
     }
 
     inline const Connection* cbegin() const {return connections;}
     inline const Connection* cend() const {return connections + len;}
+
+    inline const ConnectionId* activeBegin() const {return activeIds;}
+    inline const ConnectionId* activeEnd() const {return activeIds + numActive;}
+    inline ConnectionId getNumActive() const {return numActive;}
+    inline ConnectionId getCapacity() const {return len;}
     
 };
 
+// Explicit recipients for Destination::LIST. Lists are only appended, so a
+// list stays valid until clear is called.
+class RecipientLists {
+    ConnectionId *ids;
+    uint32_t capacity;
+    uint32_t used;
+
+    // List i is ids[offsets[i]] up to ids[offsets[i + 1]]
+    uint32_t *offsets;
+    uint32_t maxLists;
+    uint32_t numLists;
+
+public:
+    RecipientLists(uint32_t capacity, uint32_t maxLists);
+    ~RecipientLists();
+
+    RecipientLists(const RecipientLists &) = delete;
+    RecipientLists& operator=(const RecipientLists &) = delete;
+
+    // Space for a new list of up to `maxCount` ids, or null when out of room
+    inline ConnectionId* open(uint32_t maxCount) {
+        if(numLists == maxLists || capacity - used < maxCount) return nullptr;
+        return ids + used;
+    }
+    // Ends the list started by open with its first `count` ids and returns
+    // its index
+    inline uint32_t close(uint32_t count) {
+        used += count;
+        offsets[++numLists] = used;
+        return numLists - 1;
+    }
+    inline void clear() {
+        used = 0;
+        numLists = 0;
+    }
+
+    inline const ConnectionId* begin(uint32_t list) const {return ids + offsets[list];}
+    inline const ConnectionId* end(uint32_t list) const {return ids + offsets[list + 1];}
+    inline uint32_t getNumLists() const {return numLists;}
+};
+
 class Writer {
     int socket;
 
     const ConnectionHolder *holder;
+    const RecipientLists *lists;
+
+    // Only set once enableUring succeeded
+    Uring::Ring *uring;
+
+public:
+
+    // Upper bound on the number of datagrams handed to a single sendmmsg
+    static constexpr uint32_t MAX_BATCH_SIZE = 256;
+
+    struct Stats {
+        uint64_t messages;
+        uint64_t sendCalls;
+        // Datagrams queued, whether or not they were sent yet
+        uint64_t queued;
+        // Datagrams never sent: the send buffer stayed full, or sending
+        // them failed
+        uint64_t dropped;
+    };
+
+    // How long flush waits for room in a full send buffer before it drops
+    // the rest of the batch
+    static constexpr int SEND_WAIT_MS = 10;
+
+private:
+
+    mmsghdr msgs[MAX_BATCH_SIZE];
+    // One per queued packet, shared by every recipient of that packet
+    iovec iovs[MAX_BATCH_SIZE];
+    uint32_t numMsgs;
+    uint32_t numIovs;
+
+    Stats stats;
+
+    iovec* queueMessage(const Connection *c, iovec *iov);
+    NetReturn flushUring();
+    // The socket is non-blocking. Waits up to SEND_WAIT_MS for it to be
+    // writable again instead of retrying in a busy loop.
+    bool waitWritable();
+    // One datagram for write. Retries once the socket takes more, and
+    // drops it if it doesn't.
+    void sendTo(const Connection *c, const void *data, uint32_t size);
 
 public:
     
     inline Writer(int socket, const ConnectionHolder *holder) 
-        : socket(socket), holder(holder) {}
+        : socket(socket), holder(holder), lists(nullptr), uring(nullptr), 
+        numMsgs(0), numIovs(0), stats{0, 0, 0, 0} {}
+    ~Writer();
+
+    Writer(const Writer &) = delete;
+    Writer& operator=(const Writer &) = delete;
+
+    // Makes flush submit one sendmsg per datagram to io_uring, all with a
+    // single syscall, instead of calling sendmmsg. Leaves the writer on
+    // sendmmsg if the kernel can't, and returns why.
+    NetReturn enableUring();
+    inline bool usesUring() const {return uring != nullptr;}
 
-    // destination: 0xff = everyone, if the msb is set, send only to destination,
-    // otherwise send to all but destination
-    NetReturn write(const void *data, uint32_t size, uint8_t destination);
+    // Needed before anything is sent to Destination::LIST
+    inline void setRecipientLists(const RecipientLists *_lists) {lists = _lists;}
+
+    // See Destination for how `destination` is interpreted
+    NetReturn write(const void *data, uint32_t size, uint32_t destination);
+
+    // Same as write, but only records the datagrams. `data` must stay valid
+    // until the next flush. Flushes on its own if the batch fills up.
+    NetReturn queue(const void *data, uint32_t size, uint32_t destination);
+    // Sends everything queued so far with as few sendmmsg (or io_uring_enter)
+    // calls as possible
+    NetReturn flush();
+
+    inline const Stats& getStats() const {return stats;}
 };
 
+// Asks the kernel to stamp every datagram `socket` receives with when it
+// arrived, and to tell with them how many it dropped because the receive
+// buffer was full
+NetReturn enableReceiveStamps(int socket);
+
+// Room for the control messages enableReceiveStamps adds to a datagram
+constexpr uint32_t RECEIVE_CONTROL_SIZE = CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+// Reads those control messages off a received datagram. `kernelNs` gets its
+// arrival time (CLOCK_REALTIME) and `drops` the socket's drop count so far;
+// either is left alone if the datagram didn't come with it.
+void readReceiveStamps(const msghdr &msg, uint64_t *kernelNs, uint32_t *drops);
+
+// A kernel timestamp moved onto CLOCK_MONOTONIC (what Metrics::nowNs reads),
+// given both clocks read at about the same time. 0 stays 0.
+inline uint64_t toMonotonicNs(uint64_t kernelNs, uint64_t realtimeNowNs, uint64_t monotonicNowNs) {
+    if(kernelNs == 0) return 0;
+    const uint64_t queued = realtimeNowNs > kernelNs ? realtimeNowNs - kernelNs : 0;
+    return monotonicNowNs > queued ? monotonicNowNs - queued : 0;
+}
+
 class Reader {
     int socket;
 
     ConnectionHolder *holder;
 
+    // Last drop count the kernel sent along with a datagram
+    uint32_t kernelDrops;
+
+    // Only set once enableUring succeeded. Datagrams land in `buffers`
+    // through a multishot recvmsg described by `uringMsg`.
+    Uring::Ring *uring;
+    Uring::BufferRing *buffers;
+    msghdr uringMsg;
+
+public:
+
+    // Upper bound on the number of datagrams taken by a single readBatch call
+    static constexpr uint32_t MAX_BATCH_SIZE = 32;
+
+    struct ReadSlot {
+        void *data;
+        uint32_t size;
+        // Set by readBatch: the sender, its id and the same result read
+        // would return
+        ConnectionId id;
+        NetReturn res;
+        sockaddr_in addr;
+        // When the kernel received it (CLOCK_MONOTONIC), or 0 if the socket
+        // doesn't stamp datagrams
+        uint64_t arrivalNs;
+    };
+
+private:
+
+    NetReturn armUring();
+    // Copies up to `count` completed receives into `slots`
+    NetReturn readUring(ReadSlot *slots, uint32_t count, uint32_t *lengths);
+
 public:
     
     inline Reader(int socket, ConnectionHolder *holder) 
-        : socket(socket), holder(holder) {}
+        : socket(socket), holder(holder), kernelDrops(0), uring(nullptr), buffers(nullptr) {}
+    ~Reader();
+
+    Reader(const Reader &) = delete;
+    Reader& operator=(const Reader &) = delete;
+
+    // Receives through a multishot recvmsg on io_uring from then on, so
+    // datagrams arrive in `numBuffers` buffers registered with the kernel
+    // without a syscall each. readBatch copies them out from there. Leaves
+    // the reader on the socket if the kernel can't, and returns why.
+    NetReturn enableUring(uint32_t numBuffers);
+    inline bool usesUring() const {return uring != nullptr;}
+    // What to wait on before readBatch: the socket, or the ring once
+    // enableUring succeeded
+    int getReadyFd() const;
     
-    NetReturn read(void *data, uint32_t size, uint8_t *outputId);
+    // `arrivalNs` gets the same as ReadSlot::arrivalNs
+    NetReturn read(void *data, uint32_t size, ConnectionId *outputId, uint64_t *arrivalNs = nullptr);
+
+    // Takes as many datagrams as are queued (up to `count`) with a single
+    // recvmmsg. Returns the number of slots filled. The socket is
+    // nonblocking, so with nothing queued that is 0 rather than EAGAIN.
+    NetReturn readBatch(ReadSlot *slots, uint32_t count);
+
+    // Datagrams the kernel dropped on this socket for lack of buffer space,
+    // as of the last one read. Only counted after enableReceiveStamps.
+    inline uint32_t getKernelDrops() const {return kernelDrops;}
 };
 
 }
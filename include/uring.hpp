@@ -0,0 +1,121 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include "netCommon.hpp"
+
+#include <atomic>
+
+extern "C" {
+#include <linux/io_uring.h>
+}
+
+// Thin io_uring wrapper on top of the raw syscalls, so the server doesn't
+// depend on liburing. Only what Transmission needs is here.
+namespace Uring {
+
+// Submission and completion queues of one io_uring instance. Only one thread
+// may use it.
+class Ring {
+    int fd;
+
+    void *sqMap;
+    size_t sqMapLen;
+    void *cqMap;
+    size_t cqMapLen;
+    io_uring_sqe *sqes;
+    size_t sqesLen;
+
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t sqMask;
+    uint32_t sqEntries;
+    // Entries handed out by getSqe, and how many of them were submitted
+    uint32_t sqLocalTail;
+    uint32_t sqSubmitted;
+
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    io_uring_cqe *cqes;
+
+public:
+    inline Ring() : fd(-1), sqMap(nullptr), sqMapLen(0), cqMap(nullptr), cqMapLen(0),
+        sqes(nullptr), sqesLen(0) {}
+    ~Ring();
+
+    Ring(const Ring &) = delete;
+    Ring& operator=(const Ring &) = delete;
+
+    // Room for `entries` submissions and `cqEntries` completions, both
+    // rounded up to powers of two. Fails with the errno of whatever the
+    // kernel refused.
+    NetReturn init(uint32_t entries, uint32_t cqEntries);
+
+    // Readable while completions are waiting
+    inline int getFd() const {return fd;}
+
+    // A zeroed submission, or null if the queue is full
+    io_uring_sqe* getSqe();
+    // Submits everything from getSqe and waits until at least `waitFor`
+    // completions are there
+    NetReturn submit(uint32_t waitFor);
+
+    // The oldest completion, or null if there is none. It stays valid until
+    // seen is called.
+    inline io_uring_cqe* peekCqe() const {
+        uint32_t head = *cqHead;
+        if(head == std::atomic_ref<uint32_t>(*cqTail).load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return cqes + (head & cqMask);
+    }
+    inline void seen() {
+        std::atomic_ref<uint32_t>(*cqHead).store(*cqHead + 1, std::memory_order_release);
+    }
+
+    NetReturn registerBuffers(void *ringAddr, uint32_t entries, uint16_t group);
+};
+
+// Buffers registered with a ring (IORING_REGISTER_PBUF_RING) that the kernel
+// picks from for multishot receives. A buffer belongs to the kernel until
+// it was recycled and published again.
+class BufferRing {
+    io_uring_buf_ring *bufs;
+    size_t bufsLen;
+    uint8_t *data;
+    uint32_t count;
+    uint32_t size;
+    uint16_t localTail;
+
+public:
+    inline BufferRing() : bufs(nullptr), bufsLen(0), data(nullptr), count(0), size(0), localTail(0) {}
+    ~BufferRing();
+
+    BufferRing(const BufferRing &) = delete;
+    BufferRing& operator=(const BufferRing &) = delete;
+
+    // `count` buffers of `size` bytes each, registered with `ring` as
+    // `group`. `count` has to be a power of two.
+    NetReturn init(Ring &ring, uint16_t group, uint32_t count, uint32_t size);
+
+    inline uint8_t* get(uint16_t id) const {return data + static_cast<size_t>(id) * size;}
+    inline uint32_t getSize() const {return size;}
+
+    // Gives `id` back to the kernel on the next publish
+    inline void recycle(uint16_t id) {
+        // Not bufs->bufs: its empty placeholder member takes a byte in C++,
+        // which moves the array off the start of the ring
+        io_uring_buf *b = reinterpret_cast<io_uring_buf *>(bufs) + (localTail++ & (count - 1));
+        // The last field of the first buffer is the tail, so leave it be
+        b->addr = reinterpret_cast<uint64_t>(get(id));
+        b->len = size;
+        b->bid = id;
+    }
+    inline void publish() {
+        std::atomic_ref<uint16_t>(bufs->tail).store(localTail, std::memory_order_release);
+    }
+};
+
+}
+
+#endif
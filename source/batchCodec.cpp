@@ -0,0 +1,323 @@
+#include "batchCodec.hpp"
+#include "packets/packetView.hpp"
+
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_CODEC_X86
+#include <immintrin.h>
+#endif
+
+namespace Packets {
+
+namespace {
+
+// Every kernel moves four consecutive big endian words at `offset` of each
+// packet to or from four columns `stride` words apart
+
+void decodeWordsScalar(const uint8_t *const *packets, uint32_t count, uint32_t offset,
+    uint32_t *dst, uint32_t stride)
+{
+    for(uint32_t i = 0; i < count; i++) {
+        const uint8_t *words = packets[i] + offset;
+        for(uint32_t k = 0; k < 4; k++) dst[k * stride + i] = implementation::loadBigEndian(words + 4 * k);
+    }
+}
+
+void encodeWordsScalar(uint8_t *const *packets, uint32_t count, uint32_t offset,
+    const uint32_t *src, uint32_t stride)
+{
+    for(uint32_t i = 0; i < count; i++) {
+        uint8_t *words = packets[i] + offset;
+        for(uint32_t k = 0; k < 4; k++) {
+            uint32_t word = htonl(src[k * stride + i]);
+            memcpy(words + 4 * k, &word, sizeof word);
+        }
+    }
+}
+
+#ifdef BATCH_CODEC_X86
+
+// Rows of four words become columns of four packets and the other way round;
+// the same shuffle does both
+#define TRANSPOSE4(bits, r0, r1, r2, r3) do { \
+        auto t0 = _mm##bits##_unpacklo_epi32(r0, r1); \
+        auto t1 = _mm##bits##_unpacklo_epi32(r2, r3); \
+        auto t2 = _mm##bits##_unpackhi_epi32(r0, r1); \
+        auto t3 = _mm##bits##_unpackhi_epi32(r2, r3); \
+        r0 = _mm##bits##_unpacklo_epi64(t0, t1); \
+        r1 = _mm##bits##_unpackhi_epi64(t0, t1); \
+        r2 = _mm##bits##_unpacklo_epi64(t2, t3); \
+        r3 = _mm##bits##_unpackhi_epi64(t2, t3); \
+    } while(0)
+
+__attribute__((target("ssse3")))
+void decodeWordsSsse3(const uint8_t *const *packets, uint32_t count, uint32_t offset,
+    uint32_t *dst, uint32_t stride)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i r0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(packets[i] + offset)), swap);
+        __m128i r1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(packets[i + 1] + offset)), swap);
+        __m128i r2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(packets[i + 2] + offset)), swap);
+        __m128i r3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(packets[i + 3] + offset)), swap);
+        TRANSPOSE4(, r0, r1, r2, r3);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + stride + i), r1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * stride + i), r2);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 3 * stride + i), r3);
+    }
+    decodeWordsScalar(packets + i, count - i, offset, dst + i, stride);
+}
+
+__attribute__((target("ssse3")))
+void encodeWordsSsse3(uint8_t *const *packets, uint32_t count, uint32_t offset,
+    const uint32_t *src, uint32_t stride)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + stride + i));
+        __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * stride + i));
+        __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * stride + i));
+        TRANSPOSE4(, r0, r1, r2, r3);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(packets[i] + offset), _mm_shuffle_epi8(r0, swap));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(packets[i + 1] + offset), _mm_shuffle_epi8(r1, swap));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(packets[i + 2] + offset), _mm_shuffle_epi8(r2, swap));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(packets[i + 3] + offset), _mm_shuffle_epi8(r3, swap));
+    }
+    encodeWordsScalar(packets + i, count - i, offset, src + i, stride);
+}
+
+// Packets i to i + 3 go in the low lanes and i + 4 to i + 7 in the high
+// ones, so that the per-lane transpose leaves eight packets in order
+__attribute__((target("avx2")))
+static inline __m256i loadPair(const uint8_t *low, const uint8_t *high) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(low))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(high)), 1);
+}
+
+__attribute__((target("avx2")))
+static inline void storePair(uint8_t *low, uint8_t *high, __m256i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(low), _mm256_castsi256_si128(v));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(high), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2")))
+void decodeWordsAvx2(const uint8_t *const *packets, uint32_t count, uint32_t offset,
+    uint32_t *dst, uint32_t stride)
+{
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        const uint8_t *const *p = packets + i;
+        __m256i r0 = _mm256_shuffle_epi8(loadPair(p[0] + offset, p[4] + offset), swap);
+        __m256i r1 = _mm256_shuffle_epi8(loadPair(p[1] + offset, p[5] + offset), swap);
+        __m256i r2 = _mm256_shuffle_epi8(loadPair(p[2] + offset, p[6] + offset), swap);
+        __m256i r3 = _mm256_shuffle_epi8(loadPair(p[3] + offset, p[7] + offset), swap);
+        TRANSPOSE4(256, r0, r1, r2, r3);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), r0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + stride + i), r1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * stride + i), r2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 3 * stride + i), r3);
+    }
+    decodeWordsSsse3(packets + i, count - i, offset, dst + i, stride);
+}
+
+__attribute__((target("avx2")))
+void encodeWordsAvx2(uint8_t *const *packets, uint32_t count, uint32_t offset,
+    const uint32_t *src, uint32_t stride)
+{
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        uint8_t *const *p = packets + i;
+        __m256i r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i r1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + stride + i));
+        __m256i r2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * stride + i));
+        __m256i r3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 3 * stride + i));
+        TRANSPOSE4(256, r0, r1, r2, r3);
+        storePair(p[0] + offset, p[4] + offset, _mm256_shuffle_epi8(r0, swap));
+        storePair(p[1] + offset, p[5] + offset, _mm256_shuffle_epi8(r1, swap));
+        storePair(p[2] + offset, p[6] + offset, _mm256_shuffle_epi8(r2, swap));
+        storePair(p[3] + offset, p[7] + offset, _mm256_shuffle_epi8(r3, swap));
+    }
+    encodeWordsSsse3(packets + i, count - i, offset, src + i, stride);
+}
+
+#undef TRANSPOSE4
+
+#endif
+
+struct Kernels {
+    void (*decode)(const uint8_t *const *, uint32_t, uint32_t, uint32_t *, uint32_t);
+    void (*encode)(uint8_t *const *, uint32_t, uint32_t, const uint32_t *, uint32_t);
+};
+
+// Falls back to the best one there is if `isa` is not supported
+Kernels kernelsFor(BatchIsa isa) {
+#ifdef BATCH_CODEC_X86
+    if(isa > detectBatchIsa()) isa = detectBatchIsa();
+    switch(isa) {
+        case BatchIsa::AVX2: return {decodeWordsAvx2, encodeWordsAvx2};
+        case BatchIsa::SSSE3: return {decodeWordsSsse3, encodeWordsSsse3};
+        case BatchIsa::SCALAR: break;
+    }
+#else
+    (void)isa;
+#endif
+    return {decodeWordsScalar, encodeWordsScalar};
+}
+
+}
+
+BatchIsa detectBatchIsa() {
+#ifdef BATCH_CODEC_X86
+    static const BatchIsa detected = __builtin_cpu_supports("avx2") ? BatchIsa::AVX2 
+        : __builtin_cpu_supports("ssse3") ? BatchIsa::SSSE3 : BatchIsa::SCALAR;
+    return detected;
+#else
+    return BatchIsa::SCALAR;
+#endif
+}
+
+const char* batchIsaName(BatchIsa isa) {
+    switch(isa) {
+        case BatchIsa::AVX2: return "AVX2";
+        case BatchIsa::SSSE3: return "SSSE3";
+        case BatchIsa::SCALAR: break;
+    }
+    return "scalar";
+}
+
+static_assert(std::is_base_of_v<implementation::ColumnBatch<PlayerPositionBatch::NUM_COLUMNS>, PlayerPositionBatch>);
+static_assert(std::is_base_of_v<implementation::ColumnBatch<StarPieceBatch::NUM_COLUMNS>, StarPieceBatch>);
+
+PlayerPositionBatch::PlayerPositionBatch(uint32_t capacity) : ColumnBatch(capacity) {
+    stateFlags = new uint8_t[capacity];
+}
+
+PlayerPositionBatch::~PlayerPositionBatch() {
+    delete[] stateFlags;
+}
+
+void PlayerPositionBatch::get(uint32_t i, PlayerPosition *out) const {
+    out->playerId = playerIds[i];
+    out->stateFlags = stateFlags[i];
+    out->timestamp = timestamp(i);
+    out->position = position(i);
+    out->velocity = velocity(i);
+    out->direction = direction(i);
+    out->currentAnimation = currentAnimation(i);
+    out->defaultAnimation = defaultAnimation(i);
+    out->animationSpeed = animationSpeed(i);
+}
+
+void PlayerPositionBatch::set(uint32_t i, const PlayerPosition &in) {
+    playerIds[i] = in.playerId;
+    stateFlags[i] = in.stateFlags;
+    setWord(TIMESTAMP, i, std::bit_cast<uint32_t>(in.timestamp.t.timeMs));
+    setVec(POSITION, i, in.position);
+    setVec(VELOCITY, i, in.velocity);
+    setVec(DIRECTION, i, in.direction);
+    setWord(CURRENT_ANIMATION, i, std::bit_cast<uint32_t>(in.currentAnimation));
+    setWord(DEFAULT_ANIMATION, i, std::bit_cast<uint32_t>(in.defaultAnimation));
+    setWord(ANIMATION_SPEED, i, std::bit_cast<uint32_t>(in.animationSpeed));
+}
+
+// Column c is the word at TIMESTAMP_OFFSET + 4 * c. The kernels cover the
+// first twelve, and the last one is left over.
+static_assert(PlayerPositionView::TIMESTAMP_OFFSET + 4 * PlayerPositionBatch::NUM_COLUMNS 
+    == PlayerPositionView::SIZE);
+
+uint32_t PlayerPositionBatch::decode(const uint8_t *const *packets, uint32_t count, BatchIsa isa) {
+    if(count > capacity) count = capacity;
+    const Kernels kernels = kernelsFor(isa);
+
+    for(uint32_t i = 0; i < count; i++) {
+        const uint8_t *p = packets[i];
+        playerIds[i] = p[0] | p[2] << 8;
+        stateFlags[i] = p[1];
+        setWord(ANIMATION_SPEED, i, implementation::loadBigEndian(p + PlayerPositionView::ANIMATION_SPEED_OFFSET));
+    }
+    for(uint32_t c = TIMESTAMP; c < ANIMATION_SPEED; c += 4) {
+        kernels.decode(packets, count, PlayerPositionView::TIMESTAMP_OFFSET + 4 * c, column(c), capacity);
+    }
+
+    size = count;
+    return count;
+}
+
+void PlayerPositionBatch::encode(uint8_t *const *out, BatchIsa isa) const {
+    const Kernels kernels = kernelsFor(isa);
+
+    for(uint32_t i = 0; i < size; i++) {
+        uint8_t *p = out[i];
+        p[0] = playerIds[i] & 0xFF;
+        p[1] = stateFlags[i];
+        p[2] = playerIds[i] >> 8;
+        p[3] = 0;
+        uint32_t word = htonl(this->word(ANIMATION_SPEED, i));
+        memcpy(p + PlayerPositionView::ANIMATION_SPEED_OFFSET, &word, sizeof word);
+    }
+    for(uint32_t c = TIMESTAMP; c < ANIMATION_SPEED; c += 4) {
+        kernels.encode(out, size, PlayerPositionView::TIMESTAMP_OFFSET + 4 * c, column(c), capacity);
+    }
+}
+
+void StarPieceBatch::get(uint32_t i, StarPiece *out) const {
+    out->playerId = playerIds[i];
+    out->timestamp = timestamp(i);
+    out->initLineStart = initLineStart(i);
+    out->initLineEnd = initLineEnd(i);
+}
+
+void StarPieceBatch::set(uint32_t i, const StarPiece &in) {
+    playerIds[i] = in.playerId;
+    setWord(TIMESTAMP, i, std::bit_cast<uint32_t>(in.timestamp.t.timeMs));
+    setVec(INIT_LINE_START, i, in.initLineStart);
+    setVec(INIT_LINE_END, i, in.initLineEnd);
+}
+
+// Seven columns are covered by two runs of four that share the middle one
+static_assert(StarPieceView::TIMESTAMP_OFFSET + 4 * StarPieceBatch::NUM_COLUMNS == StarPieceView::SIZE);
+constexpr uint32_t STAR_PIECE_SECOND_RUN = StarPieceBatch::NUM_COLUMNS - 4;
+
+uint32_t StarPieceBatch::decode(const uint8_t *const *packets, uint32_t count, BatchIsa isa) {
+    if(count > capacity) count = capacity;
+    const Kernels kernels = kernelsFor(isa);
+
+    for(uint32_t i = 0; i < count; i++) playerIds[i] = packets[i][0] | packets[i][1] << 8;
+    kernels.decode(packets, count, StarPieceView::TIMESTAMP_OFFSET, column(TIMESTAMP), capacity);
+    kernels.decode(packets, count, StarPieceView::TIMESTAMP_OFFSET + 4 * STAR_PIECE_SECOND_RUN,
+        column(STAR_PIECE_SECOND_RUN), capacity);
+
+    size = count;
+    return count;
+}
+
+void StarPieceBatch::encode(uint8_t *const *out, BatchIsa isa) const {
+    const Kernels kernels = kernelsFor(isa);
+
+    for(uint32_t i = 0; i < size; i++) {
+        uint8_t *p = out[i];
+        p[0] = playerIds[i] & 0xFF;
+        p[1] = playerIds[i] >> 8;
+        p[2] = 0;
+        p[3] = 0;
+    }
+    kernels.encode(out, size, StarPieceView::TIMESTAMP_OFFSET, column(TIMESTAMP), capacity);
+    kernels.encode(out, size, StarPieceView::TIMESTAMP_OFFSET + 4 * STAR_PIECE_SECOND_RUN,
+        column(STAR_PIECE_SECOND_RUN), capacity);
+}
+
+}
@@ -0,0 +1,153 @@
+#include "capture.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+}
+
+namespace Capture {
+
+static inline NetReturn systemError() {
+    return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+}
+
+Writer::~Writer() {
+    close();
+}
+
+NetReturn Writer::open(const char *path) {
+    close();
+
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) return systemError();
+
+    if(ftruncate(fd, INITIAL_SIZE) < 0) {
+        NetReturn res = systemError();
+        close();
+        return res;
+    }
+
+    void *m = mmap(nullptr, INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(m == MAP_FAILED) {
+        NetReturn res = systemError();
+        close();
+        return res;
+    }
+    map = static_cast<uint8_t *>(m);
+    mapLen = INITIAL_SIZE;
+
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof header.magic);
+    header.version = VERSION;
+    header.headerSize = sizeof header;
+    memcpy(map, &header, sizeof header);
+    used = alignUp(sizeof header, RECORD_ALIGNMENT);
+
+    records = 0;
+    dropped = 0;
+    return {0, NetReturn::OK};
+}
+
+void Writer::close() {
+    if(map) munmap(map, mapLen);
+    if(fd >= 0) {
+        if(map && ftruncate(fd, used) < 0) perror("(Capture::Writer) Failed to trim capture");
+        ::close(fd);
+    }
+    map = nullptr;
+    mapLen = 0;
+    fd = -1;
+}
+
+bool Writer::grow(size_t needed) {
+    size_t newLen = mapLen;
+    while(newLen < needed) newLen *= 2;
+
+    if(ftruncate(fd, newLen) < 0) return false;
+    void *m = mremap(map, mapLen, newLen, MREMAP_MAYMOVE);
+    if(m == MAP_FAILED) return false;
+
+    map = static_cast<uint8_t *>(m);
+    mapLen = newLen;
+    return true;
+}
+
+bool Writer::append(uint64_t stampNs, const sockaddr_in &addr, uint16_t senderId,
+    const void *datagram, uint32_t size)
+{
+    if(map == nullptr) return false;
+
+    const uint32_t len = recordSize(size);
+    if(used + len > mapLen && !grow(used + len)) {
+        dropped++;
+        return false;
+    }
+
+    auto *r = reinterpret_cast<Record *>(map + used);
+    r->stampNs = stampNs;
+    r->addr = addr.sin_addr.s_addr;
+    r->port = addr.sin_port;
+    r->senderId = senderId;
+    r->size = size;
+    r->reserved = 0;
+    memcpy(r + 1, datagram, size);
+
+    used += len;
+    records++;
+    return true;
+}
+
+Reader::~Reader() {
+    if(map) munmap(const_cast<uint8_t *>(map), len);
+    if(fd >= 0) close(fd);
+}
+
+NetReturn Reader::open(const char *path) {
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return systemError();
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) return systemError();
+    len = static_cast<size_t>(st.st_size);
+    if(len < sizeof(FileHeader)) return {0, NetReturn::INVALID_DATA};
+
+    void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(m == MAP_FAILED) return systemError();
+    map = static_cast<const uint8_t *>(m);
+    madvise(m, len, MADV_SEQUENTIAL);
+
+    FileHeader header;
+    memcpy(&header, map, sizeof header);
+    if(memcmp(header.magic, MAGIC, sizeof header.magic) != 0 || header.version != VERSION
+        || header.headerSize < sizeof header || header.headerSize > len)
+    {
+        return {0, NetReturn::INVALID_DATA};
+    }
+
+    rewind();
+    return {0, NetReturn::OK};
+}
+
+const Record* Reader::next() {
+    if(map == nullptr || position + sizeof(Record) > len) return nullptr;
+
+    const auto *r = reinterpret_cast<const Record *>(map + position);
+    if(r->stampNs == 0 || position + recordSize(r->size) > len) return nullptr;
+
+    position += recordSize(r->size);
+    return r;
+}
+
+void Reader::rewind() {
+    const auto *header = reinterpret_cast<const FileHeader *>(map);
+    position = alignUp(static_cast<size_t>(header->headerSize), RECORD_ALIGNMENT);
+}
+
+}
@@ -0,0 +1,91 @@
+#include "clock.hpp"
+
+#ifdef CLOCK_X86
+#include <cpuid.h>
+#endif
+
+namespace Clock {
+
+namespace implementation {
+
+    Source source = Source::PRECISE;
+    uint64_t tscBase = 0;
+    uint64_t tscBaseNs = 0;
+    uint64_t tscMultiplier = 0;
+    uint64_t startNs = 0;
+
+}
+
+namespace {
+
+// How long the TSC is timed against CLOCK_MONOTONIC
+constexpr uint64_t CALIBRATION_NS = 20000000;
+
+#ifdef CLOCK_X86
+
+bool hasInvariantTsc() {
+    unsigned int a, b, c, d;
+    if(!__get_cpuid(0x80000007, &a, &b, &c, &d)) return false;
+    return d & (1u << 8);
+}
+
+// A TSC reading and the CLOCK_MONOTONIC time it was taken at, as the middle
+// of the narrowest of a few clock reads around it
+void sample(uint64_t *ticks, uint64_t *ns) {
+    uint64_t narrowest = UINT64_MAX;
+    for(uint32_t i = 0; i < 8; i++) {
+        const uint64_t before = preciseNs();
+        const uint64_t t = __rdtsc();
+        const uint64_t after = preciseNs();
+        if(after - before < narrowest) {
+            narrowest = after - before;
+            *ticks = t;
+            *ns = before + (after - before) / 2;
+        }
+    }
+}
+
+bool calibrateTsc() {
+    using namespace implementation;
+    if(tscMultiplier != 0) return true;
+    if(!hasInvariantTsc()) return false;
+
+    uint64_t firstTicks = 0, firstNs = 0, lastTicks = 0, lastNs = 0;
+    sample(&firstTicks, &firstNs);
+    const timespec wait = {0, static_cast<long>(CALIBRATION_NS)};
+    nanosleep(&wait, nullptr);
+    sample(&lastTicks, &lastNs);
+    if(lastTicks <= firstTicks) return false;
+
+    tscMultiplier = static_cast<uint64_t>((static_cast<unsigned __int128>(lastNs - firstNs) << 32)
+        / (lastTicks - firstTicks));
+    tscBase = lastTicks;
+    tscBaseNs = lastNs;
+    return true;
+}
+
+#endif
+
+}
+
+Source init(Source source) {
+#ifdef CLOCK_X86
+    if(source == Source::TSC && !calibrateTsc()) source = Source::PRECISE;
+#else
+    if(source == Source::TSC) source = Source::PRECISE;
+#endif
+    implementation::source = source;
+    implementation::startNs = nowNs();
+    return source;
+}
+
+const char* sourceName(Source source) {
+    switch(source) {
+        case Source::COARSE: return "coarse";
+        case Source::TSC: return "tsc";
+        case Source::PRECISE: break;
+    }
+    return "precise";
+}
+
+}
@@ -0,0 +1,88 @@
+#include "eventLoop.hpp"
+
+#include <cerrno>
+
+extern "C" {
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+}
+
+namespace Event {
+
+Loop::~Loop() {
+    if(timerFd >= 0) close(timerFd);
+    if(epollFd >= 0) close(epollFd);
+}
+
+static NetReturn addSource(int epollFd, int fd, Source source) {
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = source;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+    }
+    return {0, NetReturn::OK};
+}
+
+NetReturn Loop::init(int socket, int controlFd, uint32_t tickMs) {
+    int flags = fcntl(socket, F_GETFL);
+    if(flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0) return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+
+    NetReturn res = addSource(epollFd, socket, SOCKET);
+    if(res.errorCode != NetReturn::OK) return res;
+
+    if(controlFd >= 0) {
+        res = addSource(epollFd, controlFd, CONTROL);
+        // Regular files and /dev/null can't be waited on; run without control
+        if(res.errorCode != NetReturn::OK && res.bytes != EPERM) return res;
+    }
+
+    if(tickMs > 0) {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timerFd < 0) return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+        
+        itimerspec spec;
+        spec.it_interval.tv_sec = tickMs / 1000;
+        spec.it_interval.tv_nsec = (tickMs % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
+        if(timerfd_settime(timerFd, 0, &spec, nullptr) < 0) {
+            return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+        }
+        
+        res = addSource(epollFd, timerFd, TIMER);
+        if(res.errorCode != NetReturn::OK) return res;
+    }
+
+    return {0, NetReturn::OK};
+}
+
+NetReturn Loop::wait(uint32_t *ready) {
+    epoll_event events[3];
+    int numEvents;
+    do {
+        numEvents = epoll_wait(epollFd, events, sizeof events / sizeof *events, -1);
+    } while(numEvents < 0 && errno == EINTR);
+
+    if(numEvents < 0) return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+
+    *ready = 0;
+    for(int i = 0; i < numEvents; i++) *ready |= events[i].data.u32;
+    return {static_cast<uint32_t>(numEvents), NetReturn::OK};
+}
+
+uint64_t Loop::consumeTicks() {
+    uint64_t ticks = 0;
+    if(timerFd < 0 || ::read(timerFd, &ticks, sizeof ticks) != sizeof ticks) return 0;
+    return ticks;
+}
+
+}
@@ -1,14 +1,34 @@
 #include <cstdlib>
 #include <cstdio>
-#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #include "protocol.hpp"
 #include "packets.hpp"
 #include "packets/connect.hpp"
 #include "packets/ack.hpp"
+#include "packets/worldSnapshot.hpp"
+#include "packets/keepalive.hpp"
+#include "packets/packetView.hpp"
 #include "packetFactory.hpp"
 #include "transmission.hpp"
 #include "players.hpp"
+#include "stateHistory.hpp"
+#include "movement.hpp"
+#include "eventLoop.hpp"
+#include "snapshotHistory.hpp"
+#include "spatialGrid.hpp"
+#include "reliableChannel.hpp"
+#include "timerWheel.hpp"
+#include "batchCodec.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "capture.hpp"
+#include "clock.hpp"
 
 extern "C" {
 
@@ -17,6 +37,7 @@ extern "C" {
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/eventfd.h>
 
 }
 
@@ -36,43 +57,755 @@ static const char *bindInetAddrStr =
 	"0.0.0.0";
 #endif
 
-constexpr uint8_t maxNumPlayers =
+// Can be overridden at startup with -n
+static ConnectionId maxNumPlayers =
 #ifdef MAX_NUM_PLAYERS
 	MAX_NUM_PLAYERS;
 #else
 	8;
 #endif
 
-static uint8_t connectionBufferSize = 
+// 0 = same as maxNumPlayers
+static ConnectionId connectionBufferSize = 
 #ifdef CONNECTION_BUFFER_SIZE
 	CONNECTION_BUFFER_SIZE;
 #else
-	maxNumPlayers;
+	0;
 #endif
 
+constexpr uint32_t readBatchSize =
+#ifdef READ_BATCH_SIZE
+	READ_BATCH_SIZE;
+#else
+	Transmission::Reader::MAX_BATCH_SIZE;
+#endif
+
+// Period of the housekeeping timer, which also drives retransmits, or of the
+// server tick in snapshot mode
+static uint32_t tickIntervalMs =
+#ifdef TICK_INTERVAL_MS
+	TICK_INTERVAL_MS;
+#else
+	20;
+#endif
+
+// Snapshots per second, set with -t. 0 = relay every PlayerPosition as it
+// arrives instead of sending snapshots.
+static uint32_t snapshotRate = 0;
+
+// Relay radius in world units, set with -r. 0 = relay every position to
+// everyone.
+static float interestRadius = 0.0f;
+
+// Limits on how far players move, set with -s (world units per second) and
+// -j (world units per update). 0 = no limit. Positions with a NaN or
+// infinite coordinate are always dropped.
+static Movement::Limits movementLimits = {0.0f, 0.0f};
+
+// Players within `scale` times interestRadius of the sender get every
+// `interval`th position update. Past the last tier, players only get every
+// farUpdateInterval-th one.
+struct InterestTier {
+	float scale;
+	uint32_t interval;
+};
+constexpr InterestTier interestTiers[] = {{1.0f, 1}, {2.0f, 4}};
+
+constexpr uint32_t farUpdateInterval =
+#ifdef FAR_UPDATE_INTERVAL
+	FAR_UPDATE_INTERVAL;
+#else
+	16;
+#endif
+
+// Connections that have been silent for keepaliveIntervalMs are sent a
+// Keepalive, and are dropped after connectionTimeoutMs. Addresses that never
+// send a Connect are forgotten after candidateTimeoutMs.
+constexpr uint32_t keepaliveIntervalMs =
+#ifdef KEEPALIVE_INTERVAL_MS
+	KEEPALIVE_INTERVAL_MS;
+#else
+	2000;
+#endif
+
+constexpr uint32_t connectionTimeoutMs =
+#ifdef CONNECTION_TIMEOUT_MS
+	CONNECTION_TIMEOUT_MS;
+#else
+	10000;
+#endif
+
+constexpr uint32_t candidateTimeoutMs =
+#ifdef CANDIDATE_TIMEOUT_MS
+	CANDIDATE_TIMEOUT_MS;
+#else
+	2000;
+#endif
+
+// Length of a tick of the connection timers
+constexpr uint32_t timerResolutionMs = 10;
+
+// File each room writes a metrics snapshot to, set with -m. Rooms other
+// than the only one append ".<room>" to it. nullptr = don't export.
+static const char *metricsPath = nullptr;
+
+constexpr uint32_t metricsIntervalMs =
+#ifdef METRICS_INTERVAL_MS
+	METRICS_INTERVAL_MS;
+#else
+	1000;
+#endif
+
+// File each room appends every received datagram to, set with -c. Named
+// like the metrics files. nullptr = don't capture.
+static const char *capturePath = nullptr;
+
+// Rooms served, each by its own thread, set with -w
+static uint32_t numRooms = 1;
+
+// Receive, logic and send on threads of their own, set with -p
+static bool pipelined = false;
+
+// Receive and send through io_uring where the kernel supports it, set with -u
+static bool useUring = false;
+
+// Buffers the kernel receives into with io_uring. A power of two.
+constexpr uint32_t uringBuffers =
+#ifdef URING_BUFFERS
+	URING_BUFFERS;
+#else
+	512;
+#endif
+
+// 0 = sized from maxNumPlayers
 static size_t packetBufferSize =
 #ifdef TRANSMISSION_BUFF_SIZE
 	TRANSMISSION_BUFF_SIZE;
 #else
-	alignUp((Packets::MAX_PACKET_SIZE + 20) * maxNumPlayers, Packets::PACKET_ALIGNMENT);
+	0;
 #endif
 
-Player::Player players[maxNumPlayers];
+// Where the server clock is read from, set with -k
+static Clock::Source clockSource = Clock::Source::PRECISE;
 
-int main() {
+// The connection timers count ticks of nowNs rather than of nowMs, which
+// would wrap under them after 49 days
+constexpr uint64_t timerResolutionNs = timerResolutionMs * 1000000ull;
 
-	int err;
+// Timer tick `ns` falls in
+static uint64_t toTimerTick(uint64_t ns) {
+	return ns / timerResolutionNs;
+}
 
-	int fd = socket(AF_INET, SOCK_DGRAM, 0);
-	
-	if(fd < 0) return -1;
+// First timer tick at least `delayMs` from now
+static uint64_t timerTickIn(uint32_t delayMs) {
+	return (Clock::nowNs() + delayMs * 1000000ull + timerResolutionNs - 1) / timerResolutionNs;
+}
 
-	in_addr s_addr;
-   	err = inet_aton(bindInetAddrStr, &s_addr);
+typedef Protocol::PacketProcessor<Packets::PacketFactory> PacketProcessor;
+typedef Pipeline::PacketProcessor<Packets::PacketFactory> PipelineProcessor;
 
-	if(err < 0) {
-		perror("(main) Invalid host IP address");
-		close(fd);
+// What the connection timers need to know about a connection
+struct Session {
+	uint32_t lastHeardMs;
+	// Answers Keepalive
+	bool probe;
+	// Sends the high byte of its id, see fixIdHigh
+	bool wideIds;
+};
+
+// What a room's packet handling works on. Optional parts are null when their
+// feature is turned off.
+struct Room {
+	Transmission::ConnectionHolder &connectionHolder;
+	Transmission::Writer &writer;
+	Metrics::Recorder &metrics;
+	Player::Store *players;
+	// Recent states of every player, for checks against the past
+	Player::StateHistory *states;
+	Movement::Checker *movement;
+	Reliable::Channel *reliable;
+	Snapshot::History *history;
+	Spatial::Grid *grid;
+	Transmission::RecipientLists *recipients;
+	// Told about every change to connectionHolder in pipeline mode
+	Pipeline::PacketPipe *pipe;
+
+	// One timer per connection: the candidate deadline, or the next time to
+	// check whether it went quiet
+	Event::TimerWheel *timers;
+	Session *sessions;
+
+	// Positions of the batch being processed, decoded all at once by
+	// applyPositions, and what the movement checks made of them. Only used
+	// in snapshot mode.
+	Packets::PlayerPositionBatch *positionBatch;
+	const uint8_t **positionPackets;
+	uint32_t numPositionPackets;
+	Movement::Verdict *positionVerdicts;
+
+	// Server time the batch being processed was read at. Everything in it
+	// is handled as of then, so the clock is read once per batch.
+	uint32_t batchMs;
+
+	// Positions skipped because a newer one from the same player was
+	// processed before they were sent, and positions that arrived after a
+	// newer one
+	uint64_t superseded;
+	uint64_t outOfOrder;
+	uint64_t timedOut;
+	uint64_t expiredCandidates;
+};
+
+// Stores the positions queued by processPosition in their players
+static void applyPositions(Room &room) {
+	Packets::PlayerPositionBatch &batch = *room.positionBatch;
+	batch.decode(room.positionPackets, room.numPositionPackets);
+	room.numPositionPackets = 0;
+
+	Movement::Verdict *verdicts = room.positionVerdicts;
+	const uint32_t accepted = room.movement->check(batch, verdicts);
+	for(uint32_t i = accepted; i < batch.getSize(); i++) room.metrics.drop(NetReturn::INVALID_DATA);
+
+	Player::Store &players = *room.players;
+	for(uint32_t i = 0; i < batch.getSize(); i++) {
+		if(verdicts[i] != Movement::ACCEPTED) continue;
+		const ConnectionId id = batch.playerId(i);
+		// processPosition only saw what was applied before the batch
+		if(players.isStale(id, batch.timestamp(i))) {
+			room.outOfOrder++;
+			continue;
+		}
+		players.update(id, batch.timestamp(i));
+		players.setMotion(id, batch.position(i), batch.velocity(i), batch.direction(i));
+		room.states->record(id, batch.timestamp(i), 
+			batch.position(i), batch.velocity(i), batch.direction(i));
+		players.setAnimation(id, batch.timestamp(i), batch.getStateFlags(i), 
+			batch.currentAnimation(i), batch.defaultAnimation(i), batch.animationSpeed(i));
+	}
+}
+
+// Forgets everything about `id` and frees it for the next address
+static void disconnect(Room &room, ConnectionId id) {
+	// Queued positions may be from this holder of the id
+	if(room.numPositionPackets > 0) applyPositions(room);
+	room.connectionHolder.purgeConnection(id);
+	if(room.pipe) room.pipe->disconnect(id);
+	room.players->deactivate(id);
+	room.states->clear(id);
+	room.movement->reset(id);
+	if(room.grid) room.grid->remove(id);
+	room.reliable->connect(id, false);
+	if(room.history) room.history->connect(id, false, false);
+	room.timers->cancel(id);
+}
+
+// Runs when the timer of `id` is due. Connections are only rescheduled here,
+// not on every packet, so hearing from a peer just updates lastHeardMs.
+template<typename P>
+static void expireConnection(P &pp, Room &room, ConnectionId id, uint32_t now) {
+	Transmission::ConnectionHolder &connectionHolder = room.connectionHolder;
+
+	if(connectionHolder.isCandidate(id)) {
+		connectionHolder.purgeCandidate(id);
+		room.expiredCandidates++;
+		return;
+	}
+	if(!connectionHolder.getConnection(id)->isActive) return;
+
+	Session &session = room.sessions[id];
+	const uint32_t idleMs = now - session.lastHeardMs;
+	if(idleMs >= connectionTimeoutMs) {
+		fprintf(stderr, "Connection %u timed out\n", id);
+		disconnect(room, id);
+		room.timedOut++;
+		return;
+	}
+
+	uint32_t nextMs = session.lastHeardMs + keepaliveIntervalMs;
+	if(idleMs >= keepaliveIntervalMs) {
+		if(session.probe) pp.addPacket(Packets::Keepalive(now), Destination::ONLY | id);
+		nextMs = now + keepaliveIntervalMs;
+		if(nextMs - session.lastHeardMs > connectionTimeoutMs) {
+			nextMs = session.lastHeardMs + connectionTimeoutMs;
+		}
+	}
+	room.timers->schedule(id, timerTickIn(nextMs - now));
+}
+
+// Narrows the relay of the position being processed down to the players whose
+// distance tier is due for this update. Returns false if nobody is.
+template<typename P>
+static bool routePosition(P &pp, Room &room, ConnectionId id) {
+	const uint32_t update = room.players->getNumUpdates(room.players->slotOf(id));
+	if(update % farUpdateInterval == 0) return true;
+
+	float radius = 0.0f;
+	for(const InterestTier &tier : interestTiers) {
+		if(update % tier.interval == 0) radius = interestRadius * tier.scale;
+	}
+
+	const ConnectionId maxCount = room.connectionHolder.getNumActive();
+	ConnectionId *recipients = room.recipients->open(maxCount);
+	// Out of space for this batch, so everyone gets it
+	if(recipients == nullptr) return true;
+
+	uint32_t count = room.grid->query(id, radius, recipients, maxCount);
+	if(count == 0) {
+		pp.dropPacket();
+		return false;
+	}
+	pp.setDestination(Destination::LIST | room.recipients->close(count));
+	return true;
+}
+
+// Sends a star piece reliably to everyone who supports it, and as is to the
+// rest. `isBare` is set if `piece` is the packet being processed, which can
+// then be relayed without decoding it.
+template<typename P>
+static void relayStarPiece(P &pp, Room &room, const Packets::StarPieceView &piece,
+	ConnectionId sender, bool ordered, bool isBare)
+{
+	const Transmission::ConnectionHolder &connectionHolder = room.connectionHolder;
+
+	if(piece.playerId() != sender) {
+		fprintf(stderr, "Client %d is impersonating %d\n", sender, piece.playerId());
+		room.metrics.drop(NetReturn::INVALID_DATA);
+		if(isBare) pp.dropPacket();
+		return;
+	}
+
+	// Only decoded once somebody needs it encoded again
+	Packets::StarPiece decoded;
+	bool isDecoded = false;
+	uint32_t now = 0;
+
+	for(auto id = connectionHolder.activeBegin(); id < connectionHolder.activeEnd(); id++) {
+		if(*id == sender || !room.reliable->isSupported(*id)) continue;
+		if(!isDecoded) {
+			piece.decode(&decoded);
+			isDecoded = true;
+			now = room.batchMs;
+		}
+
+		NetReturn res = room.reliable->send(room.writer, *id, decoded, ordered, now);
+		if(res.errorCode != NetReturn::OK) {
+			// Better late than never
+			fprintf(stderr, "Warning: Reliable channel to %u is full\n", *id);
+			pp.addPacket(decoded, Destination::ONLY | *id);
+		}
+	}
+
+	// Nobody needs it reliably, so everyone gets the original
+	if(!isDecoded && isBare) return;
+
+	if(!isDecoded) piece.decode(&decoded);
+	if(isBare) pp.dropPacket();
+	for(auto id = connectionHolder.activeBegin(); id < connectionHolder.activeEnd(); id++) {
+		if(*id == sender || room.reliable->isSupported(*id)) continue;
+		pp.addPacket(decoded, Destination::ONLY | *id);
+	}
+}
+
+// Clients from before Protocol::WIDE_ID_MINOR may leave anything in the byte
+// that now holds the high byte of their id. It's overwritten with the high
+// byte of `sender` in the received bytes, which are ours to change, so the
+// checks, the decoders and everyone the bytes are relayed to read the id the
+// client meant.
+static void fixIdHigh(const Room &room, ConnectionId sender, Packets::Tag tag,
+	const void *payload, uint32_t len)
+{
+	if(room.sessions[sender].wideIds) return;
+
+	uint32_t offset;
+	switch(tag) {
+		case Packets::Tag::PLAYER_POSITION:
+			if(len < Packets::PlayerPositionView::SIZE) return;
+			offset = Packets::PlayerPositionView::ID_HIGH_OFFSET;
+			break;
+		case Packets::Tag::STAR_PIECE:
+			if(len < Packets::StarPieceView::SIZE) return;
+			offset = Packets::StarPieceView::ID_HIGH_OFFSET;
+			break;
+		default:
+			return;
+	}
+	const_cast<uint8_t *>(static_cast<const uint8_t *>(payload))[offset] = sender >> 8;
+}
+
+template<typename P>
+static void processReliable(P &pp, Room &room, ConnectionId sender,
+	Packets::Tag tag, const void *payload, uint32_t size, bool ordered)
+{
+	fixIdHigh(room, sender, tag, payload, size);
+	switch(tag) {
+		case Packets::Tag::STAR_PIECE:
+		{
+			Packets::StarPieceView piece;
+			NetReturn res = Packets::StarPieceView::bind(&piece, payload, size);
+			if(res.errorCode != NetReturn::OK) {
+				fprintf(stderr, "Warning: invalid reliable packet received (%u)\n", res.errorCode);
+				room.metrics.drop(res.errorCode);
+				break;
+			}
+			relayStarPiece(pp, room, piece, sender, ordered, false);
+			break;
+		}
+		default:
+			fprintf(stderr, "Warning: packet %u can't be sent reliably\n", 
+				static_cast<uint32_t>(tag));
+			room.metrics.drop(NetReturn::INVALID_DATA);
+			break;
+	}
+}
+
+template<typename P>
+static void processPosition(P &pp, Room &room, ConnectionId sender,
+	const Packets::PlayerPositionView &pos)
+{
+	if(pos.playerId() != sender) {
+		pp.dropPacket();
+		fprintf(stderr, "Client %d is impersonating %d\n", sender, pos.playerId());
+		room.metrics.drop(NetReturn::INVALID_DATA);
+		return;
+	}
+
+	Player::Store &players = *room.players;
+	const ServerTimestamp timestamp = pos.timestamp();
+	if(players.isStale(sender, timestamp)) {
+		room.outOfOrder++;
+		pp.dropPacket();
+		return;
+	}
+
+	// The next snapshot carries it instead, so it needs every field. Those
+	// are decoded and checked for the whole batch at once, and the packet
+	// stays in the ring until then. Only accepted ones update the player.
+	if(snapshotRate > 0) {
+		if(room.numPositionPackets == room.positionBatch->getCapacity()) applyPositions(room);
+		room.positionPackets[room.numPositionPackets++] = pos.getData();
+		pp.dropPacket();
+		return;
+	}
+
+	// Relayed as it is, so only what routing and the checks need is read
+	const Vec position = pos.position();
+	const Vec velocity = pos.velocity();
+	const Vec direction = pos.direction();
+	if(room.movement->check(sender, timestamp, position, velocity, direction) != Movement::ACCEPTED) {
+		room.metrics.drop(NetReturn::INVALID_DATA);
+		pp.dropPacket();
+		return;
+	}
+
+	players.update(sender, timestamp);
+	players.setPosition(sender, position);
+	room.states->record(sender, timestamp, position, velocity, direction);
+
+	bool relayed = true;
+	if(room.grid) {
+		room.grid->update(sender, position);
+		relayed = routePosition(pp, room, sender);
+	}
+	// Only the newest unsent position of a player is relayed
+	if(relayed && pp.supersede(sender)) room.superseded++;
+}
+
+// Handles the packets that are mostly relayed untouched straight from the
+// ring, without going through the PacketFactory. Returns false for any other
+// packet.
+template<typename P>
+static bool processInPlace(P &pp, Room &room, ConnectionId sender) {
+	Packets::Tag tag;
+	const uint8_t *payload;
+	uint32_t len;
+	if(pp.peekPacket(&tag, &payload, &len).errorCode != NetReturn::OK) return false;
+	fixIdHigh(room, sender, tag, payload, len);
+
+	NetReturn res;
+	switch(tag) {
+		case Packets::Tag::PLAYER_POSITION:
+		{
+			Packets::PlayerPositionView pos;
+			res = Packets::PlayerPositionView::bind(&pos, payload, len);
+			if(res.errorCode == NetReturn::OK) processPosition(pp, room, sender, pos);
+			break;
+		}
+		case Packets::Tag::STAR_PIECE:
+		{
+			// TODO: Maybe do some more validity checking and store the packet?
+			Packets::StarPieceView piece;
+			res = Packets::StarPieceView::bind(&piece, payload, len);
+			if(res.errorCode == NetReturn::OK) relayStarPiece(pp, room, piece, sender, false, true);
+			break;
+		}
+		default:
+			return false;
+	}
+
+	if(res.errorCode != NetReturn::OK) {
+		fprintf(stderr, "Warning: invalid packet received (%u)\n", res.errorCode);
+		room.metrics.drop(res.errorCode);
+		pp.dropPacket();
+	}
+	pp.finishProcessing();
+	return true;
+}
+
+template<typename P>
+static void processPackets(P &pp, Room &room) {
+	Transmission::ConnectionHolder &connectionHolder = room.connectionHolder;
+	Player::Store *players = room.players;
+	Snapshot::History *history = room.history;
+	const uint32_t now = room.batchMs;
+
+    while(pp.nextPacket()) {
+
+        NetReturn senderId = pp.getSenderId();
+        if(connectionHolder.isCandidate(senderId.bytes)) {
+            pp.getPacketFactory().setCandidate();
+            // However much else it sends, a candidate only has until its
+            // deadline to connect
+            if(!room.timers->isScheduled(senderId.bytes)) {
+                room.timers->schedule(senderId.bytes, timerTickIn(candidateTimeoutMs));
+            }
+        }
+        else if(senderId.errorCode == NetReturn::OK) {
+            room.sessions[senderId.bytes].lastHeardMs = now;
+            if(processInPlace(pp, room, senderId.bytes)) continue;
+        }
+
+        Packets::PacketFactory::PacketUnion pu;
+        
+        NetReturn res = pp.processPacket(&pu);
+        if(res.errorCode != NetReturn::OK) {
+            fprintf(stderr, "Warning: invalid packet received (%u)\n", res.errorCode);
+            room.metrics.drop(res.errorCode);
+            pp.dropPacket();
+            pp.finishProcessing();
+            //continue;
+        }
+        else {
+            switch(pu.tag) {
+            case Packets::Tag::CONNECT: 
+            {
+                const uint32_t minor = pu.as<Packets::Connect>().minorVersion;
+                NetReturn id = pp.getSenderId();
+                if(id.errorCode != NetReturn::OK) netHandleInvalidState();
+                if(!connectionHolder.addConnection(id.bytes)) {
+                    fprintf(stderr, "Failed to add connection %d", id.bytes);
+                }
+                const Transmission::Connection *c 
+                    = connectionHolder.getConnection(id.bytes);
+                if(room.pipe) room.pipe->connect(id.bytes, &c->addr);
+                const auto *ipAddr = reinterpret_cast<const uint8_t *>
+                    (&c->addr.sin_addr.s_addr);
+                uint16_t port = ntohs(c->addr.sin_port);
+                fprintf(stderr, "Connected to %d.%d.%d.%d on port %d (%d)\n",
+                    ipAddr[0],
+                    ipAddr[1],
+                    ipAddr[2],
+                    ipAddr[3],
+                    port,
+                    id.bytes
+                );
+                // Nothing of a previous holder of the id carries over
+                if(room.numPositionPackets > 0) applyPositions(room);
+                players->deactivate(id.bytes);
+                room.states->clear(id.bytes);
+                room.movement->reset(id.bytes);
+                if(room.grid) room.grid->remove(id.bytes);
+                room.reliable->connect(id.bytes, 
+                    minor >= Protocol::RELIABLE_MINOR);
+                if(history) {
+                    history->connect(id.bytes, 
+                        minor >= Protocol::COMPACT_SNAPSHOT_MINOR,
+                        minor >= Protocol::SNAPSHOT_CHUNK_MINOR);
+                }
+                room.sessions[id.bytes] = {now, 
+                    minor >= Protocol::KEEPALIVE_MINOR,
+                    minor >= Protocol::WIDE_ID_MINOR};
+                room.timers->schedule(id.bytes, timerTickIn(keepaliveIntervalMs));
+                pp.addPacket(Packets::ServerInitialResponse(
+                    Protocol::MAJOR, Protocol::MINOR, id.bytes
+                ), Destination::ONLY | id.bytes);
+                pp.dropPacket();
+                pp.finishProcessing();
+                break;
+            }
+
+            case Packets::Tag::ACK:
+            {
+                const Packets::Ack &ack = pu.as<Packets::Ack>();
+                if(ack.channel == Packets::Ack::RELIABLE) {
+                    room.reliable->acknowledge(senderId.bytes, ack.seqNum, ack.ackBits, now);
+                }
+                else if(history) history->acknowledge(senderId.bytes, ack.seqNum, ack.ackBits);
+                pp.dropPacket();
+                pp.finishProcessing();
+                break;
+            }
+            // Candidates can't send them, and processInPlace handles
+            // them for everyone else
+            case Packets::Tag::PLAYER_POSITION:
+            case Packets::Tag::STAR_PIECE:
+            // Hearing from the client was all it was for
+            case Packets::Tag::KEEPALIVE:
+            case Packets::Tag::TIME_RESPONSE:
+            case Packets::Tag::SERVER_INITIAL_RESPONSE:
+            case Packets::Tag::WORLD_SNAPSHOT:
+            case Packets::Tag::COMPACT_SNAPSHOT:
+            {
+                pp.dropPacket();
+                pp.finishProcessing();
+                break;
+            }
+            case Packets::Tag::RELIABLE:
+            {
+                const Packets::Reliable &rel = pu.as<Packets::Reliable>();
+                const bool ordered = rel.flags & Packets::Reliable::O_ORDERED;
+
+                if(room.reliable->receive(senderId.bytes, rel) == Reliable::Channel::DELIVER) {
+                    processReliable(pp, room, senderId.bytes, rel.innerTag, 
+                        rel.payload, rel.payloadSize, ordered);
+                }
+                // Ordered packets that were waiting on this one
+                Reliable::Channel::Received held;
+                while(room.reliable->nextHeld(senderId.bytes, &held)) {
+                    processReliable(pp, room, senderId.bytes, held.tag, held.payload, held.size, true);
+                }
+
+                pp.dropPacket();
+                pp.finishProcessing();
+                break;
+            }
+            case Packets::Tag::TIME_QUERY:
+            {
+                NetReturn id = pp.getSenderId();
+                if(id.errorCode != NetReturn::OK) netHandleInvalidState();
+                const Packets::TimeQuery &tqp = pu.as<Packets::TimeQuery>();
+                pp.addPacket(Packets::TimeResponse(now, tqp.check), 
+                    Destination::ONLY | id.bytes);
+                pp.dropPacket();
+                pp.finishProcessing();
+                break;
+            }
+            case Packets::Tag::MAX_TAG: // invalid state
+                break;
+        }
+
+        }
+        pp.getPacketFactory().resetCandidate();
+    }
+
+    if(room.numPositionPackets > 0) applyPositions(room);
+    room.reliable->queueAcks(pp);
+}
+
+template<typename P, typename T>
+static bool queueSnapshot(P &pp, Room &room,
+	const Packets::Packet<T> &snapshot, uint32_t destination)
+{
+	NetReturn res = pp.addPacket(snapshot, destination);
+	if(res.errorCode == NetReturn::NOT_ENOUGH_SPACE) {
+		pp.sendPackets(room.writer);
+		res = pp.addPacket(snapshot, destination);
+	}
+	if(res.errorCode != NetReturn::OK) {
+		fprintf(stderr, "Warning: Failed to queue snapshot (%u)\n", res.errorCode);
+		room.metrics.drop(res.errorCode);
+		return false;
+	}
+	return true;
+}
+
+// Clients are grouped by the snapshot they receive: WorldSnapshot, a full
+// CompactSnapshot, or a CompactSnapshot against one of the baselines. Each
+// datagram is encoded once per group and fanned out by the writer.
+template<typename P>
+static void sendSnapshot(P &pp, Transmission::Writer &writer, Room &room,
+	Packets::PlayerPosition *entries, uint32_t tick)
+{
+	Transmission::ConnectionHolder &connectionHolder = room.connectionHolder;
+	const Player::Store &players = *room.players;
+	Snapshot::History &history = *room.history;
+
+	// Only active players have slots, so there's nobody to skip
+	const uint16_t numEntries = players.getNumActive();
+	for(ConnectionId slot = 0; slot < numEntries; slot++) {
+		Packets::PlayerPosition &entry = entries[slot];
+		entry.playerId = players.idAt(slot);
+		entry.timestamp = players.getTimestamp(slot);
+		entry.stateFlags = players.getStateFlags(slot);
+		entry.position = players.getPosition(slot);
+		entry.velocity = players.getVelocity(slot);
+		entry.direction = players.getDirection(slot);
+		entry.currentAnimation = players.getCurrentAnimation(slot);
+		entry.defaultAnimation = players.getDefaultAnimation(slot);
+		entry.animationSpeed = players.getAnimationSpeed(slot);
+	}
+
+	history.record(tick, entries, numEntries);
+
+	// Nobody to tell about anyone else
+	if(numEntries < 2) return;
+
+	// Baseline tick of each group in use
+	uint32_t groupBaselines[Snapshot::History::MAX_GROUP];
+	bool groupUsed[Snapshot::History::MAX_GROUP] = {};
+
+	for(auto id = connectionHolder.activeBegin(); id < connectionHolder.activeEnd(); id++) {
+		uint16_t group = Snapshot::History::LEGACY_GROUP;
+		if(history.isCompact(*id)) {
+			uint32_t baselineTick = history.baselineFor(*id);
+			group = baselineTick ? Snapshot::History::baselineGroup(baselineTick) 
+				: Snapshot::History::FULL_GROUP;
+			groupBaselines[group] = baselineTick;
+		}
+		groupUsed[group] = true;
+		if(room.pipe && connectionHolder.getConnection(*id)->group != group) {
+			room.pipe->setGroup(*id, group);
+		}
+		connectionHolder.setGroup(*id, group);
+	}
+
+	if(groupUsed[Snapshot::History::LEGACY_GROUP]) {
+		for(uint16_t first = 0; first < numEntries; first += Packets::WorldSnapshot::MAX_PLAYERS) {
+			uint16_t count = numEntries - first;
+			if(count > Packets::WorldSnapshot::MAX_PLAYERS) count = Packets::WorldSnapshot::MAX_PLAYERS;
+
+			if(!queueSnapshot(pp, room, Packets::WorldSnapshot(tick, entries + first, count),
+				Destination::GROUP | Snapshot::History::LEGACY_GROUP)) break;
+		}
+	}
+
+	const Packets::CompactPosition *compact = history.getCurrent();
+	for(uint16_t group = Snapshot::History::FULL_GROUP; group < Snapshot::History::MAX_GROUP; group++) {
+		if(!groupUsed[group]) continue;
+
+		const uint32_t baselineTick = groupBaselines[group];
+		const Packets::CompactPosition *const *baseline 
+			= baselineTick ? history.gatherBaseline(baselineTick) : nullptr;
+
+		for(uint16_t first = 0; first < numEntries; first += Packets::CompactSnapshot::MAX_PLAYERS) {
+			uint16_t count = numEntries - first;
+			if(count > Packets::CompactSnapshot::MAX_PLAYERS) count = Packets::CompactSnapshot::MAX_PLAYERS;
+
+			Packets::CompactSnapshot snapshot(tick, baselineTick, history.getOrigin(), 
+				compact + first, baseline ? baseline + first : nullptr, count,
+				static_cast<uint8_t>(first / Packets::CompactSnapshot::MAX_PLAYERS));
+			if(!queueSnapshot(pp, room, snapshot, Destination::GROUP | group)) break;
+		}
+	}
+
+	pp.sendPackets(writer);
+}
+
+static int openSocket(in_addr s_addr, uint16_t port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	
+	if(fd < 0) {
+		perror("(openSocket) Failed to create socket");
 		return -1;
 	}
 
@@ -82,183 +815,560 @@ int main() {
 	addr.sin_port = htons(port);
 	addr.sin_addr = s_addr;
 
-	err = bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr);
+	int err = bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr);
 
 	if(err < 0) {
-		perror("(main) Failed to bind to IP address");
+		perror("(openSocket) Failed to bind to IP address");
 		close(fd);
 		return -1;
 	}
 
-	void *packetBuffer = aligned_alloc(Packets::PACKET_ALIGNMENT, packetBufferSize);
+	// Only for metrics, so the server runs without
+	NetReturn res = Transmission::enableReceiveStamps(fd);
+	if(res.errorCode != NetReturn::OK) {
+		fprintf(stderr, "Warning: No kernel receive timestamps: %s\n", strerror(res.bytes));
+	}
 
-	if(packetBuffer == nullptr) {
-		perror("(main) Not enough memory available on this system");
-		close(fd);
+	return fd;
+}
+
+// Waits on `readFd` for packets until `controlFd` becomes readable, and
+// runs the room's timers in between
+template<typename P>
+static int runRoom(uint32_t room, P &pp, int readFd, int controlFd, Room &roomState,
+	Transmission::Reader &reader, Packets::PlayerPosition *snapshotBuffer,
+	const char *roomMetricsPath)
+{
+	Transmission::Writer &writer = roomState.writer;
+	Metrics::Recorder &metrics = roomState.metrics;
+
+	Event::Loop loop;
+	NetReturn res = loop.init(readFd, controlFd, tickIntervalMs);
+
+	if(res.errorCode != NetReturn::OK) {
+		fprintf(stderr, "(run) Failed to set up event loop: %s\n", strerror(res.bytes));
 		return -1;
 	}
 
-	auto *connectionBuffer = new(std::nothrow) 
-        Transmission::Connection[connectionBufferSize];
+	uint32_t nextExportMs = Clock::nowMs() + metricsIntervalMs;
+
+	int ret = 0;
+	bool quit = false;
+
+    bool full = false;
+
+	uint32_t tick = 0;
+	const uint32_t ticksPerSecond = tickIntervalMs < 1000 ? 1000 / tickIntervalMs : 1;
+	
+	while(!quit) {
+
+		uint32_t ready;
+		res = loop.wait(&ready);
+
+		if(res.errorCode != NetReturn::OK) {
+			fprintf(stderr, "(run) Failed to wait for events: %s\n", strerror(res.bytes));
+			ret = -1;
+			break;
+		}
+
+		if(ready & Event::CONTROL) quit = true;
+
+		if(ready & Event::TIMER) {
+			uint64_t ticks = loop.consumeTicks();
+			if(ticks > 0) {
+				// Report the next rejected connection attempt again, once a second
+				if((tick + ticks) / ticksPerSecond != tick / ticksPerSecond) full = false;
+				tick += ticks;
+
+				const uint64_t nowNs = Clock::nowNs();
+				const uint32_t now = Clock::toMs(nowNs);
+				roomState.timers->advance(toTimerTick(nowNs), [&](uint32_t id) {
+					expireConnection(pp, roomState, id, now);
+				});
+				pp.sendPackets(writer);
+
+				roomState.reliable->poll(writer, now);
+				writer.flush();
+
+				if(snapshotRate > 0) {
+					sendSnapshot(pp, writer, roomState, snapshotBuffer, tick);
+				}
+
+				if(metricsPath && static_cast<int32_t>(now - nextExportMs) >= 0) {
+					if(!Metrics::exportSnapshot(metrics, roomMetricsPath, room, now)) {
+						fprintf(stderr, "Warning: Failed to write metrics to %s\n", roomMetricsPath);
+					}
+					nextExportMs = now + metricsIntervalMs;
+				}
+			}
+		}
+
+		if(!(ready & Event::SOCKET)) continue;
+
+		// Drain the socket before going back to sleep
+		uint32_t received;
+		do {
+			Protocol::PacketHolder::ReadBatchInfo info = {0, 0};
+			uint64_t readNs;
+			if constexpr(std::is_same_v<P, PacketProcessor>) {
+				res = pp.readPackets(reader, readBatchSize, &info);
+				readNs = Metrics::nowNs();
+			} else {
+				// Timed from when the receive thread got the datagrams
+				res = pp.readPackets(readBatchSize, &info);
+				readNs = pp.getBatchStamp();
+			}
+			roomState.batchMs = Clock::nowMs();
+			received = 0;
+			switch(res.errorCode) {
+				case NetReturn::OK:
+					received = res.bytes + info.filtered + info.invalid;
+					break;
+				case NetReturn::NOT_ENOUGH_SPACE:
+					fprintf(stderr, "Warning: Not enough memory\n");
+					break;
+				default:
+					fprintf(stderr, "Warning: failed to read from socket (%u)\n", res.bytes);
+					break;
+			}
+
+            if(info.filtered > 0 && !full) {
+                full = true;
+                fprintf(stderr, "Warning: Attempt made to connect to full server\n");
+            }
+            if(info.invalid > 0) {
+                fprintf(stderr, "Warning: invalid packet received\n");
+            }
+
+            metrics.ring(pp.getUsed());
+
+            processPackets(pp, roomState);
+            const uint64_t processedNs = Metrics::nowNs();
+
+			pp.sendPackets(writer);
+			if(roomState.recipients) roomState.recipients->clear();
+
+			// Stamped once per batch, which every packet in it shares. The
+			// send thread records processToSend in pipeline mode.
+			if(res.errorCode == NetReturn::OK && res.bytes > 0) {
+				metrics.recvToProcess.record(processedNs - readNs, res.bytes);
+				if constexpr(std::is_same_v<P, PacketProcessor>) {
+					metrics.processToSend.record(Metrics::nowNs() - processedNs, res.bytes);
+				}
+			}
+		} while(received > 0);
 
-	if(connectionBuffer == nullptr) {
-		fprintf(stderr, "(main) Not enough memory available on this system\n");
-		close(fd);
-		return -1;
 	}
 
+	return ret;
+}
+
+// The file of `room` for an option taking a path: the path itself when
+// there's only one room, otherwise the path followed by ".<room>"
+static void roomPath(char *out, size_t len, const char *path, uint32_t room) {
+	if(numRooms == 1) snprintf(out, len, "%s", path);
+	else snprintf(out, len, "%s.%u", path, room);
+}
+
+static int run(uint32_t room, int fd, int controlFd, void *packetBuffer, 
+	Transmission::Connection *connectionBuffer, Player::Store *players,
+	Packets::PlayerPosition *snapshotBuffer)
+{
 	Packets::PacketFactory factory;
-	Protocol::PacketProcessor pp(packetBuffer, packetBufferSize, factory);
 
 	Transmission::ConnectionHolder connectionHolder(connectionBuffer, connectionBufferSize);
 
     Transmission::Reader reader(fd, &connectionHolder);
     Transmission::Writer writer(fd, &connectionHolder);
 
-    const auto initialTime = std::chrono::steady_clock::now();
+	if(useUring) {
+		NetReturn res = reader.enableUring(uringBuffers);
+		if(res.errorCode == NetReturn::OK) res = writer.enableUring();
+		if(res.errorCode != NetReturn::OK) {
+			fprintf(stderr, "Warning: io_uring is unavailable (%s), using the socket instead\n", 
+				strerror(res.bytes));
+		}
+	}
 
-	printf("Hit enter to close the server\n");
+	// Sized so every connection can have a few reliable packets in flight
+	Reliable::Channel reliable(connectionBufferSize, 
+		8 * static_cast<uint32_t>(connectionBufferSize) + Reliable::Channel::WINDOW);
 
-	bool quit = false;
-	
-	pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	Event::TimerWheel timers(connectionBufferSize, toTimerTick(Clock::nowNs()));
+	Session *sessions = new Session[connectionBufferSize]();
 
-    bool full = false;
-	
-	while(!quit) {
+	Metrics::Recorder metrics;
+
+	char roomMetricsPath[PATH_MAX];
+	if(metricsPath) roomPath(roomMetricsPath, sizeof roomMetricsPath, metricsPath, room);
+
+	Capture::Writer capture;
+	if(capturePath) {
+		char roomCapturePath[PATH_MAX];
+		roomPath(roomCapturePath, sizeof roomCapturePath, capturePath, room);
+		NetReturn res = capture.open(roomCapturePath);
+		if(res.errorCode != NetReturn::OK) {
+			fprintf(stderr, "(run) Failed to open capture %s: %s\n", roomCapturePath, strerror(res.bytes));
+			delete[] sessions;
+			return -1;
+		}
+	}
+
+	Player::StateHistory states(connectionBufferSize);
+	Movement::Checker movement(connectionBufferSize, movementLimits);
+	Room roomState = {connectionHolder, writer, metrics, players, &states, &movement, &reliable, nullptr, 
+		nullptr, nullptr, nullptr, &timers, sessions, nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0};
+
+	// Latest unsent position of each player, so older ones can be skipped
+	Protocol::PacketHolder::LatestSlot *latestPositions = nullptr;
+	if(snapshotRate == 0) {
+		latestPositions = new Protocol::PacketHolder::LatestSlot[connectionBufferSize]();
+	}
+
+	// Baselines for CompactSnapshot, only kept in snapshot mode
+	if(snapshotRate > 0) {
+		roomState.history = new Snapshot::History(connectionBufferSize);
+		roomState.positionBatch = new Packets::PlayerPositionBatch(readBatchSize);
+		roomState.positionPackets = new const uint8_t*[readBatchSize];
+		roomState.positionVerdicts = new Movement::Verdict[readBatchSize];
+	}
+
+	// Interest management for relayed positions. Every batch of packets can
+	// need one recipient list per packet.
+	if(snapshotRate == 0 && interestRadius > 0.0f) {
+		roomState.grid = new Spatial::Grid(connectionBufferSize, interestRadius);
+		roomState.recipients = new Transmission::RecipientLists(
+			readBatchSize * static_cast<uint32_t>(connectionBufferSize), readBatchSize);
+		writer.setRecipientLists(roomState.recipients);
+	}
+
+	int ret;
+	if(pipelined) {
+		PipelineProcessor pp(fd, packetBufferSize, &connectionHolder, connectionBufferSize, factory);
+		pp.setMetrics(&metrics);
+		if(capture.isOpen()) pp.setCapture(&capture);
+		if(latestPositions) pp.setLatestSlots(latestPositions, connectionBufferSize);
+		roomState.pipe = &pp;
+
+		NetReturn res = pp.start();
+		if(res.errorCode != NetReturn::OK) {
+			fprintf(stderr, "(run) Failed to start pipeline: %s\n", strerror(res.bytes));
+			ret = -1;
+		} else {
+			ret = runRoom(room, pp, pp.getReadyFd(), controlFd, roomState, reader, 
+				snapshotBuffer, roomMetricsPath);
+		}
+		pp.stop();
+		roomState.pipe = nullptr;
+	} else {
+		PacketProcessor pp(packetBuffer, packetBufferSize, factory);
+		pp.setMetrics(&metrics);
+		if(capture.isOpen()) pp.setCapture(&capture);
+		if(latestPositions) pp.setLatestSlots(latestPositions, connectionBufferSize);
+
+		ret = runRoom(room, pp, reader.getReadyFd(), controlFd, roomState, reader, 
+			snapshotBuffer, roomMetricsPath);
+	}
+
+	const Transmission::Writer::Stats &sendStats = writer.getStats();
+	if(sendStats.sendCalls > 0) {
+		printf("Room %u: sent %lu datagrams in %lu sendmmsg calls (%.2f per call)\n",
+			room, sendStats.messages, sendStats.sendCalls,
+			static_cast<double>(sendStats.messages) / sendStats.sendCalls);
+	}
+	if(sendStats.dropped > 0) {
+		printf("Room %u: failed to send %lu datagrams\n", room, sendStats.dropped);
+	}
+
+	if(roomState.superseded > 0 || roomState.outOfOrder > 0) {
+		printf("Room %u: skipped %lu superseded and %lu out of order positions\n",
+			room, roomState.superseded, roomState.outOfOrder);
+	}
+
+	if(roomState.timedOut > 0 || roomState.expiredCandidates > 0) {
+		printf("Room %u: timed out %lu connections and %lu candidates\n",
+			room, roomState.timedOut, roomState.expiredCandidates);
+	}
 
-		poll(&pfd, 1, 0);
+	const uint64_t accepted = movement.getCount(Movement::ACCEPTED);
+	uint64_t rejected = 0;
+	for(uint32_t v = Movement::ACCEPTED + 1; v < Movement::NUM_VERDICTS; v++) {
+		rejected += movement.getCount(static_cast<Movement::Verdict>(v));
+	}
+	if(rejected > 0) {
+		printf("Room %u: rejected %lu of %lu positions (", room, rejected, accepted + rejected);
+		for(uint32_t v = Movement::ACCEPTED + 1; v < Movement::NUM_VERDICTS; v++) {
+			printf("%s%lu %s", v > Movement::ACCEPTED + 1 ? ", " : "", 
+				movement.getCount(static_cast<Movement::Verdict>(v)),
+				Movement::verdictName(static_cast<Movement::Verdict>(v)));
+		}
+		printf(")\n");
+	}
+
+	if(metrics.kernelToRead.getCount() > 0) {
+		const Metrics::Histogram *stages[] = {&metrics.kernelToRead, &metrics.recvToProcess, &metrics.processToSend};
+		printf("Room %u: p50/p99 us kernel->read %.1f/%.1f, read->process %.1f/%.1f, process->send %.1f/%.1f\n",
+			room, stages[0]->percentile(0.5) / 1e3, stages[0]->percentile(0.99) / 1e3,
+			stages[1]->percentile(0.5) / 1e3, stages[1]->percentile(0.99) / 1e3,
+			stages[2]->percentile(0.5) / 1e3, stages[2]->percentile(0.99) / 1e3);
+	}
+	if(metrics.getKernelDrops() > 0) {
+		printf("Room %u: the kernel dropped %lu datagrams with the receive buffer full\n",
+			room, metrics.getKernelDrops());
+	}
+
+	if(capture.isOpen()) {
+		printf("Room %u: captured %lu datagrams", room, capture.getRecords());
+		if(capture.getDropped() > 0) printf(", %lu more didn't fit", capture.getDropped());
+		printf("\n");
+		capture.close();
+	}
+
+	if(metricsPath && !Metrics::exportSnapshot(metrics, roomMetricsPath, room, Clock::nowMs())) {
+		fprintf(stderr, "Warning: Failed to write metrics to %s\n", roomMetricsPath);
+	}
+
+	delete[] sessions;
+	delete[] latestPositions;
+	delete roomState.history;
+	delete roomState.positionBatch;
+	delete[] roomState.positionPackets;
+	delete[] roomState.positionVerdicts;
+	delete roomState.grid;
+	delete roomState.recipients;
 
-		if(pfd.revents & POLLIN) quit = true;	
+	return ret;
+}
+
+// Runs one room on `fd` until `controlFd` becomes readable. Every room owns
+// its ring, connections and players, so rooms never share hot-path state.
+static int serve(uint32_t room, int fd, int controlFd) {
+
+	// The pipeline has rings of its own
+	void *packetBuffer = nullptr;
+	if(!pipelined) packetBuffer = aligned_alloc(Packets::PACKET_ALIGNMENT, packetBufferSize);
 
-		pfd.events = POLLIN;
+	if(!pipelined && packetBuffer == nullptr) {
+		perror("(serve) Not enough memory available on this system");
+		return -1;
+	}
 
-		NetReturn res;
-		res = pp.readPacket(reader);
-        bool fail = true;
-		switch(res.errorCode) {
-			case NetReturn::OK:
-                fail = false;
+	auto *connectionBuffer = new(std::nothrow) 
+        Transmission::Connection[connectionBufferSize];
+
+	if(connectionBuffer == nullptr) {
+		fprintf(stderr, "(serve) Not enough memory available on this system\n");
+		free(packetBuffer);
+		return -1;
+	}
+
+	auto *players = new(std::nothrow) Player::Store(connectionBufferSize);
+
+	if(players == nullptr) {
+		fprintf(stderr, "(serve) Not enough memory available on this system\n");
+		delete[] connectionBuffer;
+		free(packetBuffer);
+		return -1;
+	}
+
+	Packets::PlayerPosition *snapshotBuffer = nullptr;
+	if(snapshotRate > 0) {
+		snapshotBuffer = new(std::nothrow) Packets::PlayerPosition[connectionBufferSize];
+
+		if(snapshotBuffer == nullptr) {
+			fprintf(stderr, "(serve) Not enough memory available on this system\n");
+			delete players;
+			delete[] connectionBuffer;
+			free(packetBuffer);
+			return -1;
+		}
+	}
+
+	int ret = run(room, fd, controlFd, packetBuffer, connectionBuffer, players, snapshotBuffer);
+
+	delete[] snapshotBuffer;
+
+	delete players;
+	delete[] connectionBuffer;
+	free(packetBuffer);
+
+	return ret;
+}
+
+int main(int argc, char **argv) {
+
+	int err;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:w:t:r:m:puc:s:j:k:")) != -1) {
+		switch(opt) {
+			case 'n':
+			{
+				unsigned long n = strtoul(optarg, nullptr, 10);
+				if(n == 0 || n >= Transmission::ConnectionHolder::NO_CONNECTION) {
+					fprintf(stderr, "(main) Invalid number of players: %s\n", optarg);
+					return -1;
+				}
+				maxNumPlayers = n;
 				break;
-			case NetReturn::CANDIDATE:
-				pp.getPacketFactory().setCandidate();
-                fail = false;
+			}
+			case 'w':
+			{
+				unsigned long n = strtoul(optarg, nullptr, 10);
+				if(n == 0 || n + port > 0xFFFF) {
+					fprintf(stderr, "(main) Invalid number of workers: %s\n", optarg);
+					return -1;
+				}
+				numRooms = n;
 				break;
-			case NetReturn::NOT_ENOUGH_SPACE:
-				fprintf(stderr, "Warning: Not enough memory\n");
+			}
+			case 't':
+			{
+				unsigned long n = strtoul(optarg, nullptr, 10);
+				if(n == 0 || n > 1000) {
+					fprintf(stderr, "(main) Invalid snapshot rate: %s\n", optarg);
+					return -1;
+				}
+				snapshotRate = n;
+				tickIntervalMs = 1000 / n;
 				break;
-            case NetReturn::FILTERED:
-                if(!full) {
-                    full = true;
-                    fprintf(stderr, "Warning: Attempt made to connect to full server\n");
-                }
-                break;
-			default:
-				fprintf(stderr, "Warning: invalid packet received\n");
+			}
+			case 'r':
+			{
+				float r = strtof(optarg, nullptr);
+				if(!(r > 0.0f)) {
+					fprintf(stderr, "(main) Invalid relay radius: %s\n", optarg);
+					return -1;
+				}
+				interestRadius = r;
+				break;
+			}
+			case 'm':
+				metricsPath = optarg;
 				break;
+			case 'p':
+				pipelined = true;
+				break;
+			case 'u':
+				useUring = true;
+				break;
+			case 'c':
+				capturePath = optarg;
+				break;
+			case 's':
+			case 'j':
+			{
+				float limit = strtof(optarg, nullptr);
+				if(!(limit > 0.0f)) {
+					fprintf(stderr, "(main) Invalid movement limit: %s\n", optarg);
+					return -1;
+				}
+				if(opt == 's') movementLimits.maxSpeed = limit;
+				else movementLimits.maxJump = limit;
+				break;
+			}
+			case 'k':
+				if(strcmp(optarg, "precise") == 0) clockSource = Clock::Source::PRECISE;
+				else if(strcmp(optarg, "coarse") == 0) clockSource = Clock::Source::COARSE;
+				else if(strcmp(optarg, "tsc") == 0) clockSource = Clock::Source::TSC;
+				else {
+					fprintf(stderr, "(main) Invalid clock: %s\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n max players] [-w worker threads] "
+					"[-t snapshots per second] [-r relay radius] [-m metrics file] [-p] [-u] "
+					"[-c capture file] [-s max speed] [-j max jump] [-k precise|coarse|tsc]\n", argv[0]);
+				return -1;
 		}
+	}
 
-        if(!fail) {
+	// Recipient lists aren't handed to the send thread
+	if(pipelined && interestRadius > 0.0f) {
+		fprintf(stderr, "(main) -r can't be used together with -p\n");
+		return -1;
+	}
+	// The pipeline's threads receive and send on their own
+	if(pipelined && useUring) {
+		fprintf(stderr, "(main) -u can't be used together with -p\n");
+		return -1;
+	}
 
-            Packets::PacketFactory::PacketUnion pu;
-            
-            res = pp.processPacket(&pu);
-            if(res.errorCode != NetReturn::OK) {
-                fprintf(stderr, "Warning: invalid packet received (%u)\n", res.errorCode);
-                pp.dropPacket();
-                pp.finishProcessing();
-                //continue;
-            }
-            else {
-                switch(pu.tag) {
-                case Packets::Tag::CONNECT: 
-                {
-                    NetReturn id = pp.getSenderId();
-                    if(id.errorCode != NetReturn::OK) netHandleInvalidState();
-                    if(!connectionHolder.addConnection(id.bytes)) {
-                        fprintf(stderr, "Failed to add connection %d", id.bytes);
-                    }
-                    const Transmission::Connection *c 
-                        = connectionHolder.getConnection(id.bytes);
-                    const auto *ipAddr = reinterpret_cast<const uint8_t *>
-                        (&c->addr.sin_addr.s_addr);
-                    uint16_t port = ntohs(c->addr.sin_port);
-                    fprintf(stderr, "Connected to %d.%d.%d.%d on port %d (%d)\n",
-                        ipAddr[0],
-                        ipAddr[1],
-                        ipAddr[2],
-                        ipAddr[3],
-                        port,
-                        id.bytes
-                    );
-                    pp.addPacket(Packets::ServerInitialResponse(
-                        Protocol::MAJOR, Protocol::MINOR, id.bytes
-                    ), 0x80 | id.bytes);
-                    pp.dropPacket();
-                    pp.finishProcessing();
-                    break;
-                }
+	if(connectionBufferSize == 0) connectionBufferSize = maxNumPlayers;
+	// A batch reserves full-size slots up front, so leave room for a whole
+	// batch on top of the packets queued for sending
+	if(packetBufferSize == 0) {
+		packetBufferSize = alignUp((Packets::MAX_PACKET_SIZE + 48) 
+			* (static_cast<size_t>(maxNumPlayers) + readBatchSize), Packets::PACKET_ALIGNMENT);
+	}
 
-                case Packets::Tag::ACK:
-                case Packets::Tag::TIME_RESPONSE:
-                case Packets::Tag::SERVER_INITIAL_RESPONSE:
-                {
-                    pp.dropPacket();
-                    pp.finishProcessing();
-                    break;
-                }
-                case Packets::Tag::PLAYER_POSITION:
-                {
-                    const Packets::PlayerPosition &pos = pu.playerPos;
-                    NetReturn id = pp.getSenderId();
-                    if(id.errorCode != NetReturn::OK) netHandleInvalidState();
+	in_addr s_addr;
+   	err = inet_aton(bindInetAddrStr, &s_addr);
+
+	if(err == 0) {
+		fprintf(stderr, "(main) Invalid host IP address\n");
+		return -1;
+	}
 
-                    if(id.bytes != pos.playerId) {
-                        pp.dropPacket();
-                        fprintf(stderr, "Client %d is impersonating %d\n", 
-                            id.bytes, pu.playerPos.playerId);
-                    }
+    if(Clock::init(clockSource) != clockSource) {
+        fprintf(stderr, "Warning: No invariant TSC, using the %s clock instead\n", 
+            Clock::sourceName(Clock::getSource()));
+    }
 
-                    players[pos.playerId].updateInfo(&pos.position, &pos.velocity, &pos.direction);
+	if(numRooms == 1) {
+		int fd = openSocket(s_addr, port);
+		if(fd < 0) return -1;
 
-                    pp.finishProcessing();
+		printf("Hit enter to close the server\n");
 
-                    break;
-                }
-                case Packets::Tag::STAR_PIECE:
-                {
-                    // TODO: Maybe do some more validity checking and store the packet?
-                    pp.finishProcessing();
-                    break;
-                }
-                case Packets::Tag::TIME_QUERY:
-                {
-                    NetReturn id = pp.getSenderId();
-                    if(id.errorCode != NetReturn::OK) netHandleInvalidState();
-                    const Packets::TimeQuery &tqp = pu.timeQuery;
-                    uint32_t t = std::chrono::duration_cast<std::chrono::milliseconds>
-                        (std::chrono::steady_clock::now() - initialTime).count();
-                    pp.addPacket(Packets::TimeResponse(t, tqp.check), 0x80 | id.bytes);
-                    pp.dropPacket();
-                    pp.finishProcessing();
-                    break;
-                }
-                case Packets::Tag::MAX_TAG: // invalid state
-                    break;
-            }
+		err = serve(0, fd, STDIN_FILENO);
+		close(fd);
+		return err;
+	}
 
-        }}
-        pp.getPacketFactory().resetCandidate();
+	// Each worker thread serves one room on its own port (port + room)
+	std::vector<int> fds(numRooms);
+	for(uint32_t i = 0; i < numRooms; i++) {
+		fds[i] = openSocket(s_addr, port + i);
+		if(fds[i] < 0) {
+			while(i-- > 0) close(fds[i]);
+			return -1;
+		}
+	}
 
-		do {
-			res = pp.sendPacket(writer);
-		} while (res.errorCode == NetReturn::OK && res.bytes > 0);
-		
+	// Shared by every worker; becomes readable once we shut down
+	int stopFd = eventfd(0, EFD_CLOEXEC);
+	if(stopFd < 0) {
+		perror("(main) Failed to create eventfd");
+		for(uint32_t i = 0; i < numRooms; i++) close(fds[i]);
+		return -1;
+	}
 
+	std::atomic<int> failed = 0;
+	std::vector<std::thread> workers;
+	workers.reserve(numRooms);
+	for(uint32_t i = 0; i < numRooms; i++) {
+		workers.emplace_back([i, &fds, stopFd, &failed]() {
+			if(serve(i, fds[i], stopFd) != 0) failed = -1;
+		});
 	}
 
-	close(fd);
+	printf("Serving %u rooms on ports %u-%u\n", numRooms, port, port + numRooms - 1);
+	printf("Hit enter to close the server\n");
 
-	return 0;
-}
+	pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	while(poll(&pfd, 1, -1) < 0 && errno == EINTR);
 
+	uint64_t one = 1;
+	if(write(stopFd, &one, sizeof one) != sizeof one) {
+		perror("(main) Failed to stop workers");
+	}
+
+	for(auto &worker : workers) worker.join();
+
+	for(uint32_t i = 0; i < numRooms; i++) close(fds[i]);
+	close(stopFd);
+
+	return failed;
+}
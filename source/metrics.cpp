@@ -0,0 +1,135 @@
+#include "metrics.hpp"
+
+#include <climits>
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace Metrics {
+
+uint64_t Histogram::percentile(double q) const {
+    const uint64_t total = get(count);
+    if(total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * total);
+    if(rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < BUCKETS; i++) {
+        seen += get(buckets[i]);
+        if(seen > rank) {
+            if(i + 1 == BUCKETS) return get(max);
+            uint64_t upper = lowerBound(i + 1) - 1;
+            return upper < get(max) ? upper : get(max);
+        }
+    }
+    return get(max);
+}
+
+static const char *const TAG_NAMES[] = {
+    "CONNECT",
+    "ACK",
+    "SERVER_INITIAL_RESPONSE",
+    "PLAYER_POSITION",
+    "TIME_QUERY",
+    "TIME_RESPONSE",
+    "STAR_PIECE",
+    "WORLD_SNAPSHOT",
+    "COMPACT_SNAPSHOT",
+    "RELIABLE",
+    "KEEPALIVE",
+    "UNKNOWN"
+};
+static_assert(sizeof TAG_NAMES / sizeof *TAG_NAMES == Recorder::NUM_TAGS, "Every tag needs a name");
+
+static const char *const ERROR_NAMES[] = {
+    "OK",
+    "NOT_ENOUGH_SPACE",
+    "INVALID_DATA",
+    "INVALID_STATE",
+    "CANDIDATE",
+    "FILTERED",
+    "SYSTEM_ERROR"
+};
+static_assert(sizeof ERROR_NAMES / sizeof *ERROR_NAMES == Recorder::NUM_ERRORS, "Every error code needs a name");
+
+// Tags that never showed up are left out
+static void writeCounters(FILE *out, const char *name, const Recorder::Counter *counters) {
+    fprintf(out, "\"%s\": {", name);
+    bool first = true;
+    for(uint32_t i = 0; i < Recorder::NUM_TAGS; i++) {
+        if(get(counters[i].packets) == 0) continue;
+        fprintf(out, "%s\"%s\": {\"packets\": %lu, \"bytes\": %lu}", first ? "" : ", ",
+            TAG_NAMES[i], get(counters[i].packets), get(counters[i].bytes));
+        first = false;
+    }
+    fprintf(out, "}");
+}
+
+static void writeHistogram(FILE *out, const char *name, const Histogram &h) {
+    fprintf(out, "\"%s\": {\"count\": %lu, \"mean\": %lu, \"p50\": %lu, \"p99\": %lu, "
+        "\"p999\": %lu, \"max\": %lu, \"buckets\": [",
+        name, h.getCount(), h.getCount() ? h.getSum() / h.getCount() : 0,
+        h.percentile(0.5), h.percentile(0.99), h.percentile(0.999), h.getMax());
+    // [smallest value in the bucket, count] for every bucket in use
+    bool first = true;
+    for(uint32_t i = 0; i < Histogram::BUCKETS; i++) {
+        if(h.getBucket(i) == 0) continue;
+        fprintf(out, "%s[%lu, %lu]", first ? "" : ", ", Histogram::lowerBound(i), h.getBucket(i));
+        first = false;
+    }
+    fprintf(out, "]}");
+}
+
+void Recorder::write(FILE *out, uint32_t room, uint64_t uptimeMs) const {
+    fprintf(out, "{\"room\": %u, \"uptime_ms\": %lu,\n", room, uptimeMs);
+
+    writeCounters(out, "received", received);
+    fprintf(out, ",\n");
+    writeCounters(out, "sent", sent);
+    fprintf(out, ",\n");
+
+    fprintf(out, "\"dropped\": {");
+    bool first = true;
+    for(uint32_t i = 0; i < NUM_ERRORS; i++) {
+        if(get(dropped[i]) == 0) continue;
+        fprintf(out, "%s\"%s\": %lu", first ? "" : ", ", ERROR_NAMES[i], get(dropped[i]));
+        first = false;
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "\"kernel_drops\": %lu,\n", get(kernelDrops));
+
+    fprintf(out, "\"ring\": {\"capacity\": %zu, \"used\": %zu, \"peak\": %zu},\n",
+        ringCapacity, ringUsed, ringPeak);
+
+    writeHistogram(out, "kernel_to_read_ns", kernelToRead);
+    fprintf(out, ",\n");
+    writeHistogram(out, "recv_to_process_ns", recvToProcess);
+    fprintf(out, ",\n");
+    writeHistogram(out, "process_to_send_ns", processToSend);
+    fprintf(out, ",\n");
+    writeHistogram(out, "kernel_to_send_ns", kernelToSend);
+    fprintf(out, "}\n");
+}
+
+bool exportSnapshot(const Recorder &recorder, const char *path, uint32_t room, uint64_t uptimeMs) {
+    char tmpPath[PATH_MAX];
+    if(snprintf(tmpPath, sizeof tmpPath, "%s.tmp", path) >= static_cast<int>(sizeof tmpPath)) {
+        return false;
+    }
+
+    FILE *out = fopen(tmpPath, "w");
+    if(out == nullptr) return false;
+
+    recorder.write(out, room, uptimeMs);
+
+    bool failed = ferror(out);
+    if(fclose(out) != 0) failed = true;
+    if(failed || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+}
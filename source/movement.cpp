@@ -0,0 +1,247 @@
+#include "movement.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOVEMENT_X86
+#include <immintrin.h>
+#endif
+
+namespace Movement {
+
+namespace {
+
+struct Previous {
+    bool known;
+    Vec position;
+    int32_t timeMs;
+};
+
+inline bool isFinite(const Vec &v) {
+    // Both NaN and infinity minus themselves are NaN
+    return v.x - v.x == 0.0f && v.y - v.y == 0.0f && v.z - v.z == 0.0f;
+}
+
+// The verdict on one update. The AVX2 kernel does the same operations in the
+// same order, so both come to the same verdicts.
+Verdict judge(const Limits &limits, const Previous &previous, int32_t timeMs,
+    const Vec &position, const Vec &velocity, const Vec &direction)
+{
+    if(!isFinite(position) || !isFinite(velocity) || !isFinite(direction)) return NOT_FINITE;
+    if(!previous.known) return ACCEPTED;
+
+    const float dx = position.x - previous.position.x;
+    const float dy = position.y - previous.position.y;
+    const float dz = position.z - previous.position.z;
+    const float distanceSquared = dx * dx + dy * dy + dz * dz;
+
+    if(limits.maxJump > 0.0f && distanceSquared > limits.maxJump * limits.maxJump) return TELEPORT;
+
+    if(limits.maxSpeed > 0.0f) {
+        // Allowing for wraparound; updates out of order don't get here
+        int32_t elapsedMs = static_cast<int32_t>(static_cast<uint32_t>(timeMs)
+            - static_cast<uint32_t>(previous.timeMs));
+        if(elapsedMs < 0) elapsedMs = 0;
+        const float reach = limits.maxSpeed * (static_cast<float>(elapsedMs) + Checker::GRACE_MS) * 0.001f;
+        if(distanceSquared > reach * reach) return TOO_FAST;
+    }
+    return ACCEPTED;
+}
+
+#ifdef MOVEMENT_X86
+
+struct History {
+    const float *x;
+    const float *y;
+    const float *z;
+    const int32_t *timeMs;
+    const int32_t *known;
+    ConnectionId capacity;
+};
+
+__attribute__((target("avx2")))
+inline __m256 loadColumn(const Packets::PlayerPositionBatch &batch, uint32_t column, uint32_t i) {
+    return _mm256_loadu_ps(reinterpret_cast<const float *>(batch.column(column) + i));
+}
+
+// Judges the first entries of `batch`, eight at a time, against the previous
+// updates as they were before the batch. Returns how many it judged.
+__attribute__((target("avx2")))
+uint32_t judgeAvx2(const Limits &limits, const History &history,
+    const Packets::PlayerPositionBatch &batch, Verdict *out)
+{
+    using Column = Packets::PlayerPositionBatch::Column;
+
+    const ConnectionId *ids = batch.getPlayerIds();
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxJumpSquared = _mm256_set1_ps(limits.maxJump * limits.maxJump);
+    const __m256 maxSpeed = _mm256_set1_ps(limits.maxSpeed);
+    const __m256 grace = _mm256_set1_ps(static_cast<float>(Checker::GRACE_MS));
+    const __m256 perMs = _mm256_set1_ps(0.001f);
+    const __m256i capacity = _mm256_set1_epi32(history.capacity);
+    const __m256i lastId = _mm256_set1_epi32(history.capacity - 1);
+
+    uint32_t i = 0;
+    for(; i + 8 <= batch.getSize(); i += 8) {
+        __m256i id = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ids + i)));
+        // Ids past the end have no previous update, and are not looked up
+        const __m256i inRange = _mm256_cmpgt_epi32(capacity, id);
+        id = _mm256_min_epi32(id, lastId);
+        const __m256i known = _mm256_and_si256(inRange, _mm256_i32gather_epi32(history.known, id, 4));
+
+        __m256 finite = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(uint32_t c = Column::POSITION; c < Column::DIRECTION + 3; c++) {
+            const __m256 v = loadColumn(batch, c, i);
+            finite = _mm256_and_ps(finite, _mm256_cmp_ps(_mm256_sub_ps(v, v), zero, _CMP_EQ_OQ));
+        }
+
+        const __m256 dx = _mm256_sub_ps(loadColumn(batch, Column::POSITION, i), _mm256_i32gather_ps(history.x, id, 4));
+        const __m256 dy = _mm256_sub_ps(loadColumn(batch, Column::POSITION + 1, i), _mm256_i32gather_ps(history.y, id, 4));
+        const __m256 dz = _mm256_sub_ps(loadColumn(batch, Column::POSITION + 2, i), _mm256_i32gather_ps(history.z, id, 4));
+        const __m256 distanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+            _mm256_mul_ps(dz, dz));
+
+        __m256 teleport = zero;
+        if(limits.maxJump > 0.0f) teleport = _mm256_cmp_ps(distanceSquared, maxJumpSquared, _CMP_GT_OQ);
+
+        __m256 tooFast = zero;
+        if(limits.maxSpeed > 0.0f) {
+            const __m256i timeMs = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                batch.column(Column::TIMESTAMP) + i));
+            const __m256i elapsedMs = _mm256_max_epi32(_mm256_setzero_si256(),
+                _mm256_sub_epi32(timeMs, _mm256_i32gather_epi32(history.timeMs, id, 4)));
+            const __m256 reach = _mm256_mul_ps(_mm256_mul_ps(maxSpeed,
+                _mm256_add_ps(_mm256_cvtepi32_ps(elapsedMs), grace)), perMs);
+            tooFast = _mm256_cmp_ps(distanceSquared, _mm256_mul_ps(reach, reach), _CMP_GT_OQ);
+        }
+
+        const uint32_t notFiniteMask = ~_mm256_movemask_ps(finite) & 0xFF;
+        const uint32_t knownMask = _mm256_movemask_ps(_mm256_castsi256_ps(known));
+        const uint32_t teleportMask = _mm256_movemask_ps(teleport) & knownMask;
+        const uint32_t tooFastMask = _mm256_movemask_ps(tooFast) & knownMask;
+        for(uint32_t lane = 0; lane < 8; lane++) {
+            const uint32_t bit = 1u << lane;
+            out[i + lane] = notFiniteMask & bit ? NOT_FINITE : teleportMask & bit ? TELEPORT
+                : tooFastMask & bit ? TOO_FAST : ACCEPTED;
+        }
+    }
+    return i;
+}
+
+#endif
+
+}
+
+Checker::Checker(ConnectionId capacity, Limits limits)
+    : capacity(capacity), limits(limits), batchNumber(0), verdicts{}
+{
+    lastX = new float[capacity]();
+    lastY = new float[capacity]();
+    lastZ = new float[capacity]();
+    lastMs = new int32_t[capacity]();
+    known = new int32_t[capacity]();
+    pendingX = new float[capacity]();
+    pendingY = new float[capacity]();
+    pendingZ = new float[capacity]();
+    pendingMs = new int32_t[capacity]();
+    streak = new uint32_t[capacity]();
+    seenIn = new uint32_t[capacity]();
+}
+
+Checker::~Checker() {
+    delete[] lastX;
+    delete[] lastY;
+    delete[] lastZ;
+    delete[] lastMs;
+    delete[] known;
+    delete[] pendingX;
+    delete[] pendingY;
+    delete[] pendingZ;
+    delete[] pendingMs;
+    delete[] streak;
+    delete[] seenIn;
+}
+
+void Checker::remember(ConnectionId id, ServerTimestamp t, const Vec &position) {
+    lastX[id] = position.x;
+    lastY[id] = position.y;
+    lastZ[id] = position.z;
+    lastMs[id] = t.t.timeMs;
+    known[id] = -1;
+}
+
+Verdict Checker::settle(ConnectionId id, ServerTimestamp t, const Vec &position, Verdict v) {
+    if(id >= capacity || v == NOT_FINITE) return v;
+    if(v == ACCEPTED) {
+        remember(id, t, position);
+        streak[id] = 0;
+        return v;
+    }
+
+    const Previous pending = {streak[id] > 0, Vec(pendingX[id], pendingY[id], pendingZ[id]), pendingMs[id]};
+    const bool plausible = pending.known
+        && judge(limits, pending, t.t.timeMs, position, Vec(), Vec()) == ACCEPTED;
+    streak[id] = plausible ? streak[id] + 1 : 1;
+    pendingX[id] = position.x;
+    pendingY[id] = position.y;
+    pendingZ[id] = position.z;
+    pendingMs[id] = t.t.timeMs;
+
+    if(streak[id] < WARP_UPDATES) return v;
+    remember(id, t, position);
+    streak[id] = 0;
+    return ACCEPTED;
+}
+
+Verdict Checker::check(ConnectionId id, ServerTimestamp t,
+    const Vec &position, const Vec &velocity, const Vec &direction)
+{
+    Previous previous = {false, Vec(), 0};
+    if(id < capacity && known[id]) previous = {true, Vec(lastX[id], lastY[id], lastZ[id]), lastMs[id]};
+
+    const Verdict v = settle(id, t, position,
+        judge(limits, previous, t.t.timeMs, position, velocity, direction));
+    verdicts[v]++;
+    return v;
+}
+
+uint32_t Checker::check(const Packets::PlayerPositionBatch &batch, Verdict *out) {
+    uint32_t judged = 0;
+#ifdef MOVEMENT_X86
+    if(capacity > 0 && Packets::detectBatchIsa() == Packets::BatchIsa::AVX2) {
+        judged = judgeAvx2(limits, {lastX, lastY, lastZ, lastMs, known, capacity}, batch, out);
+    }
+#endif
+
+    // Whatever is left, and players that are in the batch more than once,
+    // which have to be compared with their update from earlier in the batch
+    batchNumber++;
+    uint32_t accepted = 0;
+    for(uint32_t i = 0; i < batch.getSize(); i++) {
+        const ConnectionId id = batch.playerId(i);
+        const bool repeated = id < capacity && seenIn[id] == batchNumber;
+        if(i >= judged || repeated) {
+            Previous previous = {false, Vec(), 0};
+            if(id < capacity && known[id]) previous = {true, Vec(lastX[id], lastY[id], lastZ[id]), lastMs[id]};
+            out[i] = judge(limits, previous, batch.timestamp(i).t.timeMs,
+                batch.position(i), batch.velocity(i), batch.direction(i));
+        }
+
+        if(id < capacity) seenIn[id] = batchNumber;
+        out[i] = settle(id, batch.timestamp(i), batch.position(i), out[i]);
+        verdicts[out[i]]++;
+        if(out[i] == ACCEPTED) accepted++;
+    }
+    return accepted;
+}
+
+const char* verdictName(Verdict v) {
+    switch(v) {
+        case ACCEPTED: return "accepted";
+        case NOT_FINITE: return "not finite";
+        case TELEPORT: return "teleport";
+        case TOO_FAST: return "too fast";
+        case NUM_VERDICTS: break;
+    }
+    return "unknown";
+}
+
+}
@@ -5,8 +5,18 @@
 #include "timestamps.hpp"
 #include "packets/timeSync.hpp"
 #include "packets/starPiece.hpp"
+#include "packets/worldSnapshot.hpp"
+#include "packets/compactSnapshot.hpp"
+#include "packets/reliable.hpp"
+#include "packets/keepalive.hpp"
+#include "packets/packetView.hpp"
+#include "packets/schema.hpp"
 
 #include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <bit>
 
 extern "C" {
 #include <arpa/inet.h>
@@ -15,25 +25,10 @@ extern "C" {
 namespace Packets {
 
 const static uint64_t CONNECT_MAGIC = 0x436F6E6E65637400;
-const static uint32_t CONNECT_MAGIC_LOWER = CONNECT_MAGIC & 0xFFFFFFFF;
-const static uint32_t CONNECT_MAGIC_UPPER = CONNECT_MAGIC >> 32;
 
 
 namespace implementation {
 
-    template<typename T>
-    class PacketTimestamp {
-        uint32_t tMs; // Big endian
-    public:
-        PacketTimestamp(const ClockboundTimestamp<T> &t) : 
-            tMs(htonl(std::bit_cast<uint32_t>(t.t.timeMs))) {}
-        ClockboundTimestamp<T> toHL() const { 
-            return {std::bit_cast<int32_t>(ntohl(tMs))}; 
-        }
-    };
-
-    typedef PacketTimestamp<ServerClockTag> ServerPacketTimestamp;
-
     class ReliablePacket {
     protected:
         uint32_t seqNum; // Big endian
@@ -42,119 +37,161 @@ namespace implementation {
         inline ReliablePacketCode toCode() const {return ReliablePacketCode(ntohl(seqNum));}
     };
 
-    struct Connect {
-        uint8_t magic[8];
-        uint32_t majorVersion; // Big endian
-        uint32_t minorVersion; // Big endian
-    };
-
     struct Ack {
         // In case of overflow, just don't accept new packets until all
         // prior packets have been accepted.
         uint32_t seqNum;
+        // Everything below may be left out, for snapshot acks
+        uint32_t ackBits; // Big endian
+        uint8_t channel;
+        uint8_t padding[3];
+    };
+
+    struct Reliable {
+        ReliablePacket check;
+        uint8_t flags;
+        uint8_t padding[3];
+        uint32_t innerTag; // Big endian
+        // Followed by the payload of the inner packet
     };
 
-    struct PlayerPosition {
-        uint8_t playerId;
-        uint8_t stateFlags;
+    typedef Schema::Layout<
+        Schema::Magic<CONNECT_MAGIC>,
+        Schema::Word<&_Connect::majorVersion>,
+        Schema::Word<&_Connect::minorVersion>
+    > Connect;
+
+    // Player ids are split in two bytes so that ids below 256 look the same
+    // as they did when ids were a single byte followed by padding. Clients
+    // from before Protocol::WIDE_ID_MINOR may leave anything in that padding,
+    // which the server overwrites before reading it.
+
+    typedef Schema::Layout<
+        Schema::IdLow<&_PlayerPosition::playerId>,
+        Schema::Byte<&_PlayerPosition::stateFlags>,
+        Schema::IdHigh<&_PlayerPosition::playerId>,
+        Schema::Padding<1>,
+        Schema::Word<&_PlayerPosition::timestamp>,
+        Schema::Vec3<&_PlayerPosition::position>,
+        Schema::Vec3<&_PlayerPosition::velocity>,
+        Schema::Vec3<&_PlayerPosition::direction>,
+        Schema::Word<&_PlayerPosition::currentAnimation>,
+        Schema::Word<&_PlayerPosition::defaultAnimation>,
+        Schema::Word<&_PlayerPosition::animationSpeed>
+    > PlayerPosition;
+
+    typedef Schema::Layout<
+        Schema::IdLow<&_StarPiece::playerId>,
+        Schema::IdHigh<&_StarPiece::playerId>,
+        Schema::Padding<2>,
+        Schema::Word<&_StarPiece::timestamp>,
+        Schema::Vec3<&_StarPiece::initLineStart>,
+        Schema::Vec3<&_StarPiece::initLineEnd>
+    > StarPiece;
+
+    typedef Schema::Layout<
+        Schema::Word<&_ServerInitialResponse::majorVersion>,
+        Schema::Word<&_ServerInitialResponse::minorVersion>,
+        Schema::IdLow<&_ServerInitialResponse::playerId>,
+        Schema::IdHigh<&_ServerInitialResponse::playerId>,
+        Schema::Padding<2>
+    > ServerInitialResponse;
+
+    struct WorldSnapshot {
+        uint32_t tick; // Big endian
+        uint16_t numPlayers; // Big endian
         uint8_t padding[2];
+        // Followed by numPlayers PlayerPosition
+    };
 
-        ServerPacketTimestamp timestamp;
+    struct CompactSnapshot {
+        uint32_t tick; // Big endian
+        uint32_t baselineTick; // Big endian
+        uint32_t originX; // Big endian
+        uint32_t originY; // Big endian
+        uint32_t originZ; // Big endian
+        uint16_t numPlayers; // Big endian
+        // Which of the datagrams of the tick this is, counting from 0
+        uint8_t chunk;
+        uint8_t padding;
+        // Followed by numPlayers variable length entries: the player id
+        // (low byte first), a mask of CompactField, the state flags, and
+        // then every field in the mask, in order, big endian
+    };
 
-        uint32_t positionX;
-        uint32_t positionY;
-        uint32_t positionZ;
+    enum CompactField : uint8_t {
+        C_TIMESTAMP = 1 << 0,       // int32
+        C_POSITION = 1 << 1,        // 3 x int24
+        C_VELOCITY = 1 << 2,        // 3 x int16
+        C_DIRECTION = 1 << 3,       // 2 x int16
+        C_ANIMATION = 1 << 4,       // current, default: 2 x int32
+        C_ANIMATION_SPEED = 1 << 5, // int16
+        C_ALL = (1 << 6) - 1
+    };
 
-        uint32_t velocityX;
-        uint32_t velocityY;
-        uint32_t velocityZ;
+    constexpr uint32_t COMPACT_ENTRY_HEADER_SIZE = 4;
+    constexpr uint32_t COMPACT_ENTRY_MAX_SIZE = COMPACT_ENTRY_HEADER_SIZE + 4 + 9 + 6 + 4 + 8 + 2;
 
-        uint32_t directionX;
-        uint32_t directionY;
-        uint32_t directionZ;
+    typedef Schema::Layout<
+        Schema::Word<&_TimeQuery::timeMs>,
+        Schema::Word<&_TimeQuery::check>
+    > TimeQuery;
 
-        uint32_t currentAnimation;
-        uint32_t defaultAnimation;
-        uint32_t animationSpeed;
-        
-    };
+    typedef Schema::Layout<
+        Schema::Word<&_TimeResponse::timeMs>,
+        Schema::Word<&_TimeResponse::check>
+    > TimeResponse;
 
-    struct StarPiece {
-        uint8_t playerId;
-        uint8_t padding[3];
+    typedef Schema::Layout<
+        Schema::Word<&_Keepalive::timeMs>
+    > Keepalive;
 
-        ServerPacketTimestamp timestamp;
 
-        uint32_t initLineStartX;
-        uint32_t initLineStartY;
-        uint32_t initLineStartZ;
-        
-        uint32_t initLineEndX;
-        uint32_t initLineEndY;
-        uint32_t initLineEndZ;
-    };
 
-    struct ServerInitialResponse {
-        uint32_t majorVersion;
-        uint32_t minorVersion;
-        uint8_t playerId;
-    };
 
-    struct TimeQuery {
-        uint32_t timeMs; // Big Endian
-        ReliablePacket check;
-    };
+}
 
-    struct TimeResponse {
-        uint32_t timeMs; // Big Endian
-        ReliablePacket check;
-    };
+static_assert(implementation::PlayerPosition::SIZE == PlayerPositionView::SIZE);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::timestamp>() 
+    == PlayerPositionView::TIMESTAMP_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::position>() 
+    == PlayerPositionView::POSITION_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::velocity>() 
+    == PlayerPositionView::VELOCITY_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::direction>() 
+    == PlayerPositionView::DIRECTION_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::currentAnimation>() 
+    == PlayerPositionView::CURRENT_ANIMATION_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::defaultAnimation>() 
+    == PlayerPositionView::DEFAULT_ANIMATION_OFFSET);
+static_assert(implementation::PlayerPosition::offsetOf<&_PlayerPosition::animationSpeed>() 
+    == PlayerPositionView::ANIMATION_SPEED_OFFSET);
+
+static_assert(implementation::StarPiece::SIZE == StarPieceView::SIZE);
+static_assert(implementation::StarPiece::offsetOf<&_StarPiece::timestamp>() == StarPieceView::TIMESTAMP_OFFSET);
+static_assert(implementation::StarPiece::offsetOf<&_StarPiece::initLineStart>() 
+    == StarPieceView::INIT_LINE_START_OFFSET);
+static_assert(implementation::StarPiece::offsetOf<&_StarPiece::initLineEnd>() 
+    == StarPieceView::INIT_LINE_END_OFFSET);
+
+void PlayerPositionView::decode(PlayerPosition *out) const {
+    PlayerPosition::netReadFromBuffer(out, data, SIZE);
+}
 
+void StarPieceView::decode(StarPiece *out) const {
+    StarPiece::netReadFromBuffer(out, data, SIZE);
 }
 
 NetReturn _Connect::netWriteToBuffer(void *buffer, uint32_t len) const {
-    auto *packet = reinterpret_cast<implementation::Connect *>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type, 
-        implementation::Connect
-    >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
-
-    *(uint32_t *)&packet->magic = htonl(CONNECT_MAGIC_UPPER);
-    *(uint32_t *)&packet->magic[4] = htonl(CONNECT_MAGIC_LOWER);
-    packet->majorVersion = htonl(majorVersion);
-    packet->minorVersion = htonl(minorVersion);
-
-    return {sizeof *packet, NetReturn::OK};
+    return implementation::Connect::encode(*this, buffer, len);
 }
 
 NetReturn _Connect::netReadFromBuffer(Packet<_Connect> *out, const void *buffer, uint32_t len) {
-    const auto *packet = reinterpret_cast<const implementation::Connect*>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type, 
-        implementation::Connect
-    >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
-
-    if(*(uint32_t*)&packet->magic != htonl(CONNECT_MAGIC_UPPER)
-            || *(uint32_t*)&packet->magic[4] != htonl(CONNECT_MAGIC_LOWER)) {
-        return {0, NetReturn::INVALID_DATA};
-    }
-
-    out->majorVersion = ntohl(packet->majorVersion);
-    out->minorVersion = ntohl(packet->minorVersion);
-
-    // Remember to update getSize if the size changes
-    return {sizeof *packet, NetReturn::OK};
-
+    return implementation::Connect::decode(*out, buffer, len);
 }
 
 uint32_t _Connect::getSize() const {
-    return sizeof(implementation::Connect);
+    return implementation::Connect::SIZE;
 }
 
 NetReturn _Ack::netWriteToBuffer(void *buffer, uint32_t len) const {
@@ -168,6 +205,11 @@ NetReturn _Ack::netWriteToBuffer(void *buffer, uint32_t len) const {
     if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
 
     packet->seqNum = htonl(seqNum);
+    packet->ackBits = htonl(ackBits);
+    packet->channel = channel;
+    packet->padding[0] = 0;
+    packet->padding[1] = 0;
+    packet->padding[2] = 0;
 
     // Remember to update getSize if the size changes
     return {sizeof *packet, NetReturn::OK};
@@ -181,9 +223,20 @@ NetReturn _Ack::netReadFromBuffer(Packet<_Ack> *out, const void *buffer, uint32_
         implementation::Ack
     >());
 
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+    if(len < sizeof packet->seqNum) return {sizeof packet->seqNum, NetReturn::NOT_ENOUGH_SPACE};
 
     out->seqNum = ntohl(packet->seqNum);
+
+    // Just the sequence number acks a snapshot
+    if(len < sizeof *packet) {
+        out->ackBits = 0;
+        out->channel = _Ack::SNAPSHOT;
+        return {sizeof packet->seqNum, NetReturn::OK};
+    }
+
+    if(packet->channel > _Ack::RELIABLE) return {0, NetReturn::INVALID_DATA};
+    out->ackBits = ntohl(packet->ackBits);
+    out->channel = static_cast<_Ack::Channel>(packet->channel);
     return {sizeof *packet, NetReturn::OK};
 }
 
@@ -192,239 +245,316 @@ uint32_t _Ack::getSize() const {
 }
 
 NetReturn _ServerInitialResponse::netWriteToBuffer(void *buffer, uint32_t len) const {
-    auto *packet = reinterpret_cast<implementation::ServerInitialResponse *>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type, 
-        implementation::ServerInitialResponse
-    >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
-
-    packet->majorVersion = htonl(majorVersion);
-    packet->minorVersion = htonl(minorVersion);
-    packet->playerId = playerId;
-
-    return {sizeof *packet, NetReturn::OK};
+    return implementation::ServerInitialResponse::encode(*this, buffer, len);
 }
 
 NetReturn _ServerInitialResponse::netReadFromBuffer(Packet<_ServerInitialResponse> *out, const void *buffer, uint32_t len) {
-    const auto *packet = reinterpret_cast<const implementation::ServerInitialResponse*>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type, 
-        implementation::ServerInitialResponse
-    >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
-
-    out->majorVersion = ntohl(packet->majorVersion);
-    out->minorVersion = ntohl(packet->minorVersion);
-    out->playerId = packet->playerId;
-
-    // Remember to update getSize if the size changes
-    return {sizeof *packet, NetReturn::OK};
-
+    return implementation::ServerInitialResponse::decode(*out, buffer, len);
 }
 
 uint32_t _ServerInitialResponse::getSize() const {
-    return sizeof(implementation::ServerInitialResponse);
+    return implementation::ServerInitialResponse::SIZE;
 }
 
 NetReturn _PlayerPosition::netWriteToBuffer(void *buffer, uint32_t len) const {
-    auto *packet = reinterpret_cast<implementation::PlayerPosition*>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type,
-        implementation::PlayerPosition
-    >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+    return implementation::PlayerPosition::encode(*this, buffer, len);
+}
 
-    packet->playerId = playerId;
-    packet->stateFlags = stateFlags;
-    packet->padding[0] = 0;
-    packet->padding[1] = 0;
+NetReturn _PlayerPosition::netReadFromBuffer(Packet<_PlayerPosition> *out, const void *buffer, uint32_t len) {
+    return implementation::PlayerPosition::decode(*out, buffer, len);
+}
 
-    packet->timestamp = implementation::ServerPacketTimestamp(timestamp);
+uint32_t _PlayerPosition::getSize() const {
+    return implementation::PlayerPosition::SIZE;
+}
+NetReturn _TimeQuery::netWriteToBuffer(void *, uint32_t) const {
+    return {0xDEAD, NetReturn::SYSTEM_ERROR};
+}
 
-    packet->timestamp = implementation::ServerPacketTimestamp(timestamp);
+NetReturn _TimeQuery::netReadFromBuffer(TimeQuery *out, const void *buffer, uint32_t len) {
+    return implementation::TimeQuery::decode(*out, buffer, len);
+}
 
-    packet->positionX = htonl(std::bit_cast<uint32_t>(position.x));
-    packet->positionY = htonl(std::bit_cast<uint32_t>(position.y));
-    packet->positionZ = htonl(std::bit_cast<uint32_t>(position.z));
+uint32_t _TimeQuery::getSize() const {
+    return implementation::TimeQuery::SIZE;
+}
 
-    packet->velocityX = htonl(std::bit_cast<uint32_t>(velocity.x));
-    packet->velocityY = htonl(std::bit_cast<uint32_t>(velocity.y));
-    packet->velocityZ = htonl(std::bit_cast<uint32_t>(velocity.z));
+NetReturn _TimeResponse::netWriteToBuffer(void *buffer, uint32_t len) const {
+    return implementation::TimeResponse::encode(*this, buffer, len);
+}
 
-    packet->directionX = htonl(std::bit_cast<uint32_t>(direction.x));
-    packet->directionY = htonl(std::bit_cast<uint32_t>(direction.y));
-    packet->directionZ = htonl(std::bit_cast<uint32_t>(direction.z));
+NetReturn _TimeResponse::netReadFromBuffer(TimeResponse *, const void *, uint32_t) {
+    return {0, NetReturn::INVALID_DATA};
+}
 
-    packet->currentAnimation = htonl(std::bit_cast<uint32_t>(currentAnimation));
-    packet->defaultAnimation = htonl(std::bit_cast<uint32_t>(defaultAnimation));
-    packet->animationSpeed = htonl(std::bit_cast<uint32_t>(animationSpeed));
+uint32_t _TimeResponse::getSize() const {
+    return implementation::TimeResponse::SIZE;
+}
 
-    // Remember to update getSize if the size changes
-    return {sizeof *packet, NetReturn::OK};
+NetReturn _StarPiece::netWriteToBuffer(void *buffer, uint32_t len) const {
+    return implementation::StarPiece::encode(*this, buffer, len);
 }
 
-NetReturn _PlayerPosition::netReadFromBuffer(Packet<_PlayerPosition> *out, const void *buffer, uint32_t len) {
-    const auto *packet = reinterpret_cast<const implementation::PlayerPosition*>(buffer);
+NetReturn _StarPiece::netReadFromBuffer(Packet<_StarPiece> *out, const void *buffer, uint32_t len) {
+    return implementation::StarPiece::decode(*out, buffer, len);
+}
+
+uint32_t _StarPiece::getSize() const {
+    return implementation::StarPiece::SIZE;
+}
+
+const uint16_t _WorldSnapshot::MAX_PLAYERS = 
+    (MAX_PACKET_SIZE - sizeof(implementation::WorldSnapshot)) 
+    / implementation::PlayerPosition::SIZE;
+
+NetReturn _WorldSnapshot::netWriteToBuffer(void *buffer, uint32_t len) const {
+    auto *packet = reinterpret_cast<implementation::WorldSnapshot *>(buffer);
     
     static_assert(std::is_layout_compatible<
         std::remove_reference<decltype(*packet)>::type,
-        implementation::PlayerPosition
+        implementation::WorldSnapshot
     >());
 
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+    uint32_t size = getSize();
+    if(len < size) return {size, NetReturn::NOT_ENOUGH_SPACE};
 
-    out->playerId = packet->playerId;
+    packet->tick = htonl(tick);
+    packet->numPlayers = htons(numPlayers);
+    packet->padding[0] = 0;
+    packet->padding[1] = 0;
 
-    out->stateFlags = packet->stateFlags;
-    
-    out->timestamp = packet->timestamp.toHL();
-    
-    out->position = {
-        std::bit_cast<float>(ntohl(packet->positionX)),
-        std::bit_cast<float>(ntohl(packet->positionY)),
-        std::bit_cast<float>(ntohl(packet->positionZ))
-    };
+    auto *entry = reinterpret_cast<uint8_t *>(packet + 1);
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        NetReturn res = players[i].netWriteToBuffer(entry, implementation::PlayerPosition::SIZE);
+        if(res.errorCode != NetReturn::OK) return res;
+        entry += implementation::PlayerPosition::SIZE;
+    }
 
-    out->velocity = {
-        std::bit_cast<float>(ntohl(packet->velocityX)),
-        std::bit_cast<float>(ntohl(packet->velocityY)),
-        std::bit_cast<float>(ntohl(packet->velocityZ))
-    };
-    
-    out->direction = {
-        std::bit_cast<float>(ntohl(packet->directionX)),
-        std::bit_cast<float>(ntohl(packet->directionY)),
-        std::bit_cast<float>(ntohl(packet->directionZ))
-    };
+    // Remember to update getSize if the size changes
+    return {size, NetReturn::OK};
+}
 
-    out->currentAnimation = std::bit_cast<int32_t>(ntohl(packet->currentAnimation));
-    out->defaultAnimation = std::bit_cast<int32_t>(ntohl(packet->defaultAnimation));
-    out->animationSpeed = std::bit_cast<float>(ntohl(packet->animationSpeed));
-    
+NetReturn _WorldSnapshot::netReadFromBuffer(WorldSnapshot *, const void *, uint32_t) {
+    return {0, NetReturn::INVALID_DATA};
+}
 
-    return {sizeof *packet, NetReturn::OK};
+uint32_t _WorldSnapshot::getSize() const {
+    return sizeof(implementation::WorldSnapshot) 
+        + numPlayers * implementation::PlayerPosition::SIZE;
 }
 
-uint32_t _PlayerPosition::getSize() const {
-    return sizeof(implementation::PlayerPosition);
+static int32_t quantize(float value, float scale, int32_t limit) {
+    float scaled = value * scale;
+    // Also catches NaN
+    if(!(scaled > -limit)) return -limit;
+    if(scaled > limit) return limit;
+    return static_cast<int32_t>(std::lround(scaled));
 }
-NetReturn _TimeQuery::netWriteToBuffer(void *buffer, uint32_t len) const {
-    return {0xDEAD, NetReturn::SYSTEM_ERROR};
+
+bool CompactPosition::inRange(const Vec &position, const Vec &origin) {
+    const float limit = POSITION_LIMIT / POSITION_SCALE;
+    Vec d = position - origin;
+    return std::fabs(d.x) < limit && std::fabs(d.y) < limit && std::fabs(d.z) < limit;
 }
 
-NetReturn _TimeQuery::netReadFromBuffer(TimeQuery *out, const void *buffer, uint32_t len) {
-    const auto *packet = reinterpret_cast<const implementation::TimeQuery*>(buffer);
-    
-    static_assert(std::is_layout_compatible<
-        std::remove_reference<decltype(*packet)>::type,
-        implementation::TimeQuery
-    >());
+CompactPosition::CompactPosition(const PlayerPosition &pos, const Vec &origin) 
+    : playerId(pos.playerId), stateFlags(pos.stateFlags), timestamp(pos.timestamp.t.timeMs),
+    currentAnimation(pos.currentAnimation), defaultAnimation(pos.defaultAnimation)
+{
+    Vec d = pos.position - origin;
+    position[0] = quantize(d.x, POSITION_SCALE, POSITION_LIMIT);
+    position[1] = quantize(d.y, POSITION_SCALE, POSITION_LIMIT);
+    position[2] = quantize(d.z, POSITION_SCALE, POSITION_LIMIT);
+
+    velocity[0] = quantize(pos.velocity.x, VELOCITY_SCALE, INT16_MAX);
+    velocity[1] = quantize(pos.velocity.y, VELOCITY_SCALE, INT16_MAX);
+    velocity[2] = quantize(pos.velocity.z, VELOCITY_SCALE, INT16_MAX);
+
+    // Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower
+    // half over the upper one, leaving two coordinates in [-1, 1]
+    const Vec &n = pos.direction;
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float u = 0.0f, v = 0.0f;
+    if(l1 > 0.0f) {
+        u = n.x / l1;
+        v = n.y / l1;
+        if(n.z < 0.0f) {
+            float foldedU = (1.0f - std::fabs(v)) * (u < 0.0f ? -1.0f : 1.0f);
+            v = (1.0f - std::fabs(u)) * (v < 0.0f ? -1.0f : 1.0f);
+            u = foldedU;
+        }
+    }
+    direction[0] = quantize(u, INT16_MAX, INT16_MAX);
+    direction[1] = quantize(v, INT16_MAX, INT16_MAX);
 
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+    animationSpeed = quantize(pos.animationSpeed, ANIMATION_SPEED_SCALE, INT16_MAX);
+}
 
-    out->timeMs = ntohl(packet->timeMs);
-    out->check = packet->check.toCode();
+static uint8_t compactFields(const CompactPosition &p, const CompactPosition *base) {
+    if(base == nullptr) return implementation::C_ALL;
+
+    uint8_t fields = 0;
+    if(p.timestamp != base->timestamp) fields |= implementation::C_TIMESTAMP;
+    if(memcmp(p.position, base->position, sizeof p.position)) fields |= implementation::C_POSITION;
+    if(memcmp(p.velocity, base->velocity, sizeof p.velocity)) fields |= implementation::C_VELOCITY;
+    if(memcmp(p.direction, base->direction, sizeof p.direction)) fields |= implementation::C_DIRECTION;
+    if(p.currentAnimation != base->currentAnimation 
+        || p.defaultAnimation != base->defaultAnimation) fields |= implementation::C_ANIMATION;
+    if(p.animationSpeed != base->animationSpeed) fields |= implementation::C_ANIMATION_SPEED;
+    return fields;
+}
 
-    return {sizeof *packet, NetReturn::OK};
+static uint32_t compactEntrySize(uint8_t fields) {
+    uint32_t size = implementation::COMPACT_ENTRY_HEADER_SIZE;
+    if(fields & implementation::C_TIMESTAMP) size += 4;
+    if(fields & implementation::C_POSITION) size += 9;
+    if(fields & implementation::C_VELOCITY) size += 6;
+    if(fields & implementation::C_DIRECTION) size += 4;
+    if(fields & implementation::C_ANIMATION) size += 8;
+    if(fields & implementation::C_ANIMATION_SPEED) size += 2;
+    return size;
 }
 
-uint32_t _TimeQuery::getSize() const {
-    return sizeof(implementation::TimeQuery);
+// Writes the low `bytes` bytes of `value`, most significant first
+static uint8_t* putBigEndian(uint8_t *out, uint32_t value, uint32_t bytes) {
+    for(uint32_t i = bytes; i > 0; i--) *out++ = value >> (8 * (i - 1));
+    return out;
 }
 
-NetReturn _TimeResponse::netWriteToBuffer(void *buffer, uint32_t len) const {
-    auto *packet = reinterpret_cast<implementation::TimeResponse*>(buffer);
+const uint16_t _CompactSnapshot::MAX_PLAYERS = 
+    (MAX_PACKET_SIZE - sizeof(implementation::CompactSnapshot)) 
+    / implementation::COMPACT_ENTRY_MAX_SIZE;
+
+NetReturn _CompactSnapshot::netWriteToBuffer(void *buffer, uint32_t len) const {
+    auto *packet = reinterpret_cast<implementation::CompactSnapshot *>(buffer);
     
     static_assert(std::is_layout_compatible<
         std::remove_reference<decltype(*packet)>::type,
-        implementation::TimeResponse
+        implementation::CompactSnapshot
     >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
 
-    packet->timeMs = htonl(timeMs);
-    packet->check = implementation::ReliablePacket(check);
+    uint32_t size = getSize();
+    if(len < size) return {size, NetReturn::NOT_ENOUGH_SPACE};
+
+    packet->tick = htonl(tick);
+    packet->baselineTick = htonl(baselineTick);
+    packet->originX = htonl(std::bit_cast<uint32_t>(origin.x));
+    packet->originY = htonl(std::bit_cast<uint32_t>(origin.y));
+    packet->originZ = htonl(std::bit_cast<uint32_t>(origin.z));
+    packet->numPlayers = htons(numPlayers);
+    packet->chunk = chunk;
+    packet->padding = 0;
+
+    auto *out = reinterpret_cast<uint8_t *>(packet + 1);
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        const CompactPosition &p = players[i];
+        uint8_t fields = compactFields(p, baseline ? baseline[i] : nullptr);
+
+        *out++ = p.playerId & 0xFF;
+        *out++ = p.playerId >> 8;
+        *out++ = fields;
+        *out++ = p.stateFlags;
+
+        if(fields & implementation::C_TIMESTAMP) {
+            out = putBigEndian(out, p.timestamp, 4);
+        }
+        if(fields & implementation::C_POSITION) {
+            for(int32_t c : p.position) out = putBigEndian(out, c, 3);
+        }
+        if(fields & implementation::C_VELOCITY) {
+            for(int16_t c : p.velocity) out = putBigEndian(out, c, 2);
+        }
+        if(fields & implementation::C_DIRECTION) {
+            for(int16_t c : p.direction) out = putBigEndian(out, c, 2);
+        }
+        if(fields & implementation::C_ANIMATION) {
+            out = putBigEndian(out, p.currentAnimation, 4);
+            out = putBigEndian(out, p.defaultAnimation, 4);
+        }
+        if(fields & implementation::C_ANIMATION_SPEED) {
+            out = putBigEndian(out, p.animationSpeed, 2);
+        }
+    }
 
-    return {sizeof *packet, NetReturn::OK};
+    // Remember to update getSize if the size changes
+    return {size, NetReturn::OK};
 }
 
-NetReturn _TimeResponse::netReadFromBuffer(TimeResponse *, const void *, uint32_t) {
+NetReturn _CompactSnapshot::netReadFromBuffer(CompactSnapshot *, const void *, uint32_t) {
     return {0, NetReturn::INVALID_DATA};
 }
 
-uint32_t _TimeResponse::getSize() const {
-    return sizeof(implementation::TimeResponse);
+uint32_t _CompactSnapshot::getSize() const {
+    uint32_t size = sizeof(implementation::CompactSnapshot);
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        size += compactEntrySize(compactFields(players[i], baseline ? baseline[i] : nullptr));
+    }
+    return size;
 }
 
-NetReturn _StarPiece::netWriteToBuffer(void *buffer, uint32_t len) const {
-    auto *packet = reinterpret_cast<implementation::StarPiece *>(buffer);
+const uint32_t _Reliable::HEADER_SIZE = sizeof(implementation::Reliable);
+
+NetReturn _Reliable::netWriteToBuffer(void *buffer, uint32_t len) const {
+    auto *packet = reinterpret_cast<implementation::Reliable *>(buffer);
     
     static_assert(std::is_layout_compatible<
         std::remove_reference<decltype(*packet)>::type,
-        implementation::StarPiece
+        implementation::Reliable
     >());
-    
-    if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
 
-    packet->playerId = playerId;
+    uint32_t size = getSize();
+    if(len < size) return {size, NetReturn::NOT_ENOUGH_SPACE};
+
+    packet->check = implementation::ReliablePacket(check);
+    packet->flags = flags;
     packet->padding[0] = 0;
     packet->padding[1] = 0;
     packet->padding[2] = 0;
+    packet->innerTag = htonl(static_cast<uint32_t>(innerTag));
 
-    packet->timestamp = implementation::ServerPacketTimestamp(timestamp);
+    // The payload may already be in place
+    memmove(packet + 1, payload, payloadSize);
 
-    packet->initLineStartX = htonl(std::bit_cast<uint32_t>(initLineStart.x));
-    packet->initLineStartY = htonl(std::bit_cast<uint32_t>(initLineStart.y));
-    packet->initLineStartZ = htonl(std::bit_cast<uint32_t>(initLineStart.z));
-    
-    packet->initLineEndX = htonl(std::bit_cast<uint32_t>(initLineEnd.x));
-    packet->initLineEndY = htonl(std::bit_cast<uint32_t>(initLineEnd.y));
-    packet->initLineEndZ = htonl(std::bit_cast<uint32_t>(initLineEnd.z));
-    
     // Remember to update getSize if the size changes
-    return {sizeof *packet, NetReturn::OK};
+    return {size, NetReturn::OK};
 }
 
-NetReturn _StarPiece::netReadFromBuffer(Packet<_StarPiece> *out, const void *buffer, uint32_t len) {
-    const auto *packet = reinterpret_cast<const implementation::StarPiece*>(buffer);
+NetReturn _Reliable::netReadFromBuffer(Reliable *out, const void *buffer, uint32_t len) {
+    const auto *packet = reinterpret_cast<const implementation::Reliable *>(buffer);
     
     static_assert(std::is_layout_compatible<
         std::remove_reference<decltype(*packet)>::type,
-        implementation::StarPiece
+        implementation::Reliable
     >());
 
     if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
 
-    out->playerId = packet->playerId;
+    uint32_t innerTag = ntohl(packet->innerTag);
+    if(innerTag >= static_cast<uint32_t>(Tag::MAX_TAG)) return {0, NetReturn::INVALID_DATA};
 
-    out->timestamp = packet->timestamp.toHL();
-    
-    out->initLineStart = {
-        std::bit_cast<float>(ntohl(packet->initLineStartX)),
-        std::bit_cast<float>(ntohl(packet->initLineStartY)),
-        std::bit_cast<float>(ntohl(packet->initLineStartZ))
-    };
-    
-    out->initLineEnd = {
-        std::bit_cast<float>(ntohl(packet->initLineEndX)),
-        std::bit_cast<float>(ntohl(packet->initLineEndY)),
-        std::bit_cast<float>(ntohl(packet->initLineEndZ))
-    };
+    out->check = packet->check.toCode();
+    out->flags = packet->flags;
+    out->innerTag = static_cast<Tag>(innerTag);
+    out->payload = packet + 1;
+    out->payloadSize = len - sizeof *packet;
 
-    return {sizeof *packet, NetReturn::OK};
+    return {len, NetReturn::OK};
 }
 
-uint32_t _StarPiece::getSize() const {
-    return sizeof(implementation::StarPiece);
+uint32_t _Reliable::getSize() const {
+    return sizeof(implementation::Reliable) + payloadSize;
 }
 
+NetReturn _Keepalive::netWriteToBuffer(void *buffer, uint32_t len) const {
+    return implementation::Keepalive::encode(*this, buffer, len);
+}
 
+NetReturn _Keepalive::netReadFromBuffer(Keepalive *out, const void *buffer, uint32_t len) {
+    return implementation::Keepalive::decode(*out, buffer, len);
 }
 
+uint32_t _Keepalive::getSize() const {
+    return implementation::Keepalive::SIZE;
+}
+
+}
@@ -0,0 +1,388 @@
+#include "pipeline.hpp"
+#include "metrics.hpp"
+#include "capture.hpp"
+#include "clock.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+}
+
+namespace Pipeline {
+
+Ring::Ring(size_t len, uint32_t numStages)
+    : len(alignDown(len, ENTRY_ALIGNMENT)), numStages(numStages), writePosition(0), reclaimed(0)
+{
+    buffer = new(std::align_val_t(ENTRY_ALIGNMENT)) uint8_t[this->len];
+    for(Cursor &c : cursors) c.published.store(0, std::memory_order_relaxed);
+}
+
+Ring::~Ring() {
+    ::operator delete[](buffer, std::align_val_t(ENTRY_ALIGNMENT));
+}
+
+Entry* Ring::reserve(uint32_t packetSize) {
+    const uint32_t size = entrySize(packetSize);
+    const size_t offset = writePosition % len;
+    // What reaches the end of the ring goes to WRAP if the entry doesn't fit
+    const size_t skipped = len - offset < size ? len - offset : 0;
+
+    if(writePosition + skipped + size - reclaimed > len) {
+        reclaimed = published(numStages - 1);
+        if(writePosition + skipped + size - reclaimed > len) return nullptr;
+    }
+
+    if(skipped > 0) {
+        auto *wrap = reinterpret_cast<Entry *>(buffer + offset);
+        wrap->code = Entry::WRAP;
+        wrap->next = skipped;
+        writePosition += skipped;
+    }
+
+    auto *e = reinterpret_cast<Entry *>(buffer + writePosition % len);
+    e->next = size;
+    return e;
+}
+
+PacketPipe::PacketPipe(int socket, size_t ringLen, Transmission::ConnectionHolder *holder,
+    ConnectionId capacity)
+    : inbound(ringLen, 3), outbound(ringLen, 2), socket(socket), holder(holder),
+    readyFd(-1), sendFd(-1), stopFd(-1), stopping(false), kernelDrops(0), metrics(nullptr), capture(nullptr),
+    readPosition(0), processPosition(0), batchEnd(0), batchStamp(0), unpublished(false),
+    latest(nullptr), numLatest(0), sendEpoch(1),
+    mirrorConnections(new Transmission::Connection[capacity]), mirror(mirrorConnections, capacity),
+    relayWriter(socket, &mirror), publishedNs(0) {}
+
+PacketPipe::~PacketPipe() {
+    stop();
+    if(readyFd >= 0) close(readyFd);
+    if(sendFd >= 0) close(sendFd);
+    if(stopFd >= 0) close(stopFd);
+    delete[] mirrorConnections;
+}
+
+NetReturn PacketPipe::start() {
+    readyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sendFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(readyFd < 0 || sendFd < 0 || stopFd < 0) {
+        return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+    }
+
+    receiver = std::thread(&PacketPipe::receive, this);
+    sender = std::thread(&PacketPipe::send, this);
+    return {0, NetReturn::OK};
+}
+
+void PacketPipe::stop() {
+    if(!receiver.joinable()) return;
+
+    publish();
+    stopping.store(true, std::memory_order_release);
+    signal(stopFd);
+    receiver.join();
+    sender.join();
+}
+
+void PacketPipe::signal(int fd) {
+    uint64_t one = 1;
+    while(write(fd, &one, sizeof one) < 0 && errno == EINTR);
+}
+
+static void drainFd(int fd) {
+    uint64_t count;
+    while(read(fd, &count, sizeof count) < 0 && errno == EINTR);
+}
+
+void PacketPipe::setMetrics(Metrics::Recorder *recorder) {
+    metrics = recorder;
+    if(metrics) metrics->setRingCapacity(inbound.getCapacity());
+}
+
+// Reserves full-size entries up front, since we don't know how large each
+// datagram is until recvmmsg returns, and gives back the ones left unused
+void PacketPipe::receive() {
+    constexpr uint32_t BATCH = Transmission::Reader::MAX_BATCH_SIZE;
+    mmsghdr msgs[BATCH];
+    iovec iovs[BATCH];
+    alignas(cmsghdr) uint8_t controls[BATCH][Transmission::RECEIVE_CONTROL_SIZE];
+    Entry *entries[BATCH];
+    uint64_t positions[BATCH];
+
+    pollfd fds[2] = {{socket, POLLIN, 0}, {stopFd, POLLIN, 0}};
+
+    while(!stopping.load(std::memory_order_acquire)) {
+        const uint64_t start = inbound.tell();
+        uint32_t count = 0;
+        while(count < BATCH) {
+            Entry *e = inbound.reserve(Packets::MAX_PACKET_SIZE);
+            if(e == nullptr) break;
+
+            entries[count] = e;
+            positions[count] = inbound.tell();
+            iovs[count] = {packetOf(e) - sizeof(Packets::Tag),
+                Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag)};
+            memset(&msgs[count].msg_hdr, 0, sizeof msgs[count].msg_hdr);
+            msgs[count].msg_hdr.msg_name = &e->addr;
+            msgs[count].msg_hdr.msg_namelen = sizeof e->addr;
+            msgs[count].msg_hdr.msg_iov = iovs + count;
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            msgs[count].msg_hdr.msg_control = controls[count];
+            msgs[count].msg_hdr.msg_controllen = sizeof controls[count];
+            inbound.commit(e);
+            count++;
+        }
+
+        // Nothing is taken off the socket until the send thread catches up
+        if(count == 0) {
+            poll(fds + 1, 1, 1);
+            continue;
+        }
+
+        int received = recvmmsg(socket, msgs, count, MSG_DONTWAIT, nullptr);
+        if(received <= 0) {
+            inbound.rewind(start);
+            if(received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("(PacketPipe::receive) Failed to read from socket");
+            }
+            poll(fds, 2, -1);
+            continue;
+        }
+
+        const uint64_t now = Metrics::nowNs();
+        const uint64_t realtimeNow = Clock::realtimeNs();
+        uint32_t drops = kernelDrops.load(std::memory_order_relaxed);
+        for(int i = 0; i < received; i++) {
+            Entry *e = entries[i];
+            const uint32_t len = msgs[i].msg_len;
+            e->code = len >= sizeof(Packets::Tag) ? Entry::PACKET : Entry::INVALID;
+            e->size = len >= sizeof(Packets::Tag) ? len - sizeof(Packets::Tag) : len;
+            e->stampNs = now;
+
+            uint64_t kernelNs = 0;
+            Transmission::readReceiveStamps(msgs[i].msg_hdr, &kernelNs, &drops);
+            e->arrivalNs = Transmission::toMonotonicNs(kernelNs, realtimeNow, now);
+        }
+        kernelDrops.store(drops, std::memory_order_relaxed);
+        // The last one only takes as much room as it needs
+        Entry *last = entries[received - 1];
+        last->next = entrySize(last->size);
+        inbound.rewind(positions[received - 1] + last->next);
+
+        inbound.publish();
+        signal(readyFd);
+    }
+}
+
+NetReturn PacketPipe::readPackets(uint32_t maxPackets, ReadBatchInfo *info) {
+    if(info) *info = {0, 0};
+
+    uint64_t end = inbound.published(0);
+    if(readPosition == end) {
+        // Anything published after this wakes the logic thread again
+        drainFd(readyFd);
+        end = inbound.published(0);
+    }
+
+    if(metrics) metrics->setKernelDrops(kernelDrops.load(std::memory_order_relaxed));
+
+    uint32_t numRead = 0, numAccepted = 0;
+    while(readPosition != end && numRead < maxPackets) {
+        Entry *e = inbound.at(readPosition);
+        if(numRead++ == 0) batchStamp = e->stampNs;
+
+        NetReturn id = {0, NetReturn::INVALID_DATA};
+        if(e->code == Entry::PACKET) id = holder->getId(&e->addr);
+
+        if(capture) {
+            const bool known = id.errorCode == NetReturn::OK || id.errorCode == NetReturn::CANDIDATE;
+            capture->append(e->stampNs, e->addr, 
+                known ? id.bytes : Transmission::ConnectionHolder::NO_CONNECTION,
+                packetOf(e) - sizeof(Packets::Tag),
+                e->code == Entry::PACKET ? e->size + sizeof(Packets::Tag) : e->size);
+        }
+
+        if(id.errorCode == NetReturn::OK || id.errorCode == NetReturn::CANDIDATE) {
+            e->destination = id.bytes;
+            numAccepted++;
+            if(metrics) {
+                metrics->receive(tagOf(e), e->size + sizeof(Packets::Tag));
+                if(e->arrivalNs != 0) metrics->kernelToRead.record(e->stampNs - e->arrivalNs);
+            }
+        }
+        else {
+            e->code = Entry::SKIP;
+            if(info) {
+                if(id.errorCode == NetReturn::FILTERED) info->filtered++;
+                else info->invalid++;
+            }
+            if(metrics) metrics->drop(id.errorCode);
+        }
+        readPosition += e->next;
+    }
+
+    batchEnd = readPosition;
+    return {numAccepted, NetReturn::OK};
+}
+
+bool PacketPipe::nextPacket() {
+    while(processPosition != batchEnd) {
+        Entry *e = inbound.at(processPosition);
+        if(e->code == Entry::PACKET) return true;
+        processPosition += e->next;
+    }
+    return false;
+}
+
+void PacketPipe::finishProcessing() {
+    processPosition += current()->next;
+}
+
+bool PacketPipe::supersede(uint32_t key) {
+    if(key >= numLatest) return false;
+
+    LatestSlot &slot = latest[key];
+    Entry *e = current();
+    bool skipped = false;
+    if(slot.sendEpoch == sendEpoch && slot.packet != reinterpret_cast<uint8_t *>(e)) {
+        auto *previous = reinterpret_cast<Entry *>(slot.packet);
+        skipped = previous->code == Entry::PACKET;
+        previous->code = Entry::SKIP;
+    }
+    slot.packet = reinterpret_cast<uint8_t *>(e);
+    slot.sendEpoch = sendEpoch;
+    return skipped;
+}
+
+void PacketPipe::publish() {
+    if(!unpublished && processPosition == inbound.published(1)) return;
+    unpublished = false;
+    sendEpoch++;
+
+    publishedNs.store(Metrics::nowNs(), std::memory_order_relaxed);
+    inbound.publish(1, processPosition);
+    outbound.publish();
+    signal(sendFd);
+}
+
+NetReturn PacketPipe::sendPackets(Transmission::Writer &writer) {
+    publish();
+    return writer.flush();
+}
+
+Entry* PacketPipe::reserveOutbound(uint32_t size) {
+    if(!outbound.fits(size)) return nullptr;
+
+    Entry *e = outbound.reserve(size);
+    if(e == nullptr) {
+        // Only the outbound ring. The batch's inbound entries can still be
+        // read until sendPackets, snapshot mode decodes positions at the end
+        // of the batch, and the receive thread would reuse them once sent.
+        outbound.publish();
+        signal(sendFd);
+        while((e = outbound.reserve(size)) == nullptr) std::this_thread::yield();
+    }
+    return e;
+}
+
+void PacketPipe::queueControl(Entry::Code code, ConnectionId id, uint32_t size, const sockaddr_in *addr) {
+    Entry *e = reserveOutbound(0);
+    e->code = code;
+    e->size = size;
+    e->destination = id;
+    if(addr) e->addr = *addr;
+    outbound.commit(e);
+    unpublished = true;
+}
+
+// Returns the number of packets queued on the writer
+uint32_t PacketPipe::drainOutbound(uint64_t &position, uint64_t end) {
+    uint32_t numPackets = 0;
+    while(position != end) {
+        Entry *e = outbound.at(position);
+        switch(e->code) {
+            case Entry::PACKET:
+            {
+                const uint64_t queued = relayWriter.getStats().queued;
+                relayWriter.queue(packetOf(e) - sizeof(Packets::Tag), e->size + sizeof(Packets::Tag),
+                    e->destination);
+                if(metrics) {
+                    metrics->send(tagOf(e), e->size + sizeof(Packets::Tag),
+                        relayWriter.getStats().queued - queued);
+                }
+                numPackets++;
+                break;
+            }
+            case Entry::CONNECT:
+                mirror.mirrorConnection(e->destination, &e->addr);
+                break;
+            case Entry::DISCONNECT:
+                mirror.purgeConnection(e->destination);
+                break;
+            case Entry::GROUP:
+                mirror.setGroup(e->destination, e->size);
+                break;
+            default:
+                break;
+        }
+        position += e->next;
+    }
+    return numPackets;
+}
+
+uint32_t PacketPipe::drainInbound(uint64_t &position, uint64_t end) {
+    uint32_t numPackets = 0;
+    const uint64_t sendNs = metrics && position != end ? Metrics::nowNs() : 0;
+    while(position != end) {
+        Entry *e = inbound.at(position);
+        if(e->code == Entry::PACKET) {
+            const uint64_t queued = relayWriter.getStats().queued;
+            relayWriter.queue(packetOf(e) - sizeof(Packets::Tag), e->size + sizeof(Packets::Tag),
+                e->destination);
+            if(metrics) {
+                metrics->send(tagOf(e), e->size + sizeof(Packets::Tag),
+                    relayWriter.getStats().queued - queued);
+                if(e->arrivalNs != 0) metrics->kernelToSend.record(sendNs - e->arrivalNs);
+            }
+            numPackets++;
+        }
+        position += e->next;
+    }
+    return numPackets;
+}
+
+// Connection changes come before the relayed packets, so nobody who just
+// connected misses them. Entries are only given back once sendmmsg is done
+// with them.
+void PacketPipe::send() {
+    pollfd fds[2] = {{sendFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    uint64_t outPosition = 0, inPosition = 0;
+
+    while(true) {
+        while(poll(fds, 2, -1) < 0 && errno == EINTR);
+        drainFd(sendFd);
+
+        const bool last = stopping.load(std::memory_order_acquire);
+        const uint64_t stamp = publishedNs.load(std::memory_order_relaxed);
+
+        uint32_t numPackets = drainOutbound(outPosition, outbound.published(0));
+        numPackets += drainInbound(inPosition, inbound.published(1));
+        relayWriter.flush();
+
+        outbound.publish(1, outPosition);
+        inbound.publish(2, inPosition);
+
+        if(metrics && numPackets > 0) {
+            metrics->processToSend.record(Metrics::nowNs() - stamp, numPackets);
+        }
+        if(last) break;
+    }
+}
+
+}
@@ -0,0 +1,316 @@
+#include "players.hpp"
+
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PLAYERS_X86
+#include <immintrin.h>
+#endif
+
+namespace Player {
+
+namespace {
+
+constexpr size_t ALIGNMENT = Store::LANES * sizeof(float);
+// position, velocity and direction, timestamp, both animations, animation
+// speed and the update count, in that order
+constexpr size_t NUM_COLUMNS = 3 * 3 + 5;
+
+// The kernels take the columns they read and handle players [0, count).
+// The AVX2 ones do eight at a time and leave the rest to the scalar ones.
+
+struct Columns {
+    const float *x;
+    const float *y;
+    const float *z;
+};
+
+inline float distanceSquared(const Columns &p, uint32_t i, const Vec &point) {
+    const float dx = p.x[i] - point.x;
+    const float dy = p.y[i] - point.y;
+    const float dz = p.z[i] - point.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+void distancesScalar(const Columns &p, uint32_t first, uint32_t count, const Vec &point, float *out) {
+    for(uint32_t i = first; i < count; i++) out[i] = distanceSquared(p, i, point);
+}
+
+uint32_t withinScalar(const Columns &p, const ConnectionId *ids, uint32_t first, uint32_t count,
+    const Vec &point, float radiusSquared, ConnectionId except, ConnectionId *out,
+    uint32_t written, uint32_t maxCount)
+{
+    for(uint32_t i = first; i < count && written < maxCount; i++) {
+        if(distanceSquared(p, i, point) <= radiusSquared && ids[i] != except) out[written++] = ids[i];
+    }
+    return written;
+}
+
+uint32_t insideScalar(const Columns &p, const ConnectionId *ids, uint32_t first, uint32_t count,
+    const Vec &min, const Vec &max, ConnectionId *out, uint32_t written, uint32_t maxCount)
+{
+    for(uint32_t i = first; i < count && written < maxCount; i++) {
+        if(p.x[i] >= min.x && p.x[i] <= max.x && p.y[i] >= min.y && p.y[i] <= max.y
+            && p.z[i] >= min.z && p.z[i] <= max.z) out[written++] = ids[i];
+    }
+    return written;
+}
+
+void boundsScalar(const Columns &p, uint32_t first, uint32_t count, Vec *min, Vec *max) {
+    for(uint32_t i = first; i < count; i++) {
+        if(p.x[i] < min->x) min->x = p.x[i];
+        if(p.y[i] < min->y) min->y = p.y[i];
+        if(p.z[i] < min->z) min->z = p.z[i];
+        if(p.x[i] > max->x) max->x = p.x[i];
+        if(p.y[i] > max->y) max->y = p.y[i];
+        if(p.z[i] > max->z) max->z = p.z[i];
+    }
+}
+
+void extrapolateScalar(const Columns &p, const Columns &v, uint32_t first, uint32_t count,
+    float steps, float *outX, float *outY, float *outZ)
+{
+    for(uint32_t i = first; i < count; i++) {
+        outX[i] = p.x[i] + v.x[i] * steps;
+        outY[i] = p.y[i] + v.y[i] * steps;
+        outZ[i] = p.z[i] + v.z[i] * steps;
+    }
+}
+
+#ifdef PLAYERS_X86
+
+// Columns are aligned, so loads are too. No FMA, so the results match the
+// scalar kernels bit for bit.
+
+__attribute__((target("avx2")))
+inline __m256 distanceSquared8(const Columns &p, uint32_t i, __m256 px, __m256 py, __m256 pz) {
+    const __m256 dx = _mm256_sub_ps(_mm256_load_ps(p.x + i), px);
+    const __m256 dy = _mm256_sub_ps(_mm256_load_ps(p.y + i), py);
+    const __m256 dz = _mm256_sub_ps(_mm256_load_ps(p.z + i), pz);
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+}
+
+// Appends the ids of the lanes set in `mask`, other than `except`
+inline uint32_t appendLanes(uint32_t mask, const ConnectionId *ids, ConnectionId except,
+    ConnectionId *out, uint32_t written, uint32_t maxCount)
+{
+    while(mask != 0 && written < maxCount) {
+        const ConnectionId id = ids[__builtin_ctz(mask)];
+        if(id != except) out[written++] = id;
+        mask &= mask - 1;
+    }
+    return written;
+}
+
+__attribute__((target("avx2")))
+void distancesAvx2(const Columns &p, uint32_t count, const Vec &point, float *out) {
+    const __m256 px = _mm256_set1_ps(point.x), py = _mm256_set1_ps(point.y), pz = _mm256_set1_ps(point.z);
+
+    uint32_t i = 0;
+    for(; i + Store::LANES <= count; i += Store::LANES) {
+        _mm256_storeu_ps(out + i, distanceSquared8(p, i, px, py, pz));
+    }
+    distancesScalar(p, i, count, point, out);
+}
+
+__attribute__((target("avx2")))
+uint32_t withinAvx2(const Columns &p, const ConnectionId *ids, uint32_t count,
+    const Vec &point, float radiusSquared, ConnectionId except, ConnectionId *out, uint32_t maxCount)
+{
+    const __m256 px = _mm256_set1_ps(point.x), py = _mm256_set1_ps(point.y), pz = _mm256_set1_ps(point.z);
+    const __m256 r2 = _mm256_set1_ps(radiusSquared);
+
+    uint32_t i = 0, written = 0;
+    for(; i + Store::LANES <= count && written < maxCount; i += Store::LANES) {
+        const __m256 inRange = _mm256_cmp_ps(distanceSquared8(p, i, px, py, pz), r2, _CMP_LE_OQ);
+        written = appendLanes(_mm256_movemask_ps(inRange), ids + i, except, out, written, maxCount);
+    }
+    return withinScalar(p, ids, i, count, point, radiusSquared, except, out, written, maxCount);
+}
+
+__attribute__((target("avx2")))
+uint32_t insideAvx2(const Columns &p, const ConnectionId *ids, uint32_t count,
+    const Vec &min, const Vec &max, ConnectionId *out, uint32_t maxCount)
+{
+    const __m256 minX = _mm256_set1_ps(min.x), minY = _mm256_set1_ps(min.y), minZ = _mm256_set1_ps(min.z);
+    const __m256 maxX = _mm256_set1_ps(max.x), maxY = _mm256_set1_ps(max.y), maxZ = _mm256_set1_ps(max.z);
+
+    uint32_t i = 0, written = 0;
+    for(; i + Store::LANES <= count && written < maxCount; i += Store::LANES) {
+        const __m256 x = _mm256_load_ps(p.x + i), y = _mm256_load_ps(p.y + i), z = _mm256_load_ps(p.z + i);
+        __m256 in = _mm256_and_ps(_mm256_cmp_ps(x, minX, _CMP_GE_OQ), _mm256_cmp_ps(x, maxX, _CMP_LE_OQ));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(y, minY, _CMP_GE_OQ), _mm256_cmp_ps(y, maxY, _CMP_LE_OQ)));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(z, minZ, _CMP_GE_OQ), _mm256_cmp_ps(z, maxZ, _CMP_LE_OQ)));
+        written = appendLanes(_mm256_movemask_ps(in), ids + i, Store::NONE, out, written, maxCount);
+    }
+    return insideScalar(p, ids, i, count, min, max, out, written, maxCount);
+}
+
+__attribute__((target("avx2")))
+void boundsAvx2(const Columns &p, uint32_t count, Vec *min, Vec *max) {
+    __m256 minX = _mm256_set1_ps(min->x), minY = _mm256_set1_ps(min->y), minZ = _mm256_set1_ps(min->z);
+    __m256 maxX = _mm256_set1_ps(max->x), maxY = _mm256_set1_ps(max->y), maxZ = _mm256_set1_ps(max->z);
+
+    uint32_t i = 0;
+    for(; i + Store::LANES <= count; i += Store::LANES) {
+        const __m256 x = _mm256_load_ps(p.x + i), y = _mm256_load_ps(p.y + i), z = _mm256_load_ps(p.z + i);
+        minX = _mm256_min_ps(minX, x);
+        minY = _mm256_min_ps(minY, y);
+        minZ = _mm256_min_ps(minZ, z);
+        maxX = _mm256_max_ps(maxX, x);
+        maxY = _mm256_max_ps(maxY, y);
+        maxZ = _mm256_max_ps(maxZ, z);
+    }
+
+    alignas(ALIGNMENT) float lanes[6][Store::LANES];
+    _mm256_store_ps(lanes[0], minX);
+    _mm256_store_ps(lanes[1], minY);
+    _mm256_store_ps(lanes[2], minZ);
+    _mm256_store_ps(lanes[3], maxX);
+    _mm256_store_ps(lanes[4], maxY);
+    _mm256_store_ps(lanes[5], maxZ);
+    const Columns lows = {lanes[0], lanes[1], lanes[2]};
+    const Columns highs = {lanes[3], lanes[4], lanes[5]};
+    boundsScalar(lows, 0, Store::LANES, min, max);
+    boundsScalar(highs, 0, Store::LANES, min, max);
+
+    boundsScalar(p, i, count, min, max);
+}
+
+__attribute__((target("avx2")))
+void extrapolateAvx2(const Columns &p, const Columns &v, uint32_t count,
+    float steps, float *outX, float *outY, float *outZ)
+{
+    const __m256 s = _mm256_set1_ps(steps);
+
+    uint32_t i = 0;
+    for(; i + Store::LANES <= count; i += Store::LANES) {
+        _mm256_storeu_ps(outX + i, _mm256_add_ps(_mm256_load_ps(p.x + i), _mm256_mul_ps(_mm256_load_ps(v.x + i), s)));
+        _mm256_storeu_ps(outY + i, _mm256_add_ps(_mm256_load_ps(p.y + i), _mm256_mul_ps(_mm256_load_ps(v.y + i), s)));
+        _mm256_storeu_ps(outZ + i, _mm256_add_ps(_mm256_load_ps(p.z + i), _mm256_mul_ps(_mm256_load_ps(v.z + i), s)));
+    }
+    extrapolateScalar(p, v, i, count, steps, outX, outY, outZ);
+}
+
+inline bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+}
+
+Store::Store(ConnectionId _capacity) : capacity(_capacity), numActive(0) {
+    stride = alignUp(static_cast<size_t>(capacity), LANES);
+
+    slots = new ConnectionId[capacity];
+    ids = new ConnectionId[capacity];
+    for(ConnectionId id = 0; id < capacity; id++) slots[id] = NONE;
+
+    columns = static_cast<float *>(::operator new[](NUM_COLUMNS * stride * sizeof(float),
+        std::align_val_t(ALIGNMENT)));
+    for(uint32_t c = 0; c < 3; c++) {
+        position[c] = columns + c * stride;
+        velocity[c] = columns + (3 + c) * stride;
+        direction[c] = columns + (6 + c) * stride;
+    }
+    timestampMs = reinterpret_cast<int32_t *>(columns + 9 * stride);
+    currentAnimation = reinterpret_cast<int32_t *>(columns + 10 * stride);
+    defaultAnimation = reinterpret_cast<int32_t *>(columns + 11 * stride);
+    animationSpeed = columns + 12 * stride;
+    numUpdates = reinterpret_cast<uint32_t *>(columns + 13 * stride);
+    stateFlags = new uint8_t[capacity];
+}
+
+Store::~Store() {
+    delete[] slots;
+    delete[] ids;
+    ::operator delete[](columns, std::align_val_t(ALIGNMENT));
+    delete[] stateFlags;
+}
+
+ConnectionId Store::activate(ConnectionId id) {
+    if(slots[id] != NONE) return slots[id];
+
+    const ConnectionId slot = numActive++;
+    slots[id] = slot;
+    ids[slot] = id;
+
+    setVecAt(position, slot, Vec::zero());
+    setVecAt(velocity, slot, Vec::zero());
+    setVecAt(direction, slot, Vec::zero());
+    currentAnimation[slot] = -1;
+    defaultAnimation[slot] = -1;
+    animationSpeed[slot] = 0.0f;
+    stateFlags[slot] = 0;
+    numUpdates[slot] = 0;
+    return slot;
+}
+
+void Store::deactivate(ConnectionId id) {
+    if(!isActive(id)) return;
+
+    const ConnectionId slot = slots[id];
+    const ConnectionId last = --numActive;
+    slots[id] = NONE;
+    if(slot == last) return;
+
+    const ConnectionId moved = ids[last];
+    ids[slot] = moved;
+    slots[moved] = slot;
+    for(size_t c = 0; c < NUM_COLUMNS; c++) columns[c * stride + slot] = columns[c * stride + last];
+    stateFlags[slot] = stateFlags[last];
+}
+
+void Store::distancesSquared(const Vec &point, float *out) const {
+    const Columns p = {position[0], position[1], position[2]};
+#ifdef PLAYERS_X86
+    if(hasAvx2()) return distancesAvx2(p, numActive, point, out);
+#endif
+    distancesScalar(p, 0, numActive, point, out);
+}
+
+uint32_t Store::within(const Vec &point, float radius, ConnectionId except,
+    ConnectionId *out, uint32_t maxCount) const
+{
+    const Columns p = {position[0], position[1], position[2]};
+#ifdef PLAYERS_X86
+    if(hasAvx2()) return withinAvx2(p, ids, numActive, point, radius * radius, except, out, maxCount);
+#endif
+    return withinScalar(p, ids, 0, numActive, point, radius * radius, except, out, 0, maxCount);
+}
+
+uint32_t Store::inside(const Vec &min, const Vec &max, ConnectionId *out, uint32_t maxCount) const {
+    const Columns p = {position[0], position[1], position[2]};
+#ifdef PLAYERS_X86
+    if(hasAvx2()) return insideAvx2(p, ids, numActive, min, max, out, maxCount);
+#endif
+    return insideScalar(p, ids, 0, numActive, min, max, out, 0, maxCount);
+}
+
+bool Store::bounds(Vec *min, Vec *max) const {
+    if(numActive == 0) return false;
+
+    *min = *max = getPosition(0);
+    const Columns p = {position[0], position[1], position[2]};
+#ifdef PLAYERS_X86
+    if(hasAvx2()) {
+        boundsAvx2(p, numActive, min, max);
+        return true;
+    }
+#endif
+    boundsScalar(p, 0, numActive, min, max);
+    return true;
+}
+
+void Store::extrapolate(float steps, float *outX, float *outY, float *outZ) const {
+    const Columns p = {position[0], position[1], position[2]};
+    const Columns v = {velocity[0], velocity[1], velocity[2]};
+#ifdef PLAYERS_X86
+    if(hasAvx2()) return extrapolateAvx2(p, v, numActive, steps, outX, outY, outZ);
+#endif
+    extrapolateScalar(p, v, 0, numActive, steps, outX, outY, outZ);
+}
+
+}
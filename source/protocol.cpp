@@ -1,5 +1,7 @@
 #include "protocol.hpp"
 #include "transmission.hpp"
+#include "metrics.hpp"
+#include "capture.hpp"
 
 #include <cassert>
 
@@ -24,6 +26,11 @@ inline const T* consumeBuffer(const uint8_t *&buff) {
     buff = reinterpret_cast<const uint8_t *>(ret + 1);
     return ret;
 }
+// Tag of a packet as it is on the wire
+static inline uint32_t wireTag(const void *packet) {
+    return ntohl(*reinterpret_cast<const uint32_t *>(packet));
+}
+
 /*
  *
  * Protocol:
@@ -51,7 +58,12 @@ namespace ControlSeq {
         ssize_t offsetToNextReadEnd; // Relative to the start of this struct
         ssize_t offsetToNextSend; // Relative to the start of this struct
         uint32_t size;
-        uint8_t senderId;
+        // Sender of a received packet, or destination of one we send
+        // (see Destination)
+        uint32_t senderId;
+        // When the kernel received it (see Reader::ReadSlot), 0 for packets
+        // we made
+        uint64_t arrivalNs;
     };
 
     struct Skip {
@@ -91,7 +103,7 @@ static uint8_t* calculateNewSendHead(uint8_t *tmpHead, uint32_t size) {
     return tmpHead;
 }
 NetReturn PacketHolder::rollbackSendHead(uint8_t *&packetBuffer, uint32_t size, 
-    uint8_t destination) 
+    uint32_t destination) 
 {
     resizeRead();
 
@@ -119,6 +131,7 @@ NetReturn PacketHolder::rollbackSendHead(uint8_t *&packetBuffer, uint32_t size,
     packetControl->offsetToNextReadEnd = priorReadEnd - packetControlLoc;
     packetControl->size = size;
     packetControl->senderId = destination;
+    packetControl->arrivalNs = 0;
 
     packetBuffer = alignUp(tmpHead + sizeof(Packets::Tag), Packets::PACKET_ALIGNMENT);
     return {0, NetReturn::OK};
@@ -154,6 +167,35 @@ void PacketHolder::dropPacket() {
     *consumeBuffer<ControlSeq::Code>(tmpHead) = ControlSeq::SKIP;
 }
 
+void PacketHolder::setDestination(uint32_t destination) {
+    uint8_t *tmpHead = processHead;
+    if(*consumeBuffer<ControlSeq::Code>(tmpHead) == ControlSeq::PACKET) {
+        consumeBuffer<ControlSeq::Packet>(tmpHead)->senderId = destination;
+    }
+}
+
+void PacketHolder::setMetrics(Metrics::Recorder *recorder) {
+    metrics = recorder;
+    if(metrics) metrics->setRingCapacity(bufferLen);
+}
+
+bool PacketHolder::supersede(uint32_t key) {
+    if(key >= numLatest) return false;
+
+    LatestSlot &slot = latest[key];
+    bool skipped = false;
+    // Unsent packets are never reclaimed, so the slot still holds its packet
+    if(slot.sendEpoch == sendEpoch && slot.packet != processHead) {
+        uint8_t *tmpHead = slot.packet;
+        auto *code = consumeBuffer<ControlSeq::Code>(tmpHead);
+        skipped = *code == ControlSeq::PACKET;
+        *code = ControlSeq::SKIP;
+    }
+    slot.packet = processHead;
+    slot.sendEpoch = sendEpoch;
+    return skipped;
+}
+
 NetReturn PacketHolder::getSenderId() const {
     const uint8_t *tmpHead = processHead;
     if(*consumeBuffer<ControlSeq::Code>(tmpHead) == ControlSeq::PACKET) {
@@ -209,6 +251,7 @@ NetReturn PacketHolder::sendPacket(Transmission::Writer &writer) {
             if(res.errorCode != NetReturn::OK) return res;
 
             *code = ControlSeq::SKIP;
+            sendEpoch++;
             return res;
         }
 
@@ -222,6 +265,56 @@ NetReturn PacketHolder::sendPacket(Transmission::Writer &writer) {
     return {}; // unreachable
 }
 
+NetReturn PacketHolder::sendPackets(Transmission::Writer &writer) {
+    uint32_t numPackets = 0;
+    const uint64_t sendNs = metrics && sendHead != processHead ? Metrics::nowNs() : 0;
+    while(sendHead != processHead) {
+        uint8_t *tmpHead = sendHead;
+        auto *code = consumeBuffer<ControlSeq::Code>(tmpHead);
+        
+        // Sent packets are only reclaimed by resizeRead, so they stay
+        // untouched until the writer flushes below
+        if(*code == ControlSeq::PACKET) {
+            const auto *packetControl = consumeBuffer<ControlSeq::Packet>(tmpHead);
+            
+            const uint8_t *packet = alignUp(tmpHead + sizeof(Packets::Tag), 
+                Packets::PACKET_ALIGNMENT);
+
+            packet -= sizeof(Packets::Tag);
+            
+            const uint64_t queued = writer.getStats().queued;
+            NetReturn res = writer.queue(packet, 
+                packetControl->size + sizeof(Packets::Tag), packetControl->senderId);
+
+            if(res.errorCode != NetReturn::OK) {
+                writer.flush();
+                return res;
+            }
+            if(metrics) {
+                metrics->send(wireTag(packet), packetControl->size + sizeof(Packets::Tag), 
+                    writer.getStats().queued - queued);
+                if(packetControl->arrivalNs != 0) {
+                    metrics->kernelToSend.record(sendNs - packetControl->arrivalNs);
+                }
+            }
+
+            *code = ControlSeq::SKIP;
+            numPackets++;
+        }
+
+        tmpHead = sendHead;
+        consumeBuffer<ControlSeq::Code>(tmpHead);
+        auto *skip = consumeBuffer<ControlSeq::Skip>(tmpHead);
+        sendHead = reinterpret_cast<uint8_t *>(skip) + skip->offsetToNextSend;
+    }
+
+    if(numPackets > 0) sendEpoch++;
+
+    NetReturn res = writer.flush();
+    if(res.errorCode != NetReturn::OK) return res;
+    return {numPackets, NetReturn::OK};
+}
+
 static uint8_t* calculateEnd(uint8_t *tmpHead) {
 
     tmpHead = alignUp(tmpHead, alignof(ControlSeq::Code));
@@ -273,22 +366,34 @@ NetReturn PacketHolder::readPacket(Transmission::Reader &reader) {
     tmpHead = alignUp(tmpHead, Packets::PACKET_ALIGNMENT);
     tmpHead -= sizeof(Packets::Tag);
 
+    ConnectionId senderId;
+    uint64_t arrivalNs = 0;
     NetReturn res = reader.read(tmpHead, Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag), 
-        &packetControl->senderId);
+        &senderId, &arrivalNs);
+    if(metrics) metrics->setKernelDrops(reader.getKernelDrops());
 
     if(res.errorCode != NetReturn::OK && res.errorCode != NetReturn::CANDIDATE) {
         readHead = oldHead;
+        // Anything but a failed recvfrom took a datagram with it
+        if(metrics && res.errorCode != NetReturn::SYSTEM_ERROR) metrics->drop(res.errorCode);
         return res;
     }
     else if(res.bytes < sizeof(Packets::Tag)) {
         readHead = oldHead;
+        if(metrics) metrics->drop(NetReturn::INVALID_DATA);
         return {0, NetReturn::INVALID_DATA};
     }
+    if(metrics) {
+        metrics->receive(wireTag(tmpHead), res.bytes);
+        if(arrivalNs != 0) metrics->kernelToRead.record(Metrics::nowNs() - arrivalNs);
+    }
 
     readHead = makeValid(tmpHead + res.bytes);
     cachedReadHead = makeValid(calculateEnd(readHead));
 
     packetControl->size = res.bytes - sizeof(Packets::Tag);
+    packetControl->senderId = senderId;
+    packetControl->arrivalNs = arrivalNs;
     packetControl->offsetToNextSend = readHead - reinterpret_cast<const uint8_t *>(packetControl);
     packetControl->offsetToNextReadEnd = packetControl->offsetToNextSend;
 
@@ -297,4 +402,116 @@ NetReturn PacketHolder::readPacket(Transmission::Reader &reader) {
     return res;
 }
 
+NetReturn PacketHolder::readPackets(Transmission::Reader &reader, uint32_t maxPackets, 
+    ReadBatchInfo *info) 
+{
+    using Transmission::Reader;
+
+    resizeRead();
+
+    if(maxPackets > Reader::MAX_BATCH_SIZE) maxPackets = Reader::MAX_BATCH_SIZE;
+
+    Reader::ReadSlot slots[Reader::MAX_BATCH_SIZE];
+    uint8_t *slotStarts[Reader::MAX_BATCH_SIZE];
+    ControlSeq::Packet *packetControls[Reader::MAX_BATCH_SIZE];
+    uint8_t *slotHead = readHead;
+    uint32_t numSlots = 0;
+
+    // Every slot is reserved at full size since we don't know how large
+    // each datagram is until recvmmsg returns
+    while(numSlots < maxPackets) {
+        if(numSlots > 0 && slotHead == readEnd) break; // wrapped into readEnd
+        if(!isLocationValid(readEnd, slotHead, calculateEnd(slotHead))) break;
+        
+        uint8_t *tmpHead = slotHead;
+        slotStarts[numSlots] = slotHead;
+        *consumeBuffer<ControlSeq::Code>(tmpHead) = ControlSeq::PACKET;
+        packetControls[numSlots] = consumeBuffer<ControlSeq::Packet>(tmpHead);
+        
+        tmpHead += sizeof(Packets::Tag);
+        tmpHead = alignUp(tmpHead, Packets::PACKET_ALIGNMENT);
+        tmpHead -= sizeof(Packets::Tag);
+        
+        slots[numSlots].data = tmpHead;
+        slots[numSlots].size = Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag);
+        
+        numSlots++;
+        slotHead = makeValid(calculateEnd(slotHead));
+    }
+
+    if(numSlots == 0) return {0, NetReturn::NOT_ENOUGH_SPACE};
+
+    NetReturn res = reader.readBatch(slots, numSlots);
+    if(res.errorCode != NetReturn::OK || res.bytes == 0) return res;
+
+    uint32_t numAccepted = 0;
+    if(info) *info = {0, 0};
+
+    const uint64_t readNs = Metrics::nowNs();
+    if(metrics) metrics->setKernelDrops(reader.getKernelDrops());
+
+    if(capture) {
+        for(uint32_t i = 0; i < res.bytes; i++) {
+            const NetReturn &slotRes = slots[i].res;
+            const bool known = slotRes.errorCode == NetReturn::OK 
+                || slotRes.errorCode == NetReturn::CANDIDATE;
+            capture->append(readNs, slots[i].addr, 
+                known ? slots[i].id : Transmission::ConnectionHolder::NO_CONNECTION,
+                slots[i].data, slotRes.bytes);
+        }
+    }
+
+    for(uint32_t i = 0; i < res.bytes; i++) {
+        ControlSeq::Packet *packetControl = packetControls[i];
+        const NetReturn &slotRes = slots[i].res;
+        uint8_t *next = i + 1 < res.bytes ? slotStarts[i + 1] 
+            : makeValid(reinterpret_cast<uint8_t *>(slots[i].data) + slotRes.bytes);
+
+        packetControl->offsetToNextSend = next - reinterpret_cast<const uint8_t *>(packetControl);
+        packetControl->offsetToNextReadEnd = packetControl->offsetToNextSend;
+        
+        if((slotRes.errorCode == NetReturn::OK || slotRes.errorCode == NetReturn::CANDIDATE)
+            && slotRes.bytes >= sizeof(Packets::Tag)) 
+        {
+            packetControl->size = slotRes.bytes - sizeof(Packets::Tag);
+            packetControl->senderId = slots[i].id;
+            packetControl->arrivalNs = slots[i].arrivalNs;
+            numAccepted++;
+            if(metrics) {
+                metrics->receive(wireTag(slots[i].data), slotRes.bytes);
+                if(slots[i].arrivalNs != 0) metrics->kernelToRead.record(readNs - slots[i].arrivalNs);
+            }
+        }
+        else {
+            uint8_t *tmpHead = slotStarts[i];
+            *consumeBuffer<ControlSeq::Code>(tmpHead) = ControlSeq::SKIP;
+            packetControl->size = 0;
+            if(info) {
+                if(slotRes.errorCode == NetReturn::FILTERED) info->filtered++;
+                else info->invalid++;
+            }
+            if(metrics) {
+                metrics->drop(slotRes.errorCode == NetReturn::OK || slotRes.errorCode == NetReturn::CANDIDATE
+                    ? NetReturn::INVALID_DATA : slotRes.errorCode);
+            }
+        }
+
+        if(i + 1 == res.bytes) readHead = next;
+    }
+
+    cachedReadHead = makeValid(calculateEnd(readHead));
+    processEnd = readHead;
+
+    return {numAccepted, NetReturn::OK};
+}
+
+bool PacketHolder::nextPacket() {
+    while(processHead != processEnd) {
+        const uint8_t *tmpHead = processHead;
+        if(*consumeBuffer<ControlSeq::Code>(tmpHead) == ControlSeq::PACKET) return true;
+        finishProcessing();
+    }
+    return false;
+}
+
 }
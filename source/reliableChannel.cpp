@@ -0,0 +1,248 @@
+#include "reliableChannel.hpp"
+
+#include <cstring>
+
+namespace Reliable {
+
+Channel::Channel(ConnectionId capacity, uint32_t numSlots)
+    : capacity(capacity), numFree(numSlots), numSlots(numSlots), lentSlot(NO_SLOT),
+    numBusy(0), numAcks(0)
+{
+    maxHeld = capacity > 0 ? numSlots / (2 * capacity) : WINDOW;
+    if(maxHeld == 0) maxHeld = 1;
+    if(maxHeld > WINDOW) maxHeld = WINDOW;
+
+    endpoints = new Endpoint[capacity]();
+    for(ConnectionId id = 0; id < capacity; id++) {
+        endpoints[id].nextSeq = 1;
+        endpoints[id].rtoMs = INITIAL_RTO_MS;
+        endpoints[id].recvNext = 1;
+    }
+    pending = new Pending[static_cast<size_t>(capacity) * WINDOW]();
+    held = new Held[static_cast<size_t>(capacity) * WINDOW]();
+
+    slots = new uint8_t[static_cast<size_t>(numSlots) * MAX_DATAGRAM_SIZE];
+    freeSlots = new uint32_t[numSlots];
+    for(uint32_t i = 0; i < numSlots; i++) freeSlots[i] = numSlots - 1 - i;
+
+    busy = new ConnectionId[capacity];
+    ackQueue = new ConnectionId[capacity];
+}
+
+Channel::~Channel() {
+    delete[] endpoints;
+    delete[] pending;
+    delete[] held;
+    delete[] slots;
+    delete[] freeSlots;
+    delete[] busy;
+    delete[] ackQueue;
+}
+
+void Channel::connect(ConnectionId id, bool supported) {
+    if(id >= capacity) return;
+
+    if(endpoints[id].inFlight > 0) markIdle(id);
+    for(uint32_t i = 0; i < WINDOW; i++) {
+        Pending &p = pending[id * WINDOW + i];
+        if(p.seq != 0) release(p);
+
+        Held &h = held[id * WINDOW + i];
+        if(h.seq != 0) {
+            freeSlots[numFree++] = h.slot;
+            h.seq = 0;
+        }
+    }
+
+    // An Ack may still be queued for the id, which is harmless
+    bool ackPending = endpoints[id].ackPending;
+    endpoints[id] = {};
+    endpoints[id].supported = supported;
+    endpoints[id].nextSeq = 1;
+    endpoints[id].rtoMs = INITIAL_RTO_MS;
+    endpoints[id].recvNext = 1;
+    endpoints[id].ackPending = ackPending;
+}
+
+void Channel::release(Pending &p) {
+    freeSlots[numFree++] = p.slot;
+    p.seq = 0;
+}
+
+void Channel::markBusy(ConnectionId id) {
+    endpoints[id].busyIndex = numBusy;
+    busy[numBusy++] = id;
+}
+
+void Channel::markIdle(ConnectionId id) {
+    ConnectionId last = busy[--numBusy];
+    busy[endpoints[id].busyIndex] = last;
+    endpoints[last].busyIndex = endpoints[id].busyIndex;
+}
+
+// RFC 6298
+void Channel::sample(Endpoint &e, uint32_t rttMs) {
+    if(e.srttMs == 0) {
+        e.srttMs = rttMs > 0 ? rttMs : 1;
+        e.rttvarMs = rttMs / 2;
+    }
+    else {
+        uint32_t delta = e.srttMs > rttMs ? e.srttMs - rttMs : rttMs - e.srttMs;
+        e.rttvarMs = (3 * e.rttvarMs + delta) / 4;
+        e.srttMs = (7 * e.srttMs + rttMs) / 8;
+    }
+
+    uint32_t rto = e.srttMs + 4 * e.rttvarMs;
+    if(rto < MIN_RTO_MS) rto = MIN_RTO_MS;
+    if(rto > MAX_RTO_MS) rto = MAX_RTO_MS;
+    e.rtoMs = rto;
+}
+
+NetReturn Channel::commit(Transmission::Writer &writer, ConnectionId id, uint32_t slot,
+    uint32_t size, uint32_t nowMs)
+{
+    Endpoint &e = endpoints[id];
+    Pending &p = pending[id * WINDOW + e.nextSeq % WINDOW];
+    p = {e.nextSeq, slot, size, nowMs, nowMs + e.rtoMs, 1};
+
+    e.nextSeq++;
+    if(e.inFlight++ == 0) markBusy(id);
+
+    return writer.queue(slotData(slot), size, Destination::ONLY | id);
+}
+
+void Channel::acknowledge(ConnectionId id, uint32_t seqNum, uint32_t ackBits, uint32_t nowMs) {
+    if(id >= capacity) return;
+
+    Endpoint &e = endpoints[id];
+    for(uint32_t i = 0; i < WINDOW && e.inFlight > 0; i++) {
+        Pending &p = pending[id * WINDOW + i];
+        if(p.seq == 0) continue;
+
+        bool acked = p.seq <= seqNum;
+        if(!acked && p.seq - seqNum - 2 < 32) acked = ackBits >> (p.seq - seqNum - 2) & 1;
+        if(!acked) continue;
+
+        // Karn: retransmitted packets say nothing about the RTT
+        if(p.transmissions == 1) sample(e, nowMs - p.sentAtMs);
+        release(p);
+        if(--e.inFlight == 0) markIdle(id);
+    }
+}
+
+Channel::Delivery Channel::receive(ConnectionId id, const Packets::Reliable &packet) {
+    if(id >= capacity) return IGNORE;
+
+    Endpoint &e = endpoints[id];
+    const uint32_t seq = packet.check.getSeqNum();
+
+    // Anything within the window gets acknowledged, even duplicates, since
+    // the previous Ack may have been lost
+    if(seq < e.recvNext) {
+        if(!e.ackPending && e.recvNext - seq <= WINDOW) {
+            e.ackPending = true;
+            ackQueue[numAcks++] = id;
+        }
+        return IGNORE;
+    }
+
+    const uint32_t offset = seq - e.recvNext;
+    if(offset > WINDOW) return IGNORE;
+    if(offset > 0 && (e.recvMask >> (offset - 1) & 1)) {
+        if(!e.ackPending) {
+            e.ackPending = true;
+            ackQueue[numAcks++] = id;
+        }
+        return IGNORE;
+    }
+
+    // Ordered packets wait for everything before them
+    const bool hold = (packet.flags & Packets::Reliable::O_ORDERED) && offset > 0;
+    if(hold) {
+        Held &h = held[id * WINDOW + seq % WINDOW];
+        // Dropped without an Ack, so the peer sends it again later
+        if(numFree == 0 || e.numHeld >= maxHeld || h.seq != 0 
+            || packet.payloadSize > MAX_DATAGRAM_SIZE) return IGNORE;
+
+        h = {seq, freeSlots[--numFree], packet.payloadSize, packet.innerTag};
+        memcpy(slotData(h.slot), packet.payload, packet.payloadSize);
+        e.numHeld++;
+    }
+
+    if(offset == 0) {
+        // Slide past every sequence number that is now contiguous
+        e.recvNext++;
+        while(e.recvMask & 1) {
+            e.recvMask >>= 1;
+            e.recvNext++;
+        }
+        e.recvMask >>= 1;
+    }
+    else {
+        e.recvMask |= 1u << (offset - 1);
+    }
+
+    if(!e.ackPending) {
+        e.ackPending = true;
+        ackQueue[numAcks++] = id;
+    }
+
+    return hold ? HELD : DELIVER;
+}
+
+bool Channel::nextHeld(ConnectionId id, Received *out) {
+    if(lentSlot != NO_SLOT) {
+        freeSlots[numFree++] = lentSlot;
+        lentSlot = NO_SLOT;
+    }
+    if(id >= capacity) return false;
+
+    Endpoint &e = endpoints[id];
+    if(e.numHeld == 0) return false;
+
+    Held *next = nullptr;
+    for(uint32_t i = 0; i < WINDOW; i++) {
+        Held &h = held[id * WINDOW + i];
+        if(h.seq == 0 || h.seq >= e.recvNext) continue;
+        if(next == nullptr || h.seq < next->seq) next = &h;
+    }
+    if(next == nullptr) return false;
+
+    *out = {next->tag, slotData(next->slot), next->size};
+    lentSlot = next->slot;
+    next->seq = 0;
+    e.numHeld--;
+    return true;
+}
+
+void Channel::poll(Transmission::Writer &writer, uint32_t nowMs) {
+    // Backwards, since abandoning the last packet of a connection moves the
+    // last busy one into its place
+    for(uint32_t b = numBusy; b > 0; b--) {
+        const ConnectionId id = busy[b - 1];
+        Endpoint &e = endpoints[id];
+
+        bool backedOff = false;
+        for(uint32_t i = 0; i < WINDOW; i++) {
+            Pending &p = pending[id * WINDOW + i];
+            if(p.seq == 0 || static_cast<int32_t>(nowMs - p.deadlineMs) < 0) continue;
+
+            if(p.transmissions == MAX_TRANSMISSIONS) {
+                release(p);
+                if(--e.inFlight == 0) markIdle(id);
+                continue;
+            }
+
+            // Back off once per timeout, however many packets it covers
+            if(!backedOff) {
+                e.rtoMs = e.rtoMs * 2 > MAX_RTO_MS ? MAX_RTO_MS : e.rtoMs * 2;
+                backedOff = true;
+            }
+            p.transmissions++;
+            p.deadlineMs = nowMs + e.rtoMs;
+            writer.queue(slotData(p.slot), p.size, Destination::ONLY | id);
+        }
+    }
+}
+
+}
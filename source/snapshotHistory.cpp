@@ -0,0 +1,95 @@
+#include "snapshotHistory.hpp"
+
+#include <cmath>
+
+namespace Snapshot {
+
+History::History(ConnectionId capacity)
+    : capacity(capacity), numCurrent(0), currentTick(0), hasOrigin(false), originTick(0)
+{
+    states = new Packets::CompactPosition[static_cast<size_t>(DEPTH) * capacity];
+    stateTicks = new uint32_t[static_cast<size_t>(DEPTH) * capacity]();
+    current = new Packets::CompactPosition[capacity];
+    recipients = new Recipient[capacity]();
+    baseline = new const Packets::CompactPosition*[capacity];
+
+    for(uint32_t &t : rowTicks) t = 0;
+    for(uint32_t &c : rowChunks) c = 0;
+}
+
+History::~History() {
+    delete[] states;
+    delete[] stateTicks;
+    delete[] current;
+    delete[] recipients;
+    delete[] baseline;
+}
+
+void History::connect(ConnectionId id, bool compact, bool chunked) {
+    if(id < capacity) recipients[id] = {compact, chunked, 0, 0, 0};
+}
+
+void History::acknowledge(ConnectionId id, uint32_t tick, uint32_t chunks) {
+    if(id >= capacity || tick > currentTick) return;
+
+    Recipient &r = recipients[id];
+    if(tick <= r.ackedTick || tick < r.partialTick) return;
+    if(tick > r.partialTick) {
+        r.partialTick = tick;
+        r.partialChunks = 0;
+    }
+    r.partialChunks |= r.chunked ? chunks : 1;
+
+    const uint32_t row = tick % DEPTH;
+    if(rowTicks[row] != tick || rowChunks[row] > MAX_CHUNKS) return;
+    const uint32_t all = rowChunks[row] == MAX_CHUNKS ? 0xFFFFFFFF : (1u << rowChunks[row]) - 1;
+    if((r.partialChunks & all) == all) r.ackedTick = tick;
+}
+
+void History::record(uint32_t tick, const Packets::PlayerPosition *players, uint16_t numPlayers) {
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        if(hasOrigin && Packets::CompactPosition::inRange(players[i].position, origin)) continue;
+
+        // Whole units, so that the origin itself encodes exactly
+        const Vec &p = players[i].position;
+        origin = Vec(std::round(p.x), std::round(p.y), std::round(p.z));
+        hasOrigin = true;
+        originTick = tick;
+        break;
+    }
+
+    const uint32_t row = tick % DEPTH;
+    rowTicks[row] = tick;
+    rowChunks[row] = (numPlayers + Packets::CompactSnapshot::MAX_PLAYERS - 1) 
+        / Packets::CompactSnapshot::MAX_PLAYERS;
+    currentTick = tick;
+    numCurrent = numPlayers;
+
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        current[i] = Packets::CompactPosition(players[i], origin);
+
+        size_t index = static_cast<size_t>(row) * capacity + players[i].playerId;
+        states[index] = current[i];
+        stateTicks[index] = tick;
+    }
+}
+
+uint32_t History::baselineFor(ConnectionId id) const {
+    if(id >= capacity) return 0;
+
+    uint32_t tick = recipients[id].ackedTick;
+    if(tick == 0 || tick < originTick || tick >= currentTick) return 0;
+    if(currentTick - tick >= DEPTH || rowTicks[tick % DEPTH] != tick) return 0;
+    return tick;
+}
+
+const Packets::CompactPosition *const *History::gatherBaseline(uint32_t baselineTick) {
+    const size_t row = baselineTick % DEPTH;
+    for(uint16_t i = 0; i < numCurrent; i++) {
+        size_t index = row * capacity + current[i].playerId;
+        baseline[i] = stateTicks[index] == baselineTick ? states + index : nullptr;
+    }
+    return baseline;
+}
+
+}
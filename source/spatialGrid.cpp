@@ -0,0 +1,114 @@
+#include "spatialGrid.hpp"
+
+#include <cmath>
+
+namespace Spatial {
+
+Grid::Grid(ConnectionId capacity, float cellSize)
+    : cellSize(cellSize), inverseCellSize(1.0f / cellSize), capacity(capacity)
+{
+    entries = new Entry[capacity];
+    for(ConnectionId i = 0; i < capacity; i++) entries[i].present = false;
+
+    uint32_t numBuckets = 16;
+    while(numBuckets < 2u * capacity) numBuckets <<= 1;
+    bucketMask = numBuckets - 1;
+
+    buckets = new ConnectionId[numBuckets];
+    for(uint32_t i = 0; i < numBuckets; i++) buckets[i] = NONE;
+}
+
+Grid::~Grid() {
+    delete[] entries;
+    delete[] buckets;
+}
+
+// Clients choose their own positions, so keep absurd ones from overflowing
+static int32_t toCell(float scaled) {
+    constexpr float LIMIT = 1 << 30;
+    if(!(scaled > -LIMIT)) return -(1 << 30);
+    if(scaled > LIMIT) return 1 << 30;
+    return static_cast<int32_t>(std::floor(scaled));
+}
+
+void Grid::cellOf(const Vec &position, int32_t *cell) const {
+    cell[0] = toCell(position.x * inverseCellSize);
+    cell[1] = toCell(position.y * inverseCellSize);
+    cell[2] = toCell(position.z * inverseCellSize);
+}
+
+uint32_t Grid::bucketOf(const int32_t *cell) const {
+    uint32_t h = static_cast<uint32_t>(cell[0]) * 0x8DA6B343u
+        ^ static_cast<uint32_t>(cell[1]) * 0xD8163841u
+        ^ static_cast<uint32_t>(cell[2]) * 0xCB1AB31Fu;
+    return (h ^ h >> 16) & bucketMask;
+}
+
+void Grid::unlink(ConnectionId id) {
+    Entry &e = entries[id];
+    if(e.prev != NONE) entries[e.prev].next = e.next;
+    else buckets[e.bucket] = e.next;
+    if(e.next != NONE) entries[e.next].prev = e.prev;
+}
+
+void Grid::update(ConnectionId id, const Vec &position) {
+    if(id >= capacity) return;
+
+    Entry &e = entries[id];
+    int32_t cell[3];
+    cellOf(position, cell);
+    e.position = position;
+
+    if(e.present && cell[0] == e.cell[0] && cell[1] == e.cell[1] && cell[2] == e.cell[2]) return;
+
+    if(e.present) unlink(id);
+
+    e.cell[0] = cell[0];
+    e.cell[1] = cell[1];
+    e.cell[2] = cell[2];
+    e.bucket = bucketOf(cell);
+    e.prev = NONE;
+    e.next = buckets[e.bucket];
+    if(e.next != NONE) entries[e.next].prev = id;
+    buckets[e.bucket] = id;
+    e.present = true;
+}
+
+void Grid::remove(ConnectionId id) {
+    if(id >= capacity || !entries[id].present) return;
+    unlink(id);
+    entries[id].present = false;
+}
+
+uint32_t Grid::query(ConnectionId id, float radius, ConnectionId *out, uint32_t maxCount) const {
+    if(id >= capacity || !entries[id].present) return 0;
+
+    const Vec &center = entries[id].position;
+    const float radiusSquared = radius * radius;
+
+    int32_t low[3], high[3];
+    cellOf(center - Vec(radius, radius, radius), low);
+    cellOf(center + Vec(radius, radius, radius), high);
+
+    uint32_t count = 0;
+    int32_t cell[3];
+    for(cell[0] = low[0]; cell[0] <= high[0]; cell[0]++)
+    for(cell[1] = low[1]; cell[1] <= high[1]; cell[1]++)
+    for(cell[2] = low[2]; cell[2] <= high[2]; cell[2]++) {
+        for(ConnectionId i = buckets[bucketOf(cell)]; i != NONE; i = entries[i].next) {
+            const Entry &e = entries[i];
+            // Other cells can share the bucket
+            if(e.cell[0] != cell[0] || e.cell[1] != cell[1] || e.cell[2] != cell[2]) continue;
+            if(i == id) continue;
+
+            Vec d = e.position - center;
+            if(d.dot(d) > radiusSquared) continue;
+
+            if(count == maxCount) return count;
+            out[count++] = i;
+        }
+    }
+    return count;
+}
+
+}
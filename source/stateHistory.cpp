@@ -0,0 +1,92 @@
+#include "stateHistory.hpp"
+
+namespace Player {
+
+// How far `a` is ahead of `b`, allowing for wraparound
+static inline int32_t msAfter(int32_t a, int32_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+}
+
+static inline Vec lerp(const Vec &a, const Vec &b, float f) {
+    return a + (b - a) * f;
+}
+
+StateHistory::StateHistory(ConnectionId capacity) : capacity(capacity) {
+    stampsMs = new int32_t[static_cast<size_t>(DEPTH) * capacity];
+    states = new State[static_cast<size_t>(DEPTH) * capacity];
+    numRecorded = new uint32_t[capacity]();
+}
+
+StateHistory::~StateHistory() {
+    delete[] stampsMs;
+    delete[] states;
+    delete[] numRecorded;
+}
+
+void StateHistory::record(ConnectionId id, ServerTimestamp t,
+    const Vec &position, const Vec &velocity, const Vec &direction)
+{
+    if(id >= capacity) return;
+
+    const size_t base = static_cast<size_t>(id) * DEPTH;
+    uint32_t entry = numRecorded[id];
+    if(entry > 0) {
+        const int32_t ahead = msAfter(t.t.timeMs, stampAt(base, entry - 1));
+        if(ahead < 0) return;
+        if(ahead == 0) entry--;
+        else numRecorded[id]++;
+    }
+    else numRecorded[id] = 1;
+
+    const size_t slot = base + (entry & (DEPTH - 1));
+    stampsMs[slot] = t.t.timeMs;
+    states[slot] = {position, velocity, direction};
+}
+
+bool StateHistory::sample(ConnectionId id, ServerTimestamp t, State *out) const {
+    if(id >= capacity || numRecorded[id] == 0) return false;
+
+    const size_t base = static_cast<size_t>(id) * DEPTH;
+    const uint32_t newest = numRecorded[id] - 1;
+    const uint32_t oldest = numRecorded[id] > DEPTH ? numRecorded[id] - DEPTH : 0;
+
+    if(msAfter(t.t.timeMs, stampAt(base, oldest)) <= 0) {
+        *out = states[base + (oldest & (DEPTH - 1))];
+        return true;
+    }
+    if(msAfter(t.t.timeMs, stampAt(base, newest)) >= 0) {
+        *out = states[base + (newest & (DEPTH - 1))];
+        return true;
+    }
+
+    // Timestamps only go up, so the pair around `t` is found in log2(DEPTH)
+    // steps. lo stays before `t` and hi after it.
+    uint32_t lo = oldest, hi = newest;
+    while(hi - lo > 1) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(msAfter(t.t.timeMs, stampAt(base, mid)) >= 0) lo = mid;
+        else hi = mid;
+    }
+
+    const int32_t fromMs = stampAt(base, lo);
+    const float f = static_cast<float>(msAfter(t.t.timeMs, fromMs))
+        / static_cast<float>(msAfter(stampAt(base, hi), fromMs));
+    const State &a = states[base + (lo & (DEPTH - 1))];
+    const State &b = states[base + (hi & (DEPTH - 1))];
+    out->position = lerp(a.position, b.position, f);
+    out->velocity = lerp(a.velocity, b.velocity, f);
+    out->direction = lerp(a.direction, b.direction, f);
+    return true;
+}
+
+bool StateHistory::covers(ConnectionId id, ServerTimestamp t) const {
+    if(id >= capacity || numRecorded[id] == 0) return false;
+
+    const size_t base = static_cast<size_t>(id) * DEPTH;
+    const uint32_t newest = numRecorded[id] - 1;
+    const uint32_t oldest = numRecorded[id] > DEPTH ? numRecorded[id] - DEPTH : 0;
+    return msAfter(t.t.timeMs, stampAt(base, oldest)) >= 0
+        && msAfter(t.t.timeMs, stampAt(base, newest)) <= 0;
+}
+
+}
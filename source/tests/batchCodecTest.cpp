@@ -0,0 +1,107 @@
+#include "batchCodec.hpp"
+#include "packets/packetView.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// Checks that every batch codec the CPU supports decodes and encodes
+// PlayerPosition and StarPiece bit for bit like netReadFromBuffer and
+// netWriteToBuffer, for random bytes (NaNs included) and every batch size
+// up to MAX_COUNT, so that each kernel's leftover path runs too.
+
+const static uint32_t MAX_COUNT = 37;
+
+template<typename T>
+static bool sameBits(const T &a, const T &b) {
+    return memcmp(&a, &b, sizeof a) == 0;
+}
+
+static bool samePosition(const Packets::PlayerPosition &a, const Packets::PlayerPosition &b) {
+    return a.playerId == b.playerId && a.stateFlags == b.stateFlags
+        && a.timestamp.t.timeMs == b.timestamp.t.timeMs && sameBits(a.position, b.position)
+        && sameBits(a.velocity, b.velocity) && sameBits(a.direction, b.direction)
+        && a.currentAnimation == b.currentAnimation && a.defaultAnimation == b.defaultAnimation
+        && sameBits(a.animationSpeed, b.animationSpeed);
+}
+
+static bool samePiece(const Packets::StarPiece &a, const Packets::StarPiece &b) {
+    return a.playerId == b.playerId && a.timestamp.t.timeMs == b.timestamp.t.timeMs
+        && sameBits(a.initLineStart, b.initLineStart) && sameBits(a.initLineEnd, b.initLineEnd);
+}
+
+// Packets at scattered, 8 byte aligned spots of `buffer`, like in the ring
+static void scatter(uint8_t *buffer, uint32_t size, uint32_t count, std::mt19937 &rng, uint8_t **out) {
+    for(uint32_t i = 0; i < count; i++) {
+        out[i] = buffer + (2 * i + 1) * size + 8 * (rng() % 4);
+    }
+}
+
+template<typename Batch, typename Packet>
+static bool check(const char *name, uint32_t size, Packets::BatchIsa isa, std::mt19937 &rng,
+    bool (*same)(const Packet &, const Packet &))
+{
+    // Room for MAX_COUNT packets with gaps in between
+    const uint32_t bufferLen = (2 * MAX_COUNT + 2) * size + 32;
+    auto *input = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT, bufferLen));
+    auto *encoded = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT, bufferLen));
+    uint8_t *packets[MAX_COUNT], *out[MAX_COUNT];
+    uint8_t expected[64];
+
+    Batch batch(MAX_COUNT);
+    bool ok = true;
+
+    for(uint32_t count = 0; count <= MAX_COUNT && ok; count++) {
+        for(uint32_t i = 0; i < bufferLen; i++) input[i] = rng();
+        memset(encoded, 0xAA, bufferLen);
+        scatter(input, size, count, rng, packets);
+        scatter(encoded, size, count, rng, out);
+
+        batch.decode(packets, count, isa);
+        batch.encode(out, isa);
+
+        for(uint32_t i = 0; i < count; i++) {
+            Packet scalar;
+            Packet::netReadFromBuffer(&scalar, packets[i], size);
+            Packet fromBatch;
+            batch.get(i, &fromBatch);
+            if(!same(scalar, fromBatch)) {
+                fprintf(stderr, "%s %s: decode differs at %u of %u\n", name, 
+                    Packets::batchIsaName(isa), i, count);
+                ok = false;
+                break;
+            }
+
+            scalar.netWriteToBuffer(expected, size);
+            if(memcmp(expected, out[i], size) != 0) {
+                fprintf(stderr, "%s %s: encode differs at %u of %u\n", name, 
+                    Packets::batchIsaName(isa), i, count);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    free(input);
+    free(encoded);
+    return ok;
+}
+
+int main() {
+    std::mt19937 rng(5029);
+    bool ok = true;
+
+    const auto best = static_cast<uint32_t>(Packets::detectBatchIsa());
+    for(uint32_t i = 0; i <= best; i++) {
+        auto isa = static_cast<Packets::BatchIsa>(i);
+        bool passed = check<Packets::PlayerPositionBatch, Packets::PlayerPosition>("PlayerPosition", 
+            Packets::PlayerPositionView::SIZE, isa, rng, samePosition);
+        passed &= check<Packets::StarPieceBatch, Packets::StarPiece>("StarPiece", 
+            Packets::StarPieceView::SIZE, isa, rng, samePiece);
+        printf("%-6s %s\n", Packets::batchIsaName(isa), passed ? "ok" : "FAILED");
+        ok &= passed;
+    }
+
+    return ok ? 0 : 1;
+}
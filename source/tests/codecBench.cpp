@@ -0,0 +1,197 @@
+#include "packetFactory.hpp"
+#include "packets/packetView.hpp"
+#include "batchCodec.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Measures what the relay path pays to read a received PlayerPosition and
+// StarPiece: decoding the whole packet through the PacketFactory, against
+// reading only the sender id, timestamp and position through a view. Also
+// checks that both agree on every field. Then compares decoding and encoding
+// every field one packet at a time against the batch codecs.
+
+const static uint32_t NUM_PACKETS = 256;
+const static uint32_t ROUNDS = 1 << 14;
+
+// Keeps the measured loops from being optimized out
+static volatile float sink;
+
+template<typename F>
+static double measure(F read) {
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t r = 0; r < ROUNDS; r++) {
+        for(uint32_t i = 0; i < NUM_PACKETS; i++) read(i);
+    }
+    return std::chrono::duration<double, std::nano>
+        (std::chrono::steady_clock::now() - start).count() / (static_cast<double>(ROUNDS) * NUM_PACKETS);
+}
+
+static bool sameVec(const Vec &a, const Vec &b) {
+    return memcmp(&a, &b, sizeof a) == 0;
+}
+
+int main() {
+    const uint32_t positionSize = Packets::PlayerPositionView::SIZE;
+    const uint32_t pieceSize = Packets::StarPieceView::SIZE;
+    // Aligned like packets in the ring
+    auto *positions = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * positionSize));
+    auto *pieces = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * pieceSize));
+
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        Packets::PlayerPosition pos;
+        pos.playerId = i;
+        pos.stateFlags = i & 1;
+        pos.timestamp = {static_cast<int32_t>(i * 50)};
+        pos.position = Vec(1000.0f + i, -200.5f, 5000.0f - i);
+        pos.velocity = Vec(0.5f * i, 0.0f, -1.0f);
+        pos.direction = Vec(1.0f, 0.0f, 0.0f);
+        pos.currentAnimation = i;
+        pos.defaultAnimation = 2;
+        pos.animationSpeed = 1.0f;
+        pos.netWriteToBuffer(positions + i * positionSize, positionSize);
+
+        Packets::StarPiece piece;
+        piece.playerId = i;
+        piece.timestamp = {static_cast<int32_t>(i * 50)};
+        piece.initLineStart = Vec(1.0f * i, 2.0f, 3.0f);
+        piece.initLineEnd = Vec(4.0f, 5.0f * i, 6.0f);
+        piece.netWriteToBuffer(pieces + i * pieceSize, pieceSize);
+    }
+
+    Packets::PacketFactory factory;
+    factory.resetCandidate();
+
+    // Both ways of reading have to agree before timing them means anything
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        Packets::PacketFactory::PacketUnion pu;
+        factory.constructPacket(Packets::Tag::PLAYER_POSITION, &pu, positions + i * positionSize, positionSize);
+        Packets::PlayerPositionView view;
+        Packets::PlayerPositionView::bind(&view, positions + i * positionSize, positionSize);
+        const Packets::PlayerPosition &p = pu.as<Packets::PlayerPosition>();
+        if(view.playerId() != p.playerId || view.stateFlags() != p.stateFlags
+            || view.timestamp().t.timeMs != p.timestamp.t.timeMs
+            || !sameVec(view.position(), p.position) || !sameVec(view.velocity(), p.velocity)
+            || !sameVec(view.direction(), p.direction)
+            || view.currentAnimation() != p.currentAnimation
+            || view.defaultAnimation() != p.defaultAnimation
+            || view.animationSpeed() != p.animationSpeed)
+        {
+            fprintf(stderr, "PlayerPositionView disagrees with the factory on packet %u\n", i);
+            return 1;
+        }
+
+        factory.constructPacket(Packets::Tag::STAR_PIECE, &pu, pieces + i * pieceSize, pieceSize);
+        Packets::StarPieceView pieceView;
+        Packets::StarPieceView::bind(&pieceView, pieces + i * pieceSize, pieceSize);
+        const Packets::StarPiece &s = pu.as<Packets::StarPiece>();
+        if(pieceView.playerId() != s.playerId || pieceView.timestamp().t.timeMs != s.timestamp.t.timeMs
+            || !sameVec(pieceView.initLineStart(), s.initLineStart)
+            || !sameVec(pieceView.initLineEnd(), s.initLineEnd))
+        {
+            fprintf(stderr, "StarPieceView disagrees with the factory on packet %u\n", i);
+            return 1;
+        }
+    }
+
+    double positionFactoryNs = measure([&](uint32_t i) {
+        Packets::PacketFactory::PacketUnion pu;
+        factory.constructPacket(Packets::Tag::PLAYER_POSITION, &pu, positions + i * positionSize, positionSize);
+        const Packets::PlayerPosition &p = pu.as<Packets::PlayerPosition>();
+        sink = p.playerId + p.timestamp.t.timeMs + p.position.x;
+    });
+    double positionViewNs = measure([&](uint32_t i) {
+        Packets::PlayerPositionView view;
+        Packets::PlayerPositionView::bind(&view, positions + i * positionSize, positionSize);
+        sink = view.playerId() + view.timestamp().t.timeMs + view.position().x;
+    });
+    double pieceFactoryNs = measure([&](uint32_t i) {
+        Packets::PacketFactory::PacketUnion pu;
+        factory.constructPacket(Packets::Tag::STAR_PIECE, &pu, pieces + i * pieceSize, pieceSize);
+        sink = pu.as<Packets::StarPiece>().playerId;
+    });
+    double pieceViewNs = measure([&](uint32_t i) {
+        Packets::StarPieceView view;
+        Packets::StarPieceView::bind(&view, pieces + i * pieceSize, pieceSize);
+        sink = view.playerId();
+    });
+
+    printf("packet           factory ns  view ns  speedup\n");
+    printf("PlayerPosition %12.2f %8.2f %7.2fx\n", positionFactoryNs, positionViewNs,
+        positionFactoryNs / positionViewNs);
+    printf("StarPiece      %12.2f %8.2f %7.2fx\n", pieceFactoryNs, pieceViewNs,
+        pieceFactoryNs / pieceViewNs);
+
+    // Whole batches, as pointers to packets like in the ring
+    const uint8_t *positionPackets[NUM_PACKETS], *piecePackets[NUM_PACKETS];
+    uint8_t *positionOut[NUM_PACKETS], *pieceOut[NUM_PACKETS];
+    auto *encoded = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * (positionSize + pieceSize)));
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        positionPackets[i] = positions + i * positionSize;
+        piecePackets[i] = pieces + i * pieceSize;
+        positionOut[i] = encoded + i * positionSize;
+        pieceOut[i] = encoded + NUM_PACKETS * positionSize + i * pieceSize;
+    }
+
+    Packets::PlayerPositionBatch positionBatch(NUM_PACKETS);
+    Packets::StarPieceBatch pieceBatch(NUM_PACKETS);
+
+    // Per packet calls, for reference
+    double positionDecodeNs = measure([&](uint32_t i) {
+        Packets::PlayerPosition pos;
+        Packets::PlayerPosition::netReadFromBuffer(&pos, positionPackets[i], positionSize);
+        sink = pos.position.x;
+    });
+    positionBatch.decode(positionPackets, NUM_PACKETS);
+    double positionEncodeNs = measure([&](uint32_t i) {
+        Packets::PlayerPosition pos;
+        positionBatch.get(i, &pos);
+        pos.netWriteToBuffer(positionOut[i], positionSize);
+    });
+    double pieceDecodeNs = measure([&](uint32_t i) {
+        Packets::StarPiece piece;
+        Packets::StarPiece::netReadFromBuffer(&piece, piecePackets[i], pieceSize);
+        sink = piece.initLineStart.x;
+    });
+    pieceBatch.decode(piecePackets, NUM_PACKETS);
+    double pieceEncodeNs = measure([&](uint32_t i) {
+        Packets::StarPiece piece;
+        pieceBatch.get(i, &piece);
+        piece.netWriteToBuffer(pieceOut[i], pieceSize);
+    });
+
+    // Millions of packets per second
+    const auto rate = [](double ns) {return 1000.0 / ns;};
+
+    printf("\ncodec            PlayerPosition Mpkt/s   StarPiece Mpkt/s\n");
+    printf("                   decode   encode      decode   encode\n");
+    printf("%-15s %8.1f %8.1f    %8.1f %8.1f\n", "per packet", rate(positionDecodeNs),
+        rate(positionEncodeNs), rate(pieceDecodeNs), rate(pieceEncodeNs));
+
+    const auto best = static_cast<uint32_t>(Packets::detectBatchIsa());
+    for(uint32_t i = 0; i <= best; i++) {
+        const auto isa = static_cast<Packets::BatchIsa>(i);
+        // One call per batch, spread over its packets
+        const auto perPacket = [](auto call) {
+            return measure([&](uint32_t i) {if(i == 0) call();});
+        };
+        double decodeNs = perPacket([&]() {positionBatch.decode(positionPackets, NUM_PACKETS, isa);});
+        double encodeNs = perPacket([&]() {positionBatch.encode(positionOut, isa);});
+        double pieceDecodeBatchNs = perPacket([&]() {pieceBatch.decode(piecePackets, NUM_PACKETS, isa);});
+        double pieceEncodeBatchNs = perPacket([&]() {pieceBatch.encode(pieceOut, isa);});
+        sink = positionBatch.position(NUM_PACKETS - 1).x + pieceBatch.initLineEnd(NUM_PACKETS - 1).y;
+
+        printf("batch %-9s %8.1f %8.1f    %8.1f %8.1f\n", Packets::batchIsaName(isa), 
+            rate(decodeNs), rate(encodeNs), rate(pieceDecodeBatchNs), rate(pieceEncodeBatchNs));
+    }
+
+    free(encoded);
+    free(positions);
+    free(pieces);
+    return 0;
+}
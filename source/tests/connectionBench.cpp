@@ -0,0 +1,79 @@
+#include "transmission.hpp"
+#include "netCommon.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+
+}
+
+// Measures sender lookup (ConnectionHolder::getId) and broadcast recipient
+// selection for lobbies of 8, 64 and 512 players, both in a table sized for
+// the lobby and in one sized for 4096 players.
+
+const static uint32_t LOOKUPS = 1 << 22;
+const static uint32_t BROADCASTS = 1 << 16;
+
+// Keeps the measured loops from being optimized out
+static volatile uint64_t sink;
+
+static sockaddr_in makeAddr(uint32_t i) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x0A000000 | (i >> 4));
+    addr.sin_port = htons(20000 + (i & 0xF));
+    return addr;
+}
+
+static void run(ConnectionId numPlayers, ConnectionId capacity) {
+    auto *connections = new Transmission::Connection[capacity];
+    auto *addrs = new sockaddr_in[numPlayers];
+
+    Transmission::ConnectionHolder holder(connections, capacity);
+    for(ConnectionId i = 0; i < numPlayers; i++) {
+        addrs[i] = makeAddr(i);
+        holder.addConnection(&addrs[i]);
+    }
+
+    uint64_t check = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < LOOKUPS; i++) {
+        check += holder.getId(&addrs[(i * 7919) % numPlayers]).bytes;
+    }
+    double lookupNs = std::chrono::duration<double, std::nano>
+        (std::chrono::steady_clock::now() - start).count() / LOOKUPS;
+
+    start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < BROADCASTS; i++) {
+        ConnectionId except = i % numPlayers;
+        for(auto id = holder.activeBegin(); id < holder.activeEnd(); id++) {
+            if(*id == except) continue;
+            check += holder.getConnection(*id)->addr.sin_port;
+        }
+    }
+    double broadcastNs = std::chrono::duration<double, std::nano>
+        (std::chrono::steady_clock::now() - start).count() / BROADCASTS;
+
+    sink = check;
+    printf("%7u %9u %12.1f %14.1f %14.2f\n", numPlayers, capacity, lookupNs,
+        broadcastNs, broadcastNs / (numPlayers - 1));
+
+    delete[] addrs;
+    delete[] connections;
+}
+
+int main() {
+    printf("players  capacity  getId ns/op  broadcast ns  ns/recipient\n");
+    for(ConnectionId n : {8, 64, 512}) {
+        run(n, n);
+        run(n, 4096);
+    }
+    return 0;
+}
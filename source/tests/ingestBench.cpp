@@ -0,0 +1,150 @@
+#include "protocol.hpp"
+#include "transmission.hpp"
+#include "packetFactory.hpp"
+#include "netCommon.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+}
+
+// Measures how many datagrams/sec the server ingest path sustains on loopback,
+// once with Reader::read (one recvfrom per datagram), once with
+// Reader::readBatch (one recvmmsg per batch) and once with readBatch on
+// io_uring (no syscall per batch).
+
+const static uint32_t NUM_SENDERS = 2;
+const static uint32_t SEND_BATCH = 32;
+const static auto DURATION = std::chrono::seconds(2);
+
+static std::atomic<bool> sending;
+
+static void sendLoop(sockaddr_in dst) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0) return;
+
+    uint8_t datagram[4 + 56];
+    memset(datagram, 0, sizeof datagram);
+    *(uint32_t *)datagram = htonl(static_cast<uint32_t>(Packets::Tag::PLAYER_POSITION));
+
+    mmsghdr msgs[SEND_BATCH];
+    iovec iov = {datagram, sizeof datagram};
+    for(auto &msg : msgs) {
+        memset(&msg, 0, sizeof msg);
+        msg.msg_hdr.msg_name = &dst;
+        msg.msg_hdr.msg_namelen = sizeof dst;
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+
+    while(sending.load(std::memory_order_relaxed)) {
+        sendmmsg(fd, msgs, SEND_BATCH, 0);
+    }
+    close(fd);
+}
+
+template<typename F>
+static double run(const char *name, F ingest, bool uring = false) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0) {
+        perror("(run) socket");
+        exit(-1);
+    }
+
+    int rcvbuf = 1 << 22;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    timeval timeout = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    inet_aton("127.0.0.1", &addr.sin_addr);
+    socklen_t addrlen = sizeof addr;
+    if(bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) < 0
+        || getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addrlen) < 0)
+    {
+        perror("(run) bind");
+        exit(-1);
+    }
+
+    Transmission::Connection connections[NUM_SENDERS + 1];
+    Transmission::ConnectionHolder holder(connections, NUM_SENDERS + 1);
+    Transmission::Reader reader(fd, &holder);
+    Transmission::Writer writer(fd, &holder);
+
+    if(uring) {
+        NetReturn res = reader.enableUring(512);
+        if(res.errorCode == NetReturn::OK) res = writer.enableUring();
+        if(res.errorCode != NetReturn::OK) {
+            printf("%-10s unavailable (%s)\n", name, strerror(res.bytes));
+            close(fd);
+            return 0.0;
+        }
+    }
+
+    const size_t bufferSize = 1 << 16;
+    void *buffer = aligned_alloc(Packets::PACKET_ALIGNMENT, bufferSize);
+    Protocol::PacketHolder ph(buffer, bufferSize);
+
+    sending = true;
+    std::thread senders[NUM_SENDERS];
+    for(auto &sender : senders) sender = std::thread(sendLoop, addr);
+
+    uint64_t received = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto now = start;
+    while(now - start < DURATION) {
+        received += ingest(ph, reader);
+        while(ph.nextPacket()) {
+            ph.dropPacket();
+            ph.finishProcessing();
+        }
+        NetReturn res;
+        do {
+            res = ph.sendPacket(writer);
+        } while(res.errorCode == NetReturn::OK && res.bytes > 0);
+        now = std::chrono::steady_clock::now();
+    }
+
+    sending = false;
+    for(auto &sender : senders) sender.join();
+
+    double seconds = std::chrono::duration<double>(now - start).count();
+    double rate = received / seconds;
+    printf("%-10s %12.0f datagrams/s\n", name, rate);
+
+    free(buffer);
+    close(fd);
+    return rate;
+}
+
+int main() {
+    double single = run("read", [](Protocol::PacketHolder &ph, Transmission::Reader &reader) {
+        NetReturn res = ph.readPacket(reader);
+        return res.errorCode == NetReturn::OK || res.errorCode == NetReturn::CANDIDATE ? 1u : 0u;
+    });
+    double batch = run("readBatch", [](Protocol::PacketHolder &ph, Transmission::Reader &reader) {
+        NetReturn res = ph.readPackets(reader, Transmission::Reader::MAX_BATCH_SIZE);
+        return res.errorCode == NetReturn::OK ? res.bytes : 0u;
+    });
+    printf("speedup    %12.2fx\n", batch / single);
+    double uring = run("io_uring", [](Protocol::PacketHolder &ph, Transmission::Reader &reader) {
+        NetReturn res = ph.readPackets(reader, Transmission::Reader::MAX_BATCH_SIZE);
+        return res.errorCode == NetReturn::OK ? res.bytes : 0u;
+    }, true);
+    if(uring > 0.0) printf("vs batch   %12.2fx\n", uring / batch);
+    return 0;
+}
@@ -0,0 +1,504 @@
+#include "protocol.hpp"
+#include "packets/connect.hpp"
+#include "packets/serverInitialResponse.hpp"
+#include "packets/playerPosition.hpp"
+#include "packets/packetView.hpp"
+#include "netCommon.hpp"
+#include "vec.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numbers>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" {
+
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+}
+
+// Simulates many players against a running SMGServer, spread over a few
+// threads, and reports relay latency percentiles, loss and throughput.
+//
+// Every PlayerPosition carries what is needed to measure it on arrival: the
+// timestamp is a per player sequence number, currentAnimation the send time
+// in microseconds and defaultAnimation the index of the virtual player. The
+// players connect as minor version 0, so a server in snapshot mode sends
+// them WorldSnapshot, whose entries count as received the first time their
+// sequence number is seen. Positions that a snapshot superseded count as
+// lost.
+
+enum class Pattern {
+    STILL,
+    CIRCLE,
+    RANDOM
+};
+
+static const char *serverAddr = "127.0.0.1";
+static uint16_t serverPort = 5029;
+static uint32_t numPlayers = 64;
+static uint32_t numThreads = 4;
+static float sendRate = 20.0f;
+static float durationS = 10.0f;
+static float warmupS = 1.0f;
+// Reconnects per second, over all players
+static float churnRate = 0.0f;
+static Pattern pattern = Pattern::CIRCLE;
+
+// Players move around their own spot in a square of this size
+const static float WORLD_SIZE = 10000.0f;
+const static float CIRCLE_RADIUS = 500.0f;
+const static float SPEED = 1000.0f;
+const static uint64_t CONNECT_RETRY_US = 500000;
+
+static std::chrono::steady_clock::time_point startTime;
+
+static inline uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Microseconds, exact below LINEAR and within 1/64 above
+class LatencyHistogram {
+    static constexpr uint32_t LINEAR = 128;
+    static constexpr uint32_t SUB_BITS = 6;
+    static constexpr uint32_t NUM_BUCKETS = LINEAR + (31 - SUB_BITS) * (1 << SUB_BITS);
+
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total;
+    uint32_t max;
+
+    static inline uint32_t bucketOf(uint32_t us) {
+        if(us < LINEAR) return us;
+        uint32_t shift = 31 - __builtin_clz(us) - SUB_BITS;
+        return LINEAR + (shift - 1) * (1 << SUB_BITS) + ((us >> shift) - (1 << SUB_BITS));
+    }
+    static inline uint64_t lowerBound(uint32_t bucket) {
+        if(bucket < LINEAR) return bucket;
+        uint32_t shift = (bucket - LINEAR) / (1 << SUB_BITS) + 1;
+        return static_cast<uint64_t>((bucket - LINEAR) % (1 << SUB_BITS) + (1 << SUB_BITS)) << shift;
+    }
+
+public:
+    inline LatencyHistogram() : counts{}, total(0), max(0) {}
+
+    inline void add(uint32_t us) {
+        counts[bucketOf(us)]++;
+        total++;
+        if(us > max) max = us;
+    }
+    inline void merge(const LatencyHistogram &other) {
+        for(uint32_t i = 0; i < NUM_BUCKETS; i++) counts[i] += other.counts[i];
+        total += other.total;
+        if(other.max > max) max = other.max;
+    }
+    inline uint64_t getTotal() const {return total;}
+    inline uint32_t getMax() const {return max;}
+
+    // Upper end of the bucket holding quantile `q`
+    uint64_t quantile(double q) const {
+        uint64_t target = static_cast<uint64_t>(std::ceil(q * total));
+        uint64_t seen = 0;
+        for(uint32_t i = 0; i < NUM_BUCKETS; i++) {
+            seen += counts[i];
+            if(seen >= target && seen > 0) {
+                uint64_t upper = lowerBound(i + 1) - 1;
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+};
+
+struct VirtualPlayer {
+    int fd;
+    bool connected;
+    ConnectionId id;
+    // Keeps increasing across reconnects, so the server never sees it as stale
+    uint32_t seq;
+    uint64_t nextSendUs;
+    uint64_t connectSentUs;
+    Vec center;
+    Vec position;
+    Vec velocity;
+    float angle;
+};
+
+// What one receiver got from one sender since it (re)connected
+struct PairStats {
+    uint32_t first;
+    uint32_t last;
+    uint32_t count;
+};
+
+struct ThreadStats {
+    LatencyHistogram latency;
+    // After the warmup
+    uint64_t positionsSent;
+    uint64_t datagramsReceived;
+    uint64_t positionsReceived;
+    // Positions that should have arrived, going by sequence numbers
+    uint64_t positionsExpected;
+    uint64_t reconnects;
+    uint64_t connectRetries;
+};
+
+class Worker {
+    uint32_t first;
+    uint32_t count;
+    VirtualPlayer *players;
+    // count rows of numPlayers senders
+    PairStats *pairs;
+    ThreadStats &stats;
+    int epollFd;
+    sockaddr_in server;
+    std::mt19937 rng;
+    uint64_t warmupEndUs;
+
+    void openSocket(uint32_t local);
+    void sendConnect(uint32_t local, uint64_t now);
+    void sendPosition(uint32_t local, uint64_t now);
+    void receive(uint32_t local, uint64_t now);
+    void record(uint32_t local, const Packets::PlayerPositionView &view, uint64_t now);
+    void move(VirtualPlayer &p, float dt);
+    // Moves everything a receiver got so far into the totals
+    void foldPairs(uint32_t local);
+    void reconnect(uint32_t local, uint64_t now);
+
+public:
+    Worker(uint32_t first, uint32_t count, ThreadStats &stats);
+    ~Worker();
+
+    Worker(const Worker &) = delete;
+    Worker& operator=(const Worker &) = delete;
+
+    void run();
+};
+
+Worker::Worker(uint32_t _first, uint32_t _count, ThreadStats &_stats)
+    : first(_first), count(_count), stats(_stats), rng(_first + 1)
+{
+    players = new VirtualPlayer[count];
+    pairs = new PairStats[static_cast<size_t>(count) * numPlayers]();
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0) {
+        perror("(Worker) epoll_create1");
+        exit(-1);
+    }
+
+    memset(&server, 0, sizeof server);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(serverPort);
+    inet_aton(serverAddr, &server.sin_addr);
+
+    warmupEndUs = static_cast<uint64_t>(warmupS * 1e6);
+
+    std::uniform_real_distribution<float> spot(-WORLD_SIZE / 2, WORLD_SIZE / 2);
+    std::uniform_real_distribution<float> turn(0.0f, 2 * std::numbers::pi_v<float>);
+    for(uint32_t i = 0; i < count; i++) {
+        VirtualPlayer &p = players[i];
+        p.connected = false;
+        p.seq = 1;
+        p.center = Vec(spot(rng), 0.0f, spot(rng));
+        p.position = p.center;
+        p.velocity = Vec::zero();
+        p.angle = turn(rng);
+        openSocket(i);
+    }
+}
+
+Worker::~Worker() {
+    for(uint32_t i = 0; i < count; i++) close(players[i].fd);
+    close(epollFd);
+    delete[] pairs;
+    delete[] players;
+}
+
+void Worker::openSocket(uint32_t local) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<const sockaddr *>(&server), sizeof server) < 0) {
+        perror("(Worker::openSocket) socket");
+        exit(-1);
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = local;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    players[local].fd = fd;
+}
+
+void Worker::sendConnect(uint32_t local, uint64_t now) {
+    uint8_t buffer[sizeof(Packets::Tag) + 16];
+    *reinterpret_cast<uint32_t *>(buffer) = htonl(static_cast<uint32_t>(Packets::Tag::CONNECT));
+    NetReturn res = Packets::Connect(Protocol::MAJOR, 0).netWriteToBuffer(buffer + sizeof(Packets::Tag),
+        sizeof buffer - sizeof(Packets::Tag));
+    if(res.errorCode != NetReturn::OK) netHandleInvalidState();
+    send(players[local].fd, buffer, sizeof(Packets::Tag) + res.bytes, 0);
+    players[local].connectSentUs = now;
+}
+
+void Worker::move(VirtualPlayer &p, float dt) {
+    switch(pattern) {
+        case Pattern::STILL:
+            p.velocity = Vec::zero();
+            break;
+        case Pattern::CIRCLE:
+        {
+            p.angle += SPEED / CIRCLE_RADIUS * dt;
+            Vec offset(std::cos(p.angle) * CIRCLE_RADIUS, 0.0f, std::sin(p.angle) * CIRCLE_RADIUS);
+            Vec next = p.center + offset;
+            p.velocity = (next - p.position) * (1.0f / dt);
+            p.position = next;
+            break;
+        }
+        case Pattern::RANDOM:
+        {
+            std::uniform_real_distribution<float> turn(-0.5f, 0.5f);
+            p.angle += turn(rng);
+            p.velocity = Vec(std::cos(p.angle) * SPEED, 0.0f, std::sin(p.angle) * SPEED);
+            p.position += p.velocity * dt;
+            // Stay near the own spot
+            if((p.position - p.center).magnitude() > CIRCLE_RADIUS * 4) {
+                p.angle += std::numbers::pi_v<float>;
+            }
+            break;
+        }
+    }
+}
+
+void Worker::sendPosition(uint32_t local, uint64_t now) {
+    VirtualPlayer &p = players[local];
+    move(p, 1.0f / sendRate);
+
+    Packets::PlayerPosition pos;
+    pos.playerId = p.id;
+    pos.timestamp = {static_cast<int32_t>(p.seq++)};
+    pos.position = p.position;
+    pos.velocity = p.velocity;
+    pos.direction = Vec(std::cos(p.angle), 0.0f, std::sin(p.angle));
+    pos.currentAnimation = static_cast<int32_t>(now);
+    pos.defaultAnimation = static_cast<int32_t>(first + local);
+    pos.animationSpeed = 1.0f;
+
+    uint8_t buffer[sizeof(Packets::Tag) + Packets::PlayerPositionView::SIZE];
+    *reinterpret_cast<uint32_t *>(buffer) = htonl(static_cast<uint32_t>(Packets::Tag::PLAYER_POSITION));
+    pos.netWriteToBuffer(buffer + sizeof(Packets::Tag), Packets::PlayerPositionView::SIZE);
+    send(p.fd, buffer, sizeof buffer, 0);
+    if(now >= warmupEndUs) stats.positionsSent++;
+}
+
+void Worker::record(uint32_t local, const Packets::PlayerPositionView &view, uint64_t now) {
+    uint32_t sender = static_cast<uint32_t>(view.defaultAnimation());
+    if(sender >= numPlayers || sender == first + local) return;
+
+    PairStats &pair = pairs[static_cast<size_t>(local) * numPlayers + sender];
+    uint32_t seq = static_cast<uint32_t>(view.timestamp().t.timeMs);
+    // Snapshots repeat positions that did not change
+    if(pair.count > 0 && seq <= pair.last) return;
+    if(pair.count == 0) pair.first = seq;
+    pair.last = seq;
+    pair.count++;
+
+    int32_t latency = static_cast<int32_t>(static_cast<uint32_t>(now)
+        - static_cast<uint32_t>(view.currentAnimation()));
+    stats.latency.add(latency > 0 ? latency : 0);
+}
+
+void Worker::receive(uint32_t local, uint64_t now) {
+    alignas(Packets::PACKET_ALIGNMENT) uint8_t buffer[Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag)];
+    VirtualPlayer &p = players[local];
+    ssize_t len;
+    while((len = recv(p.fd, buffer, sizeof buffer, 0)) >= 0) {
+        if(len < static_cast<ssize_t>(sizeof(Packets::Tag))) continue;
+        const bool measured = now >= warmupEndUs;
+        if(measured) stats.datagramsReceived++;
+
+        const uint8_t *payload = buffer + sizeof(Packets::Tag);
+        const uint32_t size = len - sizeof(Packets::Tag);
+        Packets::PlayerPositionView view;
+        switch(static_cast<Packets::Tag>(ntohl(*reinterpret_cast<const uint32_t *>(buffer)))) {
+            case Packets::Tag::SERVER_INITIAL_RESPONSE:
+            {
+                Packets::ServerInitialResponse sir;
+                if(Packets::ServerInitialResponse::netReadFromBuffer(&sir, payload, size).errorCode
+                    == NetReturn::OK && !p.connected)
+                {
+                    p.connected = true;
+                    p.id = sir.playerId;
+                    p.nextSendUs = now;
+                }
+                break;
+            }
+            case Packets::Tag::PLAYER_POSITION:
+                if(measured && Packets::PlayerPositionView::bind(&view, payload, size).errorCode == NetReturn::OK) {
+                    record(local, view, now);
+                }
+                break;
+            case Packets::Tag::WORLD_SNAPSHOT:
+            {
+                // Tick, number of players, padding, then the entries
+                const uint32_t HEADER_SIZE = 8;
+                if(!measured || size < HEADER_SIZE) break;
+                uint16_t entries = ntohs(*reinterpret_cast<const uint16_t *>(payload + 4));
+                for(uint16_t i = 0; i < entries; i++) {
+                    const uint32_t offset = HEADER_SIZE + i * Packets::PlayerPositionView::SIZE;
+                    if(Packets::PlayerPositionView::bind(&view, payload + offset, size - offset).errorCode
+                        != NetReturn::OK) break;
+                    record(local, view, now);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void Worker::foldPairs(uint32_t local) {
+    PairStats *row = pairs + static_cast<size_t>(local) * numPlayers;
+    for(uint32_t s = 0; s < numPlayers; s++) {
+        if(row[s].count == 0) continue;
+        stats.positionsReceived += row[s].count;
+        stats.positionsExpected += row[s].last - row[s].first + 1;
+        row[s] = {0, 0, 0};
+    }
+}
+
+void Worker::reconnect(uint32_t local, uint64_t now) {
+    foldPairs(local);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, players[local].fd, nullptr);
+    close(players[local].fd);
+    // A new port is a new connection to the server; the old one times out
+    openSocket(local);
+    players[local].connected = false;
+    sendConnect(local, now);
+    stats.reconnects++;
+}
+
+void Worker::run() {
+    const uint64_t intervalUs = static_cast<uint64_t>(1e6 / sendRate);
+    const uint64_t endUs = static_cast<uint64_t>((warmupS + durationS) * 1e6);
+    const double churnShare = churnRate / numThreads;
+    std::exponential_distribution<double> churnGap(churnShare > 0 ? churnShare : 1.0);
+    uint64_t nextChurnUs = churnShare > 0 ? warmupEndUs + static_cast<uint64_t>(churnGap(rng) * 1e6) : ~0ull;
+
+    uint64_t now = nowUs();
+    for(uint32_t i = 0; i < count; i++) sendConnect(i, now);
+
+    epoll_event events[64];
+    while(now < endUs) {
+        int ready = epoll_wait(epollFd, events, 64, 1);
+        now = nowUs();
+        for(int i = 0; i < ready; i++) receive(events[i].data.u32, now);
+
+        for(uint32_t i = 0; i < count; i++) {
+            VirtualPlayer &p = players[i];
+            if(!p.connected) {
+                if(now - p.connectSentUs >= CONNECT_RETRY_US) {
+                    sendConnect(i, now);
+                    stats.connectRetries++;
+                }
+                continue;
+            }
+            if(now < p.nextSendUs) continue;
+            sendPosition(i, now);
+            // Falling behind skips sends instead of bursting them
+            p.nextSendUs += intervalUs;
+            if(p.nextSendUs < now) p.nextSendUs = now + intervalUs;
+        }
+
+        if(now >= nextChurnUs) {
+            reconnect(rng() % count, now);
+            nextChurnUs = now + static_cast<uint64_t>(churnGap(rng) * 1e6);
+        }
+    }
+
+    for(uint32_t i = 0; i < count; i++) foldPairs(i);
+}
+
+static bool parsePattern(const char *name) {
+    if(strcmp(name, "still") == 0) pattern = Pattern::STILL;
+    else if(strcmp(name, "circle") == 0) pattern = Pattern::CIRCLE;
+    else if(strcmp(name, "random") == 0) pattern = Pattern::RANDOM;
+    else return false;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while((opt = getopt(argc, argv, "a:P:p:t:r:d:w:c:m:")) != -1) {
+        switch(opt) {
+            case 'a': serverAddr = optarg; break;
+            case 'P': serverPort = strtoul(optarg, nullptr, 10); break;
+            case 'p': numPlayers = strtoul(optarg, nullptr, 10); break;
+            case 't': numThreads = strtoul(optarg, nullptr, 10); break;
+            case 'r': sendRate = strtof(optarg, nullptr); break;
+            case 'd': durationS = strtof(optarg, nullptr); break;
+            case 'w': warmupS = strtof(optarg, nullptr); break;
+            case 'c': churnRate = strtof(optarg, nullptr); break;
+            case 'm':
+                if(parsePattern(optarg)) break;
+                [[fallthrough]];
+            default:
+                fprintf(stderr, "Usage: %s [-a server address] [-P port] [-p players] [-t threads] "
+                    "[-r sends per second] [-d seconds] [-w warmup seconds] [-c reconnects per second] "
+                    "[-m still|circle|random]\n", argv[0]);
+                return -1;
+        }
+    }
+    if(numThreads == 0 || numPlayers < numThreads || sendRate <= 0.0f || durationS <= 0.0f) {
+        fprintf(stderr, "(main) Need at least one player per thread, and a positive rate and duration\n");
+        return -1;
+    }
+
+    startTime = std::chrono::steady_clock::now();
+
+    std::vector<ThreadStats> stats(numThreads);
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for(uint32_t t = 0; t < numThreads; t++) {
+        uint32_t first = numPlayers * t / numThreads;
+        uint32_t last = numPlayers * (t + 1) / numThreads;
+        stats[t] = {};
+        threads.emplace_back([first, last, &stats, t]() {
+            Worker worker(first, last - first, stats[t]);
+            worker.run();
+        });
+    }
+    for(auto &thread : threads) thread.join();
+
+    ThreadStats total = {};
+    for(const auto &s : stats) {
+        total.latency.merge(s.latency);
+        total.positionsSent += s.positionsSent;
+        total.datagramsReceived += s.datagramsReceived;
+        total.positionsReceived += s.positionsReceived;
+        total.positionsExpected += s.positionsExpected;
+        total.reconnects += s.reconnects;
+        total.connectRetries += s.connectRetries;
+    }
+
+    const char *patternNames[] = {"still", "circle", "random"};
+    printf("players %u  threads %u  rate %.0f/s  pattern %s  churn %.1f/s  duration %.0f s\n",
+        numPlayers, numThreads, sendRate, patternNames[static_cast<int>(pattern)], churnRate, durationS);
+    printf("server in   %10.0f positions/s\n", total.positionsSent / durationS);
+    printf("server out  %10.0f datagrams/s\n", total.datagramsReceived / durationS);
+    printf("latency us  p50 %lu  p99 %lu  p999 %lu  max %u  (%lu samples)\n",
+        total.latency.quantile(0.5), total.latency.quantile(0.99), total.latency.quantile(0.999),
+        total.latency.getMax(), total.latency.getTotal());
+    printf("loss        %.3f%% (%lu of %lu positions)\n", total.positionsExpected
+        ? 100.0 * (total.positionsExpected - total.positionsReceived) / total.positionsExpected : 0.0,
+        total.positionsExpected - total.positionsReceived, total.positionsExpected);
+    printf("reconnects  %lu  connect retries %lu\n", total.reconnects, total.connectRetries);
+    return 0;
+}
@@ -0,0 +1,695 @@
+#include "protocol.hpp"
+#include "transmission.hpp"
+#include "packetFactory.hpp"
+#include "packets/packetView.hpp"
+#include "metrics.hpp"
+#include "capture.hpp"
+#include "stateHistory.hpp"
+#include "players.hpp"
+#include "movement.hpp"
+#include "clock.hpp"
+#include "batchCodec.hpp"
+#include "netCommon.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+}
+
+// Hot path microbenchmarks: the PacketHolder ring, every packet codec,
+// ConnectionHolder::getId, PacketFactory::constructPacket and metrics
+// recording. Prints ns/op
+// and ops/sec of each as JSON. With --baseline, also compares against the
+// JSON of an earlier run and fails if anything got slower than --threshold
+// percent.
+//
+//     microBench [--filter SUBSTRING] [--out FILE] [--baseline FILE] [--threshold PCT]
+
+const static uint32_t MAX_RESULTS = 64;
+const static uint32_t REPEATS = 5;
+const static double MIN_RUN_NS = 20e6;
+
+struct Result {
+    char name[64];
+    double nsPerOp;
+};
+
+static Result results[MAX_RESULTS];
+static uint32_t numResults;
+static const char *filter;
+
+// Keeps the measured loops from being optimized out
+static volatile uint64_t sink;
+
+static inline double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times `count` calls of op(i)
+template<typename F>
+static double timed(uint64_t count, F op) {
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < count; i++) op(i);
+    return since(start);
+}
+
+// `run(count)` does `count` operations and returns how many ns they took,
+// leaving out its own setup. The count grows until a run takes MIN_RUN_NS,
+// and the fastest of REPEATS runs of that count is kept, as the one least
+// disturbed by everything else on the machine.
+template<typename F>
+static void bench(const char *name, F run) {
+    if(filter && !strstr(name, filter)) return;
+    if(numResults == MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmarks, %s is left out\n", name);
+        return;
+    }
+
+    uint64_t count = 1 << 10;
+    while(run(count) < MIN_RUN_NS) count *= 2;
+
+    double best = run(count);
+    for(uint32_t i = 1; i < REPEATS; i++) best = std::min(best, run(count));
+
+    Result &r = results[numResults++];
+    snprintf(r.name, sizeof r.name, "%s", name);
+    r.nsPerOp = best / count;
+    fprintf(stderr, "%-36s %10.2f ns/op\n", r.name, r.nsPerOp);
+}
+
+static sockaddr_in bindLoopback(int fd) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    inet_aton("127.0.0.1", &addr.sin_addr);
+    socklen_t addrlen = sizeof addr;
+    if(bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) < 0
+        || getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addrlen) < 0)
+    {
+        perror("(bindLoopback) bind");
+        exit(-1);
+    }
+    return addr;
+}
+
+// A PlayerPosition datagram per operation, from a connected client through
+// read, process and send. Nobody else is connected, so sending only moves the
+// ring along. A ring barely larger than MAX_PACKET_SIZE wraps around every
+// few dozen packets.
+static void benchRing(const char *name, uint32_t ringSize, bool batched) {
+    const uint32_t BATCH = 4;
+
+    int serverFd = socket(AF_INET, SOCK_DGRAM, 0);
+    int clientFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(serverFd < 0 || clientFd < 0) {
+        perror("(benchRing) socket");
+        exit(-1);
+    }
+    int rcvbuf = 1 << 20;
+    setsockopt(serverFd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    sockaddr_in serverAddr = bindLoopback(serverFd);
+    sockaddr_in clientAddr = bindLoopback(clientFd);
+    connect(clientFd, reinterpret_cast<const sockaddr *>(&serverAddr), sizeof serverAddr);
+
+    Transmission::Connection connections[2];
+    Transmission::ConnectionHolder holder(connections, 2);
+    holder.addConnection(&clientAddr);
+    Transmission::Reader reader(serverFd, &holder);
+    Transmission::Writer writer(serverFd, &holder);
+
+    void *buffer = aligned_alloc(Packets::PACKET_ALIGNMENT, ringSize);
+    Protocol::PacketHolder ph(buffer, ringSize);
+
+    uint8_t datagram[sizeof(Packets::Tag) + Packets::PlayerPositionView::SIZE];
+    *reinterpret_cast<uint32_t *>(datagram) = htonl(static_cast<uint32_t>(Packets::Tag::PLAYER_POSITION));
+    Packets::PlayerPosition().netWriteToBuffer(datagram + sizeof(Packets::Tag),
+        Packets::PlayerPositionView::SIZE);
+    mmsghdr msgs[BATCH];
+    iovec iov = {datagram, sizeof datagram};
+    for(auto &msg : msgs) {
+        memset(&msg, 0, sizeof msg);
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+
+    bench(name, [&](uint64_t count) {
+        double ns = 0;
+        for(uint64_t done = 0; done < count; done += BATCH) {
+            if(sendmmsg(clientFd, msgs, BATCH, 0) != BATCH) {
+                perror("(benchRing) sendmmsg");
+                exit(-1);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            if(batched) {
+                uint32_t read = 0;
+                while(read < BATCH) {
+                    NetReturn res = ph.readPackets(reader, BATCH - read);
+                    if(res.errorCode != NetReturn::OK) netHandleInvalidState();
+                    read += res.bytes;
+                }
+            }
+            else {
+                for(uint32_t i = 0; i < BATCH; i++) {
+                    if(ph.readPacket(reader).errorCode != NetReturn::OK) netHandleInvalidState();
+                }
+            }
+            while(ph.nextPacket()) ph.finishProcessing();
+            NetReturn res;
+            do {
+                res = ph.sendPacket(writer);
+            } while(res.errorCode == NetReturn::OK && res.bytes > 0);
+            ns += since(start);
+        }
+        return ns;
+    });
+
+    free(buffer);
+    close(clientFd);
+    close(serverFd);
+}
+
+const static uint32_t NUM_PACKETS = 64;
+
+// Encodes and decodes NUM_PACKETS different packets of type T, made by
+// make(i). `decodable` is false for packets the server only sends.
+template<typename T, typename Make>
+static void benchCodec(const char *name, Make make, bool decodable = true) {
+    T packets[NUM_PACKETS];
+    uint32_t sizes[NUM_PACKETS];
+    auto *wire = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * Packets::MAX_PACKET_SIZE));
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        packets[i] = make(i);
+        sizes[i] = packets[i].getSize();
+        NetReturn res = packets[i].netWriteToBuffer(wire + i * Packets::MAX_PACKET_SIZE,
+            Packets::MAX_PACKET_SIZE);
+        if(res.errorCode != NetReturn::OK) netHandleInvalidState();
+    }
+
+    char label[64];
+    snprintf(label, sizeof label, "codec/%s/encode", name);
+    bench(label, [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            uint32_t p = i % NUM_PACKETS;
+            sink = packets[p].netWriteToBuffer(wire + p * Packets::MAX_PACKET_SIZE,
+                Packets::MAX_PACKET_SIZE).bytes;
+        });
+    });
+    if(!decodable) {
+        free(wire);
+        return;
+    }
+
+    snprintf(label, sizeof label, "codec/%s/decode", name);
+    bench(label, [&](uint64_t count) {
+        T out;
+        return timed(count, [&](uint64_t i) {
+            uint32_t p = i % NUM_PACKETS;
+            sink = T::netReadFromBuffer(&out, wire + p * Packets::MAX_PACKET_SIZE, sizes[p]).bytes;
+        });
+    });
+    free(wire);
+}
+
+static Packets::PlayerPosition makePosition(uint32_t i) {
+    Packets::PlayerPosition pos;
+    pos.playerId = i;
+    pos.stateFlags = i & 1;
+    pos.timestamp = {static_cast<int32_t>(i * 50)};
+    pos.position = Vec(1000.0f + i, -200.5f, 5000.0f - i);
+    pos.velocity = Vec(0.5f * i, 0.0f, -1.0f);
+    pos.direction = Vec(1.0f, 0.0f, 0.0f);
+    pos.currentAnimation = i;
+    pos.defaultAnimation = 2;
+    pos.animationSpeed = 1.0f;
+    return pos;
+}
+
+static void benchCodecs() {
+    benchCodec<Packets::Connect>("Connect", [](uint32_t i) {
+        return Packets::Connect(Protocol::MAJOR, i);
+    });
+    benchCodec<Packets::Ack>("Ack", [](uint32_t i) {
+        return Packets::Ack(i, ~i, Packets::Ack::RELIABLE);
+    });
+    benchCodec<Packets::Ack>("Ack/snapshot", [](uint32_t i) {
+        return Packets::Ack(i);
+    });
+    benchCodec<Packets::ServerInitialResponse>("ServerInitialResponse", [](uint32_t i) {
+        return Packets::ServerInitialResponse(Protocol::MAJOR, Protocol::MINOR, i);
+    });
+    benchCodec<Packets::PlayerPosition>("PlayerPosition", makePosition);
+    // TimeQuery is only received and TimeResponse only sent
+    {
+        uint8_t wire[NUM_PACKETS][8];
+        for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+            Packets::TimeResponse(i, i).netWriteToBuffer(wire[i], sizeof wire[i]);
+        }
+        bench("codec/TimeQuery/decode", [&](uint64_t count) {
+            Packets::TimeQuery out;
+            return timed(count, [&](uint64_t i) {
+                sink = Packets::TimeQuery::netReadFromBuffer(&out, wire[i % NUM_PACKETS], 8).bytes;
+            });
+        });
+    }
+    benchCodec<Packets::TimeResponse>("TimeResponse", [](uint32_t i) {
+        return Packets::TimeResponse(i, i);
+    }, false);
+    benchCodec<Packets::StarPiece>("StarPiece", [](uint32_t i) {
+        Packets::StarPiece piece;
+        piece.playerId = i;
+        piece.timestamp = {static_cast<int32_t>(i * 50)};
+        piece.initLineStart = Vec(1.0f * i, 2.0f, 3.0f);
+        piece.initLineEnd = Vec(4.0f, 5.0f * i, 6.0f);
+        return piece;
+    });
+
+    // Snapshots of 16 players, the full ones for CompactSnapshot
+    const uint32_t SNAPSHOT_PLAYERS = 16;
+    static Packets::PlayerPosition positions[SNAPSHOT_PLAYERS];
+    static Packets::CompactPosition compact[SNAPSHOT_PLAYERS];
+    for(uint32_t i = 0; i < SNAPSHOT_PLAYERS; i++) {
+        positions[i] = makePosition(i);
+        compact[i] = Packets::CompactPosition(positions[i], Vec(1000.0f, 0.0f, 5000.0f));
+    }
+    benchCodec<Packets::WorldSnapshot>("WorldSnapshot/16", [&](uint32_t i) {
+        return Packets::WorldSnapshot(i, positions, SNAPSHOT_PLAYERS);
+    }, false);
+    benchCodec<Packets::CompactSnapshot>("CompactSnapshot/16", [&](uint32_t i) {
+        return Packets::CompactSnapshot(i, 0, Vec(1000.0f, 0.0f, 5000.0f), compact,
+            nullptr, SNAPSHOT_PLAYERS);
+    }, false);
+
+    static uint8_t payload[Packets::StarPieceView::SIZE];
+    benchCodec<Packets::Reliable>("Reliable", [&](uint32_t i) {
+        return Packets::Reliable(i, 0, Packets::Tag::STAR_PIECE, payload, sizeof payload);
+    });
+    benchCodec<Packets::Keepalive>("Keepalive", [](uint32_t i) {
+        return Packets::Keepalive(i);
+    });
+}
+
+static sockaddr_in makeAddr(uint32_t i) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x0A000000 | (i >> 4));
+    addr.sin_port = htons(20000 + (i & 0xF));
+    return addr;
+}
+
+// Lookups of connected senders in a full table of `numPlayers`
+static void benchGetId(ConnectionId numPlayers) {
+    auto *connections = new Transmission::Connection[numPlayers];
+    auto *addrs = new sockaddr_in[numPlayers];
+    Transmission::ConnectionHolder holder(connections, numPlayers);
+    for(ConnectionId i = 0; i < numPlayers; i++) {
+        addrs[i] = makeAddr(i);
+        holder.addConnection(&addrs[i]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof name, "connections/getId/%u", numPlayers);
+    bench(name, [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            sink = holder.getId(&addrs[(i * 7919) % numPlayers]).bytes;
+        });
+    });
+
+    delete[] addrs;
+    delete[] connections;
+}
+
+// Dispatch of a single tag, and of every tag taking turns
+static void benchFactory() {
+    const uint32_t NUM_TAGS = static_cast<uint32_t>(Packets::Tag::MAX_TAG);
+    alignas(Packets::PACKET_ALIGNMENT) static uint8_t wire[NUM_TAGS][64];
+    uint32_t sizes[NUM_TAGS];
+    const auto encode = [&](const auto &packet) {
+        const uint32_t tag = static_cast<uint32_t>(packet.tag);
+        packet.netWriteToBuffer(wire[tag], sizeof wire[tag]);
+        sizes[tag] = packet.getSize();
+    };
+    static uint8_t payload[Packets::StarPieceView::SIZE];
+    encode(Packets::Connect(Protocol::MAJOR, Protocol::MINOR));
+    encode(Packets::Ack(1, 2, Packets::Ack::RELIABLE));
+    encode(Packets::ServerInitialResponse(Protocol::MAJOR, Protocol::MINOR, 3));
+    encode(makePosition(4));
+    encode(Packets::TimeResponse(5, 5));
+    sizes[static_cast<uint32_t>(Packets::Tag::TIME_QUERY)] = sizes[static_cast<uint32_t>(Packets::Tag::TIME_RESPONSE)];
+    memcpy(wire[static_cast<uint32_t>(Packets::Tag::TIME_QUERY)],
+        wire[static_cast<uint32_t>(Packets::Tag::TIME_RESPONSE)], sizeof wire[0]);
+    encode(Packets::StarPiece());
+    encode(Packets::WorldSnapshot());
+    encode(Packets::CompactSnapshot());
+    encode(Packets::Reliable(6, 0, Packets::Tag::STAR_PIECE, payload, sizeof payload));
+    encode(Packets::Keepalive(7));
+
+    Packets::PacketFactory factory;
+    factory.resetCandidate();
+    Packets::PacketFactory::PacketUnion pu;
+
+    bench("factory/PlayerPosition", [&](uint64_t count) {
+        const uint32_t tag = static_cast<uint32_t>(Packets::Tag::PLAYER_POSITION);
+        return timed(count, [&](uint64_t) {
+            sink = factory.constructPacket(Packets::Tag::PLAYER_POSITION, &pu, wire[tag], sizes[tag]).bytes;
+        });
+    });
+    bench("factory/mixed", [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            const uint32_t tag = i % NUM_TAGS;
+            sink = factory.constructPacket(static_cast<Packets::Tag>(tag), &pu, wire[tag], sizes[tag]).bytes;
+        });
+    });
+}
+
+// What the server records per packet, which has to stay cheap enough to be
+// left on
+static void benchMetrics() {
+    Metrics::Recorder recorder;
+
+    bench("metrics/counter", [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            recorder.receive(i % Metrics::Recorder::NUM_TAGS, 60);
+        });
+    });
+    sink = Metrics::get(recorder.getReceived(0).packets);
+
+    bench("metrics/histogram", [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            recorder.recvToProcess.record((i * 2654435761u) & 0xFFFFF);
+        });
+    });
+    sink = recorder.recvToProcess.getCount();
+
+    bench("metrics/clock", [&](uint64_t count) {
+        return timed(count, [&](uint64_t) {
+            sink = Metrics::nowNs();
+        });
+    });
+}
+
+// Recording a position for capture, including faulting in the pages of the
+// file as it grows
+static void benchCapture() {
+    char path[] = "/tmp/microBenchCaptureXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        perror("(benchCapture) mkstemp");
+        return;
+    }
+    close(fd);
+
+    Capture::Writer writer;
+    uint8_t datagram[sizeof(Packets::Tag) + 56] = {};
+    const sockaddr_in addr = makeAddr(1);
+
+    bench("capture/append", [&](uint64_t count) {
+        if(writer.open(path).errorCode != NetReturn::OK) return 0.0;
+        double ns = timed(count, [&](uint64_t i) {
+            writer.append(i + 1, addr, 0, datagram, sizeof datagram);
+        });
+        writer.close();
+        return ns;
+    });
+
+    unlink(path);
+}
+
+// Players sending 30 positions a second, looked up somewhere in the last
+// second, as lag compensation would
+static void benchStateHistory() {
+    const ConnectionId NUM_PLAYERS = 64;
+    const int32_t STEP_MS = 33;
+    Player::StateHistory history(NUM_PLAYERS);
+
+    bench("history/record", [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            const Vec v(static_cast<float>(i), 0.0f, 1.0f);
+            history.record(i % NUM_PLAYERS, {static_cast<int32_t>(i / NUM_PLAYERS) * STEP_MS}, v, v, v);
+        });
+    });
+
+    for(ConnectionId id = 0; id < NUM_PLAYERS; id++) {
+        history.clear(id);
+        for(int32_t k = 0; k < 64; k++) {
+            const Vec v(static_cast<float>(k), 0.0f, 1.0f);
+            history.record(id, {k * STEP_MS}, v, v, v);
+        }
+    }
+    bench("history/sample", [&](uint64_t count) {
+        Player::State state;
+        return timed(count, [&](uint64_t i) {
+            const int32_t t = 63 * STEP_MS - static_cast<int32_t>((i * 7919) % 1000);
+            history.sample(i % NUM_PLAYERS, {t}, &state);
+            sink = static_cast<uint64_t>(state.position.x);
+        });
+    });
+}
+
+// A per-tick pass over the world: who is near a point, with the players laid
+// out the way Player::Player used to be, and in the Player::Store columns
+static void benchWorld(ConnectionId numPlayers) {
+    struct Legacy {
+        bool active;
+        Vec position;
+        Vec velocity;
+        Vec direction;
+        int32_t timestampMs;
+        int32_t currentAnimation;
+        int32_t defaultAnimation;
+        float animationSpeed;
+        uint8_t stateFlags;
+        uint32_t numUpdates;
+    };
+    auto *legacy = new Legacy[numPlayers]();
+    Player::Store store(numPlayers);
+    for(ConnectionId id = 0; id < numPlayers; id++) {
+        const Vec position(static_cast<float>((id * 7919) % 1000), 0.0f, static_cast<float>((id * 104729) % 1000));
+        legacy[id].active = true;
+        legacy[id].position = position;
+        store.update(id, {0});
+        store.setMotion(id, position, Vec(1.0f, 0.0f, 0.0f), Vec(0.0f, 0.0f, 1.0f));
+    }
+    auto *out = new ConnectionId[numPlayers];
+    auto *x = new float[numPlayers], *y = new float[numPlayers], *z = new float[numPlayers];
+    const float radius = 250.0f;
+
+    char name[64];
+    snprintf(name, sizeof name, "world/%u/within/aos", numPlayers);
+    bench(name, [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            const Vec point = legacy[i % numPlayers].position;
+            uint32_t found = 0;
+            for(ConnectionId id = 0; id < numPlayers; id++) {
+                if(!legacy[id].active) continue;
+                const Vec d = legacy[id].position - point;
+                if(d.dot(d) <= radius * radius) out[found++] = id;
+            }
+            sink = found;
+        });
+    });
+
+    snprintf(name, sizeof name, "world/%u/within/soa", numPlayers);
+    bench(name, [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            sink = store.within(store.getPosition(i % numPlayers), radius, Player::Store::NONE, out, numPlayers);
+        });
+    });
+
+    snprintf(name, sizeof name, "world/%u/bounds", numPlayers);
+    bench(name, [&](uint64_t count) {
+        Vec min, max;
+        return timed(count, [&](uint64_t) {
+            store.bounds(&min, &max);
+            sink = static_cast<uint64_t>(max.x);
+        });
+    });
+
+    snprintf(name, sizeof name, "world/%u/extrapolate", numPlayers);
+    bench(name, [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            store.extrapolate(static_cast<float>(i & 7), x, y, z);
+            sink = static_cast<uint64_t>(x[0]);
+        });
+    });
+
+    delete[] legacy;
+    delete[] out;
+    delete[] x;
+    delete[] y;
+    delete[] z;
+}
+
+// Checks on a batch of 64 updates from 64 players, one at a time and all at
+// once. Every update is accepted, so all of them are fully checked.
+static void benchMovement() {
+    const uint32_t BATCH = 64;
+    Movement::Checker checker(BATCH, {3000.0f, 5000.0f});
+    Packets::PlayerPositionBatch batch(BATCH);
+    batch.resize(BATCH);
+    for(uint32_t i = 0; i < BATCH; i++) batch.set(i, makePosition(i));
+    Movement::Verdict verdicts[BATCH];
+    checker.check(batch, verdicts);
+
+    bench("movement/check", [&](uint64_t count) {
+        return timed(count, [&](uint64_t i) {
+            const uint32_t e = i % BATCH;
+            sink = checker.check(batch.playerId(e), batch.timestamp(e),
+                batch.position(e), batch.velocity(e), batch.direction(e));
+        });
+    });
+    // Counts are powers of two from 1024 up, so whole batches
+    bench("movement/check/batch", [&](uint64_t count) {
+        return timed(count / BATCH, [&](uint64_t) {
+            sink = checker.check(batch, verdicts);
+        });
+    });
+}
+
+// One server clock reading each: what every TimeQuery used to cost, each
+// source on its own, and nowMs going through whichever init picked
+static void benchClock() {
+    const auto start = std::chrono::steady_clock::now();
+    bench("clock/steady_clock/ms", [&](uint64_t count) {
+        return timed(count, [&](uint64_t) {
+            sink = std::chrono::duration_cast<std::chrono::milliseconds>
+                (std::chrono::steady_clock::now() - start).count();
+        });
+    });
+
+    for(Clock::Source source : {Clock::Source::PRECISE, Clock::Source::COARSE, Clock::Source::TSC}) {
+        if(Clock::init(source) != source) {
+            fprintf(stderr, "No %s clock here, left out\n", Clock::sourceName(source));
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof name, "clock/%s/ns", Clock::sourceName(source));
+        bench(name, [&](uint64_t count) {
+            return timed(count, [&](uint64_t) {
+                switch(source) {
+                    case Clock::Source::PRECISE: sink = Clock::preciseNs(); break;
+                    case Clock::Source::COARSE: sink = Clock::coarseNs(); break;
+                    case Clock::Source::TSC: sink = Clock::tscNs(); break;
+                }
+            });
+        });
+        snprintf(name, sizeof name, "clock/%s/ms", Clock::sourceName(source));
+        bench(name, [&](uint64_t count) {
+            return timed(count, [&](uint64_t) {
+                sink = Clock::nowMs();
+            });
+        });
+    }
+    Clock::init(Clock::Source::PRECISE);
+}
+
+static void writeJson(FILE *out) {
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for(uint32_t i = 0; i < numResults; i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+            results[i].name, results[i].nsPerOp, 1e9 / results[i].nsPerOp,
+            i + 1 < numResults ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Reads what writeJson wrote, one benchmark per line
+static uint32_t readJson(const char *path, Result *out, uint32_t max) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        perror("(readJson) fopen");
+        exit(-1);
+    }
+    char line[256];
+    uint32_t n = 0;
+    while(n < max && fgets(line, sizeof line, f)) {
+        if(sscanf(line, " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf", out[n].name, &out[n].nsPerOp) == 2) {
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+// Returns whether nothing got slower than `threshold` percent
+static bool compare(const char *path, double threshold) {
+    Result baseline[MAX_RESULTS];
+    uint32_t numBaseline = readJson(path, baseline, MAX_RESULTS);
+
+    bool ok = true;
+    fprintf(stderr, "\n%-36s %10s %10s %8s\n", "benchmark", "baseline", "now", "change");
+    for(uint32_t i = 0; i < numResults; i++) {
+        const Result *base = nullptr;
+        for(uint32_t j = 0; j < numBaseline; j++) {
+            if(strcmp(baseline[j].name, results[i].name) == 0) base = &baseline[j];
+        }
+        if(!base) {
+            fprintf(stderr, "%-36s %10s %10.2f %8s\n", results[i].name, "-", results[i].nsPerOp, "new");
+            continue;
+        }
+        double change = (results[i].nsPerOp / base->nsPerOp - 1.0) * 100.0;
+        bool slower = change > threshold;
+        ok = ok && !slower;
+        fprintf(stderr, "%-36s %10.2f %10.2f %+7.1f%%%s\n", results[i].name, base->nsPerOp,
+            results[i].nsPerOp, change, slower ? "  SLOWER" : "");
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *outPath = nullptr;
+    const char *baselinePath = nullptr;
+    double threshold = 10.0;
+    for(int i = 1; i < argc; i++) {
+        if(i + 1 < argc && strcmp(argv[i], "--filter") == 0) filter = argv[++i];
+        else if(i + 1 < argc && strcmp(argv[i], "--out") == 0) outPath = argv[++i];
+        else if(i + 1 < argc && strcmp(argv[i], "--baseline") == 0) baselinePath = argv[++i];
+        else if(i + 1 < argc && strcmp(argv[i], "--threshold") == 0) threshold = atof(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--filter SUBSTRING] [--out FILE] [--baseline FILE] "
+                "[--threshold PCT]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    benchRing("ring/read", 1 << 16, false);
+    benchRing("ring/read/wraparound", 4 << 10, false);
+    benchRing("ring/readBatch", 1 << 16, true);
+    benchRing("ring/readBatch/wraparound", 4 << 10, true);
+    benchCodecs();
+    for(ConnectionId n : {8, 64, 512, 4096}) benchGetId(n);
+    benchFactory();
+    benchMetrics();
+    benchCapture();
+    benchStateHistory();
+    for(ConnectionId n : {64, 512}) benchWorld(n);
+    benchMovement();
+    benchClock();
+
+    if(outPath) {
+        FILE *out = fopen(outPath, "w");
+        if(!out) {
+            perror("(main) fopen");
+            return -1;
+        }
+        writeJson(out);
+        fclose(out);
+    }
+    else writeJson(stdout);
+
+    if(baselinePath && !compare(baselinePath, threshold)) return 1;
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include "capture.hpp"
+#include "metrics.hpp"
+#include "netCommon.hpp"
+#include "packets.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+extern "C" {
+
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+}
+
+// Feeds a capture written by `SMGServer -c` back into a running server.
+//
+// Every address in the capture gets a socket of its own, so the server sees
+// as many senders as there were, and every datagram is sent in the order it
+// was captured. With speed 1 (the default) datagrams keep their original
+// spacing, scaled by the speed otherwise; speed 0 sends them as fast as
+// possible. Whatever the server sends back is counted and thrown away.
+
+static const char *serverAddr = "127.0.0.1";
+static uint16_t serverPort = 5029;
+static const char *capturePath = nullptr;
+static double speed = 1.0;
+static uint32_t loops = 1;
+
+const static uint32_t MAX_SENDERS = 4096;
+
+class Replayer {
+    sockaddr_in server;
+    int epollFd;
+    // Socket of every captured address, keyed by address and port
+    std::unordered_map<uint64_t, int> sockets;
+
+public:
+    uint64_t sent;
+    uint64_t failed;
+    uint64_t received;
+    // How late datagrams went out, in nanoseconds
+    Metrics::Histogram lag;
+
+    Replayer();
+    ~Replayer();
+
+    Replayer(const Replayer &) = delete;
+    Replayer& operator=(const Replayer &) = delete;
+
+    // The socket standing in for the sender of `r`, or -1
+    int socketOf(const Capture::Record *r);
+    // Takes everything the server sent, waiting up to `timeoutMs` for it
+    void drain(int timeoutMs);
+    inline size_t getNumSenders() const {return sockets.size();}
+};
+
+Replayer::Replayer() : sent(0), failed(0), received(0) {
+    memset(&server, 0, sizeof server);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(serverPort);
+    if(inet_aton(serverAddr, &server.sin_addr) == 0) {
+        fprintf(stderr, "(Replayer) Invalid server address %s\n", serverAddr);
+        exit(-1);
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd < 0) {
+        perror("(Replayer) epoll_create1");
+        exit(-1);
+    }
+}
+
+Replayer::~Replayer() {
+    for(auto &entry : sockets) close(entry.second);
+    close(epollFd);
+}
+
+int Replayer::socketOf(const Capture::Record *r) {
+    const uint64_t key = static_cast<uint64_t>(r->addr) << 16 | r->port;
+    auto it = sockets.find(key);
+    if(it != sockets.end()) return it->second;
+
+    if(sockets.size() == MAX_SENDERS) return -1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        perror("(Replayer) socket");
+        return -1;
+    }
+    if(connect(fd, reinterpret_cast<const sockaddr *>(&server), sizeof server) < 0) {
+        perror("(Replayer) connect");
+        close(fd);
+        return -1;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+
+    sockets[key] = fd;
+    return fd;
+}
+
+void Replayer::drain(int timeoutMs) {
+    epoll_event events[64];
+    int n = epoll_wait(epollFd, events, 64, timeoutMs);
+    for(int i = 0; i < n; i++) {
+        uint8_t buffer[Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag)];
+        mmsghdr msgs[16];
+        iovec iovs[16];
+        for(uint32_t j = 0; j < 16; j++) {
+            iovs[j] = {buffer, sizeof buffer};
+            memset(&msgs[j].msg_hdr, 0, sizeof msgs[j].msg_hdr);
+            msgs[j].msg_hdr.msg_iov = iovs + j;
+            msgs[j].msg_hdr.msg_iovlen = 1;
+        }
+        int got;
+        while((got = recvmmsg(events[i].data.fd, msgs, 16, MSG_DONTWAIT, nullptr)) > 0) {
+            received += got;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while((opt = getopt(argc, argv, "a:P:f:s:l:")) != -1) {
+        switch(opt) {
+            case 'a': serverAddr = optarg; break;
+            case 'P': serverPort = strtoul(optarg, nullptr, 10); break;
+            case 'f': capturePath = optarg; break;
+            case 's': speed = strtod(optarg, nullptr); break;
+            case 'l': loops = strtoul(optarg, nullptr, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s -f capture [-a server address] [-P port] "
+                    "[-s speed, 0 = as fast as possible] [-l loops]\n", argv[0]);
+                return -1;
+        }
+    }
+    if(capturePath == nullptr || speed < 0.0 || loops == 0) {
+        fprintf(stderr, "Usage: %s -f capture [-a server address] [-P port] "
+            "[-s speed, 0 = as fast as possible] [-l loops]\n", argv[0]);
+        return -1;
+    }
+
+    Capture::Reader capture;
+    NetReturn res = capture.open(capturePath);
+    if(res.errorCode != NetReturn::OK) {
+        fprintf(stderr, "(main) Failed to open capture %s: %s\n", capturePath,
+            res.errorCode == NetReturn::INVALID_DATA ? "not a capture" : strerror(res.bytes));
+        return -1;
+    }
+
+    const Capture::Record *first = capture.next();
+    if(first == nullptr) {
+        fprintf(stderr, "(main) Capture %s is empty\n", capturePath);
+        return -1;
+    }
+    const uint64_t firstStampNs = first->stampNs;
+
+    Replayer replayer;
+    uint64_t records = 0, lastStampNs = firstStampNs;
+
+    const uint64_t startNs = Metrics::nowNs();
+    for(uint32_t loop = 0; loop < loops; loop++) {
+        capture.rewind();
+        // Each loop starts where the last one ended
+        const uint64_t loopStartNs = Metrics::nowNs();
+
+        const Capture::Record *r;
+        while((r = capture.next()) != nullptr) {
+            if(loop == 0) {
+                records++;
+                lastStampNs = r->stampNs;
+            }
+
+            if(speed > 0.0) {
+                const uint64_t dueNs = loopStartNs
+                    + static_cast<uint64_t>((r->stampNs - firstStampNs) / speed);
+                uint64_t now = Metrics::nowNs();
+                // Sleep in epoll_wait while taking replies, spin for the last millisecond
+                while(now + 1000000 < dueNs) {
+                    replayer.drain(static_cast<int>((dueNs - now) / 1000000) - 1);
+                    now = Metrics::nowNs();
+                }
+                while(now < dueNs) now = Metrics::nowNs();
+                replayer.lag.record(now - dueNs);
+            }
+
+            int fd = replayer.socketOf(r);
+            ssize_t written = -1;
+            if(fd >= 0) {
+                // Wait for room in the socket rather than dropping the datagram
+                while((written = send(fd, Capture::datagramOf(r), r->size, 0)) < 0 
+                    && (errno == EAGAIN || errno == ENOBUFS)) replayer.drain(0);
+            }
+            if(written < 0) replayer.failed++;
+            else replayer.sent++;
+
+            if(speed == 0.0 && (replayer.sent & 255) == 0) replayer.drain(0);
+        }
+    }
+    const uint64_t elapsedNs = Metrics::nowNs() - startNs;
+
+    // Give the server a moment to answer the last datagrams
+    replayer.drain(100);
+    replayer.drain(0);
+
+    const double seconds = elapsedNs / 1e9;
+    printf("capture     %lu datagrams from %zu senders over %.2f s\n", records,
+        replayer.getNumSenders(), (lastStampNs - firstStampNs) / 1e9);
+    printf("replayed    %lu datagrams in %.2f s (%.0f/s), speed %g, %lu failed\n",
+        replayer.sent, seconds, replayer.sent / seconds, speed, replayer.failed);
+    if(speed > 0.0) {
+        printf("lag us      p50 %lu  p99 %lu  max %lu\n", replayer.lag.percentile(0.5) / 1000,
+            replayer.lag.percentile(0.99) / 1000, replayer.lag.getMax() / 1000);
+    }
+    printf("received    %lu datagrams (%.0f/s)\n", replayer.received, replayer.received / seconds);
+
+    return replayer.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+#include "packetFactory.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <bit>
+
+extern "C" {
+#include <arpa/inet.h>
+}
+
+// Compares the codecs generated from the packet schemas with the hand written
+// PlayerPosition and StarPiece codecs they replaced, kept below as they were.
+// Both have to produce the same bytes and the same fields for random packets
+// before their timings are compared. The hand written codecs are kept out of
+// line and out of interprocedural optimization, like the real ones in
+// packets.cpp, so they aren't specialized for the constant lengths below.
+
+const static uint32_t NUM_PACKETS = 256;
+const static uint32_t ROUNDS = 1 << 14;
+const static uint32_t PASSES = 7;
+
+// Keeps the measured loops from being optimized out
+static volatile float sink;
+
+namespace Legacy {
+
+    struct PlayerPosition {
+        uint8_t playerId;
+        uint8_t stateFlags;
+        uint8_t playerIdHigh;
+        uint8_t padding;
+        uint32_t timestamp;
+        uint32_t positionX, positionY, positionZ;
+        uint32_t velocityX, velocityY, velocityZ;
+        uint32_t directionX, directionY, directionZ;
+        uint32_t currentAnimation;
+        uint32_t defaultAnimation;
+        uint32_t animationSpeed;
+    };
+
+    struct StarPiece {
+        uint8_t playerId;
+        uint8_t playerIdHigh;
+        uint8_t padding[2];
+        uint32_t timestamp;
+        uint32_t initLineStartX, initLineStartY, initLineStartZ;
+        uint32_t initLineEndX, initLineEndY, initLineEndZ;
+    };
+
+    static inline uint32_t wordOf(float f) {return htonl(std::bit_cast<uint32_t>(f));}
+    static inline float floatOf(uint32_t w) {return std::bit_cast<float>(ntohl(w));}
+
+    [[gnu::noipa]] static NetReturn write(const Packets::PlayerPosition &in, void *buffer, uint32_t len) {
+        auto *packet = reinterpret_cast<PlayerPosition *>(buffer);
+        if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+
+        packet->playerId = in.playerId & 0xFF;
+        packet->stateFlags = in.stateFlags;
+        packet->playerIdHigh = in.playerId >> 8;
+        packet->padding = 0;
+        packet->timestamp = htonl(std::bit_cast<uint32_t>(in.timestamp.t.timeMs));
+        packet->positionX = wordOf(in.position.x);
+        packet->positionY = wordOf(in.position.y);
+        packet->positionZ = wordOf(in.position.z);
+        packet->velocityX = wordOf(in.velocity.x);
+        packet->velocityY = wordOf(in.velocity.y);
+        packet->velocityZ = wordOf(in.velocity.z);
+        packet->directionX = wordOf(in.direction.x);
+        packet->directionY = wordOf(in.direction.y);
+        packet->directionZ = wordOf(in.direction.z);
+        packet->currentAnimation = htonl(std::bit_cast<uint32_t>(in.currentAnimation));
+        packet->defaultAnimation = htonl(std::bit_cast<uint32_t>(in.defaultAnimation));
+        packet->animationSpeed = wordOf(in.animationSpeed);
+        return {sizeof *packet, NetReturn::OK};
+    }
+
+    [[gnu::noipa]] static NetReturn read(Packets::PlayerPosition *out, const void *buffer, uint32_t len) {
+        const auto *packet = reinterpret_cast<const PlayerPosition *>(buffer);
+        if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+
+        out->playerId = packet->playerId | packet->playerIdHigh << 8;
+        out->stateFlags = packet->stateFlags;
+        out->timestamp = {std::bit_cast<int32_t>(ntohl(packet->timestamp))};
+        out->position = {floatOf(packet->positionX), floatOf(packet->positionY), floatOf(packet->positionZ)};
+        out->velocity = {floatOf(packet->velocityX), floatOf(packet->velocityY), floatOf(packet->velocityZ)};
+        out->direction = {floatOf(packet->directionX), floatOf(packet->directionY), floatOf(packet->directionZ)};
+        out->currentAnimation = std::bit_cast<int32_t>(ntohl(packet->currentAnimation));
+        out->defaultAnimation = std::bit_cast<int32_t>(ntohl(packet->defaultAnimation));
+        out->animationSpeed = floatOf(packet->animationSpeed);
+        return {sizeof *packet, NetReturn::OK};
+    }
+
+    [[gnu::noipa]] static NetReturn write(const Packets::StarPiece &in, void *buffer, uint32_t len) {
+        auto *packet = reinterpret_cast<StarPiece *>(buffer);
+        if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+
+        packet->playerId = in.playerId & 0xFF;
+        packet->playerIdHigh = in.playerId >> 8;
+        packet->padding[0] = 0;
+        packet->padding[1] = 0;
+        packet->timestamp = htonl(std::bit_cast<uint32_t>(in.timestamp.t.timeMs));
+        packet->initLineStartX = wordOf(in.initLineStart.x);
+        packet->initLineStartY = wordOf(in.initLineStart.y);
+        packet->initLineStartZ = wordOf(in.initLineStart.z);
+        packet->initLineEndX = wordOf(in.initLineEnd.x);
+        packet->initLineEndY = wordOf(in.initLineEnd.y);
+        packet->initLineEndZ = wordOf(in.initLineEnd.z);
+        return {sizeof *packet, NetReturn::OK};
+    }
+
+    [[gnu::noipa]] static NetReturn read(Packets::StarPiece *out, const void *buffer, uint32_t len) {
+        const auto *packet = reinterpret_cast<const StarPiece *>(buffer);
+        if(len < sizeof *packet) return {sizeof *packet, NetReturn::NOT_ENOUGH_SPACE};
+
+        out->playerId = packet->playerId | packet->playerIdHigh << 8;
+        out->timestamp = {std::bit_cast<int32_t>(ntohl(packet->timestamp))};
+        out->initLineStart = {floatOf(packet->initLineStartX), floatOf(packet->initLineStartY),
+            floatOf(packet->initLineStartZ)};
+        out->initLineEnd = {floatOf(packet->initLineEndX), floatOf(packet->initLineEndY),
+            floatOf(packet->initLineEndZ)};
+        return {sizeof *packet, NetReturn::OK};
+    }
+
+}
+
+// Fastest of a few passes, so a preemption or frequency change in one of
+// them doesn't decide the comparison
+template<typename F>
+static double measure(F call) {
+    double best = 0.0;
+    for(uint32_t pass = 0; pass < PASSES; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t r = 0; r < ROUNDS; r++) {
+            for(uint32_t i = 0; i < NUM_PACKETS; i++) call(i);
+        }
+        const double ns = std::chrono::duration<double, std::nano>
+            (std::chrono::steady_clock::now() - start).count() / (static_cast<double>(ROUNDS) * NUM_PACKETS);
+        if(pass == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+template<typename T>
+static bool sameBits(const T &a, const T &b) {
+    return memcmp(&a, &b, sizeof a) == 0;
+}
+
+static bool samePosition(const Packets::PlayerPosition &a, const Packets::PlayerPosition &b) {
+    return a.playerId == b.playerId && a.stateFlags == b.stateFlags
+        && a.timestamp.t.timeMs == b.timestamp.t.timeMs && sameBits(a.position, b.position)
+        && sameBits(a.velocity, b.velocity) && sameBits(a.direction, b.direction)
+        && a.currentAnimation == b.currentAnimation && a.defaultAnimation == b.defaultAnimation
+        && sameBits(a.animationSpeed, b.animationSpeed);
+}
+
+static bool samePiece(const Packets::StarPiece &a, const Packets::StarPiece &b) {
+    return a.playerId == b.playerId && a.timestamp.t.timeMs == b.timestamp.t.timeMs
+        && sameBits(a.initLineStart, b.initLineStart) && sameBits(a.initLineEnd, b.initLineEnd);
+}
+
+// Checks one packet type both ways: decoding random bytes, and encoding what
+// was decoded
+template<typename T, typename Same>
+static bool agree(const uint8_t *bytes, uint32_t size, Same same, const char *name) {
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        const uint8_t *packet = bytes + i * size;
+        T schema, legacy;
+        NetReturn a = T::netReadFromBuffer(&schema, packet, size);
+        NetReturn b = Legacy::read(&legacy, packet, size);
+        if(a.errorCode != b.errorCode || a.bytes != b.bytes || !same(schema, legacy)) {
+            fprintf(stderr, "%s: decoding packet %u disagrees\n", name, i);
+            return false;
+        }
+
+        uint8_t schemaOut[Packets::MAX_PACKET_SIZE], legacyOut[Packets::MAX_PACKET_SIZE];
+        a = schema.netWriteToBuffer(schemaOut, size);
+        b = Legacy::write(legacy, legacyOut, size);
+        if(a.errorCode != b.errorCode || a.bytes != b.bytes || schema.getSize() != size
+            || memcmp(schemaOut, legacyOut, size) != 0)
+        {
+            fprintf(stderr, "%s: encoding packet %u disagrees\n", name, i);
+            return false;
+        }
+
+        // Both refuse short buffers the same way
+        a = T::netReadFromBuffer(&schema, packet, size - 1);
+        b = Legacy::read(&legacy, packet, size - 1);
+        if(a.errorCode != b.errorCode || a.bytes != b.bytes) {
+            fprintf(stderr, "%s: short packet %u disagrees\n", name, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const uint32_t positionSize = sizeof(Legacy::PlayerPosition);
+    const uint32_t pieceSize = sizeof(Legacy::StarPiece);
+    // Aligned like packets in the ring
+    auto *positions = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * positionSize));
+    auto *pieces = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * pieceSize));
+    auto *out = static_cast<uint8_t *>(aligned_alloc(Packets::PACKET_ALIGNMENT,
+        NUM_PACKETS * positionSize));
+
+    // Random bytes, NaNs and all. Padding is zeroed since encoding zeroes it.
+    std::mt19937 rng(14);
+    for(uint32_t i = 0; i < NUM_PACKETS * positionSize; i++) positions[i] = rng();
+    for(uint32_t i = 0; i < NUM_PACKETS * pieceSize; i++) pieces[i] = rng();
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        positions[i * positionSize + offsetof(Legacy::PlayerPosition, padding)] = 0;
+        memset(pieces + i * pieceSize + offsetof(Legacy::StarPiece, padding), 0, 2);
+    }
+
+    if(!agree<Packets::PlayerPosition>(positions, positionSize, samePosition, "PlayerPosition")
+        || !agree<Packets::StarPiece>(pieces, pieceSize, samePiece, "StarPiece"))
+    {
+        return 1;
+    }
+
+    // Connect is only valid with its magic
+    uint8_t connect[16];
+    Packets::Connect(3, 4).netWriteToBuffer(connect, sizeof connect);
+    Packets::PacketFactory factory;
+    factory.resetCandidate();
+    Packets::PacketFactory::PacketUnion pu;
+    NetReturn res = factory.constructPacket(Packets::Tag::CONNECT, &pu, connect, sizeof connect);
+    if(res.errorCode != NetReturn::OK || pu.as<Packets::Connect>().majorVersion != 3
+        || pu.as<Packets::Connect>().minorVersion != 4)
+    {
+        fprintf(stderr, "Connect does not survive a round trip\n");
+        return 1;
+    }
+    connect[3] ^= 1;
+    res = factory.constructPacket(Packets::Tag::CONNECT, &pu, connect, sizeof connect);
+    if(res.errorCode != NetReturn::INVALID_DATA) {
+        fprintf(stderr, "Connect with the wrong magic was accepted\n");
+        return 1;
+    }
+
+    Packets::PlayerPosition decodedPositions[NUM_PACKETS];
+    Packets::StarPiece decodedPieces[NUM_PACKETS];
+    for(uint32_t i = 0; i < NUM_PACKETS; i++) {
+        Packets::PlayerPosition::netReadFromBuffer(&decodedPositions[i], positions + i * positionSize, positionSize);
+        Packets::StarPiece::netReadFromBuffer(&decodedPieces[i], pieces + i * pieceSize, pieceSize);
+    }
+
+    double positionDecode[2], positionEncode[2], pieceDecode[2], pieceEncode[2];
+    positionDecode[0] = measure([&](uint32_t i) {
+        Packets::PlayerPosition pos;
+        Legacy::read(&pos, positions + i * positionSize, positionSize);
+        sink = pos.position.x + pos.animationSpeed;
+    });
+    positionDecode[1] = measure([&](uint32_t i) {
+        Packets::PlayerPosition pos;
+        Packets::PlayerPosition::netReadFromBuffer(&pos, positions + i * positionSize, positionSize);
+        sink = pos.position.x + pos.animationSpeed;
+    });
+    positionEncode[0] = measure([&](uint32_t i) {
+        Legacy::write(decodedPositions[i], out + i * positionSize, positionSize);
+    });
+    positionEncode[1] = measure([&](uint32_t i) {
+        decodedPositions[i].netWriteToBuffer(out + i * positionSize, positionSize);
+    });
+    pieceDecode[0] = measure([&](uint32_t i) {
+        Packets::StarPiece piece;
+        Legacy::read(&piece, pieces + i * pieceSize, pieceSize);
+        sink = piece.initLineEnd.z;
+    });
+    pieceDecode[1] = measure([&](uint32_t i) {
+        Packets::StarPiece piece;
+        Packets::StarPiece::netReadFromBuffer(&piece, pieces + i * pieceSize, pieceSize);
+        sink = piece.initLineEnd.z;
+    });
+    pieceEncode[0] = measure([&](uint32_t i) {
+        Legacy::write(decodedPieces[i], out + i * pieceSize, pieceSize);
+    });
+    pieceEncode[1] = measure([&](uint32_t i) {
+        decodedPieces[i].netWriteToBuffer(out + i * pieceSize, pieceSize);
+    });
+    sink = out[NUM_PACKETS * pieceSize - 1];
+
+    printf("codec ns/packet      hand written   schema\n");
+    printf("PlayerPosition decode %11.2f %8.2f\n", positionDecode[0], positionDecode[1]);
+    printf("PlayerPosition encode %11.2f %8.2f\n", positionEncode[0], positionEncode[1]);
+    printf("StarPiece decode      %11.2f %8.2f\n", pieceDecode[0], pieceDecode[1]);
+    printf("StarPiece encode      %11.2f %8.2f\n", pieceEncode[0], pieceEncode[1]);
+
+    free(out);
+    free(positions);
+    free(pieces);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "snapshotHistory.hpp"
+
+#include <cstdio>
+
+// Checks that a snapshot sent in several chunks only becomes a baseline once
+// every chunk of it was acknowledged, whether in one Ack or several, and that
+// clients acknowledging whole ticks only get baselines sent in one chunk.
+
+static Packets::PlayerPosition players[1024];
+
+static void recordTick(Snapshot::History &history, uint32_t tick, uint16_t numPlayers) {
+    for(uint16_t i = 0; i < numPlayers; i++) {
+        players[i].playerId = i;
+        players[i].position = Vec(i, static_cast<float>(tick), 0.0f);
+    }
+    history.record(tick, players, numPlayers);
+}
+
+static bool expect(const char *name, uint32_t baseline, uint32_t expected) {
+    if(baseline == expected) return true;
+    fprintf(stderr, "%s: baseline %u, expected %u\n", name, baseline, expected);
+    return false;
+}
+
+int main() {
+    // Three chunks, the last one short
+    const uint16_t numPlayers = 2 * Packets::CompactSnapshot::MAX_PLAYERS + 1;
+    const ConnectionId chunked = 0, whole = 1, single = 2;
+    bool ok = true;
+
+    Snapshot::History history(numPlayers);
+    history.connect(chunked, true, true);
+    history.connect(whole, true, false);
+
+    recordTick(history, 1, numPlayers);
+    recordTick(history, 2, numPlayers);
+
+    // The middle chunk got lost
+    history.acknowledge(chunked, 1, 0b101);
+    ok &= expect("chunk lost", history.baselineFor(chunked), 0);
+    // ... and arrived late
+    history.acknowledge(chunked, 1, 0b010);
+    ok &= expect("chunks in two acks", history.baselineFor(chunked), 1);
+    // A newer tick replaces it only once complete
+    history.acknowledge(chunked, 2, 0b011);
+    ok &= expect("newer tick incomplete", history.baselineFor(chunked), 1);
+
+    history.acknowledge(whole, 1, 0);
+    ok &= expect("whole tick ack, several chunks", history.baselineFor(whole), 0);
+
+    Snapshot::History small(numPlayers);
+    small.connect(single, true, false);
+    recordTick(small, 1, Packets::CompactSnapshot::MAX_PLAYERS);
+    recordTick(small, 2, Packets::CompactSnapshot::MAX_PLAYERS);
+    small.acknowledge(single, 1, 0);
+    ok &= expect("whole tick ack, one chunk", small.baselineFor(single), 1);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
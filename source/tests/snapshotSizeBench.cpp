@@ -0,0 +1,79 @@
+#include "packets/worldSnapshot.hpp"
+#include "packets/compactSnapshot.hpp"
+#include "snapshotHistory.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+// Compares the bytes per player update of WorldSnapshot against a full
+// CompactSnapshot and a CompactSnapshot delta against the previous tick,
+// for a lobby where two thirds of the players run in circles and the rest
+// stand still.
+
+const static uint16_t NUM_PLAYERS = 64;
+const static uint32_t TICKS = 1000;
+
+static void simulate(Packets::PlayerPosition *players, uint32_t tick) {
+    for(uint16_t i = 0; i < NUM_PLAYERS; i++) {
+        Packets::PlayerPosition &p = players[i];
+        p.playerId = i;
+        p.currentAnimation = 5;
+        p.defaultAnimation = 2;
+        p.animationSpeed = 1.0f;
+
+        float base = 1000.0f + 50.0f * i;
+        if(i % 3 == 0) {
+            p.position = Vec(base, -200.5f, 5000.0f);
+            p.velocity = Vec::zero();
+            p.direction = Vec(1.0f, 0.0f, 0.0f);
+            continue;
+        }
+
+        float a = 0.1f * tick + i;
+        p.timestamp = {static_cast<int32_t>(tick * 50)};
+        p.position = Vec(base + 30.0f * std::cos(a), -200.5f, 5000.0f + 30.0f * std::sin(a));
+        p.velocity = Vec(-3.0f * std::sin(a), 0.0f, 3.0f * std::cos(a));
+        p.direction = Vec(std::cos(a), 0.0f, std::sin(a));
+    }
+}
+
+int main() {
+    Packets::PlayerPosition players[NUM_PLAYERS];
+    Snapshot::History history(NUM_PLAYERS);
+
+    uint64_t worldBytes = 0, fullBytes = 0, deltaBytes = 0;
+
+    for(uint32_t tick = 1; tick <= TICKS; tick++) {
+        simulate(players, tick);
+        history.record(tick, players, NUM_PLAYERS);
+
+        const Packets::CompactPosition *const *baseline 
+            = tick > 1 ? history.gatherBaseline(tick - 1) : nullptr;
+
+        // One tag per datagram
+        for(uint16_t first = 0; first < NUM_PLAYERS; first += Packets::WorldSnapshot::MAX_PLAYERS) {
+            uint16_t count = NUM_PLAYERS - first;
+            if(count > Packets::WorldSnapshot::MAX_PLAYERS) count = Packets::WorldSnapshot::MAX_PLAYERS;
+            worldBytes += sizeof(Packets::Tag) 
+                + Packets::WorldSnapshot(tick, players + first, count).getSize();
+        }
+        for(uint16_t first = 0; first < NUM_PLAYERS; first += Packets::CompactSnapshot::MAX_PLAYERS) {
+            uint16_t count = NUM_PLAYERS - first;
+            if(count > Packets::CompactSnapshot::MAX_PLAYERS) count = Packets::CompactSnapshot::MAX_PLAYERS;
+            const Packets::CompactPosition *current = history.getCurrent() + first;
+            fullBytes += sizeof(Packets::Tag) + Packets::CompactSnapshot(tick, 0, 
+                history.getOrigin(), current, nullptr, count).getSize();
+            deltaBytes += sizeof(Packets::Tag) + Packets::CompactSnapshot(tick, tick - 1, 
+                history.getOrigin(), current, baseline ? baseline + first : nullptr, count).getSize();
+        }
+    }
+
+    const double updates = static_cast<double>(NUM_PLAYERS) * TICKS;
+    printf("format           bytes/update  vs WorldSnapshot\n");
+    printf("WorldSnapshot    %12.1f  %14.2fx\n", worldBytes / updates, 1.0);
+    printf("Compact (full)   %12.1f  %14.2fx\n", fullBytes / updates, 
+        static_cast<double>(worldBytes) / fullBytes);
+    printf("Compact (delta)  %12.1f  %14.2fx\n", deltaBytes / updates, 
+        static_cast<double>(worldBytes) / deltaBytes);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "timerWheel.hpp"
+
+namespace Event {
+
+TimerWheel::TimerWheel(uint32_t capacity, uint64_t now) : capacity(capacity), now(now) {
+    nodes = new Node[capacity];
+    for(uint32_t i = 0; i < capacity; i++) nodes[i].slot = NONE;
+    for(uint32_t &head : heads) head = NONE;
+}
+
+TimerWheel::~TimerWheel() {
+    delete[] nodes;
+}
+
+// Picks the level by how far away the timer is, and the slot in it by the
+// bits of the expiry that level covers
+void TimerWheel::link(uint32_t id) {
+    Node &n = nodes[id];
+    uint64_t delay = n.expires - now;
+
+    uint32_t level = 0;
+    while(level < LEVELS - 1 && delay >= 1ull << (SLOT_BITS * (level + 1))) level++;
+
+    n.slot = level * SLOTS + ((n.expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+    n.prev = NONE;
+    n.next = heads[n.slot];
+    if(n.next != NONE) nodes[n.next].prev = id;
+    heads[n.slot] = id;
+}
+
+void TimerWheel::unlink(uint32_t id) {
+    Node &n = nodes[id];
+    if(n.prev != NONE) nodes[n.prev].next = n.next;
+    else heads[n.slot] = n.next;
+    if(n.next != NONE) nodes[n.next].prev = n.prev;
+    n.slot = NONE;
+}
+
+void TimerWheel::schedule(uint32_t id, uint64_t expires) {
+    if(id >= capacity) return;
+    if(nodes[id].slot != NONE) unlink(id);
+
+    if(expires <= now) expires = now + 1;
+    if(expires - now > MAX_DELAY) expires = now + MAX_DELAY;
+
+    nodes[id].expires = expires;
+    link(id);
+}
+
+void TimerWheel::cancel(uint32_t id) {
+    if(id < capacity && nodes[id].slot != NONE) unlink(id);
+}
+
+// Spreads the slot of `level` that just came around over the levels below
+void TimerWheel::cascade(uint32_t level) {
+    uint32_t slot = level * SLOTS + ((now >> (SLOT_BITS * level)) & (SLOTS - 1));
+    uint32_t id = heads[slot];
+    heads[slot] = NONE;
+
+    while(id != NONE) {
+        uint32_t next = nodes[id].next;
+        link(id);
+        id = next;
+    }
+}
+
+uint32_t TimerWheel::popExpired() {
+    uint32_t id = heads[now & (SLOTS - 1)];
+    if(id != NONE) unlink(id);
+    return id;
+}
+
+}
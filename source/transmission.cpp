@@ -1,4 +1,7 @@
 #include "transmission.hpp"
+#include "packets.hpp"
+#include "uring.hpp"
+#include "clock.hpp"
 
 #include <cerrno>
 #include <cstring>
@@ -6,119 +9,673 @@
 extern "C" {
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/ip.h>
+#include <poll.h>
 
 }
 
 namespace Transmission {
-ConnectionHolder::ConnectionHolder(Connection *connections, uint8_t len)
-    : connections(connections), len(len) 
+static inline bool sameAddr(const sockaddr_in &a, const sockaddr_in &b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+static inline uint32_t hashAddr(const sockaddr_in &addr) {
+    uint64_t key = static_cast<uint64_t>(addr.sin_addr.s_addr) << 16 | addr.sin_port;
+    // Mix every bit of the key into the low bits that index the table
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    return static_cast<uint32_t>(key);
+}
+
+// NO_CONNECTION is reserved as the empty marker of the address index
+ConnectionHolder::ConnectionHolder(Connection *connections, ConnectionId capacity)
+    : connections(connections), 
+    len(capacity < NO_CONNECTION ? capacity : NO_CONNECTION - 1), 
+    numActive(0), numFree(len)
 {
-    for(uint8_t i = 0; i < len; i++) {
+    uint32_t indexLen = 16;
+    while(indexLen < 2 * static_cast<uint32_t>(len)) indexLen <<= 1;
+    indexMask = indexLen - 1;
+
+    activeIds = new ConnectionId[len];
+    freeIds = new ConnectionId[len];
+    addrIndex = new ConnectionId[indexLen];
+
+    for(ConnectionId i = 0; i < len; i++) {
         connections[i].isActive = false;
         connections[i].isCandidate = false;
-        memset(&connections[i].addr, 0, sizeof connections[i]);
+        connections[i].activeIndex = 0;
+        memset(&connections[i].addr, 0, sizeof connections[i].addr);
+        // Hand out the lowest ids first
+        freeIds[i] = len - 1 - i;
     }
+    for(uint32_t i = 0; i < indexLen; i++) addrIndex[i] = NO_CONNECTION;
 }
 
-NetReturn ConnectionHolder::getId(sockaddr_in *addr) {
-    Connection *i = connections, *firstFree = nullptr;
-    for(; i < cend(); i++) {
-        if (
-            (i->isActive || i->isCandidate)
-            && i->addr.sin_addr.s_addr == addr->sin_addr.s_addr
-            && i->addr.sin_port == addr->sin_port
-        ) {
-            if(i->isActive) {
-                return {static_cast<uint32_t>(i - cbegin()), NetReturn::OK};
-            }
-            else if(i->isCandidate) {
-                return {static_cast<uint32_t>(i - cbegin()), NetReturn::CANDIDATE};
-            }
-        }
-        else if(!firstFree && !i->isCandidate && !i->isActive) firstFree = i;
+ConnectionHolder::~ConnectionHolder() {
+    delete[] activeIds;
+    delete[] freeIds;
+    delete[] addrIndex;
+}
+
+// Returns the slot holding `addr`, or the empty slot where it would go
+uint32_t ConnectionHolder::findIndex(const sockaddr_in *addr) const {
+    uint32_t i = hashAddr(*addr) & indexMask;
+    while(addrIndex[i] != NO_CONNECTION && !sameAddr(connections[addrIndex[i]].addr, *addr)) {
+        i = (i + 1) & indexMask;
     }
-    if(firstFree != nullptr) {
-        firstFree->isCandidate = true;
-        firstFree->addr = *addr;
-        return {static_cast<uint32_t>(firstFree - cbegin()), NetReturn::CANDIDATE};
+    return i;
+}
+
+void ConnectionHolder::eraseIndex(ConnectionId id) {
+    uint32_t i = findIndex(&connections[id].addr);
+    if(addrIndex[i] != id) {
+        netHandleInvalidState();
+        return;
+    }
+
+    // Shift later entries of the probe sequence back so that no lookup
+    // stops early at the hole
+    uint32_t j = i;
+    while(true) {
+        j = (j + 1) & indexMask;
+        if(addrIndex[j] == NO_CONNECTION) break;
+        
+        uint32_t home = hashAddr(connections[addrIndex[j]].addr) & indexMask;
+        bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if(reachable) continue;
+        
+        addrIndex[i] = addrIndex[j];
+        i = j;
     }
-    return {0, NetReturn::FILTERED};
+    addrIndex[i] = NO_CONNECTION;
 }
 
-NetReturn Writer::write(const void *data, uint32_t size, uint8_t destination) {
-    ssize_t written;
-    if(destination & 0x80 && destination != 0xFF) {
-        const Connection *c = holder->getConnection(destination & 0x7F);
-        if(c) {
-            do {
+void ConnectionHolder::release(ConnectionId id) {
+    eraseIndex(id);
+    freeIds[numFree++] = id;
+}
 
-                written = sendto(socket, data, size, 0, 
-                    reinterpret_cast<const sockaddr *>(&c->addr), sizeof c->addr);
+NetReturn ConnectionHolder::getId(const sockaddr_in *addr) {
+    uint32_t i = findIndex(addr);
+    if(addrIndex[i] != NO_CONNECTION) {
+        ConnectionId id = addrIndex[i];
+        return {id, connections[id].isActive ? NetReturn::OK : NetReturn::CANDIDATE};
+    }
 
-                if(written < 0) {
-                    written = errno;
-                }
-            }
-            while (written == -EAGAIN);
+    if(numFree == 0) return {0, NetReturn::FILTERED};
+
+    ConnectionId id = freeIds[--numFree];
+    connections[id].isCandidate = true;
+    connections[id].addr = *addr;
+    addrIndex[i] = id;
+    return {id, NetReturn::CANDIDATE};
+}
+
+void ConnectionHolder::purgeCandidate(ConnectionId candidateId) {
+    if(candidateId < len && connections[candidateId].isCandidate) {
+        connections[candidateId].isCandidate = false;
+        release(candidateId);
+    }
+}
+
+void ConnectionHolder::purgeConnection(ConnectionId id) {
+    if(id < len && connections[id].isActive) {
+        connections[id].isActive = false;
+        
+        ConnectionId last = activeIds[--numActive];
+        activeIds[connections[id].activeIndex] = last;
+        connections[last].activeIndex = connections[id].activeIndex;
+        
+        release(id);
+    }
+}
+
+bool ConnectionHolder::addConnection(ConnectionId id) {
+    if(id < len && connections[id].isCandidate) {
+        connections[id].isCandidate = false;
+        connections[id].isActive = true;
+        connections[id].group = 0;
+        connections[id].activeIndex = numActive;
+        activeIds[numActive++] = id;
+        return true;
+    }
+    return false;
+}
+
+bool ConnectionHolder::mirrorConnection(ConnectionId id, const sockaddr_in *addr) {
+    if(id >= len) return false;
+    purgeConnection(id);
+    purgeCandidate(id);
+
+    // Whoever had the address before must be gone, even if we missed it
+    uint32_t i = findIndex(addr);
+    if(addrIndex[i] != NO_CONNECTION) {
+        purgeConnection(addrIndex[i]);
+        purgeCandidate(addrIndex[i]);
+        i = findIndex(addr);
+    }
+
+    for(ConnectionId j = 0; j < numFree; j++) {
+        if(freeIds[j] != id) continue;
+        freeIds[j] = freeIds[--numFree];
+        break;
+    }
+
+    connections[id].isCandidate = true;
+    connections[id].addr = *addr;
+    addrIndex[i] = id;
+    return addConnection(id);
+}
+
+RecipientLists::RecipientLists(uint32_t capacity, uint32_t maxLists)
+    : capacity(capacity), used(0), maxLists(maxLists), numLists(0)
+{
+    ids = new ConnectionId[capacity];
+    offsets = new uint32_t[maxLists + 1];
+    offsets[0] = 0;
+}
+
+RecipientLists::~RecipientLists() {
+    delete[] ids;
+    delete[] offsets;
+}
+
+// The list for a Destination::LIST destination, or false if it is not one
+static bool getList(const RecipientLists *lists, uint32_t destination,
+    const ConnectionId *&begin, const ConnectionId *&end)
+{
+    if((destination & (Destination::ONLY | Destination::GROUP | Destination::LIST)) 
+        != Destination::LIST) return false;
+
+    uint32_t list = destination & ~Destination::LIST;
+    if(lists == nullptr || list >= lists->getNumLists()) {
+        begin = end = nullptr;
+    }
+    else {
+        begin = lists->begin(list);
+        end = lists->end(list);
+    }
+    return true;
+}
+
+void Writer::sendTo(const Connection *c, const void *data, uint32_t size) {
+    while(sendto(socket, data, size, 0, reinterpret_cast<const sockaddr *>(&c->addr), sizeof c->addr) < 0) {
+        if(errno == EINTR) continue;
+        if((errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable()) continue;
+        stats.dropped++;
+        return;
+    }
+}
+
+NetReturn Writer::write(const void *data, uint32_t size, uint32_t destination) {
+    const ConnectionId *listBegin, *listEnd;
+    if(getList(lists, destination, listBegin, listEnd)) {
+        for(auto i = listBegin; i < listEnd; i++) {
+            const Connection *c = holder->getConnection(*i);
+            if(c == nullptr || !c->isActive) continue;
+            sendTo(c, data, size);
         }
         return {size, NetReturn::OK};
     }
-    for(auto i = holder->cbegin(); i < holder->cend(); i++) {
+    if(destination & Destination::ONLY && destination != Destination::BROADCAST) {
+        // The id may have been given up since the packet was made for it
+        const Connection *c = holder->getConnection(destination & ~Destination::ONLY);
+        if(c && c->isActive) sendTo(c, data, size);
+        return {size, NetReturn::OK};
+    }
+    const bool toGroup = (destination & Destination::GROUP) && !(destination & Destination::ONLY);
+    for(auto i = holder->activeBegin(); i < holder->activeEnd(); i++) {
         
-        uint8_t id = holder->getId(i).bytes;
+        if(*i == destination) continue;
+
+        const Connection *c = holder->getConnection(*i);
+        if(toGroup && c->group != (destination & 0xFFFF)) continue;
 
-        if(!i->isActive || id == destination) continue;
+        sendTo(c, data, size);
+    }
+    return {size, NetReturn::OK};
+}
+
+iovec* Writer::queueMessage(const Connection *c, iovec *iov) {
+    if(numMsgs == MAX_BATCH_SIZE) {
+        iovec pending = *iov;
+        flush();
+        iov = iovs + numIovs++;
+        *iov = pending;
+    }
+
+    stats.queued++;
+    msghdr &hdr = msgs[numMsgs++].msg_hdr;
+    memset(&hdr, 0, sizeof hdr);
+    // sendmmsg never writes through msg_name
+    hdr.msg_name = const_cast<sockaddr_in *>(&c->addr);
+    hdr.msg_namelen = sizeof c->addr;
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 1;
+
+    return iov;
+}
 
+NetReturn Writer::queue(const void *data, uint32_t size, uint32_t destination) {
+    if(numIovs == MAX_BATCH_SIZE) flush();
 
-        written = sendto(socket, data, size, 0, 
-            reinterpret_cast<const sockaddr *>(&i->addr), sizeof i->addr);
+    iovec *iov = iovs + numIovs++;
+    iov->iov_base = const_cast<void *>(data);
+    iov->iov_len = size;
 
-        if(written < 0) {
-            written = errno;
-            if(written == -EAGAIN) i--;
+    const ConnectionId *listBegin, *listEnd;
+    if(getList(lists, destination, listBegin, listEnd)) {
+        for(auto i = listBegin; i < listEnd; i++) {
+            const Connection *c = holder->getConnection(*i);
+            if(c && c->isActive) iov = queueMessage(c, iov);
         }
+        return {size, NetReturn::OK};
+    }
+    if(destination & Destination::ONLY && destination != Destination::BROADCAST) {
+        const Connection *c = holder->getConnection(destination & ~Destination::ONLY);
+        if(c && c->isActive) queueMessage(c, iov);
+        return {size, NetReturn::OK};
+    }
+    const bool toGroup = (destination & Destination::GROUP) && !(destination & Destination::ONLY);
+    for(auto i = holder->activeBegin(); i < holder->activeEnd(); i++) {
+        
+        if(*i == destination) continue;
+
+        const Connection *c = holder->getConnection(*i);
+        if(toGroup && c->group != (destination & 0xFFFF)) continue;
+
+        iov = queueMessage(c, iov);
     }
     return {size, NetReturn::OK};
 }
 
-NetReturn Reader::read(void *data, uint32_t size, uint8_t *outputId) {
-    ssize_t read = -EAGAIN;
-    sockaddr_in addr;
-    socklen_t addrlen = sizeof addr;
-    
-    while(read == -EAGAIN) {
-        read = recvfrom(socket, data, size, 0, 
-            reinterpret_cast<sockaddr *>(&addr), &addrlen);
-        
-        if(read < 0) read = errno;
+Writer::~Writer() {
+    delete uring;
+}
+
+NetReturn Writer::enableUring() {
+    if(uring) return {0, NetReturn::OK};
+
+    uring = new Uring::Ring();
+    NetReturn res = uring->init(MAX_BATCH_SIZE, 2 * MAX_BATCH_SIZE);
+    if(res.errorCode != NetReturn::OK) {
+        delete uring;
+        uring = nullptr;
     }
+    return res;
+}
 
-    if(read < 0) {
-        return {static_cast<uint32_t>(-read), NetReturn::SYSTEM_ERROR};
+// Every sendmsg is submitted at once and waited for, so msgs stays untouched
+// until the kernel is done with it
+NetReturn Writer::flushUring() {
+    uint32_t pending[MAX_BATCH_SIZE];
+    uint32_t numPending = numMsgs;
+    for(uint32_t i = 0; i < numPending; i++) pending[i] = i;
+
+    uint32_t sent = 0;
+    while(numPending > 0) {
+        for(uint32_t i = 0; i < numPending; i++) {
+            io_uring_sqe *sqe = uring->getSqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = socket;
+            sqe->addr = reinterpret_cast<uint64_t>(&msgs[pending[i]].msg_hdr);
+            sqe->len = 1;
+            sqe->user_data = pending[i];
+        }
+
+        uint32_t submitted = 0;
+        while(submitted < numPending) {
+            NetReturn res = uring->submit(numPending);
+            stats.sendCalls++;
+            if(res.errorCode != NetReturn::OK) {
+                if(res.bytes == EAGAIN || res.bytes == EBUSY) continue;
+                numMsgs = 0;
+                numIovs = 0;
+                return res;
+            }
+            submitted += res.bytes;
+        }
+
+        uint32_t numRetries = 0;
+        for(uint32_t i = 0; i < numPending; i++) {
+            io_uring_cqe *cqe;
+            while((cqe = uring->peekCqe()) == nullptr) uring->submit(1);
+
+            if(cqe->res >= 0) stats.messages++;
+            else if(cqe->res == -EAGAIN || cqe->res == -EINTR) {
+                pending[numRetries++] = static_cast<uint32_t>(cqe->user_data);
+            }
+            // Anything else drops the datagram that failed, like write does
+            else stats.dropped++;
+            uring->seen();
+        }
+        sent += numPending - numRetries;
+        numPending = numRetries;
+
+        if(numPending > 0 && !waitWritable()) {
+            stats.dropped += numPending;
+            break;
+        }
+    }
+
+    numMsgs = 0;
+    numIovs = 0;
+    return {sent, NetReturn::OK};
+}
+
+bool Writer::waitWritable() {
+    pollfd fd = {socket, POLLOUT, 0};
+    int res;
+    do {
+        res = poll(&fd, 1, SEND_WAIT_MS);
+    } while(res < 0 && errno == EINTR);
+    return res > 0;
+}
+
+NetReturn Writer::flush() {
+    if(uring) return flushUring();
+
+    uint32_t sent = 0;
+    while(sent < numMsgs) {
+        int res = sendmmsg(socket, msgs + sent, numMsgs - sent, 0);
+        stats.sendCalls++;
+        
+        if(res < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                if(waitWritable()) continue;
+                stats.dropped += numMsgs - sent;
+                break;
+            }
+            // Drop the datagram that failed, like write does
+            stats.dropped++;
+            sent++;
+            continue;
+        }
+        sent += res;
+        stats.messages += res;
     }
+    
+    numMsgs = 0;
+    numIovs = 0;
+    return {sent, NetReturn::OK};
+}
 
-    NetReturn res = holder->getId(&addr);
-    switch(res.errorCode) {
+static NetReturn resolveSender(const NetReturn &id, uint32_t read, ConnectionId *outputId) {
+    switch(id.errorCode) {
         case NetReturn::OK:
             *outputId = 
-                static_cast<std::remove_reference<decltype(*outputId)>::type>(res.bytes);
-            return {static_cast<uint32_t>(read), NetReturn::OK};
+                static_cast<std::remove_reference<decltype(*outputId)>::type>(id.bytes);
+            return {read, NetReturn::OK};
         
         case NetReturn::CANDIDATE:
             *outputId = 
-                static_cast<std::remove_reference<decltype(*outputId)>::type>(res.bytes);
-            return {static_cast<uint32_t>(read), NetReturn::CANDIDATE};
+                static_cast<std::remove_reference<decltype(*outputId)>::type>(id.bytes);
+            return {read, NetReturn::CANDIDATE};
         
+        // Still says how much was read, for Capture
         case NetReturn::FILTERED:
-            return {0, NetReturn::FILTERED};
+            return {read, NetReturn::FILTERED};
         case NetReturn::NOT_ENOUGH_SPACE:
             return {0, NetReturn::NOT_ENOUGH_SPACE};
         default:
             return netHandleInvalidState();
     }
+}
+
+NetReturn enableReceiveStamps(int socket) {
+    const int on = 1;
+    if(setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on) < 0
+        || setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof on) < 0)
+    {
+        return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+    }
+    return {0, NetReturn::OK};
+}
+
+void readReceiveStamps(const msghdr &msg, uint64_t *kernelNs, uint32_t *drops) {
+    auto &m = const_cast<msghdr &>(msg);
+    for(cmsghdr *c = CMSG_FIRSTHDR(&m); c != nullptr; c = CMSG_NXTHDR(&m, c)) {
+        if(c->cmsg_level != SOL_SOCKET) continue;
+
+        if(c->cmsg_type == SCM_TIMESTAMPNS && c->cmsg_len >= CMSG_LEN(sizeof(timespec))) {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof ts);
+            *kernelNs = static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+        }
+        // Only sent once the socket dropped something
+        else if(c->cmsg_type == SO_RXQ_OVFL && c->cmsg_len >= CMSG_LEN(sizeof(uint32_t))) {
+            memcpy(drops, CMSG_DATA(c), sizeof *drops);
+        }
+    }
+}
+
+Reader::~Reader() {
+    // The ring goes first, so the kernel is done with the buffers
+    delete uring;
+    delete buffers;
+}
+
+// Room for the header the kernel puts in front of every datagram, its sender
+// and as much of it as a slot takes
+static constexpr uint32_t URING_BUFFER_SIZE = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in)
+    + RECEIVE_CONTROL_SIZE + Packets::MAX_PACKET_SIZE + sizeof(Packets::Tag);
+
+NetReturn Reader::enableUring(uint32_t numBuffers) {
+    if(uring) return {0, NetReturn::OK};
+
+    uring = new Uring::Ring();
+    buffers = new Uring::BufferRing();
+    memset(&uringMsg, 0, sizeof uringMsg);
+    uringMsg.msg_namelen = sizeof(sockaddr_in);
+    uringMsg.msg_controllen = RECEIVE_CONTROL_SIZE;
+
+    // Every buffer can be waiting in a completion at once
+    NetReturn res = uring->init(4, 2 * numBuffers);
+    if(res.errorCode == NetReturn::OK) res = buffers->init(*uring, 0, numBuffers, URING_BUFFER_SIZE);
+    if(res.errorCode == NetReturn::OK) res = armUring();
+
+    // Kernels without multishot receives fail it right away
+    const io_uring_cqe *cqe = res.errorCode == NetReturn::OK ? uring->peekCqe() : nullptr;
+    if(cqe && cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE) && cqe->res != -ENOBUFS) {
+        res = {static_cast<uint32_t>(-cqe->res), NetReturn::SYSTEM_ERROR};
+    }
+
+    if(res.errorCode != NetReturn::OK) {
+        delete uring;
+        delete buffers;
+        uring = nullptr;
+        buffers = nullptr;
+    }
+    return res;
+}
+
+NetReturn Reader::armUring() {
+    io_uring_sqe *sqe = uring->getSqe();
+    if(sqe == nullptr) return {EBUSY, NetReturn::SYSTEM_ERROR};
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = socket;
+    sqe->addr = reinterpret_cast<uint64_t>(&uringMsg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+
+    NetReturn res = uring->submit(0);
+    if(res.errorCode != NetReturn::OK) return res;
+    return {0, NetReturn::OK};
+}
+
+int Reader::getReadyFd() const {
+    return uring ? uring->getFd() : socket;
+}
+
+NetReturn Reader::readUring(ReadSlot *slots, uint32_t count, uint32_t *lengths) {
+    uint32_t received = 0;
+    bool rearm = false;
+    NetReturn error = {0, NetReturn::OK};
+
+    io_uring_cqe *cqe;
+    while(received < count && (cqe = uring->peekCqe()) != nullptr) {
+        if(!(cqe->flags & IORING_CQE_F_MORE)) rearm = true;
+
+        if(cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            const auto id = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            const uint8_t *buffer = buffers->get(id);
+            const auto *out = reinterpret_cast<const io_uring_recvmsg_out *>(buffer);
+            const uint8_t *name = buffer + sizeof *out;
+            const uint8_t *payload = name + uringMsg.msg_namelen + uringMsg.msg_controllen;
+
+            // Longer datagrams are cut short, just like by recvmmsg
+            uint32_t len = out->payloadlen;
+            const uint32_t stored = buffers->getSize() - static_cast<uint32_t>(payload - buffer);
+            if(len > stored) len = stored;
+            if(len > slots[received].size) len = slots[received].size;
+
+            memcpy(slots[received].data, payload, len);
+            memcpy(&slots[received].addr, name, sizeof slots[received].addr);
+            lengths[received] = len;
+
+            // The kernel leaves the control messages between the name and
+            // the payload
+            msghdr control;
+            memset(&control, 0, sizeof control);
+            control.msg_control = const_cast<uint8_t *>(name) + uringMsg.msg_namelen;
+            control.msg_controllen = out->controllen;
+            slots[received].arrivalNs = 0;
+            readReceiveStamps(control, &slots[received].arrivalNs, &kernelDrops);
+            received++;
+
+            buffers->recycle(id);
+        }
+        // Running out of buffers only stops the receive until it is armed again
+        else if(cqe->res < 0 && cqe->res != -ENOBUFS) {
+            error = {static_cast<uint32_t>(-cqe->res), NetReturn::SYSTEM_ERROR};
+        }
+
+        uring->seen();
+    }
+
+    if(received > 0) buffers->publish();
+    if(rearm) {
+        NetReturn res = armUring();
+        if(res.errorCode != NetReturn::OK) return res;
+    }
+
+    if(received == 0 && error.errorCode != NetReturn::OK) return error;
+    return {received, NetReturn::OK};
+}
+
+NetReturn Reader::read(void *data, uint32_t size, ConnectionId *outputId, uint64_t *arrivalNs) {
+    if(uring) {
+        ReadSlot slot;
+        slot.data = data;
+        slot.size = size;
+        NetReturn res = readBatch(&slot, 1);
+        if(res.errorCode != NetReturn::OK) return res;
+        if(res.bytes == 0) return {EAGAIN, NetReturn::SYSTEM_ERROR};
+        if(arrivalNs) *arrivalNs = slot.arrivalNs;
+        if(slot.res.errorCode == NetReturn::OK || slot.res.errorCode == NetReturn::CANDIDATE) {
+            *outputId = slot.id;
+        }
+        return slot.res;
+    }
+
+    ssize_t read;
+    sockaddr_in addr;
+    alignas(cmsghdr) uint8_t control[RECEIVE_CONTROL_SIZE];
+    iovec iov = {data, size};
+
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof addr;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    // EAGAIN on a non-blocking socket is returned like any other error
+    do {
+        read = recvmsg(socket, &msg, 0);
+    } while(read < 0 && errno == EINTR);
+
+    if(read < 0) {
+        return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+    }
+
+    uint64_t kernelNs = 0;
+    readReceiveStamps(msg, &kernelNs, &kernelDrops);
+    if(arrivalNs) *arrivalNs = kernelNs ? toMonotonicNs(kernelNs, Clock::realtimeNs(), Clock::preciseNs()) : 0;
 
+    return resolveSender(holder->getId(&addr), static_cast<uint32_t>(read), outputId);
 }
 
+NetReturn Reader::readBatch(ReadSlot *slots, uint32_t count) {
+    uint32_t lengths[MAX_BATCH_SIZE];
+
+    if(count > MAX_BATCH_SIZE) count = MAX_BATCH_SIZE;
+
+    uint32_t received;
+    if(uring) {
+        NetReturn res = readUring(slots, count, lengths);
+        if(res.errorCode != NetReturn::OK || res.bytes == 0) return res;
+        received = res.bytes;
+    }
+    else {
+        mmsghdr msgs[MAX_BATCH_SIZE];
+        iovec iovs[MAX_BATCH_SIZE];
+        alignas(cmsghdr) uint8_t controls[MAX_BATCH_SIZE][RECEIVE_CONTROL_SIZE];
+
+        for(uint32_t i = 0; i < count; i++) {
+            iovs[i].iov_base = slots[i].data;
+            iovs[i].iov_len = slots[i].size;
+
+            memset(&msgs[i].msg_hdr, 0, sizeof msgs[i].msg_hdr);
+            msgs[i].msg_hdr.msg_name = &slots[i].addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof slots[i].addr;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof controls[i];
+        }
+
+        int res;
+        do {
+            res = recvmmsg(socket, msgs, count, MSG_WAITFORONE, nullptr);
+        } while(res < 0 && errno == EINTR);
+
+        if(res < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return {0, NetReturn::OK};
+            return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+        }
+
+        received = static_cast<uint32_t>(res);
+        for(uint32_t i = 0; i < received; i++) {
+            lengths[i] = msgs[i].msg_len;
+            slots[i].arrivalNs = 0;
+            readReceiveStamps(msgs[i].msg_hdr, &slots[i].arrivalNs, &kernelDrops);
+        }
+    }
+
+    // Both clocks are read once for the whole batch, if it was stamped
+    if(received > 0 && slots[0].arrivalNs != 0) {
+        const uint64_t realtimeNs = Clock::realtimeNs();
+        const uint64_t monotonicNs = Clock::preciseNs();
+        for(uint32_t i = 0; i < received; i++) {
+            slots[i].arrivalNs = toMonotonicNs(slots[i].arrivalNs, realtimeNs, monotonicNs);
+        }
+    }
+
+    for(uint32_t i = 0; i < received; i++) {
+        slots[i].res = resolveSender(holder->getId(&slots[i].addr), lengths[i], &slots[i].id);
+    }
+
+    return {received, NetReturn::OK};
 }
 
+}
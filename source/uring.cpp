@@ -0,0 +1,151 @@
+#include "uring.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+}
+
+namespace Uring {
+
+static inline NetReturn systemError() {
+    return {static_cast<uint32_t>(errno), NetReturn::SYSTEM_ERROR};
+}
+
+Ring::~Ring() {
+    if(sqes) munmap(sqes, sqesLen);
+    if(cqMap && cqMap != sqMap) munmap(cqMap, cqMapLen);
+    if(sqMap) munmap(sqMap, sqMapLen);
+    if(fd >= 0) close(fd);
+}
+
+NetReturn Ring::init(uint32_t entries, uint32_t cqEntries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = cqEntries;
+
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if(fd < 0) return systemError();
+
+    sqMapLen = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMap) {
+        if(cqMapLen > sqMapLen) sqMapLen = cqMapLen;
+        cqMapLen = sqMapLen;
+    }
+
+    void *map = mmap(nullptr, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQ_RING);
+    if(map == MAP_FAILED) return systemError();
+    sqMap = map;
+
+    if(singleMap) cqMap = sqMap;
+    else {
+        map = mmap(nullptr, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, IORING_OFF_CQ_RING);
+        if(map == MAP_FAILED) return systemError();
+        cqMap = map;
+    }
+
+    sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+    map = mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQES);
+    if(map == MAP_FAILED) return systemError();
+    sqes = static_cast<io_uring_sqe *>(map);
+
+    auto *sq = static_cast<uint8_t *>(sqMap);
+    sqHead = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = sqSubmitted = *sqTail;
+
+    // Submission i always uses sqes[i]
+    auto *array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+    for(uint32_t i = 0; i < sqEntries; i++) array[i] = i;
+
+    auto *cq = static_cast<uint8_t *>(cqMap);
+    cqHead = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    return {0, NetReturn::OK};
+}
+
+io_uring_sqe* Ring::getSqe() {
+    uint32_t head = std::atomic_ref<uint32_t>(*sqHead).load(std::memory_order_acquire);
+    if(sqLocalTail - head >= sqEntries) return nullptr;
+
+    io_uring_sqe *sqe = sqes + (sqLocalTail++ & sqMask);
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+
+NetReturn Ring::submit(uint32_t waitFor) {
+    std::atomic_ref<uint32_t>(*sqTail).store(sqLocalTail, std::memory_order_release);
+    const uint32_t toSubmit = sqLocalTail - sqSubmitted;
+
+    long res;
+    do {
+        res = syscall(__NR_io_uring_enter, fd, toSubmit, waitFor,
+            waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    } while(res < 0 && errno == EINTR);
+
+    if(res < 0) return systemError();
+    sqSubmitted += static_cast<uint32_t>(res);
+    return {static_cast<uint32_t>(res), NetReturn::OK};
+}
+
+NetReturn Ring::registerBuffers(void *ringAddr, uint32_t entries, uint16_t group) {
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr = reinterpret_cast<uint64_t>(ringAddr);
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return systemError();
+    }
+    return {0, NetReturn::OK};
+}
+
+BufferRing::~BufferRing() {
+    if(bufs) munmap(bufs, bufsLen);
+    delete[] data;
+}
+
+NetReturn BufferRing::init(Ring &ring, uint16_t group, uint32_t _count, uint32_t _size) {
+    if(_count == 0 || (_count & (_count - 1)) != 0 || _count > 0x8000) {
+        return {EINVAL, NetReturn::SYSTEM_ERROR};
+    }
+    count = _count;
+    size = _size;
+
+    // Has to be page aligned
+    bufsLen = count * sizeof(io_uring_buf);
+    void *map = mmap(nullptr, bufsLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED) {
+        bufs = nullptr;
+        return systemError();
+    }
+    bufs = static_cast<io_uring_buf_ring *>(map);
+
+    data = new uint8_t[static_cast<size_t>(count) * size];
+
+    NetReturn res = ring.registerBuffers(bufs, count, group);
+    if(res.errorCode != NetReturn::OK) return res;
+
+    for(uint32_t i = 0; i < count; i++) recycle(static_cast<uint16_t>(i));
+    publish();
+    return {0, NetReturn::OK};
+}
+
+}